@@ -0,0 +1,466 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+// Microbenchmarks for the client side of logging.  Each log call is timed against each sink - a write callback
+// that only counts bytes, a file, and a socket to a stand-in server on localhost that drains it as fast as it can -
+// on 1 to N threads.  Results are CSV (the default) or JSON, one row per run, so they can be tracked over time.
+//
+// bbclient_bench [-json] [-threads maxThreads] [-logs logsPerRun] [-file path]
+
+#include "bb.h"
+#include "bbclient/bb_atomic.h"
+#include "bbclient/bb_common.h"
+#include "bbclient/bb_connection.h"
+#include "bbclient/bb_time.h"
+#include "bbclient/bb_worker_thread.h"
+
+#include "bbclient/bb_wrap_stdio.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if BB_USING(BB_PLATFORM_LINUX)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum
+{
+	kBench_HeaderIterations = 10 * 1000 * 1000,
+	kBench_DefaultLogs = 200 * 1000,
+	kBench_DefaultMaxThreads = 4,
+	kBench_MaxThreads = 64,
+	kBench_LocalhostIp = 0x7f000001,
+	kBench_BatchSize = 64,
+};
+
+typedef enum
+{
+	kBenchSink_Callback,
+	kBenchSink_File,
+	kBenchSink_Socket,
+	kBenchSink_Count
+} bench_sink_e;
+
+static const char* s_sinkNames[] = {
+	"callback",
+	"file",
+	"socket",
+};
+BB_CTASSERT(BB_ARRAYSIZE(s_sinkNames) == kBenchSink_Count);
+
+typedef void (*bench_log_func)(u32 i);
+
+typedef struct bench_case_s
+{
+	const char* name;
+	bench_log_func func;
+	bb_init_flags_t flags;
+} bench_case_t;
+
+typedef struct bench_thread_s
+{
+	bb_worker_thread_handle_t handle;
+	bench_log_func func;
+	u32 iterations;
+	u32 pad;
+} bench_thread_t;
+
+typedef struct bench_server_s
+{
+	bb_worker_thread_handle_t handle;
+	bb_connection_t con;
+	bb_socket listenSocket;
+	u32 ip;
+	u16 port;
+	u8 pad[2];
+	volatile u32 connected;
+	volatile u32 failed;
+} bench_server_t;
+
+static volatile u64 s_sink;
+static volatile u64 s_bytesWritten;
+static volatile u32 s_go;
+static b32 s_json;
+static u32 s_rows;
+static const char* s_filePath = "bbclient_bench.bbox";
+static bench_server_t s_server;
+
+// bb_current_ticks is only millisecond resolution on Linux
+static u64 bench_current_micros(void)
+{
+	return bb_current_time_microseconds_from_epoch();
+}
+
+static void bench_write_callback(void* context, void* data, uint32_t len)
+{
+	(void)context;
+	(void)data;
+	bb_atomic_fetch_add_u64(&s_bytesWritten, len);
+}
+
+static void bench_print_row(const char* name, const char* sink, u32 threads, u32 logs, double nsPerLog, double bytesPerLog)
+{
+	if (s_json)
+	{
+		printf("%s\n    {\"benchmark\": \"%s\", \"sink\": \"%s\", \"threads\": %u, \"logs\": %u, \"ns_per_log\": %.1f, \"bytes_per_log\": %.1f}",
+		       s_rows ? "," : "", name, sink, threads, logs, nsPerLog, bytesPerLog);
+	}
+	else
+	{
+		if (!s_rows)
+		{
+			printf("benchmark,sink,threads,logs,ns_per_log,bytes_per_log\n");
+		}
+		printf("%s,%s,%u,%u,%.1f,%.1f\n", name, sink, threads, logs, nsPerLog, bytesPerLog);
+	}
+	++s_rows;
+}
+
+// what every packet header used to cost - an OS clock read and, on Linux, a gettid syscall
+static void bench_header_os(void)
+{
+	u64 sum = 0;
+	u64 start = bench_current_micros();
+	for (u32 i = 0; i < kBench_HeaderIterations; ++i)
+	{
+#if BB_USING(BB_PLATFORM_LINUX)
+		sum += bb_current_ticks() + (u64)syscall(SYS_gettid);
+#else
+		sum += bb_current_ticks() + bb_get_current_thread_id();
+#endif
+	}
+	u64 end = bench_current_micros();
+	s_sink = sum;
+	bench_print_row("header_os_clock", "none", 1, kBench_HeaderIterations, (double)(end - start) * 1000.0 / kBench_HeaderIterations, 0.0);
+}
+
+// what it costs with kBBInitFlag_TSCTimestamps and the cached thread id
+static void bench_header_tsc(void)
+{
+	if (!bb_tsc_available())
+		return;
+
+	u64 sum = 0;
+	u64 start = bench_current_micros();
+	for (u32 i = 0; i < kBench_HeaderIterations; ++i)
+	{
+		sum += bb_tsc_ticks() + bb_get_current_thread_id();
+	}
+	u64 end = bench_current_micros();
+	s_sink = sum;
+	bench_print_row("header_tsc", "none", 1, kBench_HeaderIterations, (double)(end - start) * 1000.0 / kBench_HeaderIterations, 0.0);
+}
+
+static void bench_log_0_args(u32 i)
+{
+	(void)i;
+	BB_LOG("bench", "a log with no arguments");
+}
+
+static void bench_log_1_arg(u32 i)
+{
+	BB_LOG("bench", "log %u", i);
+}
+
+static void bench_log_4_args(u32 i)
+{
+	BB_LOG("bench", "log %u of %s at %d.%02d", i, "bench", (int)(i / 100), (int)(i % 100));
+}
+
+static void bench_log_8_args(u32 i)
+{
+	BB_LOG("bench", "log %u %u %u %u %s %s %d %.2f", i, i + 1, i + 2, i + 3, "bench", "eight", (int)i, (double)i * 0.5);
+}
+
+static void bench_log_dynamic(u32 i)
+{
+	BB_LOG_DYNAMIC(__FILE__, __LINE__, "bench", "log %u", i);
+}
+
+static void bench_log_partial(u32 i)
+{
+	BB_LOG_PARTIAL("bench", "log %u", i);
+	BB_LOG_PARTIAL("bench", " finished\n");
+}
+
+static const char s_preformatted[] = "a preformatted log line\n";
+
+static void bench_log_preformatted(u32 i)
+{
+	(void)i;
+	bb_trace_dynamic_preformatted_range(__FILE__, __LINE__, "bench", kBBLogLevel_Log, 0, s_preformatted, s_preformatted + sizeof(s_preformatted) - 1);
+}
+
+// the same lines as bench_log_preformatted, sent kBench_BatchSize at a time by every kBench_BatchSize'th call
+static void bench_log_batch(u32 i)
+{
+	if (i % kBench_BatchSize != kBench_BatchSize - 1)
+		return;
+
+	bb_batch_log_t logs[kBench_BatchSize];
+	memset(logs, 0, sizeof(logs));
+	for (u32 j = 0; j < kBench_BatchSize; ++j)
+	{
+		logs[j].path = __FILE__;
+		logs[j].line = __LINE__;
+		logs[j].category = "bench";
+		logs[j].level = kBBLogLevel_Log;
+		logs[j].text = s_preformatted;
+		logs[j].textLen = sizeof(s_preformatted) - 1;
+	}
+	bb_trace_batch(logs, kBench_BatchSize);
+}
+
+#if BB_COMPILE_WIDECHAR
+static void bench_log_wide(u32 i)
+{
+	bb_trace_dynamic_w(__FILE__, __LINE__, BB_WCHARS("bench"), kBBLogLevel_Log, 0, BB_WCHARS("log %u"), i);
+}
+#endif // #if BB_COMPILE_WIDECHAR
+
+static const bench_case_t s_cases[] = {
+	{ "log_0_args", &bench_log_0_args, 0 },
+	{ "log_1_arg", &bench_log_1_arg, 0 },
+	{ "log_1_arg_tsc", &bench_log_1_arg, kBBInitFlag_TSCTimestamps },
+	{ "log_4_args", &bench_log_4_args, 0 },
+	{ "log_8_args", &bench_log_8_args, 0 },
+	{ "log_dynamic", &bench_log_dynamic, 0 },
+	{ "log_partial", &bench_log_partial, 0 },
+	{ "log_preformatted", &bench_log_preformatted, 0 },
+	{ "log_batch", &bench_log_batch, 0 },
+#if BB_COMPILE_WIDECHAR
+	{ "log_wide", &bench_log_wide, 0 },
+#endif // #if BB_COMPILE_WIDECHAR
+};
+
+static bb_worker_thread_return_t bench_server_thread(void* args)
+{
+	bench_server_t* server = (bench_server_t*)args;
+	while (!bbcon_is_connected(&server->con))
+	{
+		if (!bbcon_is_listening(&server->con) || server->failed)
+		{
+			server->failed = true;
+			bb_worker_thread_exit(0);
+		}
+		bbcon_tick_listening(&server->con);
+	}
+	bb_atomic_store_u32(&server->connected, true);
+
+	// drain the socket without decoding anything, so the client is the bottleneck
+	u8 buffer[64 * 1024];
+	while (server->con.socket != BB_INVALID_SOCKET)
+	{
+		fd_set set;
+		BB_TIMEVAL tv;
+		FD_ZERO(&set);
+		BB_FD_SET(server->con.socket, &set);
+		tv.tv_sec = 0;
+		tv.tv_usec = 1000;
+		if (select((int)server->con.socket + 1, &set, 0, 0, &tv) == 1)
+		{
+			int ret = recv(server->con.socket, (char*)buffer, sizeof(buffer), 0);
+			if (ret <= 0)
+				break;
+		}
+	}
+	bbcon_disconnect_no_flush(&server->con);
+	bb_worker_thread_exit(0);
+}
+
+static b32 bench_server_start(void)
+{
+	memset(&s_server, 0, sizeof(s_server));
+	bbcon_init(&s_server.con);
+	s_server.ip = kBench_LocalhostIp;
+	s_server.listenSocket = bbcon_init_server(&s_server.ip, &s_server.port);
+	if (s_server.listenSocket == BB_INVALID_SOCKET ||
+	    !bbcon_connect_server(&s_server.con, s_server.listenSocket, s_server.ip, s_server.port))
+	{
+		bbcon_shutdown(&s_server.con);
+		return false;
+	}
+	if (!bb_worker_thread_create(&s_server.handle, &bench_server_thread, &s_server))
+	{
+		bbcon_shutdown(&s_server.con);
+		return false;
+	}
+	return true;
+}
+
+static void bench_server_stop(void)
+{
+	s_server.failed = true;
+	bb_worker_thread_join(s_server.handle);
+	bbcon_shutdown(&s_server.con);
+}
+
+static bb_worker_thread_return_t bench_log_thread(void* args)
+{
+	bench_thread_t* thread = (bench_thread_t*)args;
+	while (!bb_atomic_load_u32(&s_go))
+	{
+	}
+	for (u32 i = 0; i < thread->iterations; ++i)
+	{
+		(*thread->func)(i);
+	}
+	bb_worker_thread_exit(0);
+}
+
+static u64 bench_file_size(const char* path)
+{
+	u64 size = 0;
+	FILE* fp = fopen(path, "rb");
+	if (fp)
+	{
+		if (fseek(fp, 0, SEEK_END) == 0)
+		{
+			long pos = ftell(fp);
+			size = (pos > 0) ? (u64)pos : 0u;
+		}
+		fclose(fp);
+	}
+	return size;
+}
+
+// returns false if the sink couldn't be set up
+static b32 bench_run(const bench_case_t* benchCase, bench_sink_e sink, u32 threadCount, u32 logs)
+{
+	bench_thread_t threads[kBench_MaxThreads];
+	const bb_init_flags_t flags = kBBInitFlag_NoConnect | benchCase->flags;
+
+	s_bytesWritten = 0;
+	if (sink == kBenchSink_Callback)
+	{
+		bb_set_write_callback(&bench_write_callback, NULL);
+	}
+	else if (sink == kBenchSink_File)
+	{
+		bb_init_file(s_filePath);
+	}
+	else if (!bench_server_start())
+	{
+		return false;
+	}
+
+	bb_init("bbclient_bench", "", "", 0, flags);
+	if (sink == kBenchSink_Socket)
+	{
+		bb_connect_direct(s_server.ip, s_server.port, NULL, 0);
+		if (!bb_is_connected())
+		{
+			BB_SHUTDOWN();
+			bench_server_stop();
+			return false;
+		}
+		while (!bb_atomic_load_u32(&s_server.connected))
+		{
+		}
+	}
+	const u64 bytesBefore = (sink == kBenchSink_Socket) ? bb_get_total_bytes_sent() : 0u;
+
+	s_go = false;
+	for (u32 i = 0; i < threadCount; ++i)
+	{
+		threads[i].func = benchCase->func;
+		threads[i].iterations = logs / threadCount;
+		bb_worker_thread_create(&threads[i].handle, &bench_log_thread, threads + i);
+	}
+
+	const u64 start = bench_current_micros();
+	bb_atomic_store_u32(&s_go, true);
+	for (u32 i = 0; i < threadCount; ++i)
+	{
+		bb_worker_thread_join(threads[i].handle);
+	}
+	bb_flush();
+	const u64 end = bench_current_micros();
+
+	const u32 logsRun = (logs / threadCount) * threadCount;
+	u64 bytes = s_bytesWritten;
+	if (sink == kBenchSink_Socket)
+	{
+		bytes = bb_get_total_bytes_sent() - bytesBefore;
+	}
+
+	BB_SHUTDOWN();
+	bb_set_write_callback(NULL, NULL);
+	if (sink == kBenchSink_File)
+	{
+		bytes = bench_file_size(s_filePath);
+		remove(s_filePath);
+	}
+	else if (sink == kBenchSink_Socket)
+	{
+		bench_server_stop();
+	}
+
+	// time per log on each thread - flat as threads are added means logging scales
+	const double nsPerLog = (double)(end - start) * 1000.0 * threadCount / logsRun;
+	bench_print_row(benchCase->name, s_sinkNames[sink], threadCount, logsRun, nsPerLog, (double)bytes / logsRun);
+	return true;
+}
+
+int main(int argc, const char** argv)
+{
+	u32 maxThreads = kBench_DefaultMaxThreads;
+	u32 logs = kBench_DefaultLogs;
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		if (!strcmp(arg, "-json"))
+		{
+			s_json = true;
+		}
+		else if (!strcmp(arg, "-threads") && i + 1 < argc)
+		{
+			maxThreads = (u32)strtoul(argv[++i], NULL, 10);
+			maxThreads = BB_MAX(1u, BB_MIN(maxThreads, (u32)kBench_MaxThreads));
+		}
+		else if (!strcmp(arg, "-logs") && i + 1 < argc)
+		{
+			logs = (u32)strtoul(argv[++i], NULL, 10);
+		}
+		else if (!strcmp(arg, "-file") && i + 1 < argc)
+		{
+			s_filePath = argv[++i];
+		}
+		else
+		{
+			fprintf(stderr, "usage: bbclient_bench [-json] [-threads maxThreads] [-logs logsPerRun] [-file path]\n");
+			return 1;
+		}
+	}
+	logs = BB_MAX(logs, maxThreads);
+
+	bbnet_init();
+	if (s_json)
+	{
+		printf("{\n  \"benchmarks\": [");
+	}
+
+	bench_header_os();
+	bench_header_tsc();
+	for (u32 sink = 0; sink < kBenchSink_Count; ++sink)
+	{
+		for (u32 caseIndex = 0; caseIndex < BB_ARRAYSIZE(s_cases); ++caseIndex)
+		{
+			for (u32 threadCount = 1; threadCount <= maxThreads; threadCount = (threadCount == maxThreads) ? threadCount + 1 : BB_MIN(threadCount * 2, maxThreads))
+			{
+				if (!bench_run(s_cases + caseIndex, (bench_sink_e)sink, threadCount, logs))
+				{
+					fprintf(stderr, "bbclient_bench: couldn't set up the %s sink\n", s_sinkNames[sink]);
+					break;
+				}
+			}
+		}
+	}
+
+	if (s_json)
+	{
+		printf("\n  ]\n}\n");
+	}
+	bbnet_shutdown();
+	return 0;
+}
@@ -23,6 +23,13 @@ extern "C"
 #define BB_COMPILE_WIDECHAR 1
 #endif // #if !defined(BB_COMPILE_WIDECHAR)
 
+// BB_DEFERRED_FORMAT makes BB_LOG etc send a format id and packed arguments instead of formatted text,
+// leaving the formatting to the server.  Format strings must be string literals, since each callsite
+// registers its format once.
+#if !defined(BB_DEFERRED_FORMAT)
+#define BB_DEFERRED_FORMAT 0
+#endif // #if !defined(BB_DEFERRED_FORMAT)
+
 #if BB_ENABLED
 
 #if defined(_MSC_VER)
@@ -92,6 +99,8 @@ enum
 	kBBSize_UserData = 2040,
 	kBBSize_MaxPath = 2048,
 	kBBSize_LogText = 2048,
+	kBBSize_DeferredArgs = 2040,
+	kBBSize_KVFields = 1024, // encoded BB_LOG_KV fields - the rest of kBBSize_LogText is for the text
 	kBBSize_MachineName = 256,
 	kBBSize_RecordingName = 256,
 };
@@ -121,9 +130,51 @@ typedef enum
 	kBBInitFlag_RecordingInfo = 0x10,
 	kBBInitFlag_ConsoleAutocomplete = 0x20,
 	kBBInitFlag_NoConnect = 0x40, // don't try to connect even to localhost
+	kBBInitFlag_SendThread = 0x80, // logs are queued in per-thread rings and sent from a bbclient thread, so logging never blocks on the socket
+	kBBInitFlag_CompressedBatches = 0x100, // once the server agrees, packets are sent in compressed batches
+	kBBInitFlag_CompactLogs = 0x200, // once the server agrees, logs are sent as callsite ids and timestamp deltas instead of full headers - ignored with bb_set_pools
+	kBBInitFlag_CategoryLevels = 0x400, // logs the server's views are hiding (by verbosity or category) are skipped before they are formatted
+	kBBInitFlag_LargeLogs = 0x800, // logs longer than kBBSize_LogText are sent as one packet instead of several partial ones
+	kBBInitFlag_TSCTimestamps = 0x1000, // timestamps come from the CPU's invariant timestamp counter, where there is one - bb_init spends a millisecond measuring its rate, and bb_tick sends updates
+	kBBInitFlag_ConnectThread = 0x2000, // discovery and connect happen on a bbclient thread, so bb_init never waits on the network - logs are queued until a connect succeeds (see bb_set_initial_buffer_max_size)
+	kBBInitFlag_Telemetry = 0x4000, // bb_tick sends what logging costs (packets, bytes, flush and lock wait times, drops) once a second, for the server to chart
 } bb_init_flag_e;
 typedef uint32_t bb_init_flags_t;
 
+// What logging does while the server can't keep up - see bb_set_backpressure.  With anything but
+// kBBBackpressure_Block, logs queue up while the socket is busy.  Warnings, errors and fatals, and packets
+// that aren't logs, have a queue of their own that is sent first.  Drops are reported to the server.
+typedef enum
+{
+	kBBBackpressure_Block,       // wait for the socket - the default
+	kBBBackpressure_DropOldest,  // drop the oldest queued logs to make room
+	kBBBackpressure_DropNewest,  // drop logs that don't fit in the queue
+	kBBBackpressure_SpillToDisk, // write logs that don't fit in the queue to a file, and send them once the socket catches up
+	kBBBackpressure_Count
+} bb_backpressure_e;
+
+// Why the flight recorder's logs were sent - see bb_set_flight_recorder
+typedef enum
+{
+	kBBFlightRecorder_Error,          // an error or fatal was logged
+	kBBFlightRecorder_ConsoleCommand, // the server sent the "bb_flight_recorder_dump" console command
+	kBBFlightRecorder_Requested,      // bb_flight_recorder_dump was called - from a crash handler, etc
+	kBBFlightRecorder_Count
+} bb_flight_recorder_trigger_e;
+
+// Memory for bbclient to use instead of the heap once bb_init returns - see bb_set_pools.  When a pool runs out,
+// threads without a trace buffer drop their logs, threads without a ring send on their own (as if there were no
+// kBBInitFlag_SendThread), new paths and categories are logged with id 0 and no name, new deferred formats are
+// formatted when logged, and new thread names aren't kept for reconnects.
+typedef struct bb_pools_s
+{
+	uint32_t threads;            // trace buffers, one per thread from its first log to bb_thread_end
+	uint32_t sendThreadRings;    // with kBBInitFlag_SendThread - one per logging thread, held until the send thread drains it
+	uint32_t sendThreadRingSize; // used instead of bb_set_send_thread_ring_size, and raised to the same minimum
+	uint32_t ids;                // per table - paths, categories, deferred formats and thread names each get this many
+	uint32_t stringBytes;        // for the names of all of the ids
+} bb_pools_t;
+
 typedef enum
 {
 	kBBPlatform_Unknown,
@@ -146,8 +197,23 @@ BB_LINKAGE void bb_init(const char* applicationName, const char* sourceApplicati
 BB_LINKAGE void bb_init_file(const char* path);
 BB_LINKAGE void bb_shutdown(const char* file, int line);
 BB_LINKAGE void bb_set_initial_buffer(void* buffer, uint32_t bufferSize);
+BB_LINKAGE void bb_set_initial_buffer_max_size(uint32_t maxSize); // with kBBInitFlag_ConnectThread and no bb_set_initial_buffer, logs are queued in a buffer that grows up to this size
 BB_LINKAGE void bb_pre_init_set_applicationGroup(const char* applicationGroup);
 BB_LINKAGE void bb_enable_stored_thread_ids(int store);
+BB_LINKAGE void bb_set_send_thread_ring_size(uint32_t ringSize); // per-thread ring size for kBBInitFlag_SendThread
+BB_LINKAGE void bb_set_ring_file_size(uint32_t fileSize); // call before bb_init_file to write a crash-safe memory-mapped ring - see bb_ring_file.h
+BB_LINKAGE void bb_set_backpressure(bb_backpressure_e policy, uint32_t queueSize, const char* spillPath); // queueSize 0 for the default, spillPath is only for kBBBackpressure_SpillToDisk
+BB_LINKAGE void bb_set_spool(uint32_t maxSize, const char* path); // logs sent while the server connection is down are kept (up to maxSize bytes, in path if it isn't NULL - written out by bb_tick) and sent after the AppInfo on the next connect - 0 to stop
+BB_LINKAGE void bb_set_flight_recorder(bb_log_level_e minSentLevel, uint32_t size); // logs below minSentLevel are kept in a ring of size bytes instead of being sent, until an error or fatal, the server or bb_flight_recorder_dump asks for them - 0 to stop
+BB_LINKAGE void bb_flight_recorder_dump(void); // sends the flight recorder's logs now - crash handlers should call bb_flush after
+BB_LINKAGE uint32_t bb_pools_size(const bb_pools_t* pools); // bytes of memory bb_set_pools needs for pools
+
+// Call before bb_init.  Logging then uses only memory, and bb_malloc asserts from the end of bb_init until
+// bb_shutdown.  What would otherwise allocate as it goes is adjusted to fit: kBBInitFlag_CompactLogs is ignored,
+// bb_set_spool is turned off, and kBBInitFlag_ConnectThread without bb_set_initial_buffer takes its whole
+// initial buffer (see bb_set_initial_buffer_max_size) in bb_init.  Returns 0 if memorySize is too small.
+BB_LINKAGE int bb_set_pools(const bb_pools_t* pools, void* memory, uint32_t memorySize);
+
 #if BB_COMPILE_WIDECHAR
 BB_LINKAGE void bb_init_w(const bb_wchar_t* applicationName, const bb_wchar_t* sourceApplicationName, const bb_wchar_t* deviceCode, uint32_t sourceIp, bb_init_flags_t initFlags);
 BB_LINKAGE void bb_init_file_w(const bb_wchar_t* path);
@@ -167,7 +233,7 @@ BB_LINKAGE uint64_t bb_get_total_bytes_sent(void);
 BB_LINKAGE uint64_t bb_get_total_bytes_received(void);
 BB_LINKAGE uint64_t bb_get_current_thread_id(void);
 
-typedef void (*bb_write_callback)(void* context, void* data, uint32_t len);
+typedef void (*bb_write_callback)(void* context, void* data, uint32_t len); // data is one or more whole packets
 BB_LINKAGE void bb_set_write_callback(bb_write_callback callback, void* context);
 
 typedef void (*bb_flush_callback)(void* context);
@@ -193,11 +259,44 @@ BB_LINKAGE void bb_thread_set_name_w(uint32_t pathId, uint32_t line, const bb_wc
 #endif // #if BB_COMPILE_WIDECHAR
 
 BB_LINKAGE uint32_t bb_resolve_ids(const char* path, const char* category, uint32_t* pathId, uint32_t* categoryId, uint32_t line);
+BB_LINKAGE uint32_t bb_resolve_ids_hashed(const char* path, uint32_t pathHash, const char* category, uint32_t categoryHash, uint32_t* pathId, uint32_t* categoryId, uint32_t line);
 BB_LINKAGE void bb_resolve_path_id(const char* path, uint32_t* pathId, uint32_t line);
 #if BB_COMPILE_WIDECHAR
 BB_LINKAGE uint32_t bb_resolve_ids_w(const char* path, const bb_wchar_t* category, uint32_t* pathId, uint32_t* categoryId, uint32_t line);
 #endif // #if BB_COMPILE_WIDECHAR
 
+// Minimum level for a category, as last sent by the server in kBBPacketType_CategoryLevels.  Callsites keep
+// the pointer, so a level change is seen by the next log.  Category ids past kBBCategoryLevels_Count, and all
+// categories without kBBInitFlag_CategoryLevels, are always enabled.  kBBLogLevel_SetColor is never skipped.
+enum
+{
+	kBBCategoryLevels_Count = 4096,
+};
+BB_LINKAGE const volatile uint8_t* bb_category_min_level(uint32_t categoryId);
+
+// Optional per-callsite limits for the BB_LOG family, off until set.  Each callsite gets a token bucket holding
+// up to burst logs and refilled at logsPerSecond.  With repeat suppression, a log whose text matches the previous
+// log from the same callsite is dropped.  Dropped logs are counted, and bb_tick sends the counts as
+// kBBPacketType_LogSuppressed, which the server shows as a line from the callsite.
+typedef struct bb_callsite_limit_s
+{
+	struct bb_callsite_limit_s* next; // internal use only - callsites that have dropped logs
+	uint32_t pathId;
+	uint32_t line;
+	uint32_t categoryId;
+	uint32_t level;
+	uint32_t millitokens;
+	uint32_t lastRefillMs; // 0 until the bucket is first filled
+	uint32_t textHash;     // of the last log sent, with repeat suppression
+	uint32_t rateLimited;  // dropped since the last kBBPacketType_LogSuppressed
+	uint32_t repeated;     // dropped since the last kBBPacketType_LogSuppressed
+	uint32_t registered;
+} bb_callsite_limit_t;
+BB_LINKAGE void bb_set_callsite_rate_limit(uint32_t logsPerSecond, uint32_t burst); // 0 logsPerSecond disables rate limiting
+BB_LINKAGE void bb_set_repeat_suppression(int enabled);
+BB_LINKAGE int bb_callsite_allow(bb_callsite_limit_t* limit, uint32_t pathId, uint32_t line, uint32_t categoryId, bb_log_level_e level);
+BB_LINKAGE extern volatile uint32_t g_bb_callsiteLimits; // nonzero while either limit is on - callsites only call bb_callsite_allow then
+
 BB_LINKAGE void bb_trace(uint32_t pathId, uint32_t line, uint32_t categoryId, bb_log_level_e level, int32_t pieInstance, const char* fmt, ...);
 BB_LINKAGE void bb_trace_dynamic(const char* path, uint32_t line, const char* category, bb_log_level_e level, int32_t pieInstance, const char* fmt, ...);
 BB_LINKAGE void bb_trace_dynamic_preformatted(const char* path, uint32_t line, const char* category, bb_log_level_e level, int32_t pieInstance, const char* preformatted);
@@ -205,6 +304,63 @@ BB_LINKAGE void bb_trace_dynamic_preformatted_range(const char* path, uint32_t l
 BB_LINKAGE void bb_trace_partial(const char* path, uint32_t line, const char* category, bb_log_level_e level, int32_t pieInstance, const char* fmt, ...);
 BB_LINKAGE void bb_trace_partial_preformatted(const char* path, uint32_t line, const char* category, bb_log_level_e level, int32_t pieInstance, const char* preformatted, const char* preformatted_end);
 BB_LINKAGE void bb_trace_partial_end(void);
+BB_LINKAGE void bb_trace_deferred(uint32_t pathId, uint32_t line, uint32_t categoryId, bb_log_level_e level, int32_t pieInstance, uint32_t* formatId, const char* fmt, ...);
+
+// One preformatted log for bb_trace_batch, for output devices that already buffer lines.  Text isn't terminated,
+// and is sent as it is (without adding a newline), up to kBBSize_LogTextLarge - 1 bytes.
+typedef struct bb_batch_log_s
+{
+	const char* path;
+	const char* category;
+	const char* text;
+	uint64_t timestamp; // from bb_get_current_timestamp when the line was logged - 0 for now
+	uint64_t threadId;  // from bb_get_current_thread_id on the thread that logged it - 0 for the calling thread
+	uint32_t textLen;
+	uint32_t line;
+	bb_log_level_e level;
+	int32_t pieInstance;
+} bb_batch_log_t;
+
+// Resolves the ids for all of the logs, then serializes them back to back and hands them to the file, write
+// callback and socket a buffer at a time, instead of a log at a time.
+BB_LINKAGE void bb_trace_batch(const bb_batch_log_t* logs, uint32_t count);
+BB_LINKAGE uint64_t bb_get_current_timestamp(void);
+
+// Typed fields for the BB_LOG_KV family, which are sent in a compact binary form instead of as text, so the server
+// doesn't have to parse them back out - see bb_kv.h.  Objects run from bb_kv_object to the matching
+// bb_kv_object_end, and nest up to kBBKV_MaxDepth deep.  Fields that don't fit in kBBSize_KVFields, and all
+// fields when a send callback is set, are sent as JSON after the text instead.
+typedef enum
+{
+	kBBKV_Int,
+	kBBKV_Float,
+	kBBKV_String,
+	kBBKV_Bool,
+	kBBKV_Object,
+	kBBKV_ObjectEnd,
+	kBBKV_Count
+} bb_kv_type_e;
+
+typedef struct bb_kv_s
+{
+	const char* key;
+	bb_kv_type_e type;
+	uint32_t pad;
+	union
+	{
+		int64_t i;
+		double f;
+		const char* s;
+	} value;
+} bb_kv_t;
+
+BB_LINKAGE bb_kv_t bb_kv_int(const char* key, int64_t value);
+BB_LINKAGE bb_kv_t bb_kv_float(const char* key, double value);
+BB_LINKAGE bb_kv_t bb_kv_string(const char* key, const char* value);
+BB_LINKAGE bb_kv_t bb_kv_bool(const char* key, int value);
+BB_LINKAGE bb_kv_t bb_kv_object(const char* key);
+BB_LINKAGE bb_kv_t bb_kv_object_end(void);
+BB_LINKAGE void bb_trace_kv(uint32_t pathId, uint32_t line, uint32_t categoryId, bb_log_level_e level, int32_t pieInstance, const char* text, const bb_kv_t* fields, uint32_t fieldCount);
 
 #if BB_COMPILE_WIDECHAR
 BB_LINKAGE void bb_trace_w(uint32_t pathId, uint32_t line, uint32_t categoryId, bb_log_level_e level, int32_t pieInstance, const bb_wchar_t* fmt, ...);
@@ -237,6 +393,40 @@ BB_LINKAGE void bb_start_frame_number(uint32_t pathId, uint32_t line, uint64_t f
 #define BB_FUNC_TRACE_PARTIAL bb_trace_partial
 #endif // #else // #if BB_WIDECHAR
 
+// Static callsites look up their ids by hash, so a callsite in an already-registered file and category
+// doesn't need to take the id lock.  C++14 hashes __FILE__ at compile time.  The hash is case-insensitive
+// FNV-1a over ASCII, and has to match bb_id_map_hash.
+#if defined(__cplusplus) && (__cplusplus >= 201402L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201402L))
+static constexpr uint32_t bb_hash_name(const char* name)
+{
+	uint32_t hash = 2166136261u;
+	for (const char* c = name; c && *c; ++c)
+	{
+		const char lower = (*c >= 'A' && *c <= 'Z') ? (char)(*c - 'A' + 'a') : *c;
+		hash = (hash ^ (uint8_t)lower) * 16777619u;
+	}
+	return hash;
+}
+extern "C++"
+{
+	template <uint32_t hash>
+	struct bb_hash_constant
+	{
+		static constexpr uint32_t value = hash;
+	};
+}
+#define BB_RESOLVE_STATIC_IDS(category, pathId, categoryId, line) \
+	bb_resolve_ids_hashed(__FILE__, bb_hash_constant<bb_hash_name(__FILE__)>::value, category, bb_hash_name(category), pathId, categoryId, line)
+#else // #if defined(__cplusplus) && C++14
+#define BB_RESOLVE_STATIC_IDS(category, pathId, categoryId, line) bb_resolve_ids(__FILE__, category, pathId, categoryId, line)
+#endif // #else // #if defined(__cplusplus) && C++14
+
+#if BB_WIDECHAR
+#define BB_FUNC_RESOLVE_STATIC_IDS(category, pathId, categoryId, line) bb_resolve_ids_w(__FILE__, category, pathId, categoryId, line)
+#else // #if BB_WIDECHAR
+#define BB_FUNC_RESOLVE_STATIC_IDS(category, pathId, categoryId, line) BB_RESOLVE_STATIC_IDS(category, pathId, categoryId, line)
+#endif // #else // #if BB_WIDECHAR
+
 #define BB_PREINIT(logPath) BB_FUNC_INIT_FILE(logPath)
 #define BB_INIT(applicationName) BB_FUNC_INIT(applicationName, 0, 0, 0, 0u)
 #define BB_INIT_WITH_FLAGS(applicationName, flags) BB_FUNC_INIT(applicationName, 0, 0, 0, flags)
@@ -278,30 +468,105 @@ BB_LINKAGE void bb_start_frame_number(uint32_t pathId, uint32_t line, uint64_t f
 		bb_thread_end(bb_path_id, (uint32_t)__LINE__);                     \
 	}
 
-#define BB_INTERNAL_LOG(level, category, ...)                                                 \
-	{                                                                                         \
-		static uint32_t bb_path_id = 0;                                                       \
-		static uint32_t bb_category_id = 0;                                                   \
-		static uint32_t bb_id_resolved = 0;                                                   \
-		if (!bb_id_resolved)                                                                  \
-		{                                                                                     \
-			bb_id_resolved = BB_FUNC_RESOLVE_IDS(__FILE__, category, &bb_path_id,             \
-			                                     &bb_category_id, (uint32_t)__LINE__);        \
-		}                                                                                     \
-		BB_FUNC_TRACE(bb_path_id, (uint32_t)__LINE__, bb_category_id, level, 0, __VA_ARGS__); \
+#define BB_INTERNAL_LOG_DEFERRED(level, category, ...)                                                                  \
+	{                                                                                                                   \
+		static uint32_t bb_path_id = 0;                                                                                 \
+		static uint32_t bb_category_id = 0;                                                                             \
+		static uint32_t bb_id_resolved = 0;                                                                             \
+		static uint32_t bb_format_id = 0;                                                                               \
+		static const volatile uint8_t bb_unresolved_min_level = 0;                                                      \
+		static const volatile uint8_t* bb_min_level = &bb_unresolved_min_level;                                         \
+		static bb_callsite_limit_t bb_limit;                                                                            \
+		const bb_log_level_e bb_level = (level);                                                                        \
+		if (!bb_id_resolved)                                                                                            \
+		{                                                                                                               \
+			bb_id_resolved = BB_RESOLVE_STATIC_IDS(category, &bb_path_id,                                               \
+			                                       &bb_category_id, (uint32_t)__LINE__);                                \
+			bb_min_level = bb_category_min_level(bb_category_id);                                                       \
+		}                                                                                                               \
+		if ((uint8_t)bb_level >= *bb_min_level &&                                                                       \
+		    (!g_bb_callsiteLimits ||                                                                                    \
+		     bb_callsite_allow(&bb_limit, bb_path_id, (uint32_t)__LINE__, bb_category_id, bb_level)))                   \
+		{                                                                                                               \
+			bb_trace_deferred(bb_path_id, (uint32_t)__LINE__, bb_category_id, bb_level, 0, &bb_format_id, __VA_ARGS__); \
+		}                                                                                                               \
+	}
+
+#if BB_DEFERRED_FORMAT && !BB_WIDECHAR
+#define BB_INTERNAL_LOG(level, category, ...) BB_INTERNAL_LOG_DEFERRED(level, category, __VA_ARGS__)
+#else // #if BB_DEFERRED_FORMAT && !BB_WIDECHAR
+#define BB_INTERNAL_LOG(level, category, ...)                                                         \
+	{                                                                                                 \
+		static uint32_t bb_path_id = 0;                                                               \
+		static uint32_t bb_category_id = 0;                                                           \
+		static uint32_t bb_id_resolved = 0;                                                           \
+		static const volatile uint8_t bb_unresolved_min_level = 0;                                    \
+		static const volatile uint8_t* bb_min_level = &bb_unresolved_min_level;                       \
+		static bb_callsite_limit_t bb_limit;                                                          \
+		const bb_log_level_e bb_level = (level);                                                      \
+		if (!bb_id_resolved)                                                                          \
+		{                                                                                             \
+			bb_id_resolved = BB_FUNC_RESOLVE_STATIC_IDS(category, &bb_path_id,                        \
+			                                            &bb_category_id, (uint32_t)__LINE__);         \
+			bb_min_level = bb_category_min_level(bb_category_id);                                     \
+		}                                                                                             \
+		if ((uint8_t)bb_level >= *bb_min_level &&                                                     \
+		    (!g_bb_callsiteLimits ||                                                                  \
+		     bb_callsite_allow(&bb_limit, bb_path_id, (uint32_t)__LINE__, bb_category_id, bb_level))) \
+		{                                                                                             \
+			BB_FUNC_TRACE(bb_path_id, (uint32_t)__LINE__, bb_category_id, bb_level, 0, __VA_ARGS__);  \
+		}                                                                                             \
+	}
+#endif // #else // #if BB_DEFERRED_FORMAT && !BB_WIDECHAR
+
+#define BB_INTERNAL_LOG_A(level, category, ...)                                                       \
+	{                                                                                                 \
+		static uint32_t bb_path_id = 0;                                                               \
+		static uint32_t bb_category_id = 0;                                                           \
+		static uint32_t bb_id_resolved = 0;                                                           \
+		static const volatile uint8_t bb_unresolved_min_level = 0;                                    \
+		static const volatile uint8_t* bb_min_level = &bb_unresolved_min_level;                       \
+		static bb_callsite_limit_t bb_limit;                                                          \
+		const bb_log_level_e bb_level = (level);                                                      \
+		if (!bb_id_resolved)                                                                          \
+		{                                                                                             \
+			bb_id_resolved = BB_RESOLVE_STATIC_IDS(category, &bb_path_id,                             \
+			                                       &bb_category_id, (uint32_t)__LINE__);              \
+			bb_min_level = bb_category_min_level(bb_category_id);                                     \
+		}                                                                                             \
+		if ((uint8_t)bb_level >= *bb_min_level &&                                                     \
+		    (!g_bb_callsiteLimits ||                                                                  \
+		     bb_callsite_allow(&bb_limit, bb_path_id, (uint32_t)__LINE__, bb_category_id, bb_level))) \
+		{                                                                                             \
+			bb_trace(bb_path_id, (uint32_t)__LINE__, bb_category_id, bb_level, 0, __VA_ARGS__);       \
+		}                                                                                             \
 	}
 
-#define BB_INTERNAL_LOG_A(level, category, ...)                                          \
-	{                                                                                    \
-		static uint32_t bb_path_id = 0;                                                  \
-		static uint32_t bb_category_id = 0;                                              \
-		static uint32_t bb_id_resolved = 0;                                              \
-		if (!bb_id_resolved)                                                             \
-		{                                                                                \
-			bb_id_resolved = bb_resolve_ids(__FILE__, category, &bb_path_id,             \
-			                                &bb_category_id, (uint32_t)__LINE__);        \
-		}                                                                                \
-		bb_trace(bb_path_id, (uint32_t)__LINE__, bb_category_id, level, 0, __VA_ARGS__); \
+// text is sent as it is, not used as a format, and is followed by one or more bb_kv_t fields:
+//   BB_LOG_KV("net", "connected", bb_kv_string("host", host), bb_kv_int("port", port));
+#define BB_INTERNAL_LOG_KV(level, category, text, ...)                                                                 \
+	{                                                                                                                  \
+		static uint32_t bb_path_id = 0;                                                                                \
+		static uint32_t bb_category_id = 0;                                                                            \
+		static uint32_t bb_id_resolved = 0;                                                                            \
+		static const volatile uint8_t bb_unresolved_min_level = 0;                                                     \
+		static const volatile uint8_t* bb_min_level = &bb_unresolved_min_level;                                        \
+		static bb_callsite_limit_t bb_limit;                                                                           \
+		const bb_log_level_e bb_level = (level);                                                                       \
+		if (!bb_id_resolved)                                                                                           \
+		{                                                                                                              \
+			bb_id_resolved = BB_RESOLVE_STATIC_IDS(category, &bb_path_id,                                              \
+			                                       &bb_category_id, (uint32_t)__LINE__);                               \
+			bb_min_level = bb_category_min_level(bb_category_id);                                                      \
+		}                                                                                                              \
+		if ((uint8_t)bb_level >= *bb_min_level &&                                                                      \
+		    (!g_bb_callsiteLimits ||                                                                                   \
+		     bb_callsite_allow(&bb_limit, bb_path_id, (uint32_t)__LINE__, bb_category_id, bb_level)))                  \
+		{                                                                                                              \
+			const bb_kv_t bb_kv_fields[] = { __VA_ARGS__ };                                                            \
+			const uint32_t bb_kv_count = (uint32_t)(sizeof(bb_kv_fields) / sizeof(bb_kv_fields[0]));                   \
+			bb_trace_kv(bb_path_id, (uint32_t)__LINE__, bb_category_id, bb_level, 0, text, bb_kv_fields, bb_kv_count); \
+		}                                                                                                              \
 	}
 
 #define BB_TRACE(logLevel, category, ...) BB_INTERNAL_LOG(logLevel, category, __VA_ARGS__)
@@ -319,6 +584,16 @@ BB_LINKAGE void bb_start_frame_number(uint32_t pathId, uint32_t line, uint64_t f
 #define BB_WARNING_A(category, ...) BB_INTERNAL_LOG_A(kBBLogLevel_Warning, category, __VA_ARGS__)
 #define BB_ERROR_A(category, ...) BB_INTERNAL_LOG_A(kBBLogLevel_Error, category, __VA_ARGS__)
 
+#define BB_TRACE_DEFERRED(logLevel, category, ...) BB_INTERNAL_LOG_DEFERRED(logLevel, category, __VA_ARGS__)
+#define BB_LOG_DEFERRED(category, ...) BB_INTERNAL_LOG_DEFERRED(kBBLogLevel_Log, category, __VA_ARGS__)
+#define BB_WARNING_DEFERRED(category, ...) BB_INTERNAL_LOG_DEFERRED(kBBLogLevel_Warning, category, __VA_ARGS__)
+#define BB_ERROR_DEFERRED(category, ...) BB_INTERNAL_LOG_DEFERRED(kBBLogLevel_Error, category, __VA_ARGS__)
+
+#define BB_TRACE_KV(logLevel, category, text, ...) BB_INTERNAL_LOG_KV(logLevel, category, text, __VA_ARGS__)
+#define BB_LOG_KV(category, text, ...) BB_INTERNAL_LOG_KV(kBBLogLevel_Log, category, text, __VA_ARGS__)
+#define BB_WARNING_KV(category, text, ...) BB_INTERNAL_LOG_KV(kBBLogLevel_Warning, category, text, __VA_ARGS__)
+#define BB_ERROR_KV(category, text, ...) BB_INTERNAL_LOG_KV(kBBLogLevel_Error, category, text, __VA_ARGS__)
+
 #define BB_LOG_DYNAMIC(file, line, category, ...) BB_FUNC_TRACE_DYNAMIC(file, line, category, kBBLogLevel_Log, 0, __VA_ARGS__)
 #define BB_WARNING_DYNAMIC(file, line, category, ...) BB_FUNC_TRACE_DYNAMIC(file, line, category, kBBLogLevel_Warning, 0, __VA_ARGS__)
 #define BB_ERROR_DYNAMIC(file, line, category, ...) BB_FUNC_TRACE_DYNAMIC(file, line, category, kBBLogLevel_Error, 0, __VA_ARGS__)
@@ -416,6 +691,16 @@ typedef struct bb_colors_s
 #define BB_WARNING(category, ...)
 #define BB_ERROR(category, ...)
 
+#define BB_TRACE_DEFERRED(logLevel, category, ...)
+#define BB_LOG_DEFERRED(category, ...)
+#define BB_WARNING_DEFERRED(category, ...)
+#define BB_ERROR_DEFERRED(category, ...)
+
+#define BB_TRACE_KV(logLevel, category, text, ...)
+#define BB_LOG_KV(category, text, ...)
+#define BB_WARNING_KV(category, text, ...)
+#define BB_ERROR_KV(category, text, ...)
+
 #define BB_LOG_DYNAMIC(file, line, category, ...)
 #define BB_WARNING_DYNAMIC(file, line, category, ...)
 #define BB_ERROR_DYNAMIC(file, line, category, ...)
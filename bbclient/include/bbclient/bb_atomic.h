@@ -0,0 +1,162 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#pragma once
+
+#include "bb.h"
+
+#if BB_ENABLED
+
+#include "bb_common.h"
+
+#if BB_USING(BB_COMPILER_MSVC)
+#include "bb_wrap_windows.h"
+#include <intrin.h>
+#endif
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Minimal set of atomics used by the lock-free paths in bbclient.
+// Loads have acquire semantics and stores have release semantics.
+
+#if BB_USING(BB_COMPILER_MSVC)
+
+// x86/x64 loads and stores are already acquire/release - we only need to keep the compiler from reordering
+static BB_INLINE u32 bb_atomic_load_u32(const volatile u32* p)
+{
+	u32 value = *p;
+	_ReadWriteBarrier();
+	return value;
+}
+
+static BB_INLINE void bb_atomic_store_u32(volatile u32* p, u32 value)
+{
+	_ReadWriteBarrier();
+	*p = value;
+}
+
+static BB_INLINE u64 bb_atomic_load_u64(const volatile u64* p)
+{
+	u64 value = *p;
+	_ReadWriteBarrier();
+	return value;
+}
+
+static BB_INLINE void bb_atomic_store_u64(volatile u64* p, u64 value)
+{
+	_ReadWriteBarrier();
+	*p = value;
+}
+
+static BB_INLINE void* bb_atomic_load_ptr(void* const volatile* p)
+{
+	void* value = *p;
+	_ReadWriteBarrier();
+	return value;
+}
+
+static BB_INLINE void bb_atomic_store_ptr(void* volatile* p, void* value)
+{
+	_ReadWriteBarrier();
+	*p = value;
+}
+
+// returns the value before the add
+static BB_INLINE u32 bb_atomic_fetch_add_u32(volatile u32* p, u32 value)
+{
+	return (u32)_InterlockedExchangeAdd((volatile long*)p, (long)value);
+}
+
+// returns the value before the add
+static BB_INLINE u64 bb_atomic_fetch_add_u64(volatile u64* p, u64 value)
+{
+	return (u64)_InterlockedExchangeAdd64((volatile __int64*)p, (__int64)value);
+}
+
+// returns true if *p was expected and has been replaced with desired
+static BB_INLINE b32 bb_atomic_cas_u32(volatile u32* p, u32 expected, u32 desired)
+{
+	return (u32)_InterlockedCompareExchange((volatile long*)p, (long)desired, (long)expected) == expected;
+}
+
+static BB_INLINE b32 bb_atomic_cas_ptr(void* volatile* p, void* expected, void* desired)
+{
+	return _InterlockedCompareExchangePointer(p, desired, expected) == expected;
+}
+
+// returns the value before the exchange
+static BB_INLINE u32 bb_atomic_exchange_u32(volatile u32* p, u32 value)
+{
+	return (u32)_InterlockedExchange((volatile long*)p, (long)value);
+}
+
+#else // #if BB_USING(BB_COMPILER_MSVC)
+
+static BB_INLINE u32 bb_atomic_load_u32(const volatile u32* p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static BB_INLINE void bb_atomic_store_u32(volatile u32* p, u32 value)
+{
+	__atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static BB_INLINE u64 bb_atomic_load_u64(const volatile u64* p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static BB_INLINE void bb_atomic_store_u64(volatile u64* p, u64 value)
+{
+	__atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static BB_INLINE void* bb_atomic_load_ptr(void* const volatile* p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static BB_INLINE void bb_atomic_store_ptr(void* volatile* p, void* value)
+{
+	__atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+// returns the value before the add
+static BB_INLINE u32 bb_atomic_fetch_add_u32(volatile u32* p, u32 value)
+{
+	return __atomic_fetch_add(p, value, __ATOMIC_ACQ_REL);
+}
+
+// returns the value before the add
+static BB_INLINE u64 bb_atomic_fetch_add_u64(volatile u64* p, u64 value)
+{
+	return __atomic_fetch_add(p, value, __ATOMIC_ACQ_REL);
+}
+
+// returns true if *p was expected and has been replaced with desired
+static BB_INLINE b32 bb_atomic_cas_u32(volatile u32* p, u32 expected, u32 desired)
+{
+	return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static BB_INLINE b32 bb_atomic_cas_ptr(void* volatile* p, void* expected, void* desired)
+{
+	return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+// returns the value before the exchange
+static BB_INLINE u32 bb_atomic_exchange_u32(volatile u32* p, u32 value)
+{
+	return __atomic_exchange_n(p, value, __ATOMIC_ACQ_REL);
+}
+
+#endif // #else // #if BB_USING(BB_COMPILER_MSVC)
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // #if BB_ENABLED
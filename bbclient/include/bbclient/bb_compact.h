@@ -0,0 +1,90 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#pragma once
+
+#include "bb.h"
+
+#if BB_ENABLED
+
+#include "bb_common.h"
+#include "bb_packet.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Compact log packets.  Most of a kBBPacketType_LogText is header - timestamp, thread id, file id, line,
+// category, level, pie instance and colors - so short logs spend more bytes on the header than the text.
+// kBBPacketType_LogTextCompact replaces all of that with
+//   [varint callsite id] [varint thread index] [varint zigzag timestamp delta] [text]
+// Callsites (file, line, category, level, pie instance, colors) are registered with kBBPacketType_Callsite,
+// and thread ids with kBBPacketType_ThreadIndex, the first time they are used.  Timestamps are relative to
+// the previous kBBPacketType_LogText or kBBPacketType_LogTextCompact on the same thread.
+//
+// Ids and timestamps only mean something within one stream, so the encoding and decoding states belong to
+// a connection or a file, and both must see the same packets in the same order.
+
+enum
+{
+	kBBCompact_MaxRegistrationBytes = 96, // a kBBPacketType_ThreadIndex and a kBBPacketType_Callsite frame
+	kBBCompact_HashBuckets = 1024,
+};
+
+typedef struct bb_compact_callsite_s
+{
+	u32 fileId;
+	u32 line;
+	u32 categoryId;
+	u32 level;
+	s32 pieInstance;
+	bb_colors_t colors;
+	u32 next; // encoding only - index + 1 of the next callsite in the same hash bucket
+} bb_compact_callsite_t;
+
+typedef struct bb_compact_callsites_s
+{
+	u32 count;
+	u32 allocated;
+	bb_compact_callsite_t* data;
+} bb_compact_callsites_t;
+
+typedef struct bb_compact_thread_s
+{
+	u64 threadId;
+	u64 timestamp; // of the last log on this thread
+} bb_compact_thread_t;
+
+typedef struct bb_compact_threads_s
+{
+	u32 count;
+	u32 allocated;
+	bb_compact_thread_t* data;
+} bb_compact_threads_t;
+
+typedef struct bb_compact_state_s
+{
+	bb_compact_callsites_t callsites;
+	bb_compact_threads_t threads;
+	u32* buckets; // encoding only - index + 1 of the first callsite in each bucket
+	u32 lastThread;
+	u8 pad[4];
+} bb_compact_state_t;
+
+void bbcompact_reset(bb_compact_state_t* state);
+
+// Re-encodes one kBBPacketType_LogText frame.  dest receives any registration frames the log needs, followed
+// by the compact frame, and must hold frameLen + kBBCompact_MaxRegistrationBytes.  Returns the number of bytes
+// written to dest, which replace the frame, or 0 if the frame should be sent as it is.
+u32 bbcompact_encode_frame(bb_compact_state_t* state, const u8* frame, u32 frameLen, u8* dest, u32 destSize);
+
+// Call with every packet read from the stream, in order.  Registrations are recorded, and
+// kBBPacketType_LogTextCompact is expanded into kBBPacketType_LogText.  Returns false if the
+// packet uses a callsite or thread that was never registered.
+b32 bbcompact_decode(bb_compact_state_t* state, bb_decoded_packet_t* decoded);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // #if BB_ENABLED
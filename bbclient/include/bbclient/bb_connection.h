@@ -7,7 +7,10 @@
 
 #if BB_ENABLED
 
+#include "bb_compact.h"
 #include "bb_criticalsection.h"
+#include "bb_lz.h"
+#include "bb_packet.h"
 #include "bb_sockets.h"
 
 #if defined(__cplusplus)
@@ -26,17 +29,49 @@ typedef enum
 
 typedef enum
 {
-	kBBCon_Client = 1 << 0,   // internal use only
-	kBBCon_Server = 1 << 1,   // internal use only
-	kBBCon_Blackbox = 1 << 2, // internal use only
+	kBBCon_Client = 1 << 0,      // internal use only
+	kBBCon_Server = 1 << 1,      // internal use only
+	kBBCon_Blackbox = 1 << 2,    // internal use only
+	kBBCon_Batches = 1 << 3,     // internal use only - set by bbcon_enable_batches
+	kBBCon_CompactLogs = 1 << 4, // internal use only - set by bbcon_enable_compact_logs
+	kBBCon_LargeLogs = 1 << 5,   // internal use only - set by bbcon_enable_large_logs
+	kBBCon_Stats = 1 << 6,       // count packets and time flushes and lock waits - see bbcon_take_stats
 } bb_connection_flag_e;
 
+// Collected with kBBCon_Stats - times are from bb_monotonic_nanoseconds, since flushes and lock waits are usually
+// well under a millisecond
+typedef struct bb_connection_stats_s
+{
+	u64 packetsSent; // frames given to bbcon_send and bbcon_send_raw
+	u64 bytesSent;   // bytes the socket took
+	u64 flushNanoseconds;
+	u64 lockWaitNanoseconds; // waiting for cs in bbcon_send and bbcon_send_raw
+	u32 flushes;
+	u32 maxSendBytes; // most bytes in sendBuffer and sendBatch at the start of a flush
+	u32 droppedLogs;  // see bbcon_set_backpressure
+	u32 pad;
+} bb_connection_stats_t;
+
+// Called with each kBBPacketType_CompressedBatch frame as it is received, before its packets are decoded
+typedef void (*bbcon_batch_frame_func)(const u8* frame, u32 frameLen, void* context);
+
+struct bb_connection_backlog_s; // see bbcon_set_backpressure
+
 // post-discovery connection
 typedef struct bb_connection_s
 {
 	bb_socket socket;
 	u8 sendBuffer[8192];
 	u8 recvBuffer[32768];
+	u8* sendBatch;    // kBBBatch_MaxExpandedSize bytes of frames waiting to be compressed into sendBuffer - see bbcon_enable_batches
+	u8* recvBatch;    // kBBBatch_MaxExpandedSize bytes of frames expanded from the last batch received - allocated with the first one
+	u16* lzHashTable; // kBBLZ_HashEntries, allocated with sendBatch
+	bbcon_batch_frame_func batchFrameFunc;
+	void* batchFrameContext;
+	struct bb_connection_backlog_s* backlog;
+	bb_connection_stats_t stats;
+	bb_compact_state_t compactSend;
+	bb_compact_state_t compactRecv;
 	bb_critical_section cs;
 	u64 sentBytesTotal;
 	u64 receivedBytesTotal;
@@ -48,6 +83,10 @@ typedef struct bb_connection_s
 	u32 recvCursor;
 	u32 decodeCursor;
 	u32 flags;
+	u32 sendBatchCursor;
+	u32 recvBatchCursor;
+	u32 recvBatchLen;
+	b32 decodedFromBatch; // the last packet returned by bbcon_decodePacket or bbcon_next_frame came from a compressed batch
 	bb_connection_state_e state;
 } bb_connection_t;
 
@@ -61,6 +100,14 @@ b32 bbcon_connect_client(bb_connection_t* con, u32 remoteAddr, u16 remotePort, u
 b32 bbcon_tick_connecting(bb_connection_t* con);
 b32 bbcon_is_connecting(const bb_connection_t* con);
 
+// Connects a new socket to remoteAddr, waiting at most con's connect timeout, without changing con - so a connection
+// other threads are sending through can be connected without holding anything they need.  Returns BB_INVALID_SOCKET
+// if it can't connect.
+bb_socket bbcon_connect_socket(const bb_connection_t* con, const struct sockaddr* remoteAddr, size_t remoteAddrSize);
+
+// Resets con, and makes it a connected client over a socket from bbcon_connect_socket
+void bbcon_connect_client_socket(bb_connection_t* con, bb_socket socket);
+
 bb_socket bbcon_init_server(u32* localIp, u16* localPort);
 b32 bbcon_connect_server(bb_connection_t* con, bb_socket testSocket, u32 localAddr, u16 localPort);
 b32 bbcon_tick_listening(bb_connection_t* con);
@@ -80,6 +127,45 @@ void bbcon_try_flush(bb_connection_t* con);
 void bbcon_tick(bb_connection_t* con);
 b32 bbcon_decodePacket(bb_connection_t* con, bb_decoded_packet_t* decoded);
 
+// Returns the next whole frame, header included, without decoding it - for callers that pass frames on as they
+// are.  Compressed batches are expanded (and given to batchFrameFunc) as in bbcon_decodePacket, and compact logs
+// are not.  The frame points into the connection's buffers, and is valid until the next call.
+u8* bbcon_next_frame(bb_connection_t* con, u32* frameLen);
+
+// Packets sent after this are collected into kBBPacketType_CompressedBatch frames.  Only call this once
+// the other end has said it can expand them (kBBServerFeature_CompressedBatches).  Cleared on reset.  The batch
+// buffers are allocated then, and kept until shutdown.
+void bbcon_enable_batches(bb_connection_t* con);
+
+// Allocates the batch buffers ahead of bbcon_enable_batches, for callers that can't allocate by then
+b32 bbcon_reserve_batches(bb_connection_t* con);
+
+// kBBPacketType_LogText frames sent after this are replaced by kBBPacketType_LogTextCompact.  Only call this once
+// the other end has said it can expand them (kBBServerFeature_CompactLogs).  Cleared on reset.  Received compact
+// logs are always expanded by bbcon_decodePacket.  bbcon_try_send doesn't compact, since only servers use it.
+void bbcon_enable_compact_logs(bb_connection_t* con);
+
+// kBBPacketType_LogTextLarge frames sent after this are sent as they are.  Before it, they are split into
+// kBBPacketType_LogTextPartial and kBBPacketType_LogText frames, so older servers can read them.  Only call this once
+// the other end has said it can read them (kBBServerFeature_LargeLogs).  Cleared on reset.  Received extended frames
+// are always decoded by bbcon_decodePacket - the text of a kBBPacketType_LogTextLarge points into recvBuffer, and
+// is valid until the next call.
+void bbcon_enable_large_logs(bb_connection_t* con);
+
+// With anything but kBBBackpressure_Block, frames sent while the socket is busy are queued instead of waiting for
+// it, and drained through the rest of the send path (large logs, compact logs, batches) as the socket catches up.
+// Logs at kBBLogLevel_Warning to kBBLogLevel_Fatal, and everything that isn't a log, are queued separately and drained
+// first.  Once queueSize bytes of other logs are queued, the policy drops them or writes them to spillPath.  Frames
+// bigger than sendBuffer can still wait on the socket for a moment.  bbcon_flush waits for everything queued, and a
+// disconnect discards it.  Kept across reset.
+void bbcon_set_backpressure(bb_connection_t* con, bb_backpressure_e policy, u32 queueSize, const char* spillPath);
+
+// Copies the number of logs dropped since the last call, by level, and returns true if there were any
+b32 bbcon_take_dropped_logs(bb_connection_t* con, u32 dropped[kBBLogLevel_Count]);
+
+// Copies the stats collected since the last call, and returns the number of bytes queued by bbcon_set_backpressure
+u32 bbcon_take_stats(bb_connection_t* con, bb_connection_stats_t* stats);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -41,9 +41,11 @@ void bb_critical_section_shutdown(bb_critical_section* cs);
 #if BB_USING(BB_COMPILER_MSVC)
 _Acquires_lock_(cs->platform) void bb_critical_section_lock_impl(bb_critical_section* cs);
 _Releases_lock_(cs->platform) void bb_critical_section_unlock_impl(bb_critical_section* cs);
+_When_(return != 0, _Acquires_lock_(cs->platform)) b32 bb_critical_section_try_lock(bb_critical_section* cs);
 #else  // #if BB_USING(BB_COMPILER_MSVC)
 void bb_critical_section_lock_impl(bb_critical_section* cs);
 void bb_critical_section_unlock_impl(bb_critical_section* cs);
+b32 bb_critical_section_try_lock(bb_critical_section* cs); // returns false instead of waiting if another thread holds cs
 #endif // #else // #if BB_USING(BB_COMPILER_MSVC)
 
 #if BB_USING(BB_DEBUG_LOCKS)
@@ -37,14 +37,21 @@ typedef struct bb_discovery_pending_connection_s
 	u8 pad[2];
 } bb_discovery_pending_connection_t;
 
+typedef struct bb_discovery_pending_connections_s
+{
+	u32 count;
+	u32 allocated;
+	bb_discovery_pending_connection_t* data;
+} bb_discovery_pending_connections_t;
+
 typedef struct bb_discovery_server_s
 {
 	bb_socket socket_in4;
 	bb_socket socket_in6;
 	bb_discovery_response_t responses[64];
-	bb_discovery_pending_connection_t pendingConnections[64];
+	bb_discovery_pending_connections_t pendingConnections; // taken by the server, which clears it - it decides how many it can record
 	u32 numResponses;
-	u32 numPendingConnections;
+	u8 pad[4];
 } bb_discovery_server_t;
 
 b32 bb_discovery_server_init(bb_discovery_server_t* ds, const int addrFamily);
@@ -0,0 +1,81 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#pragma once
+
+#include "bb.h"
+
+#if BB_ENABLED
+
+#include "bb_common.h"
+#include <stdarg.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Deferred formatting: the client packs printf arguments into a kBBPacketType_LogTextDeferred packet
+// instead of calling vsnprintf, and the server formats the text when the packet is read.
+//
+// Packed arguments are native-endian, in the order the format consumes them:
+//   integers, '*' widths/precisions, %c, %p - 8 bytes, already truncated to the size given by the length modifier
+//   floating point - 8 byte double
+//   strings - u16 length followed by the bytes (no terminator), or a length of 0xFFFF for NULL
+
+enum
+{
+	kBBFormat_MaxArgs = 28,
+	kBBFormat_NullString = 0xFFFF,
+	kBBFormat_MaxExpandedText = 16 * 1024, // matches the client's trace buffer
+};
+
+typedef enum bb_format_arg_e
+{
+	kBBFormatArg_Int,
+	kBBFormatArg_UInt,
+	kBBFormatArg_SChar,
+	kBBFormatArg_UChar,
+	kBBFormatArg_Short,
+	kBBFormatArg_UShort,
+	kBBFormatArg_Long,
+	kBBFormatArg_ULong,
+	kBBFormatArg_LongLong,
+	kBBFormatArg_ULongLong,
+	kBBFormatArg_Size,
+	kBBFormatArg_PtrDiff,
+	kBBFormatArg_IntMax,
+	kBBFormatArg_UIntMax,
+	kBBFormatArg_Double,
+	kBBFormatArg_String,
+	kBBFormatArg_Pointer,
+} bb_format_arg_e;
+
+typedef struct bb_format_s
+{
+	const char* fmt; // the format string this was parsed from - callsites verify it hasn't changed
+	u32 numArgs;
+	u8 args[kBBFormat_MaxArgs]; // bb_format_arg_e
+} bb_format_t;
+
+// Parses the va_arg types consumed by fmt.  Returns false if fmt uses anything that can't be formatted
+// later from packed arguments (%n, wide characters, positional arguments, long double, too many arguments).
+BB_LINKAGE b32 bbformat_parse(const char* fmt, bb_format_t* format);
+
+// Packs args as described by format.  Returns false if they don't fit in bufferSize bytes.
+BB_LINKAGE b32 bbformat_pack(const bb_format_t* format, u8* buffer, u32 bufferSize, u16* argsLen, va_list args);
+
+// Formats fmt from packed arguments, truncating at bufferSize - 1 characters.  Returns the number of
+// characters written, or -1 if the packed arguments don't match fmt.
+BB_LINKAGE int bbformat_expand(char* buffer, size_t bufferSize, const char* fmt, const u8* args, u32 argsLen);
+
+// Rebuilds the packets bb_trace would have sent for a kBBPacketType_LogTextDeferred packet - any number of
+// kBBPacketType_LogTextPartial packets followed by a kBBPacketType_LogText packet - and passes them to func.
+// fmt can be NULL if the format id was never registered.
+typedef void (*bbformat_log_text_func)(bb_decoded_packet_t* decoded, void* context);
+BB_LINKAGE void bbformat_expand_log_packet(const bb_decoded_packet_t* deferred, const char* fmt, bbformat_log_text_func func, void* context);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // #if BB_ENABLED
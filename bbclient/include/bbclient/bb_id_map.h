@@ -0,0 +1,58 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#pragma once
+
+#include "bb.h"
+
+#if BB_ENABLED
+
+#include "bb_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Read-mostly hash table mapping case-insensitive names to ids.  Lookups are lock-free, and can run
+// while another thread inserts.  Inserts must be serialized by the caller.  Tables that are outgrown
+// are kept until bb_id_map_reset, since a reader might still be probing them.
+
+typedef struct bb_id_map_slot_s
+{
+	const char* name; // not owned - must stay valid until bb_id_map_reset
+	u32 hash;
+	volatile u32 id; // published last - 0 means the slot is empty
+} bb_id_map_slot_t;
+
+typedef struct bb_id_map_table_s
+{
+	struct bb_id_map_table_s* retired;
+	u32 mask;
+	u32 count;
+	b32 fixed; // memory is the caller's - see bb_id_map_init_fixed
+	u8 pad[4];
+	bb_id_map_slot_t slots[1];
+} bb_id_map_table_t;
+
+typedef struct bb_id_map_s
+{
+	bb_id_map_table_t* volatile table;
+} bb_id_map_t;
+
+// matches bb_hash_name in bb.h, so C++ callsites can hash names at compile time
+u32 bb_id_map_hash(const char* name);
+
+u32 bb_id_map_find(const bb_id_map_t* map, const char* name, u32 hash);
+b32 bb_id_map_insert(bb_id_map_t* map, const char* name, u32 hash, u32 id);
+void bb_id_map_reset(bb_id_map_t* map);
+
+// A fixed map lives in memory from the caller (bb_id_map_fixed_size bytes) and never grows - it holds at
+// least maxIds, and inserts fail once it is half full.  bb_id_map_reset empties it without freeing anything.
+u32 bb_id_map_fixed_size(u32 maxIds);
+void bb_id_map_init_fixed(bb_id_map_t* map, void* memory, u32 maxIds);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // #if BB_ENABLED
@@ -0,0 +1,74 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#pragma once
+
+#include "bb.h"
+
+#if BB_ENABLED
+
+#include "bb_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Fields from the BB_LOG_KV family are sent in kBBPacketType_LogTextKV packets as a run of
+//   [u8 bb_kv_type_e][u8 key length][key][value]
+// Int values are zigzag varints, Float values are a little-endian double, String values are a varint length
+// followed by the bytes (no terminator), and Bool values are one byte.  kBBKV_Object has a key and no value,
+// and kBBKV_ObjectEnd has neither.
+
+enum
+{
+	kBBKV_MaxDepth = 8,
+	kBBKV_MaxKeyLen = 255,
+};
+
+typedef struct bbkv_field_s
+{
+	const char* key;    // not terminated
+	const char* string; // kBBKV_String, not terminated
+	s64 i;              // kBBKV_Int, and 0 or 1 for kBBKV_Bool
+	double f;           // kBBKV_Float
+	u32 keyLen;
+	u32 stringLen;
+	u32 depth; // 0 for top-level fields - kBBKV_ObjectEnd has the depth of the kBBKV_Object it ends
+	bb_kv_type_e type;
+} bbkv_field_t;
+
+typedef struct bbkv_reader_s
+{
+	const u8* data;
+	u32 len;
+	u32 cursor;
+	u32 depth;
+	u8 pad[4];
+} bbkv_reader_t;
+
+// Encodes fields, closing any objects left open.  Returns the number of bytes written, or 0 if they don't fit
+// in destSize, or objects nest deeper than kBBKV_MaxDepth or end without being started.  Keys longer than
+// kBBKV_MaxKeyLen are truncated.
+BB_LINKAGE u32 bbkv_encode(const bb_kv_t* fields, u32 count, u8* dest, u32 destSize);
+
+BB_LINKAGE void bbkv_reader_init(bbkv_reader_t* reader, const u8* data, u32 len);
+
+// Returns false at the end of the fields, or if the rest of them are corrupt
+BB_LINKAGE b32 bbkv_read(bbkv_reader_t* reader, bbkv_field_t* field);
+
+// Finds a field by its key, with the keys of the objects it is in separated by '.' - "pos.x".  Objects can be
+// found too, but have no value.
+BB_LINKAGE b32 bbkv_find(const u8* data, u32 len, const char* path, bbkv_field_t* field);
+
+// Writes a field's value as text - strings as they are, bools as true or false, and nothing for objects.  Both
+// writers truncate at destSize - 1 characters, and return the length of the whole text, so a NULL dest measures it.
+BB_LINKAGE u32 bbkv_format_value(const bbkv_field_t* field, char* dest, u32 destSize);
+
+// Writes the fields as one line of JSON
+BB_LINKAGE u32 bbkv_format_json(const u8* data, u32 len, char* dest, u32 destSize);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // #if BB_ENABLED
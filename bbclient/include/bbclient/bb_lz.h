@@ -0,0 +1,44 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#pragma once
+
+#include "bb.h"
+
+#if BB_ENABLED
+
+#include "bb_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Small LZ77 block codec used for kBBPacketType_CompressedBatch.  The block format is a sequence of
+//   [token] [literal length bytes] [literals] [u16 offset] [match length bytes]
+// where the token holds the literal length in the high 4 bits and the match length - 4 in the low 4 bits.
+// A nibble of 15 continues in following bytes, each adding up to 255.  The final sequence has
+// literals only, and ends the block.
+
+enum
+{
+	kBBLZ_MinMatch = 4,
+	kBBLZ_MaxInput = 0xFFFF, // offsets are 16 bits
+	kBBLZ_HashBits = 12,
+	kBBLZ_HashEntries = 1 << kBBLZ_HashBits,
+};
+
+// worst case compressed size, for incompressible input
+u32 bblz_compress_bound(u32 srcLen);
+
+// Returns the compressed size, or 0 if the output doesn't fit in dstSize.  hashTable is scratch space
+// of kBBLZ_HashEntries entries, so callers can avoid putting it on the stack.
+u32 bblz_compress(const u8* src, u32 srcLen, u8* dst, u32 dstSize, u16* hashTable);
+
+// Returns false unless the block expands to exactly dstLen bytes.
+b32 bblz_decompress(const u8* src, u32 srcLen, u8* dst, u32 dstLen);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // #if BB_ENABLED
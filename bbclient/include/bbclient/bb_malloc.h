@@ -15,6 +15,10 @@ extern "C" {
 
 void bb_tracked_malloc_enable(b32 enabled);
 
+// bb_malloc and bb_realloc assert while forbidden - bb_init forbids them when it has been given pools (see
+// bb_set_pools), and bb_shutdown allows them again.
+void bb_malloc_forbid(b32 forbidden);
+
 void* bb_malloc_loc(const char* file, int line, size_t size);
 #define bb_malloc(x) bb_malloc_loc(__FILE__, __LINE__, (x))
 
@@ -58,6 +58,31 @@ typedef enum
 
 	kBBPacketType_AppInfo_v6, // Client --> Server, same as kBBPacketType_AppInfo_v5 but indicates sorted verbosity enum
 
+	kBBPacketType_FormatId,        // Client --> Server, registers a format string for kBBPacketType_LogTextDeferred
+	kBBPacketType_LogTextDeferred, // Client --> Server, format id and packed arguments - formatted by the server
+
+	kBBPacketType_ServerFeatures,  // Server --> Client, sent in reply to an AppInfo that asks for optional features
+	kBBPacketType_CompressedBatch, // Client --> Server, not serialized by bbpacket_serialize - see bbpacket_expand_batch
+
+	kBBPacketType_Callsite,       // Client --> Server, registers a callsite id for kBBPacketType_LogTextCompact
+	kBBPacketType_ThreadIndex,    // Client --> Server, registers a thread index for kBBPacketType_LogTextCompact
+	kBBPacketType_LogTextCompact, // Client --> Server, no header - expanded into kBBPacketType_LogText by bbcompact_decode
+
+	kBBPacketType_CategoryLevels, // Server --> Client, minimum levels for a run of category ids - see kBBInitFlag_CategoryLevels
+	kBBPacketType_LogSuppressed,  // Client --> Server, logs dropped at a callsite - see bb_callsite_limit_t
+
+	kBBPacketType_LogTextLarge, // Client --> Server, one log longer than kBBSize_LogText, in an extended frame - see kBBInitFlag_LargeLogs
+
+	kBBPacketType_TimeCalibration, // Client --> Server, replaces appInfo.millisPerTick - see kBBInitFlag_TSCTimestamps
+
+	kBBPacketType_LogsDropped, // Client --> Server, logs a backed-up connection dropped - see bb_set_backpressure
+
+	kBBPacketType_ClientTelemetry, // Client --> Server, what logging has cost the client lately - see kBBInitFlag_Telemetry
+
+	kBBPacketType_LogTextKV, // Client --> Server, text and typed fields - see BB_LOG_KV and bb_kv.h
+
+	kBBPacketType_FlightRecorder, // Client --> Server, sent before and after a flight recorder dump - see bb_set_flight_recorder
+
 	kBBPacketType_AppInfo = kBBPacketType_AppInfo_v6
 
 } bb_packet_type_e;
@@ -95,6 +120,43 @@ typedef struct bb_packet_log_text_s
 	char text[kBBSize_LogText];
 } bb_packet_log_text_t;
 
+// Text points into the buffer the packet was deserialized from, so it is only valid as long as that buffer is.
+// It is not terminated.
+typedef struct bb_packet_log_text_large_s
+{
+	u32 categoryId;
+	u32 level;
+	s32 pieInstance;
+	bb_colors_t colors;
+	u32 textLen;
+	const char* text;
+} bb_packet_log_text_large_t;
+
+typedef struct bb_packet_log_text_deferred_s
+{
+	u32 categoryId;
+	u32 level;
+	s32 pieInstance;
+	bb_colors_t colors;
+	u32 formatId;
+	u16 argsLen;
+	u8 pad[2];
+	u8 args[kBBSize_DeferredArgs];
+} bb_packet_log_text_deferred_t;
+
+// The prefix matches bb_packet_log_text_t, so the level is in the same place in the frame
+typedef struct bb_packet_log_text_kv_s
+{
+	u32 categoryId;
+	u32 level;
+	s32 pieInstance;
+	bb_colors_t colors;
+	u16 fieldsLen;
+	u8 pad[2];
+	u8 fields[kBBSize_KVFields];
+	char text[kBBSize_LogText - kBBSize_KVFields];
+} bb_packet_log_text_kv_t;
+
 typedef struct bb_packet_user_s
 {
 	u8 data[kBBSize_UserData];
@@ -147,6 +209,96 @@ typedef struct bb_packet_frame_number_s
 	u64 frameNumber;
 } bb_packet_frame_number_t;
 
+typedef struct bb_packet_callsite_s
+{
+	u32 id;
+	u32 categoryId;
+	u32 level;
+	s32 pieInstance;
+	bb_colors_t colors;
+} bb_packet_callsite_t;
+
+typedef struct bb_packet_thread_index_s
+{
+	u32 index;
+} bb_packet_thread_index_t;
+
+enum
+{
+	kBBSize_CategoryLevels = 1024,
+};
+
+typedef struct bb_packet_category_levels_s
+{
+	u32 firstCategoryId;
+	u16 count;
+	u8 pad[2];
+	u8 minLevels[kBBSize_CategoryLevels]; // bb_log_level_e, for category ids firstCategoryId through firstCategoryId + count - 1
+} bb_packet_category_levels_t;
+
+typedef struct bb_packet_log_suppressed_s
+{
+	u32 categoryId;
+	u32 level;
+	u32 rateLimited;
+	u32 repeated;
+} bb_packet_log_suppressed_t;
+
+typedef enum
+{
+	kBBServerFeature_CompressedBatches = 0x1,
+	kBBServerFeature_CompactLogs = 0x2,
+	kBBServerFeature_LargeLogs = 0x4,
+} bb_server_feature_e;
+
+typedef struct bb_packet_server_features_s
+{
+	u32 features; // bb_server_feature_e
+} bb_packet_server_features_t;
+
+// Sent after AppInfo and then periodically, as the client measures its timestamp counter over a longer time.
+// The header timestamp and microsecondsFromEpoch are from the same moment.
+typedef struct bb_packet_time_calibration_s
+{
+	double millisPerTick;
+	u64 microsecondsFromEpoch;
+} bb_packet_time_calibration_t;
+
+// Sent periodically while a connection with a dropping bb_backpressure_e is dropping logs
+typedef struct bb_packet_logs_dropped_s
+{
+	u32 categoryId;
+	u32 policy;                     // bb_backpressure_e
+	u32 dropped[kBBLogLevel_Count]; // since the last kBBPacketType_LogsDropped, by level
+} bb_packet_logs_dropped_t;
+
+// Sent periodically with kBBInitFlag_Telemetry - everything is since the last kBBPacketType_ClientTelemetry
+typedef struct bb_packet_client_telemetry_s
+{
+	double intervalMillis;
+	double flushMillis;    // spent writing to the socket
+	double lockWaitMillis; // spent waiting for the connection's lock to send
+	u64 packetsSent;
+	u64 bytesSent; // after batching and compression
+	u32 flushes;
+	u32 maxSendBytes;   // most bytes waiting to be written to the socket at once
+	u32 queuedBytes;    // bytes queued by bb_set_backpressure when this was sent
+	u32 droppedLogs;    // by bb_set_backpressure
+	u32 suppressedLogs; // by bb_set_callsite_rate_limit and bb_set_repeat_suppression
+	u32 pad;
+} bb_packet_client_telemetry_t;
+
+// Sent before and after the logs in a flight recorder dump.  They are older than logs that were sent while they
+// sat in the ring, so the server splices the logs in between into the session by timestamp.
+typedef struct bb_packet_flight_recorder_s
+{
+	u32 categoryId;
+	u32 trigger;         // bb_flight_recorder_trigger_e
+	u32 logCount;        // in the dump
+	u32 overwrittenLogs; // to make room in the ring, since the last dump
+	u32 end;             // set in the packet after the dump
+} bb_packet_flight_recorder_t;
+
 typedef struct bb_decoded_packet_s
 {
 	bb_packet_type_e type;
@@ -161,7 +313,8 @@ typedef struct bb_decoded_packet_s
 		bb_packet_register_id_t fileId;
 		bb_packet_register_id_t categoryId;
 		bb_packet_frame_end_t frameEnd;
-		bb_packet_log_text_t logText;
+		bb_packet_log_text_t logText; // also kBBPacketType_LogTextCompact - see bb_compact.h
+		bb_packet_log_text_large_t logTextLarge;
 		bb_packet_user_t userToServer;
 		bb_packet_text_t consoleCommand;
 		bb_packet_user_t userToClient;
@@ -177,6 +330,27 @@ typedef struct bb_decoded_packet_s
 		bb_packet_console_autocomplete_response_entry_t consoleAutocompleteResponseEntry;
 
 		bb_packet_frame_number_t frameNumber;
+
+		bb_packet_register_id_t formatId;
+		bb_packet_log_text_deferred_t logTextDeferred;
+
+		bb_packet_server_features_t serverFeatures;
+
+		bb_packet_callsite_t callsite;
+		bb_packet_thread_index_t threadIndex;
+
+		bb_packet_category_levels_t categoryLevels;
+		bb_packet_log_suppressed_t logSuppressed;
+
+		bb_packet_time_calibration_t timeCalibration;
+
+		bb_packet_logs_dropped_t logsDropped;
+
+		bb_packet_client_telemetry_t clientTelemetry;
+
+		bb_packet_log_text_kv_t logTextKV;
+
+		bb_packet_flight_recorder_t flightRecorder;
 	} packet;
 } bb_decoded_packet_t;
 
@@ -185,11 +359,89 @@ enum
 	BB_MAX_PACKET_BUFFER_SIZE = sizeof(bb_decoded_packet_t)
 };
 
+// A kBBPacketType_CompressedBatch frame wraps a run of [u16 length][packet] frames compressed with bblz:
+//   [u16 frame length][u8 kBBPacketType_CompressedBatch][u16 expanded length][compressed frames]
+enum
+{
+	kBBBatch_HeaderSize = 5,
+	kBBBatch_MaxExpandedSize = 8064, // leaves room for the compressed frame in bb_connection_t's send buffer
+};
+
 BB_LINKAGE b32 bbpacket_deserialize(u8* buffer, u16 len, bb_decoded_packet_t* decoded);
 BB_LINKAGE u16 bbpacket_serialize(bb_decoded_packet_t* source, u8* buffer, u16 len);
+
+// Frames start with a big-endian u16 length, which includes itself.  kBBPacketType_LogTextLarge uses an extended
+// frame instead - a u16 0, then a big-endian u32 length.  Connections split it into kBBPacketType_LogTextPartial
+// frames until the server asks for it with kBBServerFeature_LargeLogs - see bbcon_enable_large_logs.
+//   [u16 frame length][u8 type][packet]
+//   [u16 0][u32 frame length][u8 type][packet]
+// Extended frames are never put in compressed batches.
+enum
+{
+	kBBFrame_HeaderSize = 2,
+	kBBFrame_ExtendedHeaderSize = 6,
+	kBBFrame_MaxExtendedSize = 16 * 1024, // fits in the smallest send thread ring, and in half a connection's recvBuffer
+};
+
+// Returns the length of the frame, including its header, or 0 if available doesn't cover the header or an
+// extended frame's length is out of range.  Callers still need to check available covers the whole frame.
+BB_LINKAGE u32 bbpacket_frame_length(const u8* frame, u32 available);
+BB_LINKAGE u32 bbpacket_frame_header_size(const u8* frame); // kBBFrame_ExtendedHeaderSize for extended frames
+BB_LINKAGE void bbpacket_write_frame_header(u8* frame, u32 frameLen, b32 extended);
+
+// Serializes source into a whole frame, extended for kBBPacketType_LogTextLarge.  Returns the frame length, or 0
+// if it doesn't fit in frameSize.
+BB_LINKAGE u32 bbpacket_serialize_frame(bb_decoded_packet_t* source, u8* frame, u32 frameSize);
+
+// A kBBPacketType_LogText, kBBPacketType_LogTextPartial or kBBPacketType_LogTextLarge frame is everything
+// bbpacket_serialize writes before the text, followed by the text without a terminator.  Writers that format the
+// text in place write this prefix in front of it, then fill in the frame length:
+//   [u16 frame length][u8 type][header][categoryId][level][pieInstance][colors][text]
+enum
+{
+	kBBPacket_LogTextPrefixSize = 47,
+	kBBPacket_LogTextLargePrefixSize = kBBPacket_LogTextPrefixSize + kBBFrame_ExtendedHeaderSize - kBBFrame_HeaderSize,
+	kBBSize_LogTextLarge = kBBFrame_MaxExtendedSize - kBBPacket_LogTextLargePrefixSize, // longer logs are still sent as kBBPacketType_LogTextPartial
+	kBBPacket_LogTextKVPrefixSize = kBBPacket_LogTextPrefixSize + 2,       // the same prefix, then [u16 fieldsLen][fields][text]
+	kBBPacket_LogTextDeferredPrefixSize = kBBPacket_LogTextPrefixSize + 4, // the same prefix, then [u32 formatId][args]
+};
+BB_LINKAGE void bbpacket_write_log_text_prefix(u8* frame, bb_packet_type_e type, const bb_packet_header_t* header, u32 categoryId, u32 level, s32 pieInstance, bb_colors_t colors);
+BB_LINKAGE void bbpacket_write_log_text_kv_fields_len(u8* frame, u16 fieldsLen);
+BB_LINKAGE void bbpacket_write_log_text_deferred_format_id(u8* frame, u32 formatId);
+
+// Writes a whole kBBPacketType_FlightRecorder frame, as bbpacket_serialize_frame would
+enum
+{
+	kBBPacket_FlightRecorderFrameSize = kBBFrame_HeaderSize + 1 + 24 + 20, // [u16 frame length][u8 type][header][packet]
+};
+BB_LINKAGE void bbpacket_write_flight_recorder(u8* frame, const bb_packet_header_t* header, const bb_packet_flight_recorder_t* packet);
 BB_LINKAGE b32 bbpacket_is_app_info_type(bb_packet_type_e type);
 BB_LINKAGE b32 bbpacket_is_log_text_type(bb_packet_type_e type);
 
+// Fills logText with a kBBPacketType_LogText describing a kBBPacketType_LogSuppressed, from the same callsite
+BB_LINKAGE void bbpacket_expand_log_suppressed(const bb_decoded_packet_t* suppressed, bb_decoded_packet_t* logText);
+
+// Fills logText with a kBBPacketType_LogText warning describing a kBBPacketType_LogsDropped
+BB_LINKAGE void bbpacket_expand_logs_dropped(const bb_decoded_packet_t* logsDropped, bb_decoded_packet_t* logText);
+
+// Fills logText with a kBBPacketType_LogText describing the kBBPacketType_FlightRecorder that starts a dump
+BB_LINKAGE void bbpacket_expand_flight_recorder(const bb_decoded_packet_t* flightRecorder, bb_decoded_packet_t* logText);
+
+// Returns true if frame holds a log - kBBPacketType_LogText, LogTextPartial, LogTextDeferred, LogTextLarge,
+// LogSuppressed or LogTextKV - and fills in its level, which all of them keep in the same place
+BB_LINKAGE b32 bbpacket_get_frame_log_level(const u8* frame, u32 frameLen, bb_log_level_e* level);
+
+// Rebuilds the packets a client without kBBInitFlag_LargeLogs would have sent for a kBBPacketType_LogTextLarge -
+// any number of kBBPacketType_LogTextPartial packets followed by a kBBPacketType_LogText packet - and passes them to func
+typedef void (*bbpacket_log_text_func)(bb_decoded_packet_t* decoded, void* context);
+BB_LINKAGE void bbpacket_split_log_text_large(const bb_decoded_packet_t* large, bbpacket_log_text_func func, void* context);
+
+// frame points at the u16 frame length
+BB_LINKAGE b32 bbpacket_is_batch_frame(const u8* frame, u32 frameLen);
+// Expands a batch frame into dest, which should hold kBBBatch_MaxExpandedSize bytes.  Returns the number of
+// bytes of [u16 length][packet] frames written, or 0 if the batch is corrupt.
+BB_LINKAGE u32 bbpacket_expand_batch(const u8* frame, u32 frameLen, u8* dest, u32 destSize);
+
 #if defined(__cplusplus)
 }
 #endif
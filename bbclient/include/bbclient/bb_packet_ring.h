@@ -0,0 +1,54 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#pragma once
+
+#include "bb.h"
+
+#if BB_ENABLED
+
+#include "bb_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Single-producer, single-consumer ring of serialized [u16 length][packet] frames (or extended frames - see
+// bbpacket_frame_length).
+// The producer only ever publishes whole frames, so the consumer never sees a partial one.
+typedef struct bb_packet_ring_s
+{
+	struct bb_packet_ring_s* next; // owned by whoever keeps the list of rings
+	u8* data;
+	u32 size; // power of two
+	volatile u32 writeCursor;
+	volatile u32 readCursor;
+	volatile u32 retired; // producer is done - consumer can destroy the ring once it is empty
+	u32 stalls;           // number of writes that found the ring full
+	u8 pad[4];
+} bb_packet_ring_t;
+
+bb_packet_ring_t* bb_packet_ring_create(u32 size);
+void bb_packet_ring_destroy(bb_packet_ring_t* ring);
+
+// Lays a ring out in bb_packet_ring_memory_size(size) bytes of memory from the caller, instead of allocating
+// it - rings made this way aren't passed to bb_packet_ring_destroy.
+u32 bb_packet_ring_memory_size(u32 size);
+bb_packet_ring_t* bb_packet_ring_init(void* memory, u32 size);
+
+// producer - returns false if the frame does not fit right now
+b32 bb_packet_ring_write(bb_packet_ring_t* ring, const void* frame, u32 frameLen);
+
+// consumer - copies as many whole frames as fit in dest, and returns the number of bytes copied
+u32 bb_packet_ring_read_frames(bb_packet_ring_t* ring, u8* dest, u32 destSize);
+
+// consumer - copies the oldest frame if it fits in dest, and returns its length
+u32 bb_packet_ring_read_frame(bb_packet_ring_t* ring, u8* dest, u32 destSize);
+
+b32 bb_packet_ring_is_empty(const bb_packet_ring_t* ring);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // #if BB_ENABLED
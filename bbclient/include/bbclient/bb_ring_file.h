@@ -0,0 +1,78 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#pragma once
+
+#include "bb.h"
+
+#if BB_ENABLED
+
+#include "bb_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Crash-safe file sink.  The file is preallocated and memory-mapped, so writing a packet is an atomic add
+// and a memcpy - no syscall, and nothing is lost if the process dies, since the pages belong to the OS.
+//
+// Layout:
+//   [bb_ring_file_header_t] [preamble region] [ring region]
+// Registrations (AppInfo, thread, file, category and format ids) are appended to the preamble, so they
+// outlive the logs that use them.  Everything else goes to the ring, which wraps and keeps the newest
+// data.  If the preamble fills up, registrations go to the ring too.
+//
+// Each region holds 8-byte aligned records:
+//   [u32 length] [u32 stamp] [length bytes of whole [u16 length][packet] frames] [pad to 8 bytes]
+// The stamp is derived from the record's position in the region's stream of bytes, and is written
+// after the frames, so a reader can tell a whole record from a stale or half-written one.
+// bb_ring_file_unwrap turns the regions back into a normal stream of frames - see bboxtolog -unwrap.
+
+enum
+{
+	kBBRingFile_MinSize = 1024 * 1024,
+	kBBRingFile_MaxRecordSize = 16 * 1024, // runs of frames are split into records of about this size
+};
+
+typedef struct bb_ring_file_header_s
+{
+	char magic[8]; // "BBRING01"
+	u32 version;
+	u32 headerSize;
+	u32 preambleSize;
+	u32 ringSize;
+	volatile u64 preambleCursor; // total bytes reserved in the preamble - can run past preambleSize
+	volatile u64 ringCursor;     // total bytes reserved in the ring
+} bb_ring_file_header_t;
+
+typedef struct bb_ring_file_s
+{
+	bb_ring_file_header_t* header;
+	u8* preamble;
+	u8* ring;
+	u64 mappedSize;
+} bb_ring_file_t;
+
+// size is the total size of the file - returns false if the file cannot be created or mapped, or
+// memory-mapped files aren't supported on this platform
+b32 bb_ring_file_open(bb_ring_file_t* ringFile, const char* path, u32 size);
+void bb_ring_file_close(bb_ring_file_t* ringFile);
+b32 bb_ring_file_is_open(const bb_ring_file_t* ringFile);
+
+// frames is one or more whole [u16 length][packet] frames - safe to call from any thread
+void bb_ring_file_write(bb_ring_file_t* ringFile, const u8* frames, u32 framesLen);
+
+// asks the OS to start writing dirty pages out - not needed for crash safety, only for power loss
+void bb_ring_file_flush(bb_ring_file_t* ringFile);
+
+// Reading - data is the whole file.  func is called with runs of whole frames: first the preamble, then
+// the ring from oldest to newest.  Returns false if data isn't a ring file.
+typedef void (*bb_ring_file_frames_func)(const u8* frames, u32 framesLen, void* context);
+b32 bb_ring_file_is_ring_file(const void* data, u64 dataLen);
+b32 bb_ring_file_unwrap(const void* data, u64 dataLen, bb_ring_file_frames_func func, void* context);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // #if BB_ENABLED
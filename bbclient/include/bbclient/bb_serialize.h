@@ -50,6 +50,7 @@ b32 bbserialize_s64(bb_serialize_t* ser, s64* data);
 b32 bbserialize_s32(bb_serialize_t* ser, s32* data);
 b32 bbserialize_s16(bb_serialize_t* ser, s16* data);
 b32 bbserialize_s8(bb_serialize_t* ser, s8* data);
+b32 bbserialize_varint(bb_serialize_t* ser, u64* data); // 1-10 bytes, smaller values are shorter
 b32 bbserialize_text_(bb_serialize_t* ser, char* data, size_t maxLen, u16* len);
 #define bbserialize_text(ser, data, len) bbserialize_text_(ser, data, sizeof(data), len)
 
@@ -31,6 +31,7 @@
 #define BBNET_ECONNABORTED    WSAECONNABORTED
 #define BBNET_ECONNRESET      WSAECONNRESET
 #define BBNET_ENOBUFS         WSAENOBUFS
+#define BBNET_EMFILE          WSAEMFILE
 #define BBNET_EISCONN         WSAEISCONN
 #define BBNET_ENOTCONN        WSAENOTCONN
 #define BBNET_ESHUTDOWN       WSAESHUTDOWN
@@ -74,6 +75,7 @@
 #define BBNET_ECONNABORTED    ECONNABORTED
 #define BBNET_ECONNRESET      ECONNRESET
 #define BBNET_ENOBUFS         ENOBUFS
+#define BBNET_EMFILE          EMFILE
 #define BBNET_EISCONN         EISCONN
 #define BBNET_ENOTCONN        ENOTCONN
 #define BBNET_ESHUTDOWN       ESHUTDOWN
@@ -113,6 +113,10 @@ int bbnet_socket_nodelay(bb_socket socket, b32 nodelay);
 int bbnet_socket_linger(bb_socket socket, b32 enabled, u16 seconds);
 int bbnet_socket_reuseaddr(bb_socket socket, int reuseAddr);
 int bbnet_socket_nonblocking(bb_socket socket, b32 nonblocking);
+
+// Waits up to timeoutMillis for socket to be readable, or writable.  Returns 1 if it is, 0 if it timed out, and
+// BB_SOCKET_ERROR if the wait failed, as select would - but polls, so works with any descriptor, unlike FD_SET.
+int bbnet_socket_wait(bb_socket socket, b32 writable, u32 timeoutMillis);
 int bbnet_socket_ipv6only(bb_socket socket, b32 ipv6only);
 b32 bbnet_socket_is6to4(const struct sockaddr *addr); // returns true if addr is ipv4 mapped to ipv6
 u16 bbnet_get_port_from_sockaddr(const struct sockaddr *addr);
@@ -19,6 +19,28 @@ u64 bb_current_time_ms(void);
 u64 bb_current_time_microseconds_from_epoch(void);
 void bb_sleep_ms(u32 millis);
 
+// For timing short intervals - bb_current_ticks is only milliseconds on some platforms.  Returns 0 if there is no
+// monotonic clock.
+u64 bb_monotonic_nanoseconds(void);
+
+// Invariant timestamp counter - a constant rate counter that is much cheaper to read than bb_current_ticks, where
+// the CPU has one.  bb_tsc_ticks returns 0 if bb_tsc_available is false.
+b32 bb_tsc_available(void);
+u64 bb_tsc_ticks(void);
+
+// Measures the rate of bb_tsc_ticks against a monotonic clock
+typedef struct bb_tsc_calibration_s
+{
+	u64 startTicks;
+	u64 startNanoseconds;
+} bb_tsc_calibration_t;
+
+void bb_tsc_calibration_start(bb_tsc_calibration_t* calibration);
+
+// Measured over the whole time since bb_tsc_calibration_start, so it gets more accurate the longer it has been.
+// Spins until at least a millisecond has passed.
+double bb_tsc_millis_per_tick(const bb_tsc_calibration_t* calibration);
+
 #if defined(__cplusplus)
 }
 #endif
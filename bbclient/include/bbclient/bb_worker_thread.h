@@ -0,0 +1,53 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#pragma once
+
+#include "bb.h"
+
+#if BB_ENABLED
+
+#include "bb_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Threads owned by bbclient itself (send thread, etc).  Kept separate from
+// mc_common's bb_thread.h so bbclient has no dependencies outside its own tree.
+
+#if BB_USING(BB_COMPILER_MSVC)
+
+#include "bb_wrap_process.h"
+
+typedef uintptr_t bb_worker_thread_handle_t;
+typedef unsigned bb_worker_thread_return_t;
+#define bb_worker_thread_exit(ret) \
+	{                              \
+		_endthreadex(ret);         \
+		return ret;                \
+	}
+
+#else // #if BB_USING(BB_COMPILER_MSVC)
+
+#include <pthread.h>
+
+typedef pthread_t bb_worker_thread_handle_t;
+typedef void* bb_worker_thread_return_t;
+#define bb_worker_thread_exit(ret) \
+	{                              \
+		return ret;                \
+	}
+
+#endif // #else // #if BB_USING(BB_COMPILER_MSVC)
+
+typedef bb_worker_thread_return_t (*bb_worker_thread_func)(void* args);
+
+b32 bb_worker_thread_create(bb_worker_thread_handle_t* handle, bb_worker_thread_func func, void* arg);
+void bb_worker_thread_join(bb_worker_thread_handle_t handle);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // #if BB_ENABLED
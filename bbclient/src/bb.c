@@ -11,16 +11,23 @@ __pragma(warning(disable : 4710)) // warning C4710 : 'int printf(const char *con
 
 #include "bbclient/bb_array.h"
 #include "bbclient/bb_assert.h"
+#include "bbclient/bb_atomic.h"
 #include "bbclient/bb_connection.h"
 #include "bbclient/bb_criticalsection.h"
 #include "bbclient/bb_discovery_client.h"
 #include "bbclient/bb_discovery_shared.h"
 #include "bbclient/bb_file.h"
+#include "bbclient/bb_format.h"
+#include "bbclient/bb_id_map.h"
+#include "bbclient/bb_kv.h"
 #include "bbclient/bb_log.h"
 #include "bbclient/bb_malloc.h"
 #include "bbclient/bb_packet.h"
+#include "bbclient/bb_packet_ring.h"
+#include "bbclient/bb_ring_file.h"
 #include "bbclient/bb_string.h"
 #include "bbclient/bb_time.h"
+#include "bbclient/bb_worker_thread.h"
 #include "bbclient/bb_wrap_stdio.h"
 #include <stdlib.h>
 #include <wchar.h>
@@ -35,20 +42,45 @@ u64 bb_get_current_thread_id(void)
 #else // #if BB_USING(BB_COMPILER_MSVC)
 #define bb_thread_local __thread
 #if BB_USING(BB_PLATFORM_LINUX)
+#include <pthread.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
+
+// gettid is a syscall, so each thread only asks once.  A forked child's thread has the parent's cached id,
+// so it is cleared in the child.
+static bb_thread_local u64 s_bb_thread_id;
+static void bb_clear_thread_id(void)
+{
+	s_bb_thread_id = 0;
+}
 #endif // #if BB_USING(BB_PLATFORM_LINUX)
 u64 bb_get_current_thread_id(void)
 {
 #if BB_USING(BB_PLATFORM_LINUX)
-	return syscall(SYS_gettid);
+	if (!s_bb_thread_id)
+	{
+		s_bb_thread_id = (u64)syscall(SYS_gettid);
+	}
+	return s_bb_thread_id;
 #else  // #if BB_USING(BB_PLATFORM_LINUX)
 	return (u64)pthread_self();
 #endif // #else // #if BB_USING(BB_PLATFORM_LINUX)
 }
 #endif // #else // #if BB_USING(BB_COMPILER_MSVC)
 
+static void bb_init_thread_id(void)
+{
+#if BB_USING(BB_PLATFORM_LINUX)
+	static b32 s_registered;
+	if (!s_registered)
+	{
+		s_registered = true;
+		pthread_atfork(NULL, NULL, &bb_clear_thread_id);
+	}
+#endif // #if BB_USING(BB_PLATFORM_LINUX)
+}
+
 typedef struct bb_id_s
 {
 	bb_packet_header_t header;
@@ -63,16 +95,40 @@ typedef struct bb_ids_s
 	bb_id_t* data;
 	u32 lastId;
 	u8 pad[4];
+	bb_id_map_t map; // name -> id, for lookups that don't take s_id_cs
 } bb_ids_t;
 
 static bb_ids_t s_bb_categoryIds;
 static bb_ids_t s_bb_pathIds;
 static bb_ids_t s_bb_threadIds;
+static bb_ids_t s_bb_formatIds;
+
+enum
+{
+	kBBFormatChunk_Size = 256,
+	kBBFormatChunk_Count = 1024,
+};
+static const u32 kBBFormatId_NotDeferred = ~0u;
+
+// Deferred format descriptors are looked up by id on every deferred log without taking s_id_cs,
+// so they live in fixed-size chunks that never move once allocated.
+static bb_format_t* s_bb_formatChunks[kBBFormatChunk_Count];
 
 static bb_connection_t s_con;
 static bb_critical_section s_id_cs;
 static bb_file_handle_t s_fp = BB_INVALID_FILE_HANDLE;
+static bb_ring_file_t s_ringFile; // used instead of s_fp when s_ringFileSize is set - see bb_set_ring_file_size
+static u32 s_ringFileSize;
 static u64 s_lastFileFlushTime;
+static b32 s_bb_tscTimestamps; // see kBBInitFlag_TSCTimestamps
+static bb_tsc_calibration_t s_bb_tscCalibration;
+static u64 s_bb_lastTimeCalibrationTime;
+static u64 s_bb_lastLogsDroppedTime;
+static u64 s_bb_lastTelemetryTime; // see kBBInitFlag_Telemetry
+static volatile u32 s_bb_suppressedLogs;
+static bb_backpressure_e s_bb_backpressurePolicy; // see bb_set_backpressure
+static u32 s_bb_backpressureQueueSize;
+static char s_bb_backpressureSpillPath[kBBSize_MaxPath];
 static char s_deviceCode[kBBSize_ApplicationName];
 static char s_sourceApplicationName[kBBSize_ApplicationName];
 static char s_applicationName[kBBSize_ApplicationName];
@@ -100,6 +156,14 @@ enum bbInitialBufferState_e
 	kBBInitialBuffer_Set,
 	kBBInitialBuffer_Done,
 };
+enum
+{
+	kBBInitialBuffer_GrowSize = 64 * 1024,
+	kBBInitialBuffer_DefaultMaxSize = 4 * 1024 * 1024,
+};
+// Logs are queued here until a connection is made, and replayed to it after the AppInfo and ids.  The buffer is
+// either supplied by the application (see bb_set_initial_buffer) and kept for later reconnects, or owned by bbclient
+// and grown as needed for kBBInitFlag_ConnectThread, then freed once the connect thread is done.
 typedef struct bbInitialBuffer_s
 {
 	bb_critical_section cs;
@@ -108,22 +172,205 @@ typedef struct bbInitialBuffer_s
 	u32 size;
 	u32 used;
 	u32 start;
-	u32 pad;
+	u32 maxSize; // only for an owned buffer - see bb_set_initial_buffer_max_size
+	u32 droppedFrames;
+	b32 owned;
 } bbInitialBuffer_t;
 static bbInitialBuffer_t s_initial_buffer;
 
+typedef struct bb_connect_thread_s
+{
+	bb_worker_thread_handle_t handle;
+	u32 discoveryIp;
+	b32 joinable;
+} bb_connect_thread_t;
+static bb_connect_thread_t s_connect_thread;
+
 bb_decoded_packet_t s_initialAppInfo;
 
+// Fixed memory from bb_set_pools, used instead of the heap.  Trace buffers and send thread rings are handed out
+// and returned under cs, once per thread rather than per log.  The id tables are sized to fit, and never grow.
+typedef struct bb_pool_s
+{
+	u8* data;
+	u8** free; // stack of items that aren't in use
+	u32 itemSize;
+	u32 count;
+	u32 freeCount;
+	u8 pad[4];
+} bb_pool_t;
+typedef struct bb_pools_state_s
+{
+	bb_critical_section cs;
+	u8* memory;
+	char* strings; // names of ids, allocated from the start and never freed
+	bb_pool_t threads;
+	bb_pool_t rings;
+	bb_pools_t config;
+	u32 stringsUsed;
+	b32 active;
+	volatile u32 generation; // bumped each time the pools are laid out, which takes back every item
+} bb_pools_state_t;
+static bb_pools_state_t s_bb_pools;
+
+static u8* bb_pool_take(bb_pool_t* pool)
+{
+	u8* item = NULL;
+	bb_critical_section_lock(&s_bb_pools.cs);
+	if (pool->freeCount)
+	{
+		item = pool->free[--pool->freeCount];
+	}
+	bb_critical_section_unlock(&s_bb_pools.cs);
+	return item;
+}
+
+// returns false if item didn't come from the pool, so the caller needs to free it
+static b32 bb_pool_release(bb_pool_t* pool, void* item)
+{
+	if (!pool->data || (u8*)item < pool->data || (u8*)item >= pool->data + (size_t)pool->count * pool->itemSize)
+	{
+		return false;
+	}
+	bb_critical_section_lock(&s_bb_pools.cs);
+	pool->free[pool->freeCount++] = (u8*)item;
+	bb_critical_section_unlock(&s_bb_pools.cs);
+	return true;
+}
+
 typedef struct bbtraceBuffer_s
 {
-	char packetBuffer[16 * 1024];
+	char packetBuffer[kBBFrame_MaxExtendedSize]; // LogText frame prefix, then formatted text - see bb_trace_begin
 #if BB_COMPILE_WIDECHAR
 	bb_wchar_t wideBuffer[16 * 1024];
 #endif
+	bb_packet_ring_t* ring; // only used with kBBInitFlag_SendThread
+	u32 ringGeneration;
+	u8 pad[4];
 } bbtraceBuffer_t;
 
 static bb_thread_local bbtraceBuffer_t* s_bb_trace_packet_buffer;
+static bb_thread_local u32 s_bb_trace_packet_buffer_generation; // s_bb_pools.generation it was taken in, or 0 if allocated
+
+// A buffer from the pools is forgotten once bb_shutdown lays them out again, since it may already be another
+// thread's - logging threads that outlive a shutdown take a new one
+static void bb_drop_stale_trace_buffer(void)
+{
+	if (s_bb_trace_packet_buffer_generation && s_bb_trace_packet_buffer_generation != bb_atomic_load_u32(&s_bb_pools.generation))
+	{
+		s_bb_trace_packet_buffer = NULL;
+		s_bb_trace_packet_buffer_generation = 0;
+	}
+}
+
+static bbtraceBuffer_t* bb_get_trace_buffer(void)
+{
+	bb_drop_stale_trace_buffer();
+	if (!s_bb_trace_packet_buffer)
+	{
+		if (s_bb_pools.active)
+		{
+			s_bb_trace_packet_buffer_generation = bb_atomic_load_u32(&s_bb_pools.generation);
+			s_bb_trace_packet_buffer = (bbtraceBuffer_t*)bb_pool_take(&s_bb_pools.threads);
+		}
+		else
+		{
+			s_bb_trace_packet_buffer_generation = 0;
+			s_bb_trace_packet_buffer = (bbtraceBuffer_t*)bb_malloc(sizeof(*s_bb_trace_packet_buffer));
+		}
+		if (s_bb_trace_packet_buffer)
+		{
+			s_bb_trace_packet_buffer->ring = NULL;
+			s_bb_trace_packet_buffer->ringGeneration = 0;
+		}
+	}
+	return s_bb_trace_packet_buffer;
+}
+
+static void bb_release_trace_buffer(void)
+{
+	bb_drop_stale_trace_buffer();
+	if (s_bb_trace_packet_buffer)
+	{
+		if (!bb_pool_release(&s_bb_pools.threads, s_bb_trace_packet_buffer))
+		{
+			bb_free(s_bb_trace_packet_buffer);
+		}
+		s_bb_trace_packet_buffer = NULL;
+		s_bb_trace_packet_buffer_generation = 0;
+	}
+}
+
+enum
+{
+	kBBSendThread_DefaultRingSize = 64 * 1024,
+	kBBSendThread_MinRingSize = 16 * 1024,
+	kBBSendThread_BatchSize = 64 * 1024,
+	kBBSendThread_IdleSleepMillis = 1,
+	kBBSendThread_MaxPushWaitMillis = 10, // for room in a full ring, before the frame is sent directly instead
+};
+
+// With kBBInitFlag_SendThread, each logging thread serializes into its own ring (allocated alongside
+// its trace buffer), and the send thread drains the rings into the file/write callback/socket sinks.
+// Logging threads only take cs the first time they log, to register their ring, and the send thread
+// only takes it to walk the list, never while sending.
+typedef struct bb_send_thread_s
+{
+	bb_critical_section cs;
+	bb_packet_ring_t* rings;
+	u8* batch;
+	bb_worker_thread_handle_t handle;
+	volatile u32 running;
+	volatile u32 shutdownRequested;
+	volatile u32 passes;
+	volatile u32 producers; // threads writing to or retiring a ring - shutdown waits for them before freeing the rings
+	u32 generation;         // bumped on start/shutdown so threads notice their ring is gone
+	u32 ringSize;
+} bb_send_thread_t;
+static bb_send_thread_t s_send_thread;
 static bb_thread_local bb_colors_t s_bb_colors;
+
+// Minimum level per category id, from kBBPacketType_CategoryLevels.  Everything is enabled until the server
+// says otherwise, and again once it goes away.  The extra entry is never set, for category ids past the table.
+static volatile u8 s_bb_categoryMinLevels[kBBCategoryLevels_Count + 1];
+static b32 s_bb_categoryLevelsSet;
+
+const volatile uint8_t* bb_category_min_level(uint32_t categoryId)
+{
+	return s_bb_categoryMinLevels + BB_MIN(categoryId, (u32)kBBCategoryLevels_Count);
+}
+
+static BB_INLINE b32 bb_category_level_enabled(uint32_t categoryId, bb_log_level_e level)
+{
+	return (u8)level >= *bb_category_min_level(categoryId);
+}
+
+static void bb_apply_category_levels(const bb_packet_category_levels_t* packet)
+{
+	if (packet->firstCategoryId >= kBBCategoryLevels_Count)
+		return;
+
+	const u32 count = BB_MIN((u32)packet->count, kBBCategoryLevels_Count - packet->firstCategoryId);
+	for (u32 i = 0; i < count; ++i)
+	{
+		// kBBLogLevel_SetColor only changes the thread's colors, so it is never skipped
+		s_bb_categoryMinLevels[packet->firstCategoryId + i] = BB_MIN(packet->minLevels[i], (u8)kBBLogLevel_SetColor);
+	}
+	s_bb_categoryLevelsSet = true;
+}
+
+static void bb_reset_category_levels(void)
+{
+	if (s_bb_categoryLevelsSet)
+	{
+		s_bb_categoryLevelsSet = false;
+		for (u32 i = 0; i < kBBCategoryLevels_Count; ++i)
+		{
+			s_bb_categoryMinLevels[i] = 0;
+		}
+	}
+}
+
 void bb_set_color(bb_color_t fg, bb_color_t bg)
 {
 	bb_trace_partial_end();
@@ -134,6 +381,9 @@ void bb_set_color(bb_color_t fg, bb_color_t bg)
 enum
 {
 	kBBFile_FlushIntervalMillis = 500,
+	kBBTimeCalibration_IntervalMillis = 5000,
+	kBBLogsDropped_IntervalMillis = 1000,
+	kBBTelemetry_IntervalMillis = 1000,
 };
 
 #if BB_COMPILE_WIDECHAR
@@ -229,40 +479,76 @@ static BB_INLINE void bb_shutdown_locale(void)
 }
 #endif // #else // #if BB_COMPILE_WIDECHAR
 
+static BB_INLINE u64 bb_current_timestamp(void)
+{
+	return (s_bb_tscTimestamps) ? bb_tsc_ticks() : bb_current_ticks();
+}
+
+static BB_INLINE void bb_fill_packet_header(bb_packet_header_t* header, u32 pathId, u32 line)
+{
+	header->timestamp = bb_current_timestamp();
+	header->threadId = bb_get_current_thread_id();
+	header->fileId = pathId;
+	header->line = line;
+}
+
 static BB_INLINE void bb_fill_header(bb_decoded_packet_t* decoded, bb_packet_type_e packetType, u32 pathId, u32 line)
 {
 	decoded->type = packetType;
-	decoded->header.timestamp = bb_current_ticks();
-	decoded->header.threadId = bb_get_current_thread_id();
-	decoded->header.fileId = pathId;
-	decoded->header.line = line;
+	bb_fill_packet_header(&decoded->header, pathId, line);
 }
 
-static BB_INLINE void bb_send(bb_decoded_packet_t* decoded)
+// log packets are queued in the initial buffer and the send thread rings - everything else is sent directly
+static BB_INLINE b32 bb_is_log_packet_type(bb_packet_type_e type)
 {
-	u8 buf[BB_MAX_PACKET_BUFFER_SIZE];
-	u16 serializedLen = bbpacket_serialize(decoded, buf + 2, sizeof(buf) - 2);
-	if (serializedLen)
-	{
-		serializedLen += 2;
-		buf[0] = (u8)(serializedLen >> 8);
-		buf[1] = (u8)(serializedLen & 0xFF);
-	}
-	else
+	return bbpacket_is_log_text_type(type) || type == kBBPacketType_LogTextDeferred || type == kBBPacketType_LogSuppressed ||
+	       type == kBBPacketType_LogTextLarge || type == kBBPacketType_LogTextKV;
+}
+
+// returns false if the owned initial buffer can't hold bytes without going past its max size
+static b32 bb_grow_initial_buffer(u32 bytes)
+{
+	u32 newSize = BB_MAX(s_initial_buffer.size, (u32)kBBInitialBuffer_GrowSize);
+	while (newSize < bytes && newSize < s_initial_buffer.maxSize)
 	{
-		bb_error("bb_send failed to encode packet");
-		return;
+		newSize *= 2;
 	}
+	newSize = BB_MIN(newSize, s_initial_buffer.maxSize);
+	if (newSize < bytes)
+		return false;
 
-	if (s_initial_buffer.cs.initialized && bbpacket_is_log_text_type(decoded->type))
+	void* data = bb_malloc(newSize);
+	if (!data)
+		return false;
+
+	memcpy(data, s_initial_buffer.data, s_initial_buffer.used);
+	bb_free(s_initial_buffer.data);
+	s_initial_buffer.data = data;
+	s_initial_buffer.size = newSize;
+	return true;
+}
+
+// called with s_initial_buffer.cs held
+static void bb_append_initial_buffer(const u8* frames, u32 framesLen)
+{
+	const u8* frame = frames;
+	while (s_initial_buffer.data != NULL && frame + 3 <= frames + framesLen)
 	{
-		bb_critical_section_lock(&s_initial_buffer.cs);
-		if (s_initial_buffer.data != NULL)
+		u32 frameLen = bbpacket_frame_length(frame, (u32)(frames + framesLen - frame));
+		if (frameLen < 3)
+			break;
+		if (bb_is_log_packet_type((bb_packet_type_e)frame[bbpacket_frame_header_size(frame)]))
 		{
-			if (s_initial_buffer.used + serializedLen <= s_initial_buffer.size)
+			if (s_initial_buffer.used + frameLen <= s_initial_buffer.size ||
+			    (s_initial_buffer.owned && bb_grow_initial_buffer(s_initial_buffer.used + frameLen)))
 			{
-				memcpy((u8*)s_initial_buffer.data + s_initial_buffer.used, buf, serializedLen);
-				s_initial_buffer.used += serializedLen;
+				memcpy((u8*)s_initial_buffer.data + s_initial_buffer.used, frame, frameLen);
+				s_initial_buffer.used += frameLen;
+			}
+			else if (s_initial_buffer.owned)
+			{
+				// keep the start of the process, and drop what doesn't fit
+				++s_initial_buffer.droppedFrames;
 			}
 			else
 			{
@@ -273,25 +559,1002 @@ static BB_INLINE void bb_send(bb_decoded_packet_t* decoded)
 				s_initial_buffer.state = kBBInitialBuffer_Done;
 			}
 		}
-		bb_critical_section_unlock(&s_initial_buffer.cs);
+		frame += frameLen;
 	}
+}
 
-	if (s_bb_send_callback)
+static void bb_release_initial_buffer(void)
+{
+	if (!s_initial_buffer.cs.initialized)
+		return;
+
+	bb_critical_section_lock(&s_initial_buffer.cs);
+	if (s_initial_buffer.owned)
 	{
-		(*s_bb_send_callback)(s_bb_send_callback_context, decoded);
+		if (s_initial_buffer.droppedFrames)
+		{
+			bb_log("bb initial buffer reached its max size of %u - %u logs were not queued", s_initial_buffer.maxSize, s_initial_buffer.droppedFrames);
+		}
+		bb_free(s_initial_buffer.data);
+		s_initial_buffer.data = NULL;
+		s_initial_buffer.size = 0u;
+		s_initial_buffer.used = 0u;
+		s_initial_buffer.droppedFrames = 0u;
+		s_initial_buffer.owned = false;
+		s_initial_buffer.state = kBBInitialBuffer_Done;
 	}
-	if (s_fp || s_bb_write_callback)
+	bb_critical_section_unlock(&s_initial_buffer.cs);
+}
+
+enum
+{
+	kBBSpool_GrowSize = 64 * 1024,
+	kBBSpool_MaxMemorySize = 1024 * 1024, // with a file, the most held between bb_tick writing it out
+	kBBSpool_ReadSize = 4 * kBBFrame_MaxExtendedSize,
+};
+// Log frames sent while the server connection is down are kept here (see bb_set_spool), and replayed after the
+// AppInfo and ids on the next connect.  Logging threads only copy frames into data while holding cs.  With a path,
+// bb_tick (and the replay, as it sends the file) swaps data for spare and writes spare to the end of the file,
+// holding fileCs but not cs, so the disk never holds up logging.  The replay sends the file, then data, until it has
+// caught up with logging, and only then do frames go straight to the socket again.
+typedef struct bb_spool_s
+{
+	bb_critical_section cs;
+	bb_critical_section fileCs;
+	u8* data;
+	u8* spare;
+	u8* readBuffer; // kBBSpool_ReadSize bytes, while the file is open
+	bb_file_handle_t writeHandle;
+	bb_file_handle_t readHandle;
+	u64 fileWritten; // bytes of whole frames in the file
+	u64 fileRead;
+	u32 size;
+	u32 used;
+	u32 spareSize;
+	u32 maxSize;
+	u32 droppedFrames;
+	u32 readBuffered; // bytes read from the file and not sent yet
+	b32 fileFailed;   // a write came up short - nothing more is written until the file is replayed
+	b32 active;       // frames are spooled until a replay catches up
+	char path[kBBSize_MaxPath];
+} bb_spool_t;
+static bb_spool_t s_spool;
+
+// called with s_spool.cs held - returns false if data can't hold bytes
+static b32 bb_spool_reserve(u32 bytes)
+{
+	if (bytes <= s_spool.size)
+		return true;
+
+	const u32 maxSize = (s_spool.path[0]) ? BB_MIN(s_spool.maxSize, (u32)kBBSpool_MaxMemorySize) : s_spool.maxSize;
+	u32 newSize = BB_MAX(s_spool.size, (u32)kBBSpool_GrowSize);
+	while (newSize < bytes && newSize < maxSize)
+	{
+		newSize *= 2;
+	}
+	newSize = BB_MIN(newSize, maxSize);
+	if (newSize < bytes)
+		return false;
+
+	u8* data = (u8*)bb_malloc(newSize);
+	if (!data)
+		return false;
+
+	if (s_spool.used)
 	{
-		if (s_bb_write_callback)
+		memcpy(data, s_spool.data, s_spool.used);
+	}
+	bb_free(s_spool.data);
+	s_spool.data = data;
+	s_spool.size = newSize;
+	return true;
+}
+
+// returns false if frames should go straight to the socket
+static b32 bb_spool_frames(const u8* frames, u32 framesLen)
+{
+	if (!s_spool.cs.initialized || (!s_spool.active && (!s_spool.maxSize || bbcon_is_connected(&s_con))))
+		return false;
+
+	bb_critical_section_lock(&s_spool.cs);
+	const b32 spool = s_spool.active || (s_spool.maxSize && !bbcon_is_connected(&s_con));
+	const u8* frame = frames;
+	u32 otherFrames = 0;
+	while (spool && frame + 3 <= frames + framesLen)
+	{
+		u32 frameLen = bbpacket_frame_length(frame, (u32)(frames + framesLen - frame));
+		if (frameLen < 3)
+			break;
+		if (!bb_is_log_packet_type((bb_packet_type_e)frame[bbpacket_frame_header_size(frame)]))
+		{
+			++otherFrames; // sent below, once cs is released
+		}
+		else if (s_spool.maxSize && bb_spool_reserve(s_spool.used + frameLen))
+		{
+			memcpy(s_spool.data + s_spool.used, frame, frameLen);
+			s_spool.used += frameLen;
+			s_spool.active = true;
+		}
+		else
+		{
+			++s_spool.droppedFrames;
+		}
+		frame += frameLen;
+	}
+	bb_critical_section_unlock(&s_spool.cs);
+
+	// ids and thread names are all sent again on connect, and are sent ahead of the spooled logs during a replay.
+	// Sending can wait on the socket, so it is done without cs, which every logging thread needs.
+	for (frame = frames; otherFrames && frame + 3 <= frames + framesLen;)
+	{
+		u32 frameLen = bbpacket_frame_length(frame, (u32)(frames + framesLen - frame));
+		if (frameLen < 3)
+			break;
+		if (!bb_is_log_packet_type((bb_packet_type_e)frame[bbpacket_frame_header_size(frame)]))
+		{
+			bbcon_send_raw(&s_con, frame, frameLen);
+			--otherFrames;
+		}
+		frame += frameLen;
+	}
+	return spool;
+}
+
+static void bb_spool_close_file(void)
+{
+	if (s_spool.writeHandle != BB_INVALID_FILE_HANDLE)
+	{
+		bb_file_close(s_spool.writeHandle);
+		s_spool.writeHandle = BB_INVALID_FILE_HANDLE;
+	}
+	if (s_spool.readHandle != BB_INVALID_FILE_HANDLE)
+	{
+		bb_file_close(s_spool.readHandle);
+		s_spool.readHandle = BB_INVALID_FILE_HANDLE;
+	}
+	if (s_spool.readBuffer)
+	{
+		bb_free(s_spool.readBuffer);
+		s_spool.readBuffer = NULL;
+	}
+	s_spool.fileWritten = s_spool.fileRead = 0;
+	s_spool.readBuffered = 0;
+	s_spool.fileFailed = false;
+}
+
+// Moves data to the end of the file - called with s_spool.fileCs held
+static void bb_spool_move_to_file(void)
+{
+	if (!s_spool.path[0] || !s_spool.used)
+		return;
+
+	if (s_spool.writeHandle == BB_INVALID_FILE_HANDLE && !s_spool.fileFailed)
+	{
+		s_spool.writeHandle = bb_file_open_for_write(s_spool.path);
+		s_spool.readHandle = bb_file_open_for_read(s_spool.path);
+		if (s_spool.writeHandle == BB_INVALID_FILE_HANDLE || s_spool.readHandle == BB_INVALID_FILE_HANDLE)
+		{
+			bb_spool_close_file();
+			s_spool.fileFailed = true;
+		}
+	}
+	if (s_spool.fileFailed)
+		return; // logs stay in data until the replay
+
+	bb_critical_section_lock(&s_spool.cs);
+	u8* data = s_spool.data;
+	const u32 dataSize = s_spool.size;
+	const u32 len = s_spool.used;
+	s_spool.data = s_spool.spare;
+	s_spool.size = s_spool.spareSize;
+	s_spool.used = 0;
+	s_spool.spare = data;
+	s_spool.spareSize = dataSize;
+	bb_critical_section_unlock(&s_spool.cs);
+
+	if (s_spool.fileWritten - s_spool.fileRead + len <= s_spool.maxSize)
+	{
+		if (bb_file_write(s_spool.writeHandle, data, len) == len)
+		{
+			s_spool.fileWritten += len;
+			return;
+		}
+		// the file now ends in a partial frame - keep replaying the whole ones, but write nothing more
+		s_spool.fileFailed = true;
+	}
+
+	u32 frames = 0;
+	for (u32 offset = 0; offset + 3 <= len; ++frames)
+	{
+		const u32 frameLen = bbpacket_frame_length(data + offset, len - offset);
+		if (frameLen < 3)
+			break;
+		offset += frameLen;
+	}
+	bb_critical_section_lock(&s_spool.cs);
+	s_spool.droppedFrames += frames;
+	bb_critical_section_unlock(&s_spool.cs);
+}
+
+// Called from bb_tick - skipped while a replay holds fileCs, since the replay moves data to the file itself as it goes
+static void bb_spool_write_file(void)
+{
+	if (!s_spool.cs.initialized || !s_spool.path[0] || !s_spool.active)
+		return;
+
+	if (bb_critical_section_try_lock(&s_spool.fileCs))
+	{
+		bb_spool_move_to_file();
+		bb_critical_section_unlock(&s_spool.fileCs);
+	}
+}
+
+// Sends the file in large reads, cut at frame boundaries, then empties it.  Logging carries on while this runs, so
+// data is moved to the end of the file as it goes, and kept in order behind what is already there.  If the
+// connection drops first, the file and the unsent end of readBuffer are kept for the next replay.  Called with
+// s_spool.fileCs held.
+static void bb_spool_send_file(void)
+{
+	while (bbcon_is_connected(&s_con))
+	{
+		if (s_spool.fileRead < s_spool.fileWritten && s_spool.readBuffered < kBBSpool_ReadSize)
+		{
+			bb_file_flush(s_spool.writeHandle);
+			const u32 readLen = (u32)BB_MIN((u64)(kBBSpool_ReadSize - s_spool.readBuffered), s_spool.fileWritten - s_spool.fileRead);
+			if (bb_file_read(s_spool.readHandle, s_spool.readBuffer + s_spool.readBuffered, readLen) != readLen)
+				break;
+			s_spool.fileRead += readLen;
+			s_spool.readBuffered += readLen;
+		}
+
+		u32 sendLen = 0;
+		while (sendLen + 3 <= s_spool.readBuffered)
+		{
+			const u32 frameLen = bbpacket_frame_length(s_spool.readBuffer + sendLen, s_spool.readBuffered - sendLen);
+			if (frameLen < 3 || sendLen + frameLen > s_spool.readBuffered)
+				break;
+			sendLen += frameLen;
+		}
+		if (!sendLen)
+			break; // all sent, or corrupt
+		bbcon_send_raw(&s_con, s_spool.readBuffer, sendLen);
+		memmove(s_spool.readBuffer, s_spool.readBuffer + sendLen, s_spool.readBuffered - sendLen);
+		s_spool.readBuffered -= sendLen;
+
+		bb_spool_move_to_file();
+	}
+
+	if (bbcon_is_connected(&s_con))
+	{
+		if (s_spool.fileRead != s_spool.fileWritten || s_spool.readBuffered)
+		{
+			bb_log("bb spool file %s could not be read back - %" PRIu64 " bytes were not sent", s_spool.path, s_spool.fileWritten - s_spool.fileRead + s_spool.readBuffered);
+		}
+		bb_spool_close_file();
+	}
+}
+
+// Called after the initial packets on connect, without holding s_id_cs or s_initial_buffer.cs, since it waits on the
+// socket - logging keeps spooling until everything before it has been sent
+static void bb_spool_replay(void)
+{
+	if (!s_spool.cs.initialized || !s_spool.active)
+		return;
+
+	bb_critical_section_lock(&s_spool.fileCs);
+	while (bbcon_is_connected(&s_con))
+	{
+		if (s_spool.fileWritten > s_spool.fileRead || s_spool.readBuffered)
 		{
-			(*s_bb_write_callback)(s_bb_write_callback_context, buf, serializedLen);
+			s_spool.readBuffer = (s_spool.readBuffer) ? s_spool.readBuffer : (u8*)bb_malloc(kBBSpool_ReadSize);
+			if (s_spool.readBuffer)
+			{
+				bb_spool_send_file();
+			}
+			else
+			{
+				bb_spool_close_file();
+			}
+			continue; // the connection may have dropped
 		}
-		if (s_fp)
+
+		bb_critical_section_lock(&s_spool.cs);
+		u8* data = s_spool.data;
+		const u32 dataSize = s_spool.size;
+		const u32 len = s_spool.used;
+		if (!len)
 		{
-			bb_file_write(s_fp, buf, serializedLen);
+			s_spool.active = false;
+			if (s_spool.droppedFrames)
+			{
+				bb_log("bb spool reached its max size of %u - %u logs were not sent", s_spool.maxSize, s_spool.droppedFrames);
+				s_spool.droppedFrames = 0u;
+			}
+			bb_critical_section_unlock(&s_spool.cs);
+			break;
 		}
+		s_spool.data = s_spool.spare;
+		s_spool.size = s_spool.spareSize;
+		s_spool.used = 0;
+		s_spool.spare = data;
+		s_spool.spareSize = dataSize;
+		bb_critical_section_unlock(&s_spool.cs);
+
+		bbcon_send_raw(&s_con, data, len);
+	}
+	bb_critical_section_unlock(&s_spool.fileCs);
+}
+
+static BB_INLINE b32 bb_file_is_open(void)
+{
+	return s_fp != BB_INVALID_FILE_HANDLE || bb_ring_file_is_open(&s_ringFile);
+}
+
+static void bb_file_write_frames(u8* frames, u32 framesLen)
+{
+	if (bb_ring_file_is_open(&s_ringFile))
+	{
+		bb_ring_file_write(&s_ringFile, frames, framesLen);
+	}
+	else
+	{
+		bb_file_write(s_fp, frames, framesLen);
+	}
+}
+
+static void bb_file_flush_frames(void)
+{
+	if (bb_ring_file_is_open(&s_ringFile))
+	{
+		bb_ring_file_flush(&s_ringFile);
+	}
+	else if (s_fp != BB_INVALID_FILE_HANDLE)
+	{
+		bb_file_flush(s_fp);
+	}
+}
+
+// frames is one or more whole serialized [u16 length][packet] frames
+static void bb_send_frames(u8* frames, u32 framesLen)
+{
+	if (bb_file_is_open() || s_bb_write_callback)
+	{
+		if (s_bb_write_callback)
+		{
+			(*s_bb_write_callback)(s_bb_write_callback_context, frames, framesLen);
+		}
+		if (bb_file_is_open())
+		{
+			bb_file_write_frames(frames, framesLen);
+		}
+	}
+
+	if (s_initial_buffer.cs.initialized && s_initial_buffer.data != NULL)
+	{
+		// bb_connect_* holds the lock from connecting until the queued logs are replayed, so frames are
+		// either queued and replayed, or sent after the replay - never both, and never ahead of the AppInfo
+		bb_critical_section_lock(&s_initial_buffer.cs);
+		bb_append_initial_buffer(frames, framesLen);
+		bbcon_send_raw(&s_con, frames, framesLen);
+		bb_critical_section_unlock(&s_initial_buffer.cs);
+	}
+	else if (!bb_spool_frames(frames, framesLen))
+	{
+		bbcon_send_raw(&s_con, frames, framesLen);
+	}
+}
+
+// Log frames below minLevel are kept here instead of being sent (see bb_set_flight_recorder), overwriting the
+// oldest ones once the ring is full.  Frames are never split: when one doesn't fit before the end of data, the
+// rest of data is left unused (wrapEnd) and it goes at the start.  A dump swaps data for spare while holding cs,
+// and sends spare holding only dumpCs, so logging threads never wait on the socket for it.
+typedef struct bb_flight_recorder_s
+{
+	bb_critical_section cs;
+	bb_critical_section dumpCs;
+	u8* data;
+	u8* spare;
+	u32 size;
+	u32 start;   // oldest frame
+	u32 end;     // where the next frame goes
+	u32 wrapEnd; // end of the frames from start while wrapped - the newer ones are before end
+	u32 logCount;
+	u32 overwrittenLogs;
+	u32 pathId;     // for the markers around a dump, resolved by bb_set_flight_recorder
+	u32 categoryId;
+	volatile u32 minLevel; // bb_log_level_e - 0 while stopped
+	b32 wrapped;
+} bb_flight_recorder_t;
+static bb_flight_recorder_t s_flightRecorder;
+
+// called with s_flightRecorder.cs held
+static void bb_flight_recorder_write(const u8* frame, u32 frameLen)
+{
+	bb_flight_recorder_t* r = &s_flightRecorder;
+	if (frameLen > r->size)
+	{
+		++r->overwrittenLogs;
+		return;
+	}
+
+	for (;;)
+	{
+		if (!r->wrapped)
+		{
+			if (r->end + frameLen <= r->size)
+				break;
+			r->wrapped = true;
+			r->wrapEnd = r->end;
+			r->end = 0;
+		}
+		if (r->end + frameLen <= r->start)
+			break;
+
+		r->start += bbpacket_frame_length(r->data + r->start, r->wrapEnd - r->start);
+		--r->logCount;
+		++r->overwrittenLogs;
+		if (r->start >= r->wrapEnd)
+		{
+			r->start = 0;
+			r->wrapped = false;
+		}
+	}
+
+	memcpy(r->data + r->end, frame, frameLen);
+	r->end += frameLen;
+	++r->logCount;
+}
+
+// called with s_flightRecorder.dumpCs held
+static void bb_flight_recorder_send_marker(bb_flight_recorder_trigger_e trigger, u32 logCount, u32 overwrittenLogs, b32 end)
+{
+	u8 frame[kBBPacket_FlightRecorderFrameSize];
+	bb_packet_header_t header;
+	bb_packet_flight_recorder_t marker;
+	bb_fill_packet_header(&header, s_flightRecorder.pathId, __LINE__);
+	marker.categoryId = s_flightRecorder.categoryId;
+	marker.trigger = (u32)trigger;
+	marker.logCount = logCount;
+	marker.overwrittenLogs = overwrittenLogs;
+	marker.end = (end) ? 1u : 0u;
+	bbpacket_write_flight_recorder(frame, &header, &marker);
+	bb_send_frames(frame, sizeof(frame));
+}
+
+static void bb_flight_recorder_send(bb_flight_recorder_trigger_e trigger)
+{
+	bb_flight_recorder_t* r = &s_flightRecorder;
+	if (!r->dumpCs.initialized)
+		return;
+
+	bb_critical_section_lock(&r->dumpCs);
+	bb_critical_section_lock(&r->cs);
+	u8* frames = r->data;
+	const u32 start = r->start;
+	const u32 end = r->end;
+	const u32 wrapEnd = r->wrapEnd;
+	const b32 wrapped = r->wrapped;
+	const u32 logCount = r->logCount;
+	const u32 overwrittenLogs = r->overwrittenLogs;
+	r->data = r->spare;
+	r->spare = frames;
+	r->start = 0;
+	r->end = 0;
+	r->wrapEnd = 0;
+	r->wrapped = false;
+	r->logCount = 0;
+	r->overwrittenLogs = 0;
+	bb_critical_section_unlock(&r->cs);
+
+	if (frames && (logCount || overwrittenLogs))
+	{
+		bb_flight_recorder_send_marker(trigger, logCount, overwrittenLogs, false);
+		if (wrapped)
+		{
+			bb_send_frames(frames + start, wrapEnd - start);
+			bb_send_frames(frames, end);
+		}
+		else
+		{
+			bb_send_frames(frames + start, end - start);
+		}
+		bb_flight_recorder_send_marker(trigger, logCount, overwrittenLogs, true);
+	}
+	bb_critical_section_unlock(&r->dumpCs);
+}
+
+// returns false if the frame needs to be sent - errors and fatals send the flight recorder's logs ahead of them
+static b32 bb_flight_recorder_frame(const u8* frame, u32 frameLen)
+{
+	bb_log_level_e level;
+	const u32 minLevel = s_flightRecorder.minLevel;
+	if (!minLevel || !bbpacket_get_frame_log_level(frame, frameLen, &level))
+		return false;
+
+	if (level == kBBLogLevel_Error || level == kBBLogLevel_Fatal)
+	{
+		bb_flight_recorder_send(kBBFlightRecorder_Error);
+		return false;
+	}
+	if ((u32)level >= minLevel)
+		return false;
+
+	bb_critical_section_lock(&s_flightRecorder.cs);
+	const b32 recorded = s_flightRecorder.data != NULL;
+	if (recorded)
+	{
+		bb_flight_recorder_write(frame, frameLen);
+	}
+	bb_critical_section_unlock(&s_flightRecorder.cs);
+	return recorded;
+}
+
+static bb_packet_ring_t* bb_get_thread_ring(void)
+{
+	bbtraceBuffer_t* traceBuffer = bb_get_trace_buffer();
+	if (!traceBuffer)
+	{
+		return NULL;
+	}
+	if (traceBuffer->ring && traceBuffer->ringGeneration == s_send_thread.generation)
+	{
+		return traceBuffer->ring;
+	}
+
+	bb_packet_ring_t* ring = NULL;
+	if (s_bb_pools.active)
+	{
+		u8* memory = bb_pool_take(&s_bb_pools.rings);
+		ring = (memory) ? bb_packet_ring_init(memory, s_bb_pools.config.sendThreadRingSize) : NULL;
+	}
+	else
+	{
+		ring = bb_packet_ring_create(s_send_thread.ringSize);
+	}
+	if (ring)
+	{
+		bb_critical_section_lock(&s_send_thread.cs);
+		ring->next = s_send_thread.rings;
+		s_send_thread.rings = ring;
+		bb_critical_section_unlock(&s_send_thread.cs);
+	}
+	traceBuffer->ring = ring;
+	traceBuffer->ringGeneration = s_send_thread.generation;
+	return ring;
+}
+
+static void bb_send_thread_leave(void)
+{
+	bb_atomic_fetch_add_u32(&s_send_thread.producers, ~0u);
+}
+
+// Returns false once shutdown has started.  The increment comes before the check of running, and shutdown
+// clears running before it checks producers, so either the caller sees running cleared or shutdown waits for it.
+static b32 bb_send_thread_enter(void)
+{
+	bb_atomic_fetch_add_u32(&s_send_thread.producers, 1);
+	if (bb_atomic_load_u32(&s_send_thread.running))
+	{
+		return true;
+	}
+	bb_send_thread_leave();
+	return false;
+}
+
+// Returns false if the caller needs to send the frame directly.  When the send thread can't make room in the ring
+// within kBBSendThread_MaxPushWaitMillis, the caller sends the frame itself, under the connection's lock and
+// backpressure policy, so a stalled sink can't hold logging threads indefinitely - at the cost of that frame
+// going ahead of ones still in the ring.
+static b32 bb_send_thread_push(const u8* frame, u32 frameLen)
+{
+	if (!bb_atomic_load_u32(&s_send_thread.running) || !bb_send_thread_enter())
+	{
+		return false;
+	}
+
+	b32 pushed = false;
+	u64 waitStart = 0;
+	bb_packet_ring_t* ring = bb_get_thread_ring();
+	while (ring && !pushed)
+	{
+		pushed = bb_packet_ring_write(ring, frame, frameLen);
+		if (!pushed)
+		{
+			const u64 now = bb_current_time_ms();
+			waitStart = (waitStart) ? waitStart : now;
+			if (!bb_atomic_load_u32(&s_send_thread.running) || now - waitStart >= kBBSendThread_MaxPushWaitMillis)
+				break;
+			bb_sleep_ms(0);
+		}
+	}
+	bb_send_thread_leave();
+	return pushed;
+}
+
+// frame is one whole serialized [u16 length][packet] frame
+static void bb_send_frame(u8* frame, u32 frameLen, bb_packet_type_e type)
+{
+	// Only log text goes through the per-thread rings.  Ids, thread names, etc are rare and
+	// go out directly, so they are always ahead of any logs that reference them.
+	if (bb_is_log_packet_type(type) && (bb_flight_recorder_frame(frame, frameLen) || bb_send_thread_push(frame, frameLen)))
+	{
+		return;
+	}
+
+	bb_send_frames(frame, frameLen);
+}
+
+static BB_INLINE void bb_send(bb_decoded_packet_t* decoded)
+{
+	u8 buf[BB_MAX_PACKET_BUFFER_SIZE];
+	u16 serializedLen = bbpacket_serialize(decoded, buf + 2, sizeof(buf) - 2);
+	if (serializedLen)
+	{
+		serializedLen += 2;
+		buf[0] = (u8)(serializedLen >> 8);
+		buf[1] = (u8)(serializedLen & 0xFF);
+	}
+	else
+	{
+		bb_error("bb_send failed to encode packet");
+		return;
+	}
+
+	if (s_bb_send_callback)
+	{
+		(*s_bb_send_callback)(s_bb_send_callback_context, decoded);
+	}
+
+	bb_send_frame(buf, serializedLen, decoded->type);
+}
+
+enum
+{
+	kBBCallsite_SummaryIntervalMillis = 1000,
+};
+
+volatile uint32_t g_bb_callsiteLimits;
+static volatile u32 s_bb_callsiteLogsPerSecond;
+static volatile u32 s_bb_callsiteBurst;
+static volatile u32 s_bb_repeatSuppression;
+static bb_callsite_limit_t* volatile s_bb_suppressedCallsites; // only grows - callsites are statics
+static u64 s_bb_lastCallsiteSummaryTime;
+
+// set by bb_callsite_allow for the bb_trace call that follows it, so the text can be checked for repeats
+static bb_thread_local bb_callsite_limit_t* s_bb_callsite_limit;
+
+static void bb_update_callsite_limits(void)
+{
+	bb_atomic_store_u32(&g_bb_callsiteLimits, bb_atomic_load_u32(&s_bb_callsiteLogsPerSecond) || bb_atomic_load_u32(&s_bb_repeatSuppression));
+}
+
+void bb_set_callsite_rate_limit(uint32_t logsPerSecond, uint32_t burst)
+{
+	bb_atomic_store_u32(&s_bb_callsiteBurst, BB_MAX(BB_MIN(burst, 1000000u), 1u));
+	bb_atomic_store_u32(&s_bb_callsiteLogsPerSecond, logsPerSecond);
+	bb_update_callsite_limits();
+}
+
+void bb_set_repeat_suppression(int enabled)
+{
+	bb_atomic_store_u32(&s_bb_repeatSuppression, enabled != 0);
+	bb_update_callsite_limits();
+}
+
+static void bb_callsite_suppress(bb_callsite_limit_t* limit, volatile u32* counter)
+{
+	bb_atomic_fetch_add_u32(counter, 1);
+	bb_atomic_fetch_add_u32(&s_bb_suppressedLogs, 1);
+	if (!bb_atomic_load_u32(&limit->registered) && bb_atomic_cas_u32(&limit->registered, 0, 1))
+	{
+		bb_callsite_limit_t* head;
+		do
+		{
+			head = (bb_callsite_limit_t*)bb_atomic_load_ptr((void* volatile*)&s_bb_suppressedCallsites);
+			limit->next = head;
+		} while (!bb_atomic_cas_ptr((void* volatile*)&s_bb_suppressedCallsites, head, limit));
+	}
+}
+
+static b32 bb_callsite_take_token(bb_callsite_limit_t* limit, u32 logsPerSecond, u32 burst)
+{
+	// tokens are kept in thousandths, so a millisecond adds logsPerSecond of them
+	const u32 now = (u32)bb_current_time_ms() | 1u; // 0 means the bucket has never been filled
+	const u32 last = bb_atomic_load_u32(&limit->lastRefillMs);
+	const u32 maxMillitokens = burst * 1000u;
+	if (now != last && bb_atomic_cas_u32(&limit->lastRefillMs, last, now))
+	{
+		const u64 refill = (last) ? (u64)(now - last) * logsPerSecond : maxMillitokens;
+		u32 millitokens;
+		do
+		{
+			millitokens = bb_atomic_load_u32(&limit->millitokens);
+		} while (!bb_atomic_cas_u32(&limit->millitokens, millitokens, (u32)BB_MIN(millitokens + refill, (u64)maxMillitokens)));
+	}
+
+	u32 millitokens;
+	do
+	{
+		millitokens = bb_atomic_load_u32(&limit->millitokens);
+		if (millitokens < 1000u)
+			return false;
+	} while (!bb_atomic_cas_u32(&limit->millitokens, millitokens, millitokens - 1000u));
+	return true;
+}
+
+int bb_callsite_allow(bb_callsite_limit_t* limit, uint32_t pathId, uint32_t line, uint32_t categoryId, bb_log_level_e level)
+{
+	const u32 logsPerSecond = bb_atomic_load_u32(&s_bb_callsiteLogsPerSecond);
+	const b32 repeatSuppression = bb_atomic_load_u32(&s_bb_repeatSuppression);
+	if ((!logsPerSecond && !repeatSuppression) || level == kBBLogLevel_SetColor)
+		return true;
+
+	// other threads log from the same callsite and read it for summaries, so these are only stored as they change
+	if (bb_atomic_load_u32(&limit->pathId) != pathId)
+	{
+		bb_atomic_store_u32(&limit->pathId, pathId);
+	}
+	if (bb_atomic_load_u32(&limit->line) != line)
+	{
+		bb_atomic_store_u32(&limit->line, line);
+	}
+	if (bb_atomic_load_u32(&limit->categoryId) != categoryId)
+	{
+		bb_atomic_store_u32(&limit->categoryId, categoryId);
+	}
+	if (bb_atomic_load_u32(&limit->level) != (u32)level)
+	{
+		bb_atomic_store_u32(&limit->level, (u32)level);
+	}
+	if (logsPerSecond && !bb_callsite_take_token(limit, logsPerSecond, bb_atomic_load_u32(&s_bb_callsiteBurst)))
+	{
+		bb_callsite_suppress(limit, &limit->rateLimited);
+		return false;
+	}
+	if (repeatSuppression)
+	{
+		s_bb_callsite_limit = limit;
+	}
+	return true;
+}
+
+static void bb_send_callsite_summary(bb_callsite_limit_t* limit)
+{
+	const u32 rateLimited = bb_atomic_exchange_u32(&limit->rateLimited, 0);
+	const u32 repeated = bb_atomic_exchange_u32(&limit->repeated, 0);
+	if (rateLimited || repeated)
+	{
+		bb_decoded_packet_t decoded;
+		bb_fill_header(&decoded, kBBPacketType_LogSuppressed, bb_atomic_load_u32(&limit->pathId), bb_atomic_load_u32(&limit->line));
+		decoded.packet.logSuppressed.categoryId = bb_atomic_load_u32(&limit->categoryId);
+		decoded.packet.logSuppressed.level = bb_atomic_load_u32(&limit->level);
+		decoded.packet.logSuppressed.rateLimited = rateLimited;
+		decoded.packet.logSuppressed.repeated = repeated;
+		bb_send(&decoded);
+	}
+}
+
+static void bb_send_callsite_summaries(void)
+{
+	bb_callsite_limit_t* limit = (bb_callsite_limit_t*)bb_atomic_load_ptr((void* volatile*)&s_bb_suppressedCallsites);
+	for (; limit; limit = limit->next)
+	{
+		bb_send_callsite_summary(limit);
+	}
+}
+
+// Returns true if the log is a repeat of the last one from the callsite bb_callsite_allow was just called for,
+// and should be dropped.  A changed log first sends the count of repeats it ends.
+static b32 bb_callsite_is_repeat(const bb_packet_header_t* header, const void* data, size_t len)
+{
+	bb_callsite_limit_t* limit = s_bb_callsite_limit;
+	s_bb_callsite_limit = NULL;
+	if (!limit || bb_atomic_load_u32(&limit->pathId) != header->fileId || bb_atomic_load_u32(&limit->line) != header->line)
+		return false;
+
+	u32 hash = 2166136261u;
+	for (size_t i = 0; i < len; ++i)
+	{
+		hash = (hash ^ ((const u8*)data)[i]) * 16777619u;
+	}
+	hash |= 1u; // 0 means nothing has been sent yet
+	if (bb_atomic_exchange_u32(&limit->textHash, hash) == hash)
+	{
+		bb_callsite_suppress(limit, &limit->repeated);
+		return true;
+	}
+	if (bb_atomic_load_u32(&limit->repeated))
+	{
+		bb_send_callsite_summary(limit);
+	}
+	return false;
+}
+
+static void bb_send_thread_destroy_ring(bb_packet_ring_t* ring)
+{
+	if (!bb_pool_release(&s_bb_pools.rings, ring))
+	{
+		bb_packet_ring_destroy(ring);
+	}
+}
+
+static u32 bb_send_thread_drain(void)
+{
+	// New rings are only ever added at the head, and only this thread removes them, so the list from the
+	// snapshot on stays intact while the sinks are written to without the lock.
+	bb_critical_section_lock(&s_send_thread.cs);
+	bb_packet_ring_t* rings = s_send_thread.rings;
+	bb_critical_section_unlock(&s_send_thread.cs);
+
+	u32 total = 0;
+	b32 retired = false;
+	for (bb_packet_ring_t* ring = rings; ring; ring = ring->next)
+	{
+		// read at most one ring's worth so a busy thread can't starve the others
+		u32 ringBytes = 0;
+		while (ringBytes < ring->size)
+		{
+			u32 bytes = bb_packet_ring_read_frames(ring, s_send_thread.batch, kBBSendThread_BatchSize);
+			if (!bytes)
+				break;
+			bb_send_frames(s_send_thread.batch, bytes);
+			ringBytes += bytes;
+		}
+		total += ringBytes;
+		retired = retired || (bb_atomic_load_u32(&ring->retired) && bb_packet_ring_is_empty(ring));
+	}
+
+	if (retired)
+	{
+		bb_critical_section_lock(&s_send_thread.cs);
+		bb_packet_ring_t** prev = &s_send_thread.rings;
+		while (*prev)
+		{
+			bb_packet_ring_t* ring = *prev;
+			if (bb_atomic_load_u32(&ring->retired) && bb_packet_ring_is_empty(ring))
+			{
+				*prev = ring->next;
+				bb_send_thread_destroy_ring(ring);
+			}
+			else
+			{
+				prev = &ring->next;
+			}
+		}
+		bb_critical_section_unlock(&s_send_thread.cs);
+	}
+	bb_atomic_fetch_add_u32(&s_send_thread.passes, 1);
+	return total;
+}
+
+static bb_worker_thread_return_t bb_send_thread_func(void* args)
+{
+	BB_UNUSED(args);
+	while (!bb_atomic_load_u32(&s_send_thread.shutdownRequested))
+	{
+		if (!bb_send_thread_drain())
+		{
+			bb_sleep_ms(kBBSendThread_IdleSleepMillis);
+		}
+	}
+	bb_send_thread_drain();
+	bb_worker_thread_exit(0);
+}
+
+static void bb_send_thread_start(void)
+{
+	if (s_send_thread.running)
+		return;
+
+	if (!s_send_thread.cs.initialized)
+	{
+		bb_critical_section_init(&s_send_thread.cs);
+	}
+	if (!s_send_thread.ringSize)
+	{
+		s_send_thread.ringSize = kBBSendThread_DefaultRingSize;
+	}
+	s_send_thread.batch = (u8*)bb_malloc(kBBSendThread_BatchSize);
+	if (!s_send_thread.batch)
+	{
+		bb_error("bb_send_thread_start failed to allocate batch buffer");
+		return;
+	}
+
+	++s_send_thread.generation;
+	bb_atomic_store_u32(&s_send_thread.shutdownRequested, false);
+	bb_atomic_store_u32(&s_send_thread.running, true);
+	if (!bb_worker_thread_create(&s_send_thread.handle, &bb_send_thread_func, NULL))
+	{
+		bb_error("bb_send_thread_start failed to create thread");
+		bb_atomic_store_u32(&s_send_thread.running, false);
+		bb_free(s_send_thread.batch);
+		s_send_thread.batch = NULL;
+	}
+}
+
+static void bb_send_thread_shutdown(void)
+{
+	if (!bb_atomic_exchange_u32(&s_send_thread.running, false))
+		return;
+
+	// logging threads send directly from here on - once the ones still writing to a ring are done, the
+	// thread's final drain gets everything, and nothing touches the rings after they are freed
+	while (bb_atomic_load_u32(&s_send_thread.producers))
+	{
+		bb_sleep_ms(0);
+	}
+	bb_atomic_store_u32(&s_send_thread.shutdownRequested, true);
+	bb_worker_thread_join(s_send_thread.handle);
+
+	bb_critical_section_lock(&s_send_thread.cs);
+	while (s_send_thread.rings)
+	{
+		bb_packet_ring_t* ring = s_send_thread.rings;
+		s_send_thread.rings = ring->next;
+		bb_send_thread_destroy_ring(ring);
+	}
+	++s_send_thread.generation;
+	bb_critical_section_unlock(&s_send_thread.cs);
+
+	bb_free(s_send_thread.batch);
+	s_send_thread.batch = NULL;
+}
+
+// waits until everything queued by any thread before the call has been handed to the sinks
+static void bb_send_thread_flush(void)
+{
+	if (!bb_atomic_load_u32(&s_send_thread.running))
+		return;
+
+	// the pass in progress might have already skipped a ring, so wait for the one after it to finish
+	const u32 target = bb_atomic_load_u32(&s_send_thread.passes) + 2;
+	while ((s32)(bb_atomic_load_u32(&s_send_thread.passes) - target) < 0 && bb_atomic_load_u32(&s_send_thread.running))
+	{
+		bb_sleep_ms(0);
+	}
+}
+
+// called when a thread ends - its remaining logs are drained before the ring is released
+static void bb_send_thread_release_ring(void)
+{
+	bb_drop_stale_trace_buffer();
+	bbtraceBuffer_t* traceBuffer = s_bb_trace_packet_buffer;
+	if (!traceBuffer || !traceBuffer->ring)
+		return;
+
+	bb_packet_ring_t* ring = traceBuffer->ring;
+	traceBuffer->ring = NULL;
+	if (traceBuffer->ringGeneration != s_send_thread.generation || !bb_send_thread_enter())
+		return;
+
+	while (!bb_packet_ring_is_empty(ring) && bb_atomic_load_u32(&s_send_thread.running))
+	{
+		bb_sleep_ms(0);
+	}
+	bb_atomic_store_u32(&ring->retired, true);
+	bb_send_thread_leave();
+}
+
+void bb_set_send_thread_ring_size(uint32_t ringSize)
+{
+	s_send_thread.ringSize = BB_MAX(ringSize, (u32)kBBSendThread_MinRingSize);
+}
+
+void bb_set_ring_file_size(uint32_t fileSize)
+{
+	s_ringFileSize = fileSize;
+}
+
+void bb_set_backpressure(bb_backpressure_e policy, uint32_t queueSize, const char* spillPath)
+{
+	s_bb_backpressurePolicy = policy;
+	s_bb_backpressureQueueSize = queueSize;
+	bb_strncpy(s_bb_backpressureSpillPath, spillPath ? spillPath : "", sizeof(s_bb_backpressureSpillPath));
+	if (s_con.cs.initialized)
+	{
+		bbcon_set_backpressure(&s_con, s_bb_backpressurePolicy, s_bb_backpressureQueueSize, s_bb_backpressureSpillPath);
 	}
-	bbcon_send_raw(&s_con, buf, serializedLen);
 }
 
 static const char* s_bbLogLevelNames[] = {
@@ -373,7 +1636,7 @@ static BB_INLINE void bb_send_directed(bb_decoded_packet_t* decoded, b32 bCallba
 	{
 		(*s_bb_send_callback)(s_bb_send_callback_context, decoded);
 	}
-	if (s_fp || s_bb_write_callback)
+	if (bb_file_is_open() || s_bb_write_callback)
 	{
 		u8 buf[BB_MAX_PACKET_BUFFER_SIZE];
 		u16 serializedLen = bbpacket_serialize(decoded, buf + 2, sizeof(buf) - 2);
@@ -386,9 +1649,9 @@ static BB_INLINE void bb_send_directed(bb_decoded_packet_t* decoded, b32 bCallba
 			{
 				(*s_bb_write_callback)(s_bb_write_callback_context, buf, serializedLen);
 			}
-			if (s_fp && bFile)
+			if (bFile && bb_file_is_open())
 			{
-				bb_file_write(s_fp, buf, serializedLen);
+				bb_file_write_frames(buf, serializedLen);
 			}
 		}
 		else
@@ -445,12 +1708,12 @@ static bb_decoded_packet_t bb_build_appinfo(void)
 {
 	bb_decoded_packet_t decoded;
 	decoded.type = kBBPacketType_AppInfo;
-	decoded.header.timestamp = bb_current_ticks();
+	decoded.header.timestamp = bb_current_timestamp();
 	decoded.header.threadId = bb_get_current_thread_id();
 	decoded.header.fileId = 0;
 	decoded.header.line = 0;
 	decoded.packet.appInfo.initialTimestamp = decoded.header.timestamp;
-	decoded.packet.appInfo.millisPerTick = bb_millis_per_tick();
+	decoded.packet.appInfo.millisPerTick = (s_bb_tscTimestamps) ? bb_tsc_millis_per_tick(&s_bb_tscCalibration) : bb_millis_per_tick();
 	decoded.packet.appInfo.initFlags = g_bb_initFlags;
 	decoded.packet.appInfo.platform = (u32)(bb_platform_e)bb_platform();
 	decoded.packet.appInfo.microsecondsFromEpoch = bb_current_time_microseconds_from_epoch();
@@ -459,6 +1722,53 @@ static bb_decoded_packet_t bb_build_appinfo(void)
 	return decoded;
 }
 
+// The rate of the timestamp counter, measured since bb_init - see kBBInitFlag_TSCTimestamps
+static bb_decoded_packet_t bb_build_time_calibration(void)
+{
+	bb_decoded_packet_t decoded;
+	decoded.type = kBBPacketType_TimeCalibration;
+	decoded.packet.timeCalibration.millisPerTick = bb_tsc_millis_per_tick(&s_bb_tscCalibration);
+	bb_fill_packet_header(&decoded.header, 0, 0);
+	decoded.packet.timeCalibration.microsecondsFromEpoch = bb_current_time_microseconds_from_epoch();
+	return decoded;
+}
+
+static void bb_send_logs_dropped(void)
+{
+	bb_decoded_packet_t decoded;
+	if (!bbcon_take_dropped_logs(&s_con, decoded.packet.logsDropped.dropped))
+		return;
+
+	u32 pathId = 0;
+	u32 categoryId = 0;
+	bb_resolve_ids(__FILE__, "bbcon", &pathId, &categoryId, __LINE__);
+	bb_fill_header(&decoded, kBBPacketType_LogsDropped, pathId, __LINE__);
+	decoded.packet.logsDropped.categoryId = categoryId;
+	decoded.packet.logsDropped.policy = (u32)s_bb_backpressurePolicy;
+	bb_send(&decoded);
+}
+
+static void bb_send_client_telemetry(u64 now)
+{
+	bb_connection_stats_t stats;
+	bb_decoded_packet_t decoded;
+	const u32 queuedBytes = bbcon_take_stats(&s_con, &stats);
+	bb_fill_header(&decoded, kBBPacketType_ClientTelemetry, 0, 0);
+	decoded.packet.clientTelemetry.intervalMillis = (double)(now - s_bb_lastTelemetryTime);
+	decoded.packet.clientTelemetry.flushMillis = (double)stats.flushNanoseconds / 1000000.0;
+	decoded.packet.clientTelemetry.lockWaitMillis = (double)stats.lockWaitNanoseconds / 1000000.0;
+	decoded.packet.clientTelemetry.packetsSent = stats.packetsSent;
+	decoded.packet.clientTelemetry.bytesSent = stats.bytesSent;
+	decoded.packet.clientTelemetry.flushes = stats.flushes;
+	decoded.packet.clientTelemetry.maxSendBytes = stats.maxSendBytes;
+	decoded.packet.clientTelemetry.queuedBytes = queuedBytes;
+	decoded.packet.clientTelemetry.droppedLogs = stats.droppedLogs;
+	decoded.packet.clientTelemetry.suppressedLogs = bb_atomic_exchange_u32(&s_bb_suppressedLogs, 0);
+	decoded.packet.clientTelemetry.pad = 0;
+	s_bb_lastTelemetryTime = now;
+	bb_send(&decoded);
+}
+
 static void bb_save_initial_appinfo(void)
 {
 	if (s_initial_buffer.cs.initialized)
@@ -473,9 +1783,15 @@ static void bb_send_initial(b32 bCallbacks, b32 bSocket, b32 bFile)
 {
 	BB_ASSERT(bbpacket_is_app_info_type(s_initialAppInfo.type));
 	bb_send_directed(&s_initialAppInfo, bCallbacks, bSocket, bFile);
+	if (s_bb_tscTimestamps)
+	{
+		bb_decoded_packet_t calibration = bb_build_time_calibration();
+		bb_send_directed(&calibration, bCallbacks, bSocket, bFile);
+	}
 
 	bb_send_ids(&s_bb_pathIds, bCallbacks, bSocket, bFile);
 	bb_send_ids(&s_bb_categoryIds, bCallbacks, bSocket, bFile);
+	bb_send_ids(&s_bb_formatIds, bCallbacks, bSocket, bFile);
 	bb_send_thread_ids(&s_bb_threadIds, bCallbacks, bSocket, bFile);
 
 	 if (s_initial_buffer.cs.initialized)
@@ -489,12 +1805,50 @@ static void bb_send_initial(b32 bCallbacks, b32 bSocket, b32 bFile)
 	}
 }
 
+// held while connecting and sending the initial packets - see bb_send_frames
+static void bb_lock_initial_buffer(void)
+{
+	if (s_initial_buffer.cs.initialized)
+	{
+		bb_critical_section_lock(&s_initial_buffer.cs);
+	}
+}
+
+static void bb_unlock_initial_buffer(void)
+{
+	if (s_initial_buffer.cs.initialized)
+	{
+		bb_critical_section_unlock(&s_initial_buffer.cs);
+	}
+}
+
+// held while a connect replaces s_con, so a replay left running by an earlier connect never sends to the new
+// connection ahead of its initial packets - taken before s_id_cs
+static void bb_lock_spool_replay(void)
+{
+	if (s_spool.cs.initialized)
+	{
+		bb_critical_section_lock(&s_spool.fileCs);
+	}
+}
+
+static void bb_unlock_spool_replay(void)
+{
+	if (s_spool.cs.initialized)
+	{
+		bb_critical_section_unlock(&s_spool.fileCs);
+	}
+}
+
 void bb_init_file(const char* path)
 {
 	bb_init_locale();
-	if (s_fp == BB_INVALID_FILE_HANDLE)
+	if (!bb_file_is_open())
 	{
-		s_fp = bb_file_open_for_write(path);
+		if (!s_ringFileSize || !bb_ring_file_open(&s_ringFile, path, s_ringFileSize))
+		{
+			s_fp = bb_file_open_for_write(path);
+		}
 
 		if (s_id_cs.initialized && bbpacket_is_app_info_type(s_initialAppInfo.type))
 		{
@@ -530,6 +1884,7 @@ void bb_disconnect(void)
 	{
 		bbcon_disconnect(&s_con);
 	}
+	bb_reset_category_levels();
 }
 
 void bb_connect_direct(uint32_t targetIp, uint16_t targetPort, const void* payload, uint32_t payloadBytes)
@@ -537,6 +1892,14 @@ void bb_connect_direct(uint32_t targetIp, uint16_t targetPort, const void* paylo
 	if (!s_id_cs.initialized)
 		return;
 
+	// the connect waits on the network, so it happens before taking locks that logging threads need
+	struct sockaddr_in addr = { BB_EMPTY_INITIALIZER };
+	addr.sin_family = AF_INET;
+	BB_S_ADDR_UNION(addr) = htonl(targetIp);
+	addr.sin_port = htons(targetPort);
+	const bb_socket serverSocket = bbcon_connect_socket(&s_con, (const struct sockaddr*)&addr, sizeof(addr));
+
+	bb_lock_spool_replay();
 	bb_critical_section_lock(&s_id_cs);
 
 	b32 bCallbacks = !s_bCallbackSentAppInfo;
@@ -545,27 +1908,30 @@ void bb_connect_direct(uint32_t targetIp, uint16_t targetPort, const void* paylo
 	s_bFileSentAppInfo = true;
 	b32 bSocket = false;
 	bb_disconnect();
+	bb_lock_initial_buffer();
 	s_serverIp = targetIp;
 	s_serverPort = targetPort;
-	if (bbcon_connect_client_async_ipv4(&s_con, targetIp, targetPort))
+	if (serverSocket != BB_INVALID_SOCKET)
 	{
-		while (bbcon_is_connecting(&s_con))
-		{
-			bbcon_tick_connecting(&s_con);
-		}
-		if (bbcon_is_connected(&s_con))
-		{
-			bSocket = true;
+		bbcon_connect_client_socket(&s_con, serverSocket);
+		bSocket = true;
 
-			if (payload && payloadBytes)
-			{
-				bbcon_send_raw(&s_con, payload, payloadBytes);
-			}
+		if (payload && payloadBytes)
+		{
+			bbcon_send_raw(&s_con, payload, payloadBytes);
 		}
 	}
 	bb_send_initial(bCallbacks, bSocket, bFile);
+	bb_unlock_initial_buffer();
 
 	bb_critical_section_unlock(&s_id_cs);
+	bb_unlock_spool_replay();
+
+	if (bSocket)
+	{
+		bb_release_initial_buffer();
+		bb_spool_replay();
+	}
 }
 
 b32 bb_connect_sockaddr(const struct sockaddr* discoveryAddr, size_t discoveryAddrSize)
@@ -573,6 +1939,11 @@ b32 bb_connect_sockaddr(const struct sockaddr* discoveryAddr, size_t discoveryAd
 	if (!s_id_cs.initialized)
 		return false;
 
+	// discovery and the connect wait on the network, so they happen before taking locks that logging threads need
+	bb_discovery_result_t discovery = bb_discovery_client_start(s_applicationName, s_sourceApplicationName, s_deviceCode, s_sourceIp, discoveryAddr, discoveryAddrSize);
+	const bb_socket serverSocket = (discovery.success) ? bbcon_connect_socket(&s_con, (const struct sockaddr*)&discovery.serverAddr, sizeof(discovery.serverAddr)) : BB_INVALID_SOCKET;
+
+	bb_lock_spool_replay();
 	bb_critical_section_lock(&s_id_cs);
 
 	b32 bCallbacks = !s_bCallbackSentAppInfo;
@@ -582,7 +1953,7 @@ b32 bb_connect_sockaddr(const struct sockaddr* discoveryAddr, size_t discoveryAd
 	b32 bSocket = false;
 
 	bb_disconnect();
-	bb_discovery_result_t discovery = bb_discovery_client_start(s_applicationName, s_sourceApplicationName, s_deviceCode, s_sourceIp, discoveryAddr, discoveryAddrSize);
+	bb_lock_initial_buffer();
 	if (discovery.success)
 	{
 		if (discovery.serverAddr.ss_family == AF_INET)
@@ -594,22 +1965,24 @@ b32 bb_connect_sockaddr(const struct sockaddr* discoveryAddr, size_t discoveryAd
 			s_serverIp = 0;
 		}
 		s_serverPort = bbnet_get_port_from_sockaddr((const struct sockaddr*)&discovery.serverAddr);
-		if (bbcon_connect_client_async(&s_con, (const struct sockaddr*)&discovery.serverAddr, sizeof(discovery.serverAddr)))
-		{
-			while (bbcon_is_connecting(&s_con))
-			{
-				bbcon_tick_connecting(&s_con);
-			}
-			if (bbcon_is_connected(&s_con))
-			{
-				bSocket = true;
-			}
-		}
+	}
+	if (serverSocket != BB_INVALID_SOCKET)
+	{
+		bbcon_connect_client_socket(&s_con, serverSocket);
+		bSocket = true;
 	}
 
 	bb_send_initial(bCallbacks, bSocket, bFile);
+	bb_unlock_initial_buffer();
 
 	bb_critical_section_unlock(&s_id_cs);
+	bb_unlock_spool_replay();
+
+	if (bSocket)
+	{
+		bb_release_initial_buffer();
+		bb_spool_replay();
+	}
 
 	return bSocket;
 }
@@ -669,6 +2042,60 @@ void bb_connect(uint32_t discoveryIp, uint16_t discoveryPort)
 	}
 }
 
+static bb_worker_thread_return_t bb_connect_thread_func(void* args)
+{
+	BB_UNUSED(args);
+	bb_connect(s_connect_thread.discoveryIp, 0);
+	bb_worker_thread_exit(0);
+}
+
+// returns false if the caller needs to connect directly
+static b32 bb_connect_thread_start(uint32_t discoveryIp)
+{
+	s_connect_thread.discoveryIp = discoveryIp;
+	if (!bb_worker_thread_create(&s_connect_thread.handle, &bb_connect_thread_func, NULL))
+	{
+		bb_error("bb_connect_thread_start failed to create thread");
+		return false;
+	}
+	s_connect_thread.joinable = true;
+	return true;
+}
+
+// waits for discovery and connect to finish - at most a second or so
+static void bb_connect_thread_shutdown(void)
+{
+	if (!s_connect_thread.joinable)
+		return;
+
+	bb_worker_thread_join(s_connect_thread.handle);
+	memset(&s_connect_thread, 0, sizeof(s_connect_thread));
+}
+
+// With kBBInitFlag_ConnectThread, logs are queued from bb_init until a connect succeeds, unless the application
+// supplied its own buffer.  With bb_set_pools, the buffer can't grow once bb_init returns, so it starts at its max size.
+static void bb_start_initial_buffer(void)
+{
+	bb_critical_section_lock(&s_initial_buffer.cs);
+	if (s_initial_buffer.state == kBBInitialBuffer_Unset)
+	{
+		if (!s_initial_buffer.maxSize)
+		{
+			s_initial_buffer.maxSize = kBBInitialBuffer_DefaultMaxSize;
+		}
+		const u32 size = (s_bb_pools.active) ? s_initial_buffer.maxSize : BB_MIN((u32)kBBInitialBuffer_GrowSize, s_initial_buffer.maxSize);
+		s_initial_buffer.data = bb_malloc(size);
+		if (s_initial_buffer.data)
+		{
+			s_initial_buffer.size = size;
+			s_initial_buffer.used = 0u;
+			s_initial_buffer.owned = true;
+			s_initial_buffer.state = kBBInitialBuffer_Set;
+		}
+	}
+	bb_critical_section_unlock(&s_initial_buffer.cs);
+}
+
 void bb_init_critical_sections(void)
 {
 	if (!s_id_cs.initialized)
@@ -679,6 +2106,48 @@ void bb_init_critical_sections(void)
 	{
 		bb_critical_section_init(&s_initial_buffer.cs);
 	}
+	if (!s_spool.cs.initialized)
+	{
+		bb_critical_section_init(&s_spool.cs);
+		bb_critical_section_init(&s_spool.fileCs);
+		s_spool.writeHandle = BB_INVALID_FILE_HANDLE;
+		s_spool.readHandle = BB_INVALID_FILE_HANDLE;
+	}
+	if (!s_flightRecorder.cs.initialized)
+	{
+		bb_critical_section_init(&s_flightRecorder.cs);
+		bb_critical_section_init(&s_flightRecorder.dumpCs);
+	}
+	if (!s_bb_pools.cs.initialized)
+	{
+		bb_critical_section_init(&s_bb_pools.cs);
+	}
+}
+
+static void bb_init_connect(void)
+{
+	if ((g_bb_initFlags & kBBInitFlag_NoConnect) != 0)
+		return; // no connect, with or without discovery
+
+	// no discovery, so only try connecting to localhost - otherwise full discovery
+	const uint32_t discoveryIp = ((g_bb_initFlags & kBBInitFlag_NoDiscovery) != 0) ? (127 << 24) | 1 : 0;
+	if ((g_bb_initFlags & kBBInitFlag_ConnectThread) != 0)
+	{
+		// callbacks see logs before the connection is made, so they get the AppInfo now
+		bb_critical_section_lock(&s_id_cs);
+		if (!s_bCallbackSentAppInfo)
+		{
+			bb_send_initial(true, false, false);
+			s_bCallbackSentAppInfo = true;
+		}
+		bb_critical_section_unlock(&s_id_cs);
+
+		bb_start_initial_buffer();
+		if (bb_connect_thread_start(discoveryIp))
+			return;
+	}
+
+	bb_connect(discoveryIp, 0);
 }
 
 void bb_init(const char* applicationName, const char* sourceApplicationName, const char* deviceCode, uint32_t sourceIp, bb_init_flags_t initFlags)
@@ -696,18 +2165,50 @@ void bb_init(const char* applicationName, const char* sourceApplicationName, con
 	bb_strncpy(s_applicationName, applicationName, sizeof(s_applicationName));
 	bb_strncpy(s_sourceApplicationName, sourceApplicationName, sizeof(s_sourceApplicationName));
 	g_bb_initFlags = initFlags;
+	if (s_bb_pools.active)
+	{
+		// compact logs grow their callsite and thread tables with bb_malloc as new ones are logged
+		g_bb_initFlags &= ~(u32)kBBInitFlag_CompactLogs;
+	}
+	bb_init_thread_id();
+	s_bb_tscTimestamps = false;
+	if ((g_bb_initFlags & kBBInitFlag_TSCTimestamps) != 0 && bb_tsc_available())
+	{
+		bb_tsc_calibration_start(&s_bb_tscCalibration);
+		s_bb_tscTimestamps = bb_tsc_millis_per_tick(&s_bb_tscCalibration) > 0.0;
+	}
 	bb_init_critical_sections();
 	bb_log_init();
 	bbnet_init();
 	bbcon_init(&s_con);
 	s_con.flags |= kBBCon_Blackbox;
+	if ((g_bb_initFlags & kBBInitFlag_Telemetry) != 0)
+	{
+		s_con.flags |= kBBCon_Stats;
+		s_bb_lastTelemetryTime = bb_current_time_ms();
+	}
+	else
+	{
+		s_con.flags &= ~(u32)kBBCon_Stats;
+	}
+	bbcon_set_backpressure(&s_con, s_bb_backpressurePolicy, s_bb_backpressureQueueSize, s_bb_backpressureSpillPath);
+	if (s_bb_pools.active && (g_bb_initFlags & kBBInitFlag_CompressedBatches) != 0)
+	{
+		// batches only start once the server says it can take them, after bb_malloc is off limits
+		bbcon_reserve_batches(&s_con);
+	}
 	s_sourceIp = sourceIp;
 	bb_save_initial_appinfo();
 
+	if ((g_bb_initFlags & kBBInitFlag_SendThread) != 0)
+	{
+		bb_send_thread_start();
+	}
+
 	if (s_id_cs.initialized)
 	{
 		bb_critical_section_lock(&s_id_cs);
-		if (s_fp != NULL && !s_bFileSentAppInfo)
+		if (bb_file_is_open() && !s_bFileSentAppInfo)
 		{
 			bb_send_initial(false, false, true);
 			s_bFileSentAppInfo = true;
@@ -715,17 +2216,17 @@ void bb_init(const char* applicationName, const char* sourceApplicationName, con
 		bb_critical_section_unlock(&s_id_cs);
 	}
 
-	if ((g_bb_initFlags & kBBInitFlag_NoConnect) != 0)
-		return; // no connect, with or without discovery
+	bb_init_connect();
 
-	if ((g_bb_initFlags & kBBInitFlag_NoDiscovery) != 0)
+	if (s_bb_pools.active && s_spool.maxSize)
 	{
-		bb_connect((127 << 24) | 1, 0); // no discovery, so only try connecting to localhost
-	}
-	else
-	{
-		bb_connect(0, 0); // full discovery
+		// the spool grows with bb_malloc while the server is away
+		bb_set_spool(0, NULL);
+		bb_error("bb spool is not used with bb_set_pools");
 	}
+
+	// everything from here on comes from the pools - see bb_set_pools
+	bb_malloc_forbid(s_bb_pools.active);
 }
 
 #if BB_COMPILE_WIDECHAR
@@ -740,6 +2241,85 @@ void bb_init_w(const bb_wchar_t* applicationName, const bb_wchar_t* sourceApplic
 }
 #endif // #if BB_COMPILE_WIDECHAR
 
+enum
+{
+	kBBPools_Alignment = 16,
+};
+
+static u8* bb_pools_slice(u8* memory, u32* offset, size_t bytes)
+{
+	u8* slice = (memory) ? memory + *offset : NULL;
+	*offset += ((u32)bytes + kBBPools_Alignment - 1) & ~(u32)(kBBPools_Alignment - 1);
+	return slice;
+}
+
+static void bb_pools_carve_pool(bb_pool_t* pool, u8* memory, u32* offset, u32 count, u32 itemSize)
+{
+	itemSize = (itemSize + kBBPools_Alignment - 1) & ~(u32)(kBBPools_Alignment - 1);
+	u8* data = bb_pools_slice(memory, offset, (size_t)count * itemSize);
+	u8** freeItems = (u8**)bb_pools_slice(memory, offset, count * sizeof(u8*));
+	if (memory)
+	{
+		pool->data = data;
+		pool->free = freeItems;
+		pool->itemSize = itemSize;
+		pool->count = count;
+		pool->freeCount = count;
+		for (u32 i = 0; i < count; ++i)
+		{
+			freeItems[i] = data + (size_t)(count - 1 - i) * itemSize;
+		}
+	}
+}
+
+static void bb_pools_carve_ids(bb_ids_t* ids, u8* memory, u32* offset, u32 count)
+{
+	bb_id_t* data = (bb_id_t*)bb_pools_slice(memory, offset, count * sizeof(bb_id_t));
+	u8* map = bb_pools_slice(memory, offset, bb_id_map_fixed_size(count));
+	if (memory)
+	{
+		ids->count = 0;
+		ids->allocated = count;
+		ids->data = data;
+		ids->lastId = 0;
+		bb_id_map_init_fixed(&ids->map, map, count);
+	}
+}
+
+// lays the pools out in memory, or only measures them if memory is NULL - returns the bytes used
+static u32 bb_pools_carve(const bb_pools_t* pools, u8* memory)
+{
+	u32 offset = 0;
+	bb_pools_carve_pool(&s_bb_pools.threads, memory, &offset, pools->threads, sizeof(bbtraceBuffer_t));
+	bb_pools_carve_pool(&s_bb_pools.rings, memory, &offset, pools->sendThreadRings, bb_packet_ring_memory_size(pools->sendThreadRingSize));
+	bb_pools_carve_ids(&s_bb_categoryIds, memory, &offset, pools->ids);
+	bb_pools_carve_ids(&s_bb_pathIds, memory, &offset, pools->ids);
+	bb_pools_carve_ids(&s_bb_threadIds, memory, &offset, pools->ids);
+
+	const u32 formats = BB_MIN(pools->ids, (u32)kBBFormatChunk_Size * (u32)kBBFormatChunk_Count);
+	const u32 formatChunks = (formats + kBBFormatChunk_Size - 1) / kBBFormatChunk_Size;
+	bb_pools_carve_ids(&s_bb_formatIds, memory, &offset, formats);
+	bb_format_t* formatData = (bb_format_t*)bb_pools_slice(memory, &offset, (size_t)formatChunks * kBBFormatChunk_Size * sizeof(bb_format_t));
+
+	char* strings = (char*)bb_pools_slice(memory, &offset, pools->stringBytes);
+	if (memory)
+	{
+		bb_atomic_fetch_add_u32(&s_bb_pools.generation, 1);
+		for (u32 i = 0; i < BB_ARRAYSIZE(s_bb_formatChunks); ++i)
+		{
+			s_bb_formatChunks[i] = (i < formatChunks) ? formatData + (size_t)i * kBBFormatChunk_Size : NULL;
+		}
+		s_bb_pools.strings = strings;
+		s_bb_pools.stringsUsed = 0;
+	}
+	return offset;
+}
+
+static u8* bb_pools_aligned_memory(void)
+{
+	return (u8*)(((uintptr_t)s_bb_pools.memory + kBBPools_Alignment - 1) & ~(uintptr_t)(kBBPools_Alignment - 1));
+}
+
 static void bb_free_ids(bb_ids_t *ids)
 {
 	for (u32 i = 0; i < ids->count; ++i)
@@ -751,34 +2331,87 @@ static void bb_free_ids(bb_ids_t *ids)
 		}
 	}
 	bba_free(*ids);
+	bb_id_map_reset(&ids->map);
 }
 
 void bb_shutdown(const char* file, int line)
 {
+	bb_malloc_forbid(false);
 	uint32_t bb_path_id = 0;
 	bb_resolve_path_id(file, &bb_path_id, (uint32_t)line);
+	bb_send_callsite_summaries();
 	bb_thread_end(bb_path_id, (u32)line);
+	bb_connect_thread_shutdown();
+	bb_send_thread_shutdown();
 	if (s_fp != BB_INVALID_FILE_HANDLE)
 	{
 		bb_file_close(s_fp);
 		s_fp = BB_INVALID_FILE_HANDLE;
 	}
+	bb_ring_file_close(&s_ringFile);
 	bbcon_flush(&s_con);
 	bbcon_shutdown(&s_con);
 	bbnet_shutdown();
 	bb_log_shutdown();
 	bb_critical_section_shutdown(&s_id_cs);
-	bb_free_ids(&s_bb_categoryIds);
-	bb_free_ids(&s_bb_pathIds);
-	bb_free_ids(&s_bb_threadIds);
-	if (s_bb_trace_packet_buffer)
+	if (s_bb_pools.active)
 	{
-		bb_free(s_bb_trace_packet_buffer);
-		s_bb_trace_packet_buffer = NULL;
+		// empties the pools for the next bb_init
+		bb_pools_carve(&s_bb_pools.config, bb_pools_aligned_memory());
+	}
+	else
+	{
+		bb_free_ids(&s_bb_categoryIds);
+		bb_free_ids(&s_bb_pathIds);
+		bb_free_ids(&s_bb_threadIds);
+		bb_free_ids(&s_bb_formatIds);
+		for (u32 i = 0; i < BB_ARRAYSIZE(s_bb_formatChunks); ++i)
+		{
+			if (s_bb_formatChunks[i])
+			{
+				bb_free(s_bb_formatChunks[i]);
+				s_bb_formatChunks[i] = NULL;
+			}
+		}
 	}
+	bb_release_trace_buffer();
 	bb_shutdown_locale();
+	bb_release_initial_buffer(); // if nothing ever connected
 	bb_critical_section_shutdown(&s_initial_buffer.cs);
 	memset(&s_initial_buffer, 0, sizeof(s_initial_buffer));
+	if (s_spool.cs.initialized)
+	{
+		bb_spool_close_file();
+		if (s_spool.data)
+		{
+			bb_free(s_spool.data);
+		}
+		if (s_spool.spare)
+		{
+			bb_free(s_spool.spare);
+		}
+		bb_critical_section_shutdown(&s_spool.cs);
+		bb_critical_section_shutdown(&s_spool.fileCs);
+		memset(&s_spool, 0, sizeof(s_spool));
+	}
+	if (s_flightRecorder.cs.initialized)
+	{
+		if (s_flightRecorder.data)
+		{
+			bb_free(s_flightRecorder.data);
+		}
+		if (s_flightRecorder.spare)
+		{
+			bb_free(s_flightRecorder.spare);
+		}
+		bb_critical_section_shutdown(&s_flightRecorder.cs);
+		bb_critical_section_shutdown(&s_flightRecorder.dumpCs);
+		memset(&s_flightRecorder, 0, sizeof(s_flightRecorder));
+	}
+	if (s_send_thread.cs.initialized)
+	{
+		bb_critical_section_shutdown(&s_send_thread.cs);
+	}
 }
 
 void bb_set_initial_buffer(void* buffer, uint32_t bufferSize)
@@ -797,8 +2430,15 @@ void bb_set_initial_buffer(void* buffer, uint32_t bufferSize)
 	}
 
 	bb_critical_section_lock(&s_initial_buffer.cs);
+	if (s_initial_buffer.owned)
+	{
+		bb_free(s_initial_buffer.data);
+		s_initial_buffer.owned = false;
+		s_initial_buffer.droppedFrames = 0u;
+	}
 	s_initial_buffer.data = buffer;
 	s_initial_buffer.size = bufferSize;
+	s_initial_buffer.used = 0u;
 	if (bufferSize > 0)
 	{
 		s_initial_buffer.state = kBBInitialBuffer_Set;
@@ -810,6 +2450,110 @@ void bb_set_initial_buffer(void* buffer, uint32_t bufferSize)
 	bb_critical_section_unlock(&s_initial_buffer.cs);
 }
 
+void bb_set_initial_buffer_max_size(uint32_t maxSize)
+{
+	s_initial_buffer.maxSize = maxSize;
+}
+
+void bb_set_spool(uint32_t maxSize, const char* path)
+{
+	if (s_bb_pools.active && maxSize)
+	{
+		bb_error("bb spool is not used with bb_set_pools");
+		maxSize = 0;
+	}
+
+	bb_init_critical_sections();
+	bb_critical_section_lock(&s_spool.fileCs);
+	bb_critical_section_lock(&s_spool.cs);
+	s_spool.maxSize = maxSize;
+	if (!s_spool.fileWritten)
+	{
+		bb_strncpy(s_spool.path, (path) ? path : "", sizeof(s_spool.path));
+	}
+	bb_critical_section_unlock(&s_spool.cs);
+	bb_critical_section_unlock(&s_spool.fileCs);
+}
+
+void bb_set_flight_recorder(bb_log_level_e minSentLevel, uint32_t size)
+{
+	bb_init_critical_sections();
+	u8* data = (size && minSentLevel > kBBLogLevel_VeryVerbose) ? (u8*)bb_malloc(size) : NULL;
+	u8* spare = (data) ? (u8*)bb_malloc(size) : NULL;
+	if (!spare && data)
+	{
+		bb_free(data);
+		data = NULL;
+	}
+	u32 pathId = 0;
+	u32 categoryId = 0;
+	if (data)
+	{
+		bb_resolve_ids(__FILE__, "bb", &pathId, &categoryId, __LINE__);
+	}
+
+	// logs already in the ring are discarded
+	bb_critical_section_lock(&s_flightRecorder.dumpCs);
+	bb_critical_section_lock(&s_flightRecorder.cs);
+	u8* oldData = s_flightRecorder.data;
+	u8* oldSpare = s_flightRecorder.spare;
+	s_flightRecorder.data = data;
+	s_flightRecorder.spare = spare;
+	s_flightRecorder.size = (data) ? size : 0u;
+	s_flightRecorder.start = 0;
+	s_flightRecorder.end = 0;
+	s_flightRecorder.wrapEnd = 0;
+	s_flightRecorder.wrapped = false;
+	s_flightRecorder.logCount = 0;
+	s_flightRecorder.overwrittenLogs = 0;
+	s_flightRecorder.pathId = pathId;
+	s_flightRecorder.categoryId = categoryId;
+	s_flightRecorder.minLevel = (data) ? (u32)minSentLevel : 0u;
+	bb_critical_section_unlock(&s_flightRecorder.cs);
+	bb_critical_section_unlock(&s_flightRecorder.dumpCs);
+
+	if (oldData)
+	{
+		bb_free(oldData);
+	}
+	if (oldSpare)
+	{
+		bb_free(oldSpare);
+	}
+}
+
+void bb_flight_recorder_dump(void)
+{
+	bb_flight_recorder_send(kBBFlightRecorder_Requested);
+}
+
+// rings smaller than kBBSendThread_MinRingSize can't hold the largest frame, as with bb_set_send_thread_ring_size
+static bb_pools_t bb_pools_clamp(const bb_pools_t* pools)
+{
+	bb_pools_t clamped = *pools;
+	clamped.sendThreadRingSize = BB_MAX(clamped.sendThreadRingSize, (u32)kBBSendThread_MinRingSize);
+	return clamped;
+}
+
+uint32_t bb_pools_size(const bb_pools_t* pools)
+{
+	const bb_pools_t clamped = bb_pools_clamp(pools);
+	return bb_pools_carve(&clamped, NULL) + kBBPools_Alignment - 1;
+}
+
+int bb_set_pools(const bb_pools_t* pools, void* memory, uint32_t memorySize)
+{
+	if (!pools || !memory || memorySize < bb_pools_size(pools))
+		return false;
+
+	bb_init_critical_sections();
+	s_bb_pools.config = bb_pools_clamp(pools);
+	s_bb_pools.memory = (u8*)memory;
+	bb_pools_carve(&s_bb_pools.config, bb_pools_aligned_memory());
+	s_bb_pools.active = true;
+	return true;
+}
+
 void bb_pre_init_set_applicationGroup(const char* applicationGroup)
 {
 	if (s_con.cs.initialized)
@@ -841,8 +2585,45 @@ void bb_set_send_interval_ms(uint64_t sendInterval)
 void bb_tick(void)
 {
 	bb_decoded_packet_t decoded;
+	if (s_bb_suppressedCallsites)
+	{
+		u64 now = bb_current_time_ms();
+		if (now > s_bb_lastCallsiteSummaryTime + kBBCallsite_SummaryIntervalMillis)
+		{
+			s_bb_lastCallsiteSummaryTime = now;
+			bb_send_callsite_summaries();
+		}
+	}
+	if (s_bb_tscTimestamps)
+	{
+		u64 now = bb_current_time_ms();
+		if (now > s_bb_lastTimeCalibrationTime + kBBTimeCalibration_IntervalMillis)
+		{
+			s_bb_lastTimeCalibrationTime = now;
+			bb_decoded_packet_t calibration = bb_build_time_calibration();
+			bb_send(&calibration);
+		}
+	}
+	if (s_bb_backpressurePolicy != kBBBackpressure_Block)
+	{
+		u64 now = bb_current_time_ms();
+		if (now > s_bb_lastLogsDroppedTime + kBBLogsDropped_IntervalMillis)
+		{
+			s_bb_lastLogsDroppedTime = now;
+			bb_send_logs_dropped();
+		}
+	}
+	if ((g_bb_initFlags & kBBInitFlag_Telemetry) != 0)
+	{
+		u64 now = bb_current_time_ms();
+		if (now > s_bb_lastTelemetryTime + kBBTelemetry_IntervalMillis)
+		{
+			bb_send_client_telemetry(now);
+		}
+	}
+	bb_spool_write_file();
 	bbcon_tick(&s_con);
-	if (s_fp != BB_INVALID_FILE_HANDLE || s_bb_flush_callback)
+	if (bb_file_is_open() || s_bb_flush_callback)
 	{
 		u64 now = bb_current_time_ms();
 		if (now > s_lastFileFlushTime + kBBFile_FlushIntervalMillis)
@@ -852,14 +2633,44 @@ void bb_tick(void)
 			{
 				(*s_bb_flush_callback)(s_bb_flush_callback_context);
 			}
-			if (s_fp != BB_INVALID_FILE_HANDLE)
-			{
-				bb_file_flush(s_fp);
-			}
+			bb_file_flush_frames();
 		}
 	}
+	if (!bbcon_is_connected(&s_con))
+	{
+		bb_reset_category_levels();
+	}
 	while (bbcon_decodePacket(&s_con, &decoded))
 	{
+		if (decoded.type == kBBPacketType_ConsoleCommand && !strcmp(decoded.packet.consoleCommand.text, "bb_flight_recorder_dump"))
+		{
+			// handled here, so applications don't see it as an unknown command
+			bb_flight_recorder_send(kBBFlightRecorder_ConsoleCommand);
+			continue;
+		}
+		if (decoded.type == kBBPacketType_CategoryLevels && (g_bb_initFlags & kBBInitFlag_CategoryLevels) != 0)
+		{
+			bb_apply_category_levels(&decoded.packet.categoryLevels);
+		}
+		else if (decoded.type == kBBPacketType_ServerFeatures)
+		{
+			if ((decoded.packet.serverFeatures.features & kBBServerFeature_CompressedBatches) != 0 &&
+			    (g_bb_initFlags & kBBInitFlag_CompressedBatches) != 0)
+			{
+				bbcon_enable_batches(&s_con);
+			}
+			if ((decoded.packet.serverFeatures.features & kBBServerFeature_CompactLogs) != 0 &&
+			    (g_bb_initFlags & kBBInitFlag_CompactLogs) != 0)
+			{
+				bbcon_enable_compact_logs(&s_con);
+			}
+			if ((decoded.packet.serverFeatures.features & kBBServerFeature_LargeLogs) != 0 &&
+			    (g_bb_initFlags & kBBInitFlag_LargeLogs) != 0)
+			{
+				bbcon_enable_large_logs(&s_con);
+			}
+		}
+
 		// handle server->client packet here - callback to application
 		if (s_bb_incoming_packet_handler)
 		{
@@ -870,14 +2681,12 @@ void bb_tick(void)
 
 void bb_flush(void)
 {
+	bb_send_thread_flush();
 	if (s_bb_flush_callback)
 	{
 		(*s_bb_flush_callback)(s_bb_flush_callback_context);
 	}
-	if (s_fp != BB_INVALID_FILE_HANDLE)
-	{
-		bb_file_flush(s_fp);
-	}
+	bb_file_flush_frames();
 	bbcon_flush(&s_con);
 }
 
@@ -976,6 +2785,34 @@ int bb_send_raw_packet(bb_decoded_packet_t* decoded)
 	}
 }
 
+// called with s_id_cs held - returns NULL when a pooled table or the string pool is full, since they never grow
+static bb_id_t* bb_add_id(bb_ids_t* ids, const char* name)
+{
+	if (!s_bb_pools.active)
+	{
+		bb_id_t* id = bba_add(*ids, 1);
+		if (id && name)
+		{
+			id->name = bb_strdup(name);
+		}
+		return id;
+	}
+
+	const u32 len = (name) ? (u32)strlen(name) + 1 : 0;
+	if (ids->count >= ids->allocated || len > s_bb_pools.config.stringBytes - s_bb_pools.stringsUsed)
+	{
+		return NULL;
+	}
+	bb_id_t* id = bba_add(*ids, 1);
+	if (name)
+	{
+		id->name = s_bb_pools.strings + s_bb_pools.stringsUsed;
+		memcpy(id->name, name, len);
+		s_bb_pools.stringsUsed += len;
+	}
+	return id;
+}
+
 static void bb_thread_store_id_packet(bb_decoded_packet_t* decoded)
 {
 	if (s_bDisableStoredThreadIds)
@@ -984,19 +2821,20 @@ static void bb_thread_store_id_packet(bb_decoded_packet_t* decoded)
 	{
 		bb_critical_section_lock(&s_id_cs);
 	}
-	bb_id_t* newIdData = bba_add(s_bb_threadIds, 1);
+	const char* name = NULL;
+	if (decoded->type == kBBPacketType_ThreadStart)
+	{
+		name = decoded->packet.threadStart.text;
+	}
+	else if (decoded->type == kBBPacketType_ThreadName)
+	{
+		name = decoded->packet.threadName.text;
+	}
+	bb_id_t* newIdData = bb_add_id(&s_bb_threadIds, name);
 	if (newIdData)
 	{
 		newIdData->packetType = decoded->type;
 		newIdData->header = decoded->header;
-		if (decoded->type == kBBPacketType_ThreadStart)
-		{
-			newIdData->name = bb_strdup(decoded->packet.threadStart.text);
-		}
-		else if (decoded->type == kBBPacketType_ThreadName)
-		{
-			newIdData->name = bb_strdup(decoded->packet.threadName.text);
-		}
 	}
 	if (s_id_cs.initialized)
 	{
@@ -1040,15 +2878,12 @@ void bb_thread_set_name_w(uint32_t pathId, uint32_t line, const bb_wchar_t* name
 
 void bb_thread_end(uint32_t pathId, uint32_t line)
 {
+	bb_send_thread_release_ring();
 	bb_decoded_packet_t decoded;
 	bb_fill_header(&decoded, kBBPacketType_ThreadEnd, pathId, line);
 	bb_send(&decoded);
 	bb_thread_store_id_packet(&decoded);
-	if (s_bb_trace_packet_buffer)
-	{
-		bb_free(s_bb_trace_packet_buffer);
-		s_bb_trace_packet_buffer = NULL;
-	}
+	bb_release_trace_buffer();
 }
 
 void bb_start_frame_number(uint32_t pathId, uint32_t line, uint64_t frameNumber)
@@ -1059,24 +2894,10 @@ void bb_start_frame_number(uint32_t pathId, uint32_t line, uint64_t frameNumber)
 	bb_send(&decoded);
 }
 
-static u32 bb_find_id(const char* name, bb_ids_t* ids)
-{
-	u32 i;
-	for (i = 0; i < ids->count; ++i)
-	{
-		bb_id_t* id = ids->data + i;
-		if (id->name && !bb_stricmp(id->name, name))
-		{
-			return id->id;
-		}
-	}
-	return 0;
-}
-
-static u32 bb_resolve_id(const char* name, bb_ids_t* ids, u32 pathId, u32 line, bb_packet_type_e packetType, size_t maxSize, b32 recurse)
+static u32 bb_resolve_id(const char* name, u32 hash, bb_ids_t* ids, u32 pathId, u32 line, bb_packet_type_e packetType, size_t maxSize, b32 recurse)
 {
 	bb_decoded_packet_t decoded;
-	u32 existing = bb_find_id((name = (name ? name : "")), ids);
+	u32 existing = bb_id_map_find(&ids->map, (name = (name ? name : "")), hash);
 	if (existing)
 	{
 		return existing;
@@ -1094,7 +2915,7 @@ static u32 bb_resolve_id(const char* name, bb_ids_t* ids, u32 pathId, u32 line,
 				if (s[0] == ':' && s[1] == ':')
 				{
 					*c = '\0';
-					bb_resolve_id(categoryBuf, ids, pathId, line, packetType, maxSize, false);
+					bb_resolve_id(categoryBuf, bb_id_map_hash(categoryBuf), ids, pathId, line, packetType, maxSize, false);
 					*c++ = *s++;
 				}
 				*c++ = *s++;
@@ -1102,8 +2923,12 @@ static u32 bb_resolve_id(const char* name, bb_ids_t* ids, u32 pathId, u32 line,
 		}
 
 		{
+			bb_id_t* newIdData = bb_add_id(ids, name);
+			if (!newIdData && s_bb_pools.active)
+			{
+				return 0; // out of pooled ids, so logs go out with no path or category
+			}
 			u32 newId = ++ids->lastId;
-			bb_id_t* newIdData = bba_add(*ids, 1);
 			// u32 tmp;
 			// for(tmp = 0; tmp < 1000; ++tmp) {
 			//	newIdData = bba_add(*ids, 1);
@@ -1114,33 +2939,56 @@ static u32 bb_resolve_id(const char* name, bb_ids_t* ids, u32 pathId, u32 line,
 				newIdData->header = decoded.header;
 				newIdData->id = newId;
 				newIdData->packetType = packetType;
-				newIdData->name = bb_strdup(name);
 			}
 			decoded.packet.registerId.id = newId;
 			bb_strncpy(decoded.packet.registerId.name, name, BB_MIN(maxSize, sizeof(decoded.packet.registerId.name)));
 			bb_send(&decoded);
+
+			// publish only after the id has been sent, so lock-free lookups can't log with it first
+			if (newIdData && newIdData->name)
+			{
+				bb_id_map_insert(&ids->map, newIdData->name, hash, newId);
+			}
 			return newId;
 		}
 	}
 }
 
-uint32_t bb_resolve_ids(const char* path, const char* category, uint32_t* pathId, uint32_t* categoryId, uint32_t line)
+uint32_t bb_resolve_ids_hashed(const char* path, uint32_t pathHash, const char* category, uint32_t categoryHash, uint32_t* pathId, uint32_t* categoryId, uint32_t line)
 {
 	if (!s_id_cs.initialized)
 		return 0;
+
+	// ids are only ever added while running, so hits never need s_id_cs
+	if (!*pathId)
+	{
+		*pathId = bb_id_map_find(&s_bb_pathIds.map, path ? path : "", pathHash);
+	}
+	if (!*categoryId)
+	{
+		*categoryId = bb_id_map_find(&s_bb_categoryIds.map, category ? category : "", categoryHash);
+	}
+	if (*pathId && *categoryId)
+		return 1;
+
 	bb_critical_section_lock(&s_id_cs);
 	if (!*pathId)
 	{
-		*pathId = bb_resolve_id(path, &s_bb_pathIds, 0, line, kBBPacketType_FileId, ~0U, false);
+		*pathId = bb_resolve_id(path, pathHash, &s_bb_pathIds, 0, line, kBBPacketType_FileId, ~0U, false);
 	}
 	if (!*categoryId)
 	{
-		*categoryId = bb_resolve_id(category, &s_bb_categoryIds, *pathId, line, kBBPacketType_CategoryId, kBBSize_Category, true);
+		*categoryId = bb_resolve_id(category, categoryHash, &s_bb_categoryIds, *pathId, line, kBBPacketType_CategoryId, kBBSize_Category, true);
 	}
 	bb_critical_section_unlock(&s_id_cs);
 	return 1;
 }
 
+uint32_t bb_resolve_ids(const char* path, const char* category, uint32_t* pathId, uint32_t* categoryId, uint32_t line)
+{
+	return bb_resolve_ids_hashed(path, bb_id_map_hash(path), category, bb_id_map_hash(category), pathId, categoryId, line);
+}
+
 #if BB_COMPILE_WIDECHAR
 uint32_t bb_resolve_ids_w(const char* path, const bb_wchar_t* category, uint32_t* pathId, uint32_t* categoryId, uint32_t line)
 {
@@ -1150,16 +2998,72 @@ uint32_t bb_resolve_ids_w(const char* path, const bb_wchar_t* category, uint32_t
 
 void bb_resolve_path_id(const char* path, uint32_t* pathId, uint32_t line)
 {
-	if (!s_id_cs.initialized)
+	if (!s_id_cs.initialized || *pathId)
+		return;
+	u32 pathHash = bb_id_map_hash(path);
+	*pathId = bb_id_map_find(&s_bb_pathIds.map, path ? path : "", pathHash);
+	if (*pathId)
 		return;
 	bb_critical_section_lock(&s_id_cs);
 	if (!*pathId)
 	{
-		*pathId = bb_resolve_id(path, &s_bb_pathIds, 0, line, kBBPacketType_FileId, ~0U, false);
+		*pathId = bb_resolve_id(path, pathHash, &s_bb_pathIds, 0, line, kBBPacketType_FileId, ~0U, false);
+	}
+	bb_critical_section_unlock(&s_id_cs);
+}
+
+static void bb_resolve_format_id(const char* fmt, uint32_t* formatId, u32 pathId, u32 line)
+{
+	bb_format_t format;
+	if (strlen(fmt) >= kBBSize_MaxPath || !bbformat_parse(fmt, &format))
+	{
+		*formatId = kBBFormatId_NotDeferred;
+		return;
+	}
+
+	bb_critical_section_lock(&s_id_cs);
+	if (!*formatId)
+	{
+		u32 newId = s_bb_formatIds.lastId + 1;
+		u32 chunkIndex = (newId - 1) / kBBFormatChunk_Size;
+		if (chunkIndex < kBBFormatChunk_Count && !s_bb_formatChunks[chunkIndex] && !s_bb_pools.active)
+		{
+			s_bb_formatChunks[chunkIndex] = (bb_format_t*)bb_malloc(kBBFormatChunk_Size * sizeof(bb_format_t));
+		}
+		bb_id_t* newIdData = (chunkIndex < kBBFormatChunk_Count && s_bb_formatChunks[chunkIndex]) ? bb_add_id(&s_bb_formatIds, fmt) : NULL;
+		if (newIdData)
+		{
+			bb_decoded_packet_t decoded;
+			bb_fill_header(&decoded, kBBPacketType_FormatId, pathId, line);
+			newIdData->header = decoded.header;
+			newIdData->id = newId;
+			newIdData->packetType = kBBPacketType_FormatId;
+			s_bb_formatChunks[chunkIndex][(newId - 1) % kBBFormatChunk_Size] = format;
+			s_bb_formatIds.lastId = newId;
+
+			decoded.packet.registerId.id = newId;
+			bb_strncpy(decoded.packet.registerId.name, fmt, sizeof(decoded.packet.registerId.name));
+			bb_send(&decoded);
+			*formatId = newId;
+		}
+		else
+		{
+			*formatId = kBBFormatId_NotDeferred;
+		}
 	}
 	bb_critical_section_unlock(&s_id_cs);
 }
 
+static const bb_format_t* bb_get_format(u32 formatId)
+{
+	if (formatId == 0 || formatId == kBBFormatId_NotDeferred)
+	{
+		return NULL;
+	}
+	const bb_format_t* chunk = s_bb_formatChunks[(formatId - 1) / kBBFormatChunk_Size];
+	return (chunk) ? chunk + (formatId - 1) % kBBFormatChunk_Size : NULL;
+}
+
 static bb_color_t bb_resolve_color_str(const char* str)
 {
 	// clang-format off
@@ -1199,61 +3103,105 @@ static void bb_resolve_and_set_colors(const char* str)
 	bb_set_color(fgColor, bgColor);
 }
 
-static void bb_trace_send(bb_decoded_packet_t* decoded, size_t textlen)
+typedef struct bb_trace_builder_s
+{
+	char* textStart; // kBBPacket_LogTextLargePrefixSize bytes into the trace buffer
+	size_t textBufferSize;
+	bb_packet_header_t header;
+	u32 categoryId;
+	u32 level;
+	s32 pieInstance;
+	bb_colors_t colors;
+	u8 pad[4];
+} bb_trace_builder_t;
+
+// The text is already in the trace buffer, right after room for a frame prefix, so the frame is built around
+// it and goes straight to the sinks.  Long text goes out as one kBBPacketType_LogTextLarge frame with
+// kBBInitFlag_LargeLogs, and otherwise as kBBPacketType_LogTextPartial frames - each one's prefix overwrites
+// the end of the text that has already been sent.
+static void bb_trace_send(bb_trace_builder_t* builder, size_t textlen)
 {
-	if (textlen >= kBBSize_LogText)
+	char* text = builder->textStart;
+	if (bb_callsite_is_repeat(&builder->header, text, textlen))
+		return;
+
+	if (textlen >= kBBSize_LogText && textlen <= kBBSize_LogTextLarge && !s_bb_send_callback &&
+	    (g_bb_initFlags & kBBInitFlag_LargeLogs) != 0)
+	{
+		// bbcon splits it back into partial frames for servers without kBBServerFeature_LargeLogs
+		u8* frame = (u8*)text - kBBPacket_LogTextLargePrefixSize;
+		const u32 frameLen = kBBPacket_LogTextLargePrefixSize + (u32)textlen;
+		bbpacket_write_log_text_prefix(frame, kBBPacketType_LogTextLarge, &builder->header, builder->categoryId, builder->level, builder->pieInstance, builder->colors);
+		bbpacket_write_frame_header(frame, frameLen, true);
+		bb_send_frame(frame, frameLen, kBBPacketType_LogTextLarge);
+		return;
+	}
+
+	for (;;)
 	{
-		char* text = decoded->packet.logText.text;
-		size_t preTextSize = (size_t)(text - (char*)decoded);
-		while (textlen >= kBBSize_LogText)
+		const b32 partial = textlen >= kBBSize_LogText;
+		const size_t chunkLen = (partial) ? kBBSize_LogText - 1 : textlen;
+		const bb_packet_type_e type = (partial) ? kBBPacketType_LogTextPartial : kBBPacketType_LogText;
+		if (s_bb_send_callback)
+		{
+			// send callbacks expect a decoded packet
+			bb_decoded_packet_t decoded;
+			decoded.type = type;
+			decoded.header = builder->header;
+			decoded.packet.logText.categoryId = builder->categoryId;
+			decoded.packet.logText.level = builder->level;
+			decoded.packet.logText.pieInstance = builder->pieInstance;
+			decoded.packet.logText.colors = builder->colors;
+			memcpy(decoded.packet.logText.text, text, chunkLen);
+			decoded.packet.logText.text[chunkLen] = '\0';
+			bb_send(&decoded);
+		}
+		else
 		{
-			bb_decoded_packet_t partial;
-			memcpy(&partial, decoded, preTextSize);
-			bb_strncpy(partial.packet.logText.text, text, kBBSize_LogText);
-			partial.type = kBBPacketType_LogTextPartial;
-			bb_send(&partial);
-			text += kBBSize_LogText - 1;
-			textlen -= kBBSize_LogText - 1;
+			u8* frame = (u8*)text - kBBPacket_LogTextPrefixSize;
+			const u32 frameLen = kBBPacket_LogTextPrefixSize + (u32)chunkLen;
+			bbpacket_write_log_text_prefix(frame, type, &builder->header, builder->categoryId, builder->level, builder->pieInstance, builder->colors);
+			bbpacket_write_frame_header(frame, frameLen, false);
+			bb_send_frame(frame, frameLen, type);
 		}
 
-		bb_decoded_packet_t remainder;
-		memcpy(&remainder, decoded, preTextSize);
-		bb_strncpy(remainder.packet.logText.text, text, textlen + 1);
-		bb_send(&remainder);
-	}
-	else
-	{
-		bb_send(decoded);
+		if (!partial)
+			break;
+		text += chunkLen;
+		textlen -= chunkLen;
 	}
 }
 
-typedef struct bb_trace_builder_s
-{
-	bb_decoded_packet_t* decoded;
-	size_t textOffset;
-	size_t textBufferSize;
-	char* textStart;
-} bb_trace_builder_t;
-
 static b32 bb_trace_begin(bb_trace_builder_t* builder, uint32_t pathId, uint32_t line)
 {
-	if (!s_bb_trace_packet_buffer)
+	if (!bb_get_trace_buffer())
 	{
-		s_bb_trace_packet_buffer = (bbtraceBuffer_t*)bb_malloc(sizeof(*s_bb_trace_packet_buffer));
-		if (!s_bb_trace_packet_buffer)
-		{
-			return false;
-		}
+		return false;
 	}
-	builder->decoded = (bb_decoded_packet_t*)s_bb_trace_packet_buffer->packetBuffer;
-	builder->textOffset = (size_t)(builder->decoded->packet.logText.text - (char*)builder->decoded);
-	builder->textBufferSize = sizeof(s_bb_trace_packet_buffer->packetBuffer) - builder->textOffset;
-	builder->textStart = s_bb_trace_packet_buffer->packetBuffer + sizeof(s_bb_trace_packet_buffer->packetBuffer) - builder->textBufferSize;
+	builder->textStart = s_bb_trace_packet_buffer->packetBuffer + kBBPacket_LogTextLargePrefixSize;
+	builder->textBufferSize = sizeof(s_bb_trace_packet_buffer->packetBuffer) - kBBPacket_LogTextLargePrefixSize;
 	bb_trace_partial_end();
-	bb_fill_header(builder->decoded, kBBPacketType_LogText, pathId, line);
+	bb_fill_packet_header(&builder->header, pathId, line);
 	return true;
 }
 
+// textStart holds len bytes of text and a terminator
+static void bb_trace_finish(bb_trace_builder_t* builder, size_t len, uint32_t categoryId, bb_log_level_e level, s32 pieInstance)
+{
+	if (level == kBBLogLevel_SetColor)
+	{
+		bb_resolve_and_set_colors(builder->textStart);
+	}
+	else
+	{
+		builder->categoryId = categoryId;
+		builder->level = (u32)(bb_log_level_e)level;
+		builder->pieInstance = pieInstance;
+		builder->colors = s_bb_colors;
+		bb_trace_send(builder, len);
+	}
+}
+
 static void bb_trace_end(bb_trace_builder_t* builder, int len, uint32_t categoryId, bb_log_level_e level, s32 pieInstance)
 {
 	int maxLen = (int)builder->textBufferSize - 2;
@@ -1263,22 +3211,14 @@ static void bb_trace_end(bb_trace_builder_t* builder, int len, uint32_t category
 		builder->textStart[len++] = '\n';
 	}
 	builder->textStart[len] = '\0';
-	if (level == kBBLogLevel_SetColor)
-	{
-		bb_resolve_and_set_colors(builder->decoded->packet.logText.text);
-	}
-	else
-	{
-		builder->decoded->packet.logText.categoryId = categoryId;
-		builder->decoded->packet.logText.level = (u32)(bb_log_level_e)level;
-		builder->decoded->packet.logText.pieInstance = pieInstance;
-		builder->decoded->packet.logText.colors = s_bb_colors;
-		bb_trace_send(builder->decoded, (size_t)len);
-	}
+	bb_trace_finish(builder, (size_t)len, categoryId, level, pieInstance);
 }
 
 static void bb_trace_va(uint32_t pathId, uint32_t line, uint32_t categoryId, bb_log_level_e level, s32 pieInstance, const char* fmt, va_list args)
 {
+	if (!bb_category_level_enabled(categoryId, level))
+		return;
+
 	bb_trace_builder_t builder = { BB_EMPTY_INITIALIZER };
 	if (!bb_trace_begin(&builder, pathId, line))
 	{
@@ -1296,31 +3236,125 @@ void bb_trace(uint32_t pathId, uint32_t line, uint32_t categoryId, bb_log_level_
 	va_end(args);
 }
 
+void bb_trace_deferred(uint32_t pathId, uint32_t line, uint32_t categoryId, bb_log_level_e level, s32 pieInstance, uint32_t* formatId, const char* fmt, ...)
+{
+	if (!bb_category_level_enabled(categoryId, level))
+		return;
+
+	va_list args;
+	va_start(args, fmt);
+	if (!*formatId && s_id_cs.initialized)
+	{
+		bb_resolve_format_id(fmt, formatId, pathId, line);
+	}
+
+	// send callbacks expect formatted text, and colors are parsed on the client.  Like bb_trace_send, the frame is
+	// built in the trace buffer, with the arguments packed where the frame needs them.
+	const bb_format_t* format = bb_get_format(*formatId);
+	bb_trace_builder_t builder = { BB_EMPTY_INITIALIZER };
+	u8* frame = NULL;
+	u16 argsLen = 0;
+	if (format && format->fmt == fmt && level != kBBLogLevel_SetColor && !s_bb_send_callback && bb_trace_begin(&builder, pathId, line))
+	{
+		frame = (u8*)s_bb_trace_packet_buffer->packetBuffer;
+		if (!bbformat_pack(format, frame + kBBPacket_LogTextDeferredPrefixSize, kBBSize_DeferredArgs, &argsLen, args))
+		{
+			frame = NULL;
+		}
+	}
+
+	if (frame)
+	{
+		if (!bb_callsite_is_repeat(&builder.header, frame + kBBPacket_LogTextDeferredPrefixSize, argsLen))
+		{
+			const u32 frameLen = kBBPacket_LogTextDeferredPrefixSize + argsLen;
+			bbpacket_write_log_text_prefix(frame, kBBPacketType_LogTextDeferred, &builder.header, categoryId, (u32)level, pieInstance, s_bb_colors);
+			bbpacket_write_log_text_deferred_format_id(frame, *formatId);
+			bbpacket_write_frame_header(frame, frameLen, false);
+			bb_send_frame(frame, frameLen, kBBPacketType_LogTextDeferred);
+		}
+	}
+	else
+	{
+		// bbformat_pack may have consumed some of the arguments
+		va_end(args);
+		va_start(args, fmt);
+		bb_trace_va(pathId, line, categoryId, level, pieInstance, fmt, args);
+	}
+	va_end(args);
+}
+
+// Fields go out as JSON after the text instead when they don't fit in kBBSize_KVFields, and when a send callback
+// is set, since send callbacks expect text.  Like bb_trace_send, the frame is built in the trace buffer: the fields
+// are encoded where the frame needs them, and the text copied in after them.
+void bb_trace_kv(uint32_t pathId, uint32_t line, uint32_t categoryId, bb_log_level_e level, s32 pieInstance, const char* text, const bb_kv_t* fields, uint32_t fieldCount)
+{
+	if (!bb_category_level_enabled(categoryId, level))
+		return;
+
+	bb_trace_builder_t builder = { BB_EMPTY_INITIALIZER };
+	if (!bb_trace_begin(&builder, pathId, line))
+	{
+		return;
+	}
+
+	// up to kBBSize_LogText, so fields too big for the frame still all go in the JSON
+	u8* frame = (u8*)s_bb_trace_packet_buffer->packetBuffer;
+	u8* encoded = frame + kBBPacket_LogTextKVPrefixSize;
+	const u32 encodedLen = bbkv_encode(fields, fieldCount, encoded, kBBSize_LogText);
+	if (!encodedLen && fieldCount)
+	{
+		bb_error("bb_trace_kv failed to encode fields");
+	}
+
+	text = (text) ? text : "";
+	const size_t textLen = strlen(text);
+	if (encodedLen <= kBBSize_KVFields && textLen < kBBSize_LogText - kBBSize_KVFields && level != kBBLogLevel_SetColor && !s_bb_send_callback)
+	{
+		// the repeat check covers everything after the same prefix as kBBPacketType_LogText
+		const u32 frameLen = kBBPacket_LogTextKVPrefixSize + encodedLen + (u32)textLen;
+		memcpy(encoded + encodedLen, text, textLen);
+		bbpacket_write_log_text_kv_fields_len(frame, (u16)encodedLen);
+		if (!bb_callsite_is_repeat(&builder.header, frame + kBBPacket_LogTextPrefixSize, frameLen - kBBPacket_LogTextPrefixSize))
+		{
+			bbpacket_write_log_text_prefix(frame, kBBPacketType_LogTextKV, &builder.header, categoryId, (u32)level, pieInstance, s_bb_colors);
+			bbpacket_write_frame_header(frame, frameLen, false);
+			bb_send_frame(frame, frameLen, kBBPacketType_LogTextKV);
+		}
+	}
+	else
+	{
+		// the fields overlap where the text goes, so they move to the end of the buffer first
+		u8* moved = (u8*)builder.textStart + builder.textBufferSize - encodedLen;
+		memmove(moved, encoded, encodedLen);
+		const size_t available = (size_t)(moved - (u8*)builder.textStart);
+		size_t len = BB_MIN(textLen, available - 1);
+		memcpy(builder.textStart, text, len);
+		if (len && len < available - 1)
+		{
+			builder.textStart[len++] = ' ';
+		}
+		len += BB_MIN(bbkv_format_json(moved, encodedLen, builder.textStart + len, (u32)(available - len)), (u32)(available - len - 1));
+		bb_trace_end(&builder, (int)len, categoryId, level, pieInstance);
+	}
+}
+
 #if BB_COMPILE_WIDECHAR
 typedef struct bb_trace_builder_w_s
 {
-	bb_decoded_packet_t* decoded;
-	size_t textBufferSize;
+	bb_trace_builder_t builder;
 	size_t wstrSize;
 	bb_wchar_t* wstr;
 } bb_trace_builder_w_t;
 
 static b32 bb_trace_begin_w(bb_trace_builder_w_t* builder, uint32_t pathId, uint32_t line)
 {
-	if (!s_bb_trace_packet_buffer)
+	if (!bb_trace_begin(&builder->builder, pathId, line))
 	{
-		s_bb_trace_packet_buffer = (bbtraceBuffer_t*)bb_malloc(sizeof(*s_bb_trace_packet_buffer));
-		if (!s_bb_trace_packet_buffer)
-		{
-			return false;
-		}
+		return false;
 	}
-	builder->decoded = (bb_decoded_packet_t*)s_bb_trace_packet_buffer->packetBuffer;
-	builder->textBufferSize = sizeof(s_bb_trace_packet_buffer->packetBuffer) - sizeof(bb_decoded_packet_t) + kBBSize_LogText;
 	builder->wstr = s_bb_trace_packet_buffer->wideBuffer;
 	builder->wstrSize = BB_ARRAYSIZE(s_bb_trace_packet_buffer->wideBuffer);
-	bb_trace_partial_end();
-	bb_fill_header(builder->decoded, kBBPacketType_LogText, pathId, line);
 	return true;
 }
 
@@ -1334,23 +3368,15 @@ static void bb_trace_end_w(bb_trace_builder_w_t* builder, int len, uint32_t cate
 	}
 	builder->wstr[len] = L'\0';
 	size_t numCharsConverted = 0;
-	bb_wcstombcs_inline(builder->wstr, builder->decoded->packet.logText.text, builder->textBufferSize, &numCharsConverted);
-	if (level == kBBLogLevel_SetColor)
-	{
-		bb_resolve_and_set_colors(builder->decoded->packet.logText.text);
-	}
-	else
-	{
-		builder->decoded->packet.logText.categoryId = categoryId;
-		builder->decoded->packet.logText.level = (u32)(bb_log_level_e)level;
-		builder->decoded->packet.logText.pieInstance = pieInstance;
-		builder->decoded->packet.logText.colors = s_bb_colors;
-		bb_trace_send(builder->decoded, numCharsConverted);
-	}
+	bb_wcstombcs_inline(builder->wstr, builder->builder.textStart, builder->builder.textBufferSize, &numCharsConverted);
+	bb_trace_finish(&builder->builder, numCharsConverted, categoryId, level, pieInstance);
 }
 
 static void bb_trace_va_w(uint32_t pathId, uint32_t line, uint32_t categoryId, bb_log_level_e level, s32 pieInstance, const bb_wchar_t* fmt, va_list args)
 {
+	if (!bb_category_level_enabled(categoryId, level))
+		return;
+
 	bb_trace_builder_w_t builder = { BB_EMPTY_INITIALIZER };
 	if (!bb_trace_begin_w(&builder, pathId, line))
 	{
@@ -1391,25 +3417,18 @@ void bb_trace_dynamic_preformatted_range(const char* path, uint32_t line, const
 	uint32_t pathId = 0;
 	uint32_t categoryId = 0;
 	bb_resolve_ids(path, category, &pathId, &categoryId, line);
+	if (!bb_category_level_enabled(categoryId, level))
+		return;
 
 	size_t len = (preformatted_end && preformatted_end > preformatted) ? (size_t)(preformatted_end - preformatted) : strlen(preformatted);
 	if (len < kBBSize_LogText)
 	{
-		bb_decoded_packet_t decoded = { BB_EMPTY_INITIALIZER };
-		bb_fill_header(&decoded, kBBPacketType_LogText, pathId, line);
-		decoded.packet.logText.categoryId = categoryId;
-		decoded.packet.logText.level = (u32)(bb_log_level_e)level;
-		decoded.packet.logText.pieInstance = pieInstance;
-		decoded.packet.logText.colors = s_bb_colors;
-		memcpy(&decoded.packet.logText.text, preformatted, len);
-		decoded.packet.logText.text[len] = '\0';
-		if (decoded.packet.logText.level == kBBLogLevel_SetColor)
-		{
-			bb_resolve_and_set_colors(decoded.packet.logText.text);
-		}
-		else
+		bb_trace_builder_t builder = { BB_EMPTY_INITIALIZER };
+		if (bb_trace_begin(&builder, pathId, line))
 		{
-			bb_send(&decoded);
+			memcpy(builder.textStart, preformatted, len);
+			builder.textStart[len] = '\0';
+			bb_trace_finish(&builder, len, categoryId, level, pieInstance);
 		}
 	}
 	else
@@ -1424,6 +3443,122 @@ void bb_trace_dynamic_preformatted(const char* path, uint32_t line, const char*
 	bb_trace_dynamic_preformatted_range(path, line, category, level, pieInstance, preformatted, NULL);
 }
 
+uint64_t bb_get_current_timestamp(void)
+{
+	return bb_current_timestamp();
+}
+
+static void bb_trace_batch_flush(u8* frames, u32* framesLen)
+{
+	if (*framesLen)
+	{
+		bb_send_frames(frames, *framesLen);
+		*framesLen = 0;
+	}
+}
+
+// Frames are built back to back in the trace buffer, and go to the sinks whenever it fills.  Send callbacks want
+// decoded packets, and the flight recorder and send thread route each frame on its own, so with any of them the
+// logs go through bb_trace_finish one at a time instead.
+void bb_trace_batch(const bb_batch_log_t* logs, uint32_t count)
+{
+	if (!count || !bb_get_trace_buffer())
+		return;
+
+	bb_trace_partial_end();
+	const b32 batched = !s_bb_send_callback && !bb_atomic_load_u32(&s_flightRecorder.minLevel) && !bb_atomic_load_u32(&s_send_thread.running);
+	const b32 largeLogs = (g_bb_initFlags & kBBInitFlag_LargeLogs) != 0;
+	const u64 now = bb_current_timestamp();
+	const u64 threadId = bb_get_current_thread_id();
+	u8* frames = (u8*)s_bb_trace_packet_buffer->packetBuffer;
+	u32 framesLen = 0;
+
+	// the strings can't change during the call, so runs of logs with the same path or category pointer share ids
+	const char* path = NULL;
+	const char* category = NULL;
+	u32 pathId = 0;
+	u32 categoryId = 0;
+	for (u32 i = 0; i < count; ++i)
+	{
+		const bb_batch_log_t* log = logs + i;
+		if (!i || log->path != path || !pathId)
+		{
+			path = log->path;
+			pathId = 0;
+		}
+		if (!i || log->category != category || !categoryId)
+		{
+			category = log->category;
+			categoryId = 0;
+		}
+		if (!pathId || !categoryId)
+		{
+			bb_resolve_ids(path, category, &pathId, &categoryId, log->line);
+		}
+		if (!bb_category_level_enabled(categoryId, log->level))
+			continue;
+
+		bb_packet_header_t header;
+		header.timestamp = (log->timestamp) ? log->timestamp : now;
+		header.threadId = (log->threadId) ? log->threadId : threadId;
+		header.fileId = pathId;
+		header.line = log->line;
+		const char* text = (log->text) ? log->text : "";
+		u32 textLen = (log->text) ? BB_MIN(log->textLen, (u32)kBBSize_LogTextLarge - 1) : 0;
+
+		if (!batched || log->level == kBBLogLevel_SetColor)
+		{
+			bb_trace_batch_flush(frames, &framesLen);
+			bb_trace_builder_t builder = { BB_EMPTY_INITIALIZER };
+			builder.textStart = s_bb_trace_packet_buffer->packetBuffer + kBBPacket_LogTextLargePrefixSize;
+			builder.textBufferSize = sizeof(s_bb_trace_packet_buffer->packetBuffer) - kBBPacket_LogTextLargePrefixSize;
+			builder.header = header;
+			memcpy(builder.textStart, text, textLen);
+			builder.textStart[textLen] = '\0';
+			bb_trace_finish(&builder, textLen, categoryId, log->level, log->pieInstance);
+			continue;
+		}
+
+		if (largeLogs && textLen >= kBBSize_LogText)
+		{
+			const u32 frameLen = kBBPacket_LogTextLargePrefixSize + textLen;
+			if (framesLen + frameLen > sizeof(s_bb_trace_packet_buffer->packetBuffer))
+			{
+				bb_trace_batch_flush(frames, &framesLen);
+			}
+			u8* frame = frames + framesLen;
+			bbpacket_write_log_text_prefix(frame, kBBPacketType_LogTextLarge, &header, categoryId, (u32)log->level, log->pieInstance, s_bb_colors);
+			memcpy(frame + kBBPacket_LogTextLargePrefixSize, text, textLen);
+			bbpacket_write_frame_header(frame, frameLen, true);
+			framesLen += frameLen;
+			continue;
+		}
+
+		for (;;)
+		{
+			const b32 partial = textLen >= kBBSize_LogText;
+			const u32 chunkLen = (partial) ? kBBSize_LogText - 1 : textLen;
+			const bb_packet_type_e type = (partial) ? kBBPacketType_LogTextPartial : kBBPacketType_LogText;
+			const u32 frameLen = kBBPacket_LogTextPrefixSize + chunkLen;
+			if (framesLen + frameLen > sizeof(s_bb_trace_packet_buffer->packetBuffer))
+			{
+				bb_trace_batch_flush(frames, &framesLen);
+			}
+			u8* frame = frames + framesLen;
+			bbpacket_write_log_text_prefix(frame, type, &header, categoryId, (u32)log->level, log->pieInstance, s_bb_colors);
+			memcpy(frame + kBBPacket_LogTextPrefixSize, text, chunkLen);
+			bbpacket_write_frame_header(frame, frameLen, false);
+			framesLen += frameLen;
+
+			if (!partial)
+				break;
+			text += chunkLen;
+			textLen -= chunkLen;
+		}
+	}
+	bb_trace_batch_flush(frames, &framesLen);
+}
+
 #if BB_COMPILE_WIDECHAR
 void bb_trace_dynamic_w(const char* path, uint32_t line, const bb_wchar_t* category, bb_log_level_e level, int32_t pieInstance, const bb_wchar_t* fmt, ...)
 {
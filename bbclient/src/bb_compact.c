@@ -0,0 +1,296 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#if !defined(BB_ENABLED) || BB_ENABLED
+
+#include "bb.h"
+
+#include "bbclient/bb_array.h"
+#include "bbclient/bb_compact.h"
+#include "bbclient/bb_malloc.h"
+#include "bbclient/bb_serialize.h"
+#include <string.h>
+
+enum
+{
+	kBBCompact_NotFound = ~0u,
+};
+
+void bbcompact_reset(bb_compact_state_t* state)
+{
+	bba_free(state->callsites);
+	bba_free(state->threads);
+	if (state->buckets)
+	{
+		bb_free(state->buckets);
+		state->buckets = NULL;
+	}
+	state->lastThread = 0;
+}
+
+static u32 bbcompact_find_thread(bb_compact_state_t* state, u64 threadId)
+{
+	// most runs of logs come from the same thread
+	if (state->lastThread < state->threads.count && state->threads.data[state->lastThread].threadId == threadId)
+	{
+		return state->lastThread;
+	}
+	for (u32 i = 0; i < state->threads.count; ++i)
+	{
+		if (state->threads.data[i].threadId == threadId)
+		{
+			state->lastThread = i;
+			return i;
+		}
+	}
+	return kBBCompact_NotFound;
+}
+
+static u32 bbcompact_hash_callsite(const bb_compact_callsite_t* callsite)
+{
+	u32 hash = 2166136261u;
+	hash = (hash ^ callsite->fileId) * 16777619u;
+	hash = (hash ^ callsite->line) * 16777619u;
+	hash = (hash ^ callsite->categoryId) * 16777619u;
+	hash = (hash ^ callsite->level) * 16777619u;
+	hash = (hash ^ (u32)callsite->pieInstance) * 16777619u;
+	hash = (hash ^ (u32)callsite->colors.fg) * 16777619u;
+	hash = (hash ^ (u32)callsite->colors.bg) * 16777619u;
+	return hash & (kBBCompact_HashBuckets - 1);
+}
+
+static b32 bbcompact_callsite_matches(const bb_compact_callsite_t* a, const bb_compact_callsite_t* b)
+{
+	return a->fileId == b->fileId &&
+	       a->line == b->line &&
+	       a->categoryId == b->categoryId &&
+	       a->level == b->level &&
+	       a->pieInstance == b->pieInstance &&
+	       a->colors.fg == b->colors.fg &&
+	       a->colors.bg == b->colors.bg;
+}
+
+static u32 bbcompact_find_callsite(const bb_compact_state_t* state, const bb_compact_callsite_t* callsite, u32 bucket)
+{
+	for (u32 next = state->buckets[bucket]; next; next = state->callsites.data[next - 1].next)
+	{
+		if (bbcompact_callsite_matches(state->callsites.data + next - 1, callsite))
+		{
+			return next - 1;
+		}
+	}
+	return kBBCompact_NotFound;
+}
+
+static u32 bbcompact_write_frame(bb_decoded_packet_t* decoded, u8* dest, u32 destSize)
+{
+	u16 serializedLen = bbpacket_serialize(decoded, dest + 2, (u16)BB_MIN(destSize - 2, 0xFFFFu));
+	if (!serializedLen)
+		return 0;
+	serializedLen += 2;
+	dest[0] = (u8)(serializedLen >> 8);
+	dest[1] = (u8)(serializedLen & 0xFF);
+	return serializedLen;
+}
+
+u32 bbcompact_encode_frame(bb_compact_state_t* state, const u8* frame, u32 frameLen, u8* dest, u32 destSize)
+{
+	if (frameLen < 3 || frame[2] != kBBPacketType_LogText)
+		return 0;
+
+	// same layout as bbpacket_serialize_log_text
+	bb_packet_header_t header;
+	bb_compact_callsite_t callsite;
+	bb_serialize_t ser;
+	bbserialize_init_read(&ser, (void*)(frame + 3), frameLen - 3);
+	bbserialize_u64(&ser, &header.timestamp);
+	bbserialize_u64(&ser, &header.threadId);
+	bbserialize_u32(&ser, &callsite.fileId);
+	bbserialize_u32(&ser, &callsite.line);
+	bbserialize_u32(&ser, &callsite.categoryId);
+	bbserialize_u32(&ser, &callsite.level);
+	bbserialize_s32(&ser, &callsite.pieInstance);
+	bbserialize_s32(&ser, (s32*)&callsite.colors.fg);
+	bbserialize_s32(&ser, (s32*)&callsite.colors.bg);
+	if (ser.state != kBBSerialize_Ok)
+		return 0;
+	const u8* text = frame + 3 + ser.nCursorBytes;
+	const u32 textLen = frameLen - 3 - ser.nCursorBytes;
+
+	u32 threadIndex = bbcompact_find_thread(state, header.threadId);
+	if (destSize < frameLen + kBBCompact_MaxRegistrationBytes)
+	{
+		// sent as is - the other end moves the thread's timestamp along just the same
+		if (threadIndex != kBBCompact_NotFound)
+		{
+			state->threads.data[threadIndex].timestamp = header.timestamp;
+		}
+		return 0;
+	}
+
+	// From here on the frame is always replaced by what is in dest, so the registrations
+	// recorded in state are always sent.
+	u32 destCursor = 0;
+	if (threadIndex == kBBCompact_NotFound)
+	{
+		bb_compact_thread_t* thread = bba_add(state->threads, 1);
+		if (thread)
+		{
+			thread->threadId = header.threadId;
+			thread->timestamp = header.timestamp;
+			threadIndex = state->threads.count - 1;
+			state->lastThread = threadIndex;
+
+			bb_decoded_packet_t decoded;
+			decoded.type = kBBPacketType_ThreadIndex;
+			decoded.header = header;
+			decoded.header.fileId = callsite.fileId;
+			decoded.header.line = callsite.line;
+			decoded.packet.threadIndex.index = threadIndex;
+			destCursor += bbcompact_write_frame(&decoded, dest + destCursor, destSize - destCursor);
+		}
+	}
+
+	u32 callsiteId = kBBCompact_NotFound;
+	if (!state->buckets)
+	{
+		state->buckets = (u32*)bb_malloc(kBBCompact_HashBuckets * sizeof(u32));
+		if (state->buckets)
+		{
+			memset(state->buckets, 0, kBBCompact_HashBuckets * sizeof(u32));
+		}
+	}
+	if (state->buckets)
+	{
+		const u32 bucket = bbcompact_hash_callsite(&callsite);
+		callsiteId = bbcompact_find_callsite(state, &callsite, bucket);
+		if (callsiteId == kBBCompact_NotFound)
+		{
+			bb_compact_callsite_t* added = bba_add(state->callsites, 1);
+			if (added)
+			{
+				*added = callsite;
+				added->next = state->buckets[bucket];
+				state->buckets[bucket] = state->callsites.count;
+				callsiteId = state->callsites.count - 1;
+
+				bb_decoded_packet_t decoded;
+				decoded.type = kBBPacketType_Callsite;
+				decoded.header = header;
+				decoded.header.fileId = callsite.fileId;
+				decoded.header.line = callsite.line;
+				decoded.packet.callsite.id = callsiteId;
+				decoded.packet.callsite.categoryId = callsite.categoryId;
+				decoded.packet.callsite.level = callsite.level;
+				decoded.packet.callsite.pieInstance = callsite.pieInstance;
+				decoded.packet.callsite.colors = callsite.colors;
+				destCursor += bbcompact_write_frame(&decoded, dest + destCursor, destSize - destCursor);
+			}
+		}
+	}
+
+	if (threadIndex == kBBCompact_NotFound || callsiteId == kBBCompact_NotFound)
+	{
+		// out of memory - send the log as it is, after any registration that did make it
+		if (threadIndex != kBBCompact_NotFound)
+		{
+			state->threads.data[threadIndex].timestamp = header.timestamp;
+		}
+		memcpy(dest + destCursor, frame, frameLen);
+		return destCursor + frameLen;
+	}
+
+	bb_compact_thread_t* thread = state->threads.data + threadIndex;
+	const s64 delta = (s64)(header.timestamp - thread->timestamp);
+	u64 zigzag = ((u64)delta << 1) ^ (u64)(delta >> 63);
+	u64 callsiteValue = callsiteId;
+	u64 threadValue = threadIndex;
+	u8 type = kBBPacketType_LogTextCompact;
+	thread->timestamp = header.timestamp;
+
+	u8* compact = dest + destCursor;
+	bbserialize_init_write(&ser, compact + 2, destSize - destCursor - 2);
+	bbserialize_u8(&ser, &type);
+	bbserialize_varint(&ser, &callsiteValue);
+	bbserialize_varint(&ser, &threadValue);
+	bbserialize_varint(&ser, &zigzag);
+	bbserialize_buffer(&ser, (void*)text, textLen);
+	const u32 compactLen = ser.nCursorBytes + 2;
+	compact[0] = (u8)(compactLen >> 8);
+	compact[1] = (u8)(compactLen & 0xFF);
+	return destCursor + compactLen;
+}
+
+b32 bbcompact_decode(bb_compact_state_t* state, bb_decoded_packet_t* decoded)
+{
+	switch (decoded->type)
+	{
+	case kBBPacketType_Callsite:
+	{
+		const bb_packet_callsite_t* packet = &decoded->packet.callsite;
+		if (packet->id > state->callsites.count)
+			return false;
+		if (packet->id == state->callsites.count && !bba_add(state->callsites, 1))
+			return false;
+		bb_compact_callsite_t* callsite = state->callsites.data + packet->id;
+		callsite->fileId = decoded->header.fileId;
+		callsite->line = decoded->header.line;
+		callsite->categoryId = packet->categoryId;
+		callsite->level = packet->level;
+		callsite->pieInstance = packet->pieInstance;
+		callsite->colors = packet->colors;
+		return true;
+	}
+
+	case kBBPacketType_ThreadIndex:
+	{
+		const u32 index = decoded->packet.threadIndex.index;
+		if (index > state->threads.count)
+			return false;
+		if (index == state->threads.count && !bba_add(state->threads, 1))
+			return false;
+		state->threads.data[index].threadId = decoded->header.threadId;
+		state->threads.data[index].timestamp = decoded->header.timestamp;
+		return true;
+	}
+
+	case kBBPacketType_LogText:
+	{
+		const u32 index = bbcompact_find_thread(state, decoded->header.threadId);
+		if (index != kBBCompact_NotFound)
+		{
+			state->threads.data[index].timestamp = decoded->header.timestamp;
+		}
+		return true;
+	}
+
+	case kBBPacketType_LogTextCompact:
+	{
+		const u64 callsiteId = decoded->header.fileId;
+		const u64 threadIndex = decoded->header.threadId;
+		if (callsiteId >= state->callsites.count || threadIndex >= state->threads.count)
+			return false;
+		const bb_compact_callsite_t* callsite = state->callsites.data + callsiteId;
+		bb_compact_thread_t* thread = state->threads.data + threadIndex;
+		const u64 zigzag = decoded->header.timestamp;
+		const s64 delta = (s64)(zigzag >> 1) ^ -(s64)(zigzag & 1);
+		thread->timestamp += (u64)delta;
+
+		decoded->type = kBBPacketType_LogText;
+		decoded->header.timestamp = thread->timestamp;
+		decoded->header.threadId = thread->threadId;
+		decoded->header.fileId = callsite->fileId;
+		decoded->header.line = callsite->line;
+		decoded->packet.logText.categoryId = callsite->categoryId;
+		decoded->packet.logText.level = callsite->level;
+		decoded->packet.logText.pieInstance = callsite->pieInstance;
+		decoded->packet.logText.colors = callsite->colors;
+		return true;
+	}
+
+	default:
+		return true;
+	}
+}
+
+#endif // #if BB_ENABLED
@@ -6,9 +6,13 @@
 #include "bb.h"
 
 #include "bbclient/bb_connection.h"
+#include "bbclient/bb_file.h"
 #include "bbclient/bb_log.h"
+#include "bbclient/bb_malloc.h"
 #include "bbclient/bb_packet.h"
+#include "bbclient/bb_packet_ring.h"
 #include "bbclient/bb_socket_errors.h"
+#include "bbclient/bb_string.h"
 #include "bbclient/bb_time.h"
 #include <string.h> // for memset
 
@@ -43,22 +47,66 @@
 	}
 
 static void bbcon_disconnect_no_flush_no_lock(bb_connection_t* con);
+static void bbcon_drain_backlog_no_lock(bb_connection_t* con, b32 retry);
+static void bbcon_clear_backlog_no_lock(bb_connection_t* con);
+static void bbcon_send_bytes_no_lock(bb_connection_t* con, const void* pData, u32 nBytes);
 
 enum
 {
 	kBBCon_SendIntervalMillis = 500,
 };
 
+enum
+{
+	kBBBacklog_DefaultQueueSize = 256 * 1024,
+	kBBBacklog_MinQueueSize = 2 * kBBFrame_MaxExtendedSize,
+	kBBBacklog_SpillRecordHeaderSize = 4, // [u32 length] before each frame in the spill file
+};
+
+typedef enum
+{
+	kBBBacklogLane_Priority, // non-log frames, and logs at kBBLogLevel_Warning and above
+	kBBBacklogLane_Normal,
+	kBBBacklogLane_Count
+} bb_backlog_lane_e;
+
+typedef struct bb_connection_backlog_s
+{
+	bb_packet_ring_t* lanes[kBBBacklogLane_Count];
+	bb_file_handle_t spillWriteHandle;
+	bb_file_handle_t spillReadHandle;
+	u64 spillWritten; // bytes of whole records in the spill file
+	u64 spillRead;
+	b32 spillUnflushed;
+	b32 spillFailed; // a write came up short - nothing more is spilled
+	b32 draining;    // a frame is on its way out of pending - anything sent meanwhile is queued behind it
+	u32 policy;      // bb_backpressure_e
+	u32 pendingLen;
+	u32 dropped[kBBLogLevel_Count];
+	char spillPath[kBBSize_MaxPath];
+	u8 pending[kBBFrame_MaxExtendedSize];
+	u8 scratch[kBBBacklog_SpillRecordHeaderSize + kBBFrame_MaxExtendedSize];
+	u8 pad[4];
+} bb_connection_backlog_t;
+
 void bbcon_init(bb_connection_t* con)
 {
 	bb_critical_section_init(&con->cs);
 	con->sentBytesTotal = con->receivedBytesTotal = 0u;
 	con->socket = BB_INVALID_SOCKET;
 	con->sendCursor = con->recvCursor = con->decodeCursor = 0;
+	con->sendBatchCursor = con->recvBatchCursor = con->recvBatchLen = 0;
+	con->decodedFromBatch = false;
+	bbcompact_reset(&con->compactSend);
+	bbcompact_reset(&con->compactRecv);
 	con->prevSendTime = 0;
 	con->sendInterval = kBBCon_SendIntervalMillis;
-	con->flags = con->flags & (~((u32)kBBCon_Client | (u32)kBBCon_Server));
+	con->flags = con->flags & (~((u32)kBBCon_Client | (u32)kBBCon_Server | (u32)kBBCon_Batches | (u32)kBBCon_CompactLogs | (u32)kBBCon_LargeLogs));
 	con->state = kBBConnection_NotConnected;
+	con->backlog = NULL;
+	con->sendBatch = con->recvBatch = NULL;
+	con->lzHashTable = NULL;
+	memset(&con->stats, 0, sizeof(con->stats));
 	if (!con->connectTimeoutInterval)
 	{
 		con->connectTimeoutInterval = 10000;
@@ -68,6 +116,12 @@ void bbcon_init(bb_connection_t* con)
 void bbcon_shutdown(bb_connection_t* con)
 {
 	bbcon_reset(con);
+	bbcon_set_backpressure(con, kBBBackpressure_Block, 0, NULL);
+	bb_free(con->sendBatch);
+	bb_free(con->recvBatch);
+	bb_free(con->lzHashTable);
+	con->sendBatch = con->recvBatch = NULL;
+	con->lzHashTable = NULL;
 	bb_critical_section_shutdown(&con->cs);
 }
 
@@ -76,8 +130,12 @@ void bbcon_reset(bb_connection_t* con)
 	bbcon_disconnect(con);
 	con->sentBytesTotal = con->receivedBytesTotal = 0u;
 	con->sendCursor = con->recvCursor = con->decodeCursor = 0;
+	con->sendBatchCursor = con->recvBatchCursor = con->recvBatchLen = 0;
+	con->decodedFromBatch = false;
+	bbcompact_reset(&con->compactSend);
+	bbcompact_reset(&con->compactRecv);
 	con->prevSendTime = 0;
-	con->flags = con->flags = con->flags & (~((u32)kBBCon_Client | (u32)kBBCon_Server));
+	con->flags &= ~((u32)kBBCon_Client | (u32)kBBCon_Server | (u32)kBBCon_Batches | (u32)kBBCon_CompactLogs | (u32)kBBCon_LargeLogs);
 	if (!con->connectTimeoutInterval)
 	{
 		con->connectTimeoutInterval = 10000;
@@ -211,17 +269,80 @@ b32 bbcon_connect_client_async_ipv4(bb_connection_t* con, u32 remoteAddr, u16 re
 	return true;
 }
 
-b32 bbcon_tick_connecting(bb_connection_t* con)
+bb_socket bbcon_connect_socket(const bb_connection_t* con, const struct sockaddr* remoteAddr, size_t remoteAddrSize)
 {
-	BB_TIMEVAL tv = { BB_EMPTY_INITIALIZER };
-	tv.tv_usec = 1000; // 1 millisecond
+	char ipport[32];
+	bb_socket testSocket = socket(remoteAddr->sa_family, SOCK_STREAM, IPPROTO_TCP);
+	if (testSocket == BB_INVALID_SOCKET)
+	{
+		BBCON_ERROR("bbcon_connect_socket failed - could not create socket");
+		return BB_INVALID_SOCKET;
+	}
+
+	bb_format_addr(ipport, sizeof(ipport), remoteAddr, remoteAddrSize, true);
+	BBCON_LOG("BlackBox client trying to connect to %s", ipport);
+
+	bbnet_socket_nodelay(testSocket, true);
+	bbnet_socket_nonblocking(testSocket, true);
+
+	int ret = connect(testSocket, remoteAddr, (int)bbnet_get_addr_size(remoteAddr, (socklen_t)remoteAddrSize));
+	int err = (ret == BB_SOCKET_ERROR) ? BBNET_ERRNO : 0;
+	if (err == BBNET_EWOULDBLOCK || err == BBNET_EINPROGRESS)
+	{
+		err = 0;
+		const u64 timeoutTime = bb_current_time_ms() + con->connectTimeoutInterval;
+		for (;;)
+		{
+			ret = bbnet_socket_wait(testSocket, true, 1);
+			if (ret == 1)
+			{
+				// writable once the connect has finished, either way
+				socklen_t errLen = sizeof(err);
+				if (getsockopt(testSocket, SOL_SOCKET, SO_ERROR, (char*)&err, &errLen) == BB_SOCKET_ERROR)
+				{
+					err = BBNET_ERRNO;
+				}
+				break;
+			}
+			if (ret == BB_SOCKET_ERROR && BBNET_ERRNO != BBNET_EWOULDBLOCK)
+			{
+				err = BBNET_ERRNO;
+				break;
+			}
+			if (bb_current_time_ms() >= timeoutTime)
+			{
+				BBCON_ERROR("bbcon_connect_socket failed - timed out waiting to connect to %s", ipport);
+				BB_CLOSE(testSocket);
+				return BB_INVALID_SOCKET;
+			}
+		}
+	}
+
+	if (err)
+	{
+		BBCON_ERROR("BlackBox client connect to %s failed with errno %d (%s)", ipport, err, bbnet_error_to_string(err));
+		BB_CLOSE(testSocket);
+		return BB_INVALID_SOCKET;
+	}
+
+	BBCON_LOG("BlackBox client connected to %s", ipport);
+	return testSocket;
+}
 
-	fd_set set;
-	FD_ZERO(&set);
-	BB_FD_SET(con->socket, &set);
+void bbcon_connect_client_socket(bb_connection_t* con, bb_socket socket)
+{
+	bb_critical_section_lock(&con->cs);
+	bbcon_reset(con);
+	con->socket = socket;
+	con->flags |= kBBCon_Client;
+	con->state = kBBConnection_Connected;
+	bb_critical_section_unlock(&con->cs);
+}
 
+b32 bbcon_tick_connecting(bb_connection_t* con)
+{
 	//BBCON_LOG("BlackBox client connecting tick");
-	int ret = select((int)con->socket + 1, 0, &set, 0, &tv);
+	int ret = bbnet_socket_wait(con->socket, true, 1);
 	int err = (ret == BB_SOCKET_ERROR) ? BBNET_ERRNO : 0;
 	if (err == BBNET_EWOULDBLOCK)
 	{
@@ -318,7 +439,8 @@ bb_socket bbcon_init_server(u32* localIp, u16* localPort)
 	bb_socket testSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 	if (testSocket == BB_INVALID_SOCKET)
 	{
-		BB_ERROR_A("bbcon", "bbcon_init_server failed - could create socket");
+		int err = BBNET_ERRNO;
+		BB_ERROR_A("bbcon", "bbcon_init_server failed - could not create socket - errno %d (%s)", err, bbnet_error_to_string(err));
 		return BB_INVALID_SOCKET;
 	}
 
@@ -374,20 +496,12 @@ b32 bbcon_connect_server(bb_connection_t* con, bb_socket testSocket, u32 localAd
 
 b32 bbcon_tick_listening(bb_connection_t* con)
 {
-	BB_TIMEVAL tv;
-	fd_set set;
 	struct sockaddr_in remoteAddrStorage; // client address
 	socklen_t addrLen = sizeof(remoteAddrStorage);
 	bb_socket clientSock;
 
-	tv.tv_sec = 0;
-	tv.tv_usec = 1000;
-
-	FD_ZERO(&set);
-	BB_FD_SET(con->socket, &set);
-
 	// Now wait for the client to connect
-	if (1 != select((int)con->socket + 1, &set, 0, 0, &tv))
+	if (1 != bbnet_socket_wait(con->socket, false, 1))
 	{
 		u64 now = bb_current_time_ms();
 		if (now >= con->connectTimeoutTime)
@@ -401,7 +515,15 @@ b32 bbcon_tick_listening(bb_connection_t* con)
 	clientSock = accept(con->socket, (struct sockaddr*)&remoteAddrStorage, &addrLen);
 	if (clientSock == BB_INVALID_SOCKET)
 	{
-		BBCON_ERROR("bbcon_connect_server failed - client failed to connect");
+		int err = BBNET_ERRNO;
+		if (err == BBNET_EMFILE)
+		{
+			BBCON_ERROR("bbcon_connect_server refused client - out of file descriptors");
+		}
+		else
+		{
+			BBCON_ERROR("bbcon_connect_server failed - client failed to connect with errno %d (%s)", err, bbnet_error_to_string(err));
+		}
 		bbcon_disconnect_no_flush(con);
 		return false;
 	}
@@ -440,28 +562,28 @@ static void bbcon_flush_no_lock(bb_connection_t* con, b32 retry)
 {
 	int ret;
 	u32 nSendCursor = 0;
-	fd_set set;
-	struct timeval tv;
 
 	u64 start = bb_current_time_ms();
 	u64 timeout = start + 2000;
 
+	const b32 stats = (con->flags & kBBCon_Stats) != 0 && con->sendCursor > 0;
+	const u64 startNanoseconds = stats ? bb_monotonic_nanoseconds() : 0;
+	if (stats)
+	{
+		con->stats.maxSendBytes = BB_MAX(con->stats.maxSendBytes, con->sendCursor + con->sendBatchCursor);
+	}
+
 	if (con->socket != BB_INVALID_SOCKET)
 	{
 		while (nSendCursor < con->sendCursor)
 		{
-			FD_ZERO(&set);
-			BB_FD_SET(con->socket, &set);
-
-			tv.tv_sec = 0;
-			tv.tv_usec = 1000;
-			ret = select((int)con->socket + 1, 0, &set, 0, &tv);
-			//BBCON_LOG( "Flush select ret:%d", ret );
+			ret = bbnet_socket_wait(con->socket, true, retry ? 1 : 0);
+			//BBCON_LOG( "Flush wait ret:%d", ret );
 
 			if (ret == BB_SOCKET_ERROR)
 			{
 				int err = BBNET_ERRNO;
-				BBCON_LOG("bbcon_flush: disconnected during select with errno %d (%s)", err, bbnet_error_to_string(err));
+				BBCON_LOG("bbcon_flush: disconnected during wait with errno %d (%s)", err, bbnet_error_to_string(err));
 				bbcon_disconnect_no_flush_no_lock(con);
 				break;
 			}
@@ -499,6 +621,7 @@ static void bbcon_flush_no_lock(bb_connection_t* con, b32 retry)
 			}
 
 			con->sentBytesTotal += (u64)ret;
+			con->stats.bytesSent += (u64)ret;
 			nSendCursor += (u32)ret;
 			if (!retry)
 			{
@@ -508,6 +631,11 @@ static void bbcon_flush_no_lock(bb_connection_t* con, b32 retry)
 	}
 
 	u64 end = bb_current_time_ms();
+	if (stats)
+	{
+		con->stats.flushNanoseconds += bb_monotonic_nanoseconds() - startNanoseconds;
+		++con->stats.flushes;
+	}
 
 	if (nSendCursor < con->sendCursor)
 	{
@@ -529,6 +657,112 @@ static void bbcon_flush_no_lock(bb_connection_t* con, b32 retry)
 	}
 }
 
+// Compresses the frames waiting in sendBatch into a single batch frame at the end of sendBuffer.  Returns false
+// if sendBuffer couldn't be flushed enough to hold it - with retry, the frames are sent uncompressed instead, so
+// that only happens once the socket is gone.
+static b32 bbcon_seal_batch_no_lock(bb_connection_t* con, b32 retry)
+{
+	if (!con->sendBatchCursor)
+		return true;
+
+	const u32 kSendBufferSize = sizeof(con->sendBuffer);
+	const u32 maxFrameBytes = kBBBatch_HeaderSize + bblz_compress_bound(con->sendBatchCursor);
+	if (kSendBufferSize - con->sendCursor < maxFrameBytes)
+	{
+		bbcon_flush_no_lock(con, retry);
+		if (kSendBufferSize - con->sendCursor < maxFrameBytes)
+		{
+			if (!retry)
+				return false;
+
+			const u32 batchBytes = con->sendBatchCursor;
+			con->sendBatchCursor = 0;
+			bbcon_send_bytes_no_lock(con, con->sendBatch, batchBytes);
+			return con->socket != BB_INVALID_SOCKET;
+		}
+	}
+
+	u8* frame = con->sendBuffer + con->sendCursor;
+	u32 compressedBytes = bblz_compress(con->sendBatch, con->sendBatchCursor, frame + kBBBatch_HeaderSize, maxFrameBytes - kBBBatch_HeaderSize, con->lzHashTable);
+	if (compressedBytes && compressedBytes + kBBBatch_HeaderSize < con->sendBatchCursor)
+	{
+		u32 frameBytes = compressedBytes + kBBBatch_HeaderSize;
+		frame[0] = (u8)(frameBytes >> 8);
+		frame[1] = (u8)(frameBytes & 0xFF);
+		frame[2] = kBBPacketType_CompressedBatch;
+		frame[3] = (u8)(con->sendBatchCursor >> 8);
+		frame[4] = (u8)(con->sendBatchCursor & 0xFF);
+		con->sendCursor += frameBytes;
+	}
+	else
+	{
+		// not worth compressing - send the frames as they are
+		memcpy(frame, con->sendBatch, con->sendBatchCursor);
+		con->sendCursor += con->sendBatchCursor;
+	}
+	con->sendBatchCursor = 0;
+	return true;
+}
+
+static b32 bbcon_reserve_batches_no_lock(bb_connection_t* con)
+{
+	if (!con->sendBatch)
+	{
+		con->sendBatch = (u8*)bb_malloc(kBBBatch_MaxExpandedSize);
+	}
+	if (!con->lzHashTable)
+	{
+		con->lzHashTable = (u16*)bb_malloc(kBBLZ_HashEntries * sizeof(u16));
+	}
+	return con->sendBatch && con->lzHashTable;
+}
+
+b32 bbcon_reserve_batches(bb_connection_t* con)
+{
+	if (!con->cs.initialized)
+		return false;
+	bb_critical_section_lock(&con->cs);
+	const b32 reserved = bbcon_reserve_batches_no_lock(con);
+	bb_critical_section_unlock(&con->cs);
+	return reserved;
+}
+
+void bbcon_enable_batches(bb_connection_t* con)
+{
+	if (!con->cs.initialized)
+		return;
+	bb_critical_section_lock(&con->cs);
+	if (con->socket != BB_INVALID_SOCKET && bbcon_reserve_batches_no_lock(con))
+	{
+		con->flags |= kBBCon_Batches;
+	}
+	bb_critical_section_unlock(&con->cs);
+}
+
+void bbcon_enable_compact_logs(bb_connection_t* con)
+{
+	if (!con->cs.initialized)
+		return;
+	bb_critical_section_lock(&con->cs);
+	if (con->socket != BB_INVALID_SOCKET)
+	{
+		con->flags |= kBBCon_CompactLogs;
+	}
+	bb_critical_section_unlock(&con->cs);
+}
+
+void bbcon_enable_large_logs(bb_connection_t* con)
+{
+	if (!con->cs.initialized)
+		return;
+	bb_critical_section_lock(&con->cs);
+	if (con->socket != BB_INVALID_SOCKET)
+	{
+		con->flags |= kBBCon_LargeLogs;
+	}
+	bb_critical_section_unlock(&con->cs);
+}
+
 void bbcon_disconnect(bb_connection_t* con)
 {
 	if (!con->cs.initialized || con->state == kBBConnection_NotConnected)
@@ -537,9 +771,12 @@ void bbcon_disconnect(bb_connection_t* con)
 	if (con->socket != BB_INVALID_SOCKET)
 	{
 		con->state = kBBConnection_NotConnected;
+		bbcon_drain_backlog_no_lock(con, true);
+		bbcon_seal_batch_no_lock(con, true);
 		bbcon_flush_no_lock(con, true);
 		bbnet_gracefulclose(&con->socket);
 	}
+	bbcon_clear_backlog_no_lock(con);
 	bb_critical_section_unlock(&con->cs);
 }
 
@@ -553,6 +790,7 @@ void bbcon_disconnect_no_flush(bb_connection_t* con)
 		con->state = kBBConnection_NotConnected;
 		bbnet_gracefulclose(&con->socket);
 	}
+	bbcon_clear_backlog_no_lock(con);
 	bb_critical_section_unlock(&con->cs);
 }
 
@@ -565,6 +803,7 @@ static void bbcon_disconnect_no_flush_no_lock(bb_connection_t* con)
 		con->state = kBBConnection_NotConnected;
 		bbnet_gracefulclose(&con->socket);
 	}
+	bbcon_clear_backlog_no_lock(con);
 }
 
 void bbcon_flush(bb_connection_t* con)
@@ -572,6 +811,8 @@ void bbcon_flush(bb_connection_t* con)
 	if (!con->cs.initialized)
 		return;
 	bb_critical_section_lock(&con->cs);
+	bbcon_drain_backlog_no_lock(con, true);
+	bbcon_seal_batch_no_lock(con, true);
 	bbcon_flush_no_lock(con, true);
 	bb_critical_section_unlock(&con->cs);
 }
@@ -581,13 +822,14 @@ void bbcon_try_flush(bb_connection_t* con)
 	if (!con->cs.initialized)
 		return;
 	bb_critical_section_lock(&con->cs);
+	bbcon_drain_backlog_no_lock(con, false);
+	bbcon_seal_batch_no_lock(con, false);
 	bbcon_flush_no_lock(con, false);
 	bb_critical_section_unlock(&con->cs);
 }
 
-static void bbcon_send_no_lock(bb_connection_t* con, const void* pData, u32 nBytes)
+static void bbcon_send_bytes_no_lock(bb_connection_t* con, const void* pData, u32 nBytes)
 {
-	u64 now;
 	u32 nRemaining = nBytes;
 	const s8* pBytes = (const s8*)(pData);
 
@@ -605,217 +847,906 @@ static void bbcon_send_no_lock(bb_connection_t* con, const void* pData, u32 nByt
 			bbcon_flush_no_lock(con, true);
 		}
 	}
-
-	now = bb_current_time_ms();
-	if (now >= con->prevSendTime + con->sendInterval)
-	{
-		bbcon_flush_no_lock(con, false);
-	}
 }
 
-void bbcon_send_raw(bb_connection_t* con, const void* pData, u32 nBytes)
+// pData holds whole [u16 length][packet] frames - extended frames are sent after the batch so far
+static void bbcon_send_batched_no_lock(bb_connection_t* con, const void* pData, u32 nBytes)
 {
-	if (!con->cs.initialized)
-		return;
-
-	bb_critical_section_lock(&con->cs);
+	u32 nRemaining = nBytes;
+	const u8* pBytes = (const u8*)(pData);
 
-	if (con->socket != BB_INVALID_SOCKET)
+	while (nRemaining && con->socket != BB_INVALID_SOCKET)
 	{
-		bbcon_send_no_lock(con, pData, nBytes);
-	}
+		const u32 nFrameBytes = bbpacket_frame_length(pBytes, nRemaining);
+		if (nFrameBytes < 3 || nFrameBytes > nRemaining || bbpacket_frame_header_size(pBytes) != kBBFrame_HeaderSize)
+		{
+			// not whole frames, or an extended frame - keep the ordering and send it as is
+			const u32 nUnbatchedBytes = (nFrameBytes < 3 || nFrameBytes > nRemaining) ? nRemaining : nFrameBytes;
+			if (!bbcon_seal_batch_no_lock(con, true))
+				break;
+			bbcon_send_bytes_no_lock(con, pBytes, nUnbatchedBytes);
+			pBytes += nUnbatchedBytes;
+			nRemaining -= nUnbatchedBytes;
+			continue;
+		}
 
-	bb_critical_section_unlock(&con->cs);
+		if (con->sendBatchCursor + nFrameBytes > kBBBatch_MaxExpandedSize && !bbcon_seal_batch_no_lock(con, true))
+		{
+			break;
+		}
+
+		memcpy(con->sendBatch + con->sendBatchCursor, pBytes, nFrameBytes);
+		con->sendBatchCursor += nFrameBytes;
+		pBytes += nFrameBytes;
+		nRemaining -= nFrameBytes;
+	}
 }
 
-void bbcon_send(bb_connection_t* con, bb_decoded_packet_t* decoded)
+static void bbcon_send_frames_no_lock(bb_connection_t* con, const void* pData, u32 nBytes)
 {
-	u8 buf[BB_MAX_PACKET_BUFFER_SIZE];
-	u16 serializedLen;
-	if (!con->cs.initialized)
-		return;
-
-	serializedLen = bbpacket_serialize(decoded, buf + 2, sizeof(buf) - 2);
-	if (!serializedLen)
+	if ((con->flags & kBBCon_Batches) != 0)
 	{
-		BBCON_ERROR("bbcon_send failed to encode packet");
-		return;
+		bbcon_send_batched_no_lock(con, pData, nBytes);
 	}
-	serializedLen += 2;
-	buf[0] = (u8)(serializedLen >> 8);
-	buf[1] = (u8)(serializedLen & 0xFF);
-
-	//BBCON_LOG( "bbcon_send packetType:%d nBytes:%d m_nSendCursor:%d", decoded->type, serializedLen, con->sendCursor );
-
-	bb_critical_section_lock(&con->cs);
-
-	if (con->socket != BB_INVALID_SOCKET)
+	else
 	{
-		bbcon_send_no_lock(con, buf, serializedLen);
+		bbcon_send_bytes_no_lock(con, pData, nBytes);
 	}
-
-	bb_critical_section_unlock(&con->cs);
 }
 
-b32 bbcon_try_send(bb_connection_t* con, bb_decoded_packet_t* decoded)
+// Compacts one log text frame straight into sendBatch, or sendBuffer, making room for it first.  Returns false if
+// it wasn't compacted, and should be sent as it is.
+static b32 bbcon_send_compact_frame_no_lock(bb_connection_t* con, const u8* frame, u32 frameLen)
 {
-	u8 buf[BB_MAX_PACKET_BUFFER_SIZE];
-	u16 serializedLen;
-	b32 ret = true;
-	if (!con->cs.initialized)
-		return ret;
+	const u32 nNeeded = frameLen + kBBCompact_MaxRegistrationBytes;
+	if (con->socket == BB_INVALID_SOCKET)
+		return false;
 
-	serializedLen = bbpacket_serialize(decoded, buf + 2, sizeof(buf) - 2);
-	if (!serializedLen)
+	if ((con->flags & kBBCon_Batches) != 0)
 	{
-		BBCON_ERROR("bbcon_send failed to encode packet");
-		return ret;
+		if (con->sendBatchCursor + nNeeded > kBBBatch_MaxExpandedSize && !bbcon_seal_batch_no_lock(con, true))
+			return false;
+		const u32 nCompactBytes = bbcompact_encode_frame(&con->compactSend, frame, frameLen, con->sendBatch + con->sendBatchCursor, kBBBatch_MaxExpandedSize - con->sendBatchCursor);
+		con->sendBatchCursor += nCompactBytes;
+		return nCompactBytes != 0;
 	}
-	serializedLen += 2;
-	buf[0] = (u8)(serializedLen >> 8);
-	buf[1] = (u8)(serializedLen & 0xFF);
 
-	//BBCON_LOG( "bbcon_try_send packetType:%d nBytes:%d m_nSendCursor:%d", decoded->type, serializedLen, con->sendCursor );
+	if (con->sendCursor + nNeeded > sizeof(con->sendBuffer))
+	{
+		bbcon_flush_no_lock(con, true);
+		if (con->socket == BB_INVALID_SOCKET || con->sendCursor + nNeeded > sizeof(con->sendBuffer))
+			return false;
+	}
+	const u32 nCompactBytes = bbcompact_encode_frame(&con->compactSend, frame, frameLen, con->sendBuffer + con->sendCursor, (u32)sizeof(con->sendBuffer) - con->sendCursor);
+	con->sendCursor += nCompactBytes;
+	return nCompactBytes != 0;
+}
 
-	bb_critical_section_lock(&con->cs);
+// pData holds whole [u16 length][packet] frames - log text frames are replaced by compact ones, and everything
+// else is sent in runs as it is
+static void bbcon_send_compact_no_lock(bb_connection_t* con, const void* pData, u32 nBytes)
+{
+	const u8* pBytes = (const u8*)(pData);
+	const u8* pEnd = pBytes + nBytes;
+	const u8* pRun = pBytes;
 
-	if (con->socket != BB_INVALID_SOCKET)
+	while (pEnd - pBytes >= 3)
 	{
-		u32 kSendBufferSize = sizeof(con->sendBuffer);
-		const u32 nBytesToCopy = BB_MIN(kSendBufferSize - con->sendCursor, serializedLen);
-		if (nBytesToCopy == serializedLen)
-		{
-			const s8* pBytes = (const s8*)(buf);
-			memcpy(con->sendBuffer + con->sendCursor, pBytes, nBytesToCopy);
-			con->sendCursor += nBytesToCopy;
-		}
-		else
+		const u32 nFrameBytes = bbpacket_frame_length(pBytes, (u32)(pEnd - pBytes));
+		if (nFrameBytes < 3 || nFrameBytes > (u32)(pEnd - pBytes))
+			break;
+
+		if (bbpacket_frame_header_size(pBytes) == kBBFrame_HeaderSize && pBytes[2] == kBBPacketType_LogText)
 		{
-			ret = false;
+			if (pBytes > pRun)
+			{
+				bbcon_send_frames_no_lock(con, pRun, (u32)(pBytes - pRun));
+			}
+			pRun = (bbcon_send_compact_frame_no_lock(con, pBytes, nFrameBytes)) ? pBytes + nFrameBytes : pBytes;
 		}
+		pBytes += nFrameBytes;
 	}
 
-	bb_critical_section_unlock(&con->cs);
-	return ret;
+	if (pEnd > pRun)
+	{
+		bbcon_send_frames_no_lock(con, pRun, (u32)(pEnd - pRun));
+	}
 }
 
-static void bbcon_receive(bb_connection_t* con)
+static void bbcon_send_logs_no_lock(bb_connection_t* con, const void* pData, u32 nBytes)
 {
-	int ret;
-	fd_set set;
-	b32 isServer;
-	struct timeval tv;
-
-	if (con->socket == BB_INVALID_SOCKET)
-		return;
-
-	FD_ZERO(&set);
-	BB_FD_SET(con->socket, &set);
+	if ((con->flags & kBBCon_CompactLogs) != 0)
+	{
+		bbcon_send_compact_no_lock(con, pData, nBytes);
+	}
+	else
+	{
+		bbcon_send_frames_no_lock(con, pData, nBytes);
+	}
+}
 
-	isServer = (con->flags & kBBCon_Server) != 0;
-	tv.tv_sec = 0;
-	tv.tv_usec = (isServer) ? 100 : 0;
+static void bbcon_send_split_packet_no_lock(bb_decoded_packet_t* decoded, void* context)
+{
+	bb_connection_t* con = (bb_connection_t*)context;
+	u8 buf[BB_MAX_PACKET_BUFFER_SIZE];
+	u32 serializedLen = bbpacket_serialize_frame(decoded, buf, sizeof(buf));
+	if (serializedLen)
+	{
+		bbcon_send_logs_no_lock(con, buf, serializedLen);
+	}
+}
 
-	ret = select((int)con->socket + 1, &set, 0, 0, &tv);
-	if (ret != 1)
+// Splits one kBBPacketType_LogTextLarge frame into the kBBPacketType_LogTextPartial and kBBPacketType_LogText
+// frames a client without large logs would have sent
+static void bbcon_send_split_large_no_lock(bb_connection_t* con, const u8* frame, u32 frameLen)
+{
+	bb_decoded_packet_t decoded;
+	if (!bbpacket_deserialize((u8*)frame + kBBFrame_ExtendedHeaderSize, (u16)(frameLen - kBBFrame_ExtendedHeaderSize), &decoded) ||
+	    decoded.type != kBBPacketType_LogTextLarge)
 	{
-		if (ret == BB_SOCKET_ERROR)
-		{
-			int err = BBNET_ERRNO;
-			BBCON_ERROR("bbcon_receive: disconnected during select with errno %d (%s)", err, bbnet_error_to_string(err));
-			bbcon_disconnect_no_flush(con);
-		}
-		//BBCON_LOG( "select returned %d", ret );
+		BBCON_ERROR("bbcon_send failed to split large packet");
 		return;
 	}
-	else
+	bbpacket_split_log_text_large(&decoded, &bbcon_send_split_packet_no_lock, con);
+}
+
+// pData holds whole frames - extended frames are split up unless the other end has asked for them
+static void bbcon_send_large_no_lock(bb_connection_t* con, const void* pData, u32 nBytes)
+{
+	const u8* pBytes = (const u8*)(pData);
+	const u8* pEnd = pBytes + nBytes;
+	const u8* pRun = pBytes;
+
+	while (pEnd - pBytes >= 3)
 	{
-		u32 kRecvBufferSize = sizeof(con->recvBuffer);
-		u32 nBytesAvailable = kRecvBufferSize - con->recvCursor;
-		int nBytesReceived = recv(con->socket, (char*)(con->recvBuffer + con->recvCursor), (int)nBytesAvailable, 0);
-		if (nBytesReceived <= 0)
+		const u32 nFrameBytes = bbpacket_frame_length(pBytes, (u32)(pEnd - pBytes));
+		if (nFrameBytes < 3 || nFrameBytes > (u32)(pEnd - pBytes))
+			break;
+
+		if (bbpacket_frame_header_size(pBytes) != kBBFrame_HeaderSize)
 		{
-			if (nBytesAvailable > 0)
+			if (pBytes > pRun)
 			{
-				int err = BBNET_ERRNO;
-				if (err)
-				{
-					BBCON_ERROR("bbcon_receive: disconnected during recv with errno %d (%s)", err, bbnet_error_to_string(err));
-				}
-				else
-				{
-					BBCON_LOG("bbcon_receive: disconnected during recv with errno %d (%s)", err, bbnet_error_to_string(err));
-				}
-				bbcon_disconnect_no_flush(con);
+				bbcon_send_logs_no_lock(con, pRun, (u32)(pBytes - pRun));
 			}
-			return;
+			bbcon_send_split_large_no_lock(con, pBytes, nFrameBytes);
+			pRun = pBytes + nFrameBytes;
 		}
+		pBytes += nFrameBytes;
+	}
 
-		con->receivedBytesTotal += (u64)nBytesReceived;
-		con->recvCursor += (u32)nBytesReceived;
-
-		//BBCON_LOG( "bbcon_receive nBytesReceived:%d decodeCursor:%d recvCursor:%d", nBytesReceived, con->decodeCursor, con->recvCursor );
+	if (pEnd > pRun)
+	{
+		bbcon_send_logs_no_lock(con, pRun, (u32)(pEnd - pRun));
 	}
 }
 
-b32 bbcon_decodePacket(bb_connection_t* con, bb_decoded_packet_t* decoded)
+static void bbcon_send_unqueued_no_lock(bb_connection_t* con, const void* pData, u32 nBytes)
 {
-	const u32 kRecvBufferSize = sizeof(con->recvBuffer);
-	const u32 kHalfRecvBufferBytes = kRecvBufferSize / 2;
-	b32 valid = false;
-
-	if (!con->cs.initialized)
+	u64 now;
+	if ((con->flags & kBBCon_LargeLogs) != 0)
+	{
+		bbcon_send_logs_no_lock(con, pData, nBytes);
+	}
+	else
+	{
+		bbcon_send_large_no_lock(con, pData, nBytes);
+	}
+
+	now = bb_current_time_ms();
+	if (now >= con->prevSendTime + con->sendInterval)
+	{
+		bbcon_seal_batch_no_lock(con, false);
+		bbcon_flush_no_lock(con, false);
+	}
+}
+
+// Returns true if a frame can go through bbcon_send_unqueued_no_lock without waiting on the socket - it can
+// grow by compact registrations, or by a prefix per kBBPacketType_LogTextPartial when a large log is split up.
+static b32 bbcon_has_room_no_lock(bb_connection_t* con, const u8* frame, u32 frameLen)
+{
+	const u32 kSendBufferSize = sizeof(con->sendBuffer);
+	const u32 need = frameLen + kBBCompact_MaxRegistrationBytes + (frameLen / kBBSize_LogText + 1) * kBBPacket_LogTextPrefixSize;
+	const b32 batchable = bbpacket_frame_header_size(frame) == kBBFrame_HeaderSize || (con->flags & kBBCon_LargeLogs) == 0;
+	if ((con->flags & kBBCon_Batches) != 0 && batchable)
+	{
+		if (con->sendBatchCursor + need <= kBBBatch_MaxExpandedSize)
+			return true;
+		if (!bbcon_seal_batch_no_lock(con, false))
+			return false;
+		if (need <= kBBBatch_MaxExpandedSize)
+			return true;
+	}
+	else if (!bbcon_seal_batch_no_lock(con, false))
+	{
 		return false;
+	}
+
+	if (con->sendCursor + need > kSendBufferSize)
+	{
+		bbcon_flush_no_lock(con, false);
+	}
+	return con->sendCursor + BB_MIN(need, kSendBufferSize) <= kSendBufferSize;
+}
+
+static b32 bbcon_backlog_is_empty(const bb_connection_backlog_t* backlog)
+{
+	return !backlog->pendingLen &&
+	       bb_packet_ring_is_empty(backlog->lanes[kBBBacklogLane_Priority]) &&
+	       bb_packet_ring_is_empty(backlog->lanes[kBBBacklogLane_Normal]) &&
+	       backlog->spillWriteHandle == BB_INVALID_FILE_HANDLE;
+}
+
+static void bbcon_backlog_close_spill(bb_connection_backlog_t* backlog)
+{
+	if (backlog->spillWriteHandle != BB_INVALID_FILE_HANDLE)
+	{
+		bb_file_close(backlog->spillWriteHandle);
+		backlog->spillWriteHandle = BB_INVALID_FILE_HANDLE;
+	}
+	if (backlog->spillReadHandle != BB_INVALID_FILE_HANDLE)
+	{
+		bb_file_close(backlog->spillReadHandle);
+		backlog->spillReadHandle = BB_INVALID_FILE_HANDLE;
+	}
+	backlog->spillWritten = backlog->spillRead = 0;
+	backlog->spillUnflushed = false;
+}
+
+static b32 bbcon_backlog_write_spill(bb_connection_backlog_t* backlog, const u8* frame, u32 frameLen)
+{
+	if (backlog->spillFailed || !backlog->spillPath[0] || frameLen > kBBFrame_MaxExtendedSize)
+		return false;
+
+	if (backlog->spillWriteHandle == BB_INVALID_FILE_HANDLE)
+	{
+		backlog->spillWriteHandle = bb_file_open_for_write(backlog->spillPath);
+		backlog->spillReadHandle = bb_file_open_for_read(backlog->spillPath);
+		if (backlog->spillWriteHandle == BB_INVALID_FILE_HANDLE || backlog->spillReadHandle == BB_INVALID_FILE_HANDLE)
+		{
+			bbcon_backlog_close_spill(backlog);
+			backlog->spillFailed = true;
+			return false;
+		}
+	}
+
+	const u32 recordLen = kBBBacklog_SpillRecordHeaderSize + frameLen;
+	memcpy(backlog->scratch, &frameLen, sizeof(frameLen));
+	memcpy(backlog->scratch + kBBBacklog_SpillRecordHeaderSize, frame, frameLen);
+	if (bb_file_write(backlog->spillWriteHandle, backlog->scratch, recordLen) != recordLen)
+	{
+		// the file now ends in a partial record - keep reading the whole ones, but spill nothing more
+		backlog->spillFailed = true;
+		return false;
+	}
+	backlog->spillWritten += recordLen;
+	backlog->spillUnflushed = true;
+	return true;
+}
+
+// Reads the oldest spilled frame into pending, and closes the file once it has all been read
+static u32 bbcon_backlog_read_spill(bb_connection_backlog_t* backlog)
+{
+	if (backlog->spillRead >= backlog->spillWritten)
+		return 0;
+
+	if (backlog->spillUnflushed)
+	{
+		bb_file_flush(backlog->spillWriteHandle);
+		backlog->spillUnflushed = false;
+	}
+
+	// only whole records are read, so the reader never hits the end of the file and sees a sticky EOF
+	u32 frameLen = 0;
+	if (bb_file_read(backlog->spillReadHandle, &frameLen, sizeof(frameLen)) != sizeof(frameLen) ||
+	    frameLen > sizeof(backlog->pending) ||
+	    bb_file_read(backlog->spillReadHandle, backlog->pending, frameLen) != frameLen)
+	{
+		bbcon_backlog_close_spill(backlog);
+		return 0;
+	}
+
+	backlog->spillRead += kBBBacklog_SpillRecordHeaderSize + frameLen;
+	if (backlog->spillRead >= backlog->spillWritten)
+	{
+		bbcon_backlog_close_spill(backlog);
+	}
+	return frameLen;
+}
+
+static void bbcon_backlog_drop(bb_connection_t* con, bb_log_level_e level)
+{
+	++con->backlog->dropped[level];
+	++con->stats.droppedLogs;
+}
+
+static void bbcon_backlog_drop_frame(bb_connection_t* con, const u8* frame, u32 frameLen)
+{
+	bb_log_level_e level;
+	if (bbpacket_get_frame_log_level(frame, frameLen, &level))
+	{
+		bbcon_backlog_drop(con, level);
+	}
+}
+
+static void bbcon_queue_frame_no_lock(bb_connection_t* con, const u8* frame, u32 frameLen)
+{
+	bb_connection_backlog_t* backlog = con->backlog;
+	bb_log_level_e level = kBBLogLevel_Log;
+	const b32 isLog = bbpacket_get_frame_log_level(frame, frameLen, &level);
+	if (!isLog || level >= kBBLogLevel_Warning)
+	{
+		bb_packet_ring_t* lane = backlog->lanes[kBBBacklogLane_Priority];
+		if (bb_packet_ring_write(lane, frame, frameLen))
+			return;
+
+		if (isLog)
+		{
+			bbcon_backlog_drop(con, level);
+			return;
+		}
+
+		// registrations and other non-log packets are never dropped, since later logs depend on them - they wait
+		// for room, and if the socket can't make any, the connection is closed instead of going on without them
+		bbcon_drain_backlog_no_lock(con, true);
+		if (!bb_packet_ring_write(lane, frame, frameLen) && con->socket != BB_INVALID_SOCKET)
+		{
+			BBCON_WARNING("bbcon_queue: no room to queue a %u byte packet - disconnecting", frameLen);
+			bbcon_disconnect_no_flush_no_lock(con);
+		}
+		return;
+	}
+
+	bb_packet_ring_t* lane = backlog->lanes[kBBBacklogLane_Normal];
+	if (backlog->spillWriteHandle != BB_INVALID_FILE_HANDLE)
+	{
+		// once logs are spilling, they all go through the spill file, so they stay in order
+		if (!bbcon_backlog_write_spill(backlog, frame, frameLen))
+		{
+			bbcon_backlog_drop(con, level);
+		}
+		return;
+	}
+
+	while (!bb_packet_ring_write(lane, frame, frameLen))
+	{
+		if (backlog->policy == kBBBackpressure_DropOldest)
+		{
+			const u32 oldestLen = bb_packet_ring_read_frame(lane, backlog->scratch, sizeof(backlog->scratch));
+			if (oldestLen)
+			{
+				bbcon_backlog_drop_frame(con, backlog->scratch, oldestLen);
+				continue;
+			}
+		}
+		else if (backlog->policy == kBBBackpressure_SpillToDisk && bbcon_backlog_write_spill(backlog, frame, frameLen))
+		{
+			return;
+		}
+		bbcon_backlog_drop(con, level);
+		return;
+	}
+}
+
+// Sends queued frames, oldest priority frame first, for as long as the socket keeps up - or until they are
+// all sent, with retry.
+static void bbcon_drain_backlog_no_lock(bb_connection_t* con, b32 retry)
+{
+	bb_connection_backlog_t* backlog = con->backlog;
+	if (!backlog || backlog->draining)
+		return;
+
+	backlog->draining = true;
+	while (con->socket != BB_INVALID_SOCKET)
+	{
+		if (!backlog->pendingLen)
+		{
+			backlog->pendingLen = bb_packet_ring_read_frame(backlog->lanes[kBBBacklogLane_Priority], backlog->pending, sizeof(backlog->pending));
+			if (!backlog->pendingLen)
+			{
+				backlog->pendingLen = bb_packet_ring_read_frame(backlog->lanes[kBBBacklogLane_Normal], backlog->pending, sizeof(backlog->pending));
+			}
+			if (!backlog->pendingLen)
+			{
+				backlog->pendingLen = bbcon_backlog_read_spill(backlog);
+			}
+			if (!backlog->pendingLen)
+				break;
+		}
+
+		if (bbcon_has_room_no_lock(con, backlog->pending, backlog->pendingLen))
+		{
+			const u32 pendingLen = backlog->pendingLen;
+			bbcon_send_unqueued_no_lock(con, backlog->pending, pendingLen);
+			backlog->pendingLen = 0;
+		}
+		else if (retry)
+		{
+			bbcon_seal_batch_no_lock(con, true);
+			bbcon_flush_no_lock(con, true);
+			if (con->sendCursor)
+				break; // timed out
+		}
+		else
+		{
+			break;
+		}
+	}
+	backlog->draining = false;
+
+	if (con->socket == BB_INVALID_SOCKET)
+	{
+		bbcon_clear_backlog_no_lock(con);
+	}
+}
+
+static void bbcon_clear_backlog_no_lock(bb_connection_t* con)
+{
+	bb_connection_backlog_t* backlog = con->backlog;
+	if (!backlog || backlog->draining)
+		return;
+
+	for (u32 i = 0; i < kBBBacklogLane_Count; ++i)
+	{
+		bb_packet_ring_t* lane = backlog->lanes[i];
+		lane->readCursor = lane->writeCursor;
+	}
+	bbcon_backlog_close_spill(backlog);
+	backlog->spillFailed = false;
+	backlog->pendingLen = 0;
+}
+
+// pData holds whole frames - they are sent as they are while nothing is queued and the socket keeps up, and are
+// queued after that
+static void bbcon_send_backlogged_no_lock(bb_connection_t* con, const void* pData, u32 nBytes)
+{
+	const u8* pBytes = (const u8*)(pData);
+	const u8* pEnd = pBytes + nBytes;
+
+	bbcon_drain_backlog_no_lock(con, false);
+	while (pEnd - pBytes >= 3 && con->socket != BB_INVALID_SOCKET)
+	{
+		const u32 nFrameBytes = bbpacket_frame_length(pBytes, (u32)(pEnd - pBytes));
+		if (nFrameBytes < 3 || nFrameBytes > (u32)(pEnd - pBytes))
+			break;
+
+		if (!con->backlog->draining && bbcon_backlog_is_empty(con->backlog) && bbcon_has_room_no_lock(con, pBytes, nFrameBytes))
+		{
+			bbcon_send_unqueued_no_lock(con, pBytes, nFrameBytes);
+		}
+		else
+		{
+			bbcon_queue_frame_no_lock(con, pBytes, nFrameBytes);
+		}
+		pBytes += nFrameBytes;
+	}
+}
+
+static void bbcon_send_no_lock(bb_connection_t* con, const void* pData, u32 nBytes)
+{
+	if ((con->flags & kBBCon_Stats) != 0)
+	{
+		const u8* pBytes = (const u8*)(pData);
+		const u8* pEnd = pBytes + nBytes;
+		while (pEnd - pBytes >= 3)
+		{
+			const u32 nFrameBytes = bbpacket_frame_length(pBytes, (u32)(pEnd - pBytes));
+			if (nFrameBytes < 3 || nFrameBytes > (u32)(pEnd - pBytes))
+				break;
+			++con->stats.packetsSent;
+			pBytes += nFrameBytes;
+		}
+	}
+
+	if (con->backlog)
+	{
+		bbcon_send_backlogged_no_lock(con, pData, nBytes);
+	}
+	else
+	{
+		bbcon_send_unqueued_no_lock(con, pData, nBytes);
+	}
+}
+
+void bbcon_set_backpressure(bb_connection_t* con, bb_backpressure_e policy, u32 queueSize, const char* spillPath)
+{
+	if (!con->cs.initialized)
+		return;
 
-	// #investigate why original impl didn't lock here
 	bb_critical_section_lock(&con->cs);
 
+	// everything queued goes out under the old settings
+	bbcon_drain_backlog_no_lock(con, true);
+
+	bb_connection_backlog_t* backlog = con->backlog;
+	if (backlog)
+	{
+		bbcon_clear_backlog_no_lock(con);
+		for (u32 i = 0; i < kBBBacklogLane_Count; ++i)
+		{
+			bb_packet_ring_destroy(backlog->lanes[i]);
+		}
+		bb_free(backlog);
+		con->backlog = NULL;
+	}
+
+	if (policy != kBBBackpressure_Block && policy < kBBBackpressure_Count)
+	{
+		backlog = (bb_connection_backlog_t*)bb_malloc(sizeof(bb_connection_backlog_t));
+		if (backlog)
+		{
+			memset(backlog, 0, sizeof(*backlog));
+			queueSize = queueSize ? BB_MAX(queueSize, (u32)kBBBacklog_MinQueueSize) : (u32)kBBBacklog_DefaultQueueSize;
+			for (u32 i = 0; i < kBBBacklogLane_Count; ++i)
+			{
+				backlog->lanes[i] = bb_packet_ring_create(queueSize);
+			}
+			if (backlog->lanes[kBBBacklogLane_Priority] && backlog->lanes[kBBBacklogLane_Normal])
+			{
+				backlog->spillWriteHandle = backlog->spillReadHandle = BB_INVALID_FILE_HANDLE;
+				backlog->policy = policy;
+				if (spillPath)
+				{
+					bb_strncpy(backlog->spillPath, spillPath, sizeof(backlog->spillPath));
+				}
+				con->backlog = backlog;
+			}
+			else
+			{
+				for (u32 i = 0; i < kBBBacklogLane_Count; ++i)
+				{
+					bb_packet_ring_destroy(backlog->lanes[i]);
+				}
+				bb_free(backlog);
+			}
+		}
+	}
+
+	bb_critical_section_unlock(&con->cs);
+}
+
+b32 bbcon_take_dropped_logs(bb_connection_t* con, u32 dropped[kBBLogLevel_Count])
+{
+	b32 any = false;
+	memset(dropped, 0, sizeof(u32) * kBBLogLevel_Count);
+	if (!con->cs.initialized)
+		return any;
+
+	bb_critical_section_lock(&con->cs);
+	if (con->backlog)
+	{
+		for (u32 i = 0; i < kBBLogLevel_Count; ++i)
+		{
+			dropped[i] = con->backlog->dropped[i];
+			any = any || dropped[i] != 0;
+		}
+		memset(con->backlog->dropped, 0, sizeof(con->backlog->dropped));
+	}
+	bb_critical_section_unlock(&con->cs);
+	return any;
+}
+
+u32 bbcon_take_stats(bb_connection_t* con, bb_connection_stats_t* stats)
+{
+	u32 queuedBytes = 0;
+	memset(stats, 0, sizeof(*stats));
+	if (!con->cs.initialized)
+		return queuedBytes;
+
+	bb_critical_section_lock(&con->cs);
+	*stats = con->stats;
+	memset(&con->stats, 0, sizeof(con->stats));
+	bb_connection_backlog_t* backlog = con->backlog;
+	if (backlog)
+	{
+		queuedBytes = backlog->pendingLen + (u32)(backlog->spillWritten - backlog->spillRead);
+		for (u32 i = 0; i < kBBBacklogLane_Count; ++i)
+		{
+			queuedBytes += backlog->lanes[i]->writeCursor - backlog->lanes[i]->readCursor;
+		}
+	}
+	bb_critical_section_unlock(&con->cs);
+	return queuedBytes;
+}
+
+static void bbcon_lock_for_send(bb_connection_t* con)
+{
+	if ((con->flags & kBBCon_Stats) != 0)
+	{
+		const u64 startNanoseconds = bb_monotonic_nanoseconds();
+		bb_critical_section_lock(&con->cs);
+		con->stats.lockWaitNanoseconds += bb_monotonic_nanoseconds() - startNanoseconds;
+	}
+	else
+	{
+		bb_critical_section_lock(&con->cs);
+	}
+}
+
+void bbcon_send_raw(bb_connection_t* con, const void* pData, u32 nBytes)
+{
+	if (!con->cs.initialized)
+		return;
+
+	bbcon_lock_for_send(con);
+
+	if (con->socket != BB_INVALID_SOCKET)
+	{
+		bbcon_send_no_lock(con, pData, nBytes);
+	}
+
+	bb_critical_section_unlock(&con->cs);
+}
+
+void bbcon_send(bb_connection_t* con, bb_decoded_packet_t* decoded)
+{
+	u8 buf[BB_MAX_PACKET_BUFFER_SIZE];
+	u32 serializedLen;
+	if (!con->cs.initialized)
+		return;
+
+	serializedLen = bbpacket_serialize_frame(decoded, buf, sizeof(buf));
+	if (!serializedLen)
+	{
+		BBCON_ERROR("bbcon_send failed to encode packet");
+		return;
+	}
+
+	//BBCON_LOG( "bbcon_send packetType:%d nBytes:%d m_nSendCursor:%d", decoded->type, serializedLen, con->sendCursor );
+
+	bbcon_lock_for_send(con);
+
 	if (con->socket != BB_INVALID_SOCKET)
 	{
-		u16 nDecodableBytes = (u16)(con->recvCursor - con->decodeCursor);
+		bbcon_send_no_lock(con, buf, serializedLen);
+	}
+
+	bb_critical_section_unlock(&con->cs);
+}
+
+b32 bbcon_try_send(bb_connection_t* con, bb_decoded_packet_t* decoded)
+{
+	u8 buf[BB_MAX_PACKET_BUFFER_SIZE];
+	u32 serializedLen;
+	b32 ret = true;
+	if (!con->cs.initialized)
+		return ret;
+
+	// servers don't send kBBPacketType_LogTextLarge, so this is always a [u16 length][packet] frame
+	serializedLen = bbpacket_serialize_frame(decoded, buf, sizeof(buf));
+	if (!serializedLen)
+	{
+		BBCON_ERROR("bbcon_send failed to encode packet");
+		return ret;
+	}
+
+	//BBCON_LOG( "bbcon_try_send packetType:%d nBytes:%d m_nSendCursor:%d", decoded->type, serializedLen, con->sendCursor );
+
+	bb_critical_section_lock(&con->cs);
+
+	if (con->socket != BB_INVALID_SOCKET && (con->flags & kBBCon_Batches) != 0)
+	{
+		if (con->sendBatchCursor + serializedLen <= kBBBatch_MaxExpandedSize || bbcon_seal_batch_no_lock(con, false))
+		{
+			memcpy(con->sendBatch + con->sendBatchCursor, buf, serializedLen);
+			con->sendBatchCursor += serializedLen;
+		}
+		else
+		{
+			ret = false;
+		}
+	}
+	else if (con->socket != BB_INVALID_SOCKET)
+	{
+		u32 kSendBufferSize = sizeof(con->sendBuffer);
+		const u32 nBytesToCopy = BB_MIN(kSendBufferSize - con->sendCursor, serializedLen);
+		if (nBytesToCopy == serializedLen)
+		{
+			const s8* pBytes = (const s8*)(buf);
+			memcpy(con->sendBuffer + con->sendCursor, pBytes, nBytesToCopy);
+			con->sendCursor += nBytesToCopy;
+		}
+		else
+		{
+			ret = false;
+		}
+	}
+
+	bb_critical_section_unlock(&con->cs);
+	return ret;
+}
+
+// Reads whatever has arrived, without waiting - callers like the server's ingest threads already know the socket
+// is readable, and select can't take descriptors past FD_SETSIZE
+static void bbcon_receive(bb_connection_t* con)
+{
+	if (con->socket == BB_INVALID_SOCKET)
+		return;
+
+	u32 kRecvBufferSize = sizeof(con->recvBuffer);
+	u32 nBytesAvailable = kRecvBufferSize - con->recvCursor;
+	if (nBytesAvailable == 0)
+		return;
+
+#if defined(MSG_DONTWAIT)
+	const int flags = MSG_DONTWAIT;
+#else
+	const int flags = 0; // sockets from bbcon are non-blocking anyway
+#endif
+	int nBytesReceived = recv(con->socket, (char*)(con->recvBuffer + con->recvCursor), (int)nBytesAvailable, flags);
+	if (nBytesReceived < 0)
+	{
+		int err = BBNET_ERRNO;
+		if (err != BBNET_EWOULDBLOCK)
+		{
+			BBCON_ERROR("bbcon_receive: disconnected during recv with errno %d (%s)", err, bbnet_error_to_string(err));
+			bbcon_disconnect_no_flush(con);
+		}
+		return;
+	}
+	if (nBytesReceived == 0)
+	{
+		BBCON_LOG("bbcon_receive: disconnected during recv - connection closed");
+		bbcon_disconnect_no_flush(con);
+		return;
+	}
+
+	con->receivedBytesTotal += (u64)nBytesReceived;
+	con->recvCursor += (u32)nBytesReceived;
+
+	//BBCON_LOG( "bbcon_receive nBytesReceived:%d decodeCursor:%d recvCursor:%d", nBytesReceived, con->decodeCursor, con->recvCursor );
+}
+
+static u8* bbcon_next_batched_frame_no_lock(bb_connection_t* con, u32* frameLen)
+{
+	// bbpacket_expand_batch has already checked the frame lengths
+	u8* cursor = con->recvBatch + con->recvBatchCursor;
+	u16 nPacketBytes = (u16)((*cursor << 8) + (*(cursor + 1)));
+	con->recvBatchCursor += nPacketBytes;
+	con->decodedFromBatch = true;
+	*frameLen = nPacketBytes;
+	return cursor;
+}
+
+static u8* bbcon_next_frame_no_lock(bb_connection_t* con, u32* frameLen)
+{
+	const u32 kRecvBufferSize = sizeof(con->recvBuffer);
+	const u32 kHalfRecvBufferBytes = kRecvBufferSize / 2;
+	u8* frame = NULL;
+
+	con->decodedFromBatch = false;
+	if (con->socket != BB_INVALID_SOCKET && con->recvBatchCursor < con->recvBatchLen)
+	{
+		frame = bbcon_next_batched_frame_no_lock(con, frameLen);
+	}
+	else if (con->socket != BB_INVALID_SOCKET)
+	{
+		// TODO: rather lame to keep resetting the buffer - this should be a circular buffer
+		// Done before decoding rather than after, since a kBBPacketType_LogTextLarge points into recvBuffer.
+		if (con->decodeCursor >= kHalfRecvBufferBytes)
+		{
+			u32 nBytesRemaining = con->recvCursor - con->decodeCursor;
+			//BBCON_LOG( "bbcon_decodePacketReset PRE decodeCursor:%d recvCursor:%d", con->decodeCursor, con->recvCursor );
+			memmove(con->recvBuffer, con->recvBuffer + con->decodeCursor, nBytesRemaining);
+			con->decodeCursor = 0;
+			con->recvCursor = nBytesRemaining;
+			//BBCON_LOG( "bbcon_decodePacketReset POST decodeCursor:%d recvCursor:%d", con->decodeCursor, con->recvCursor );
+		}
+
+		u32 nDecodableBytes = con->recvCursor - con->decodeCursor;
 		if (nDecodableBytes >= 3)
 		{
 			u8* cursor = con->recvBuffer + con->decodeCursor;
-			u16 nPacketBytes = (u16)((*cursor << 8) + (*(cursor + 1)));
-			if (nDecodableBytes >= nPacketBytes)
+			u32 nPacketBytes = bbpacket_frame_length(cursor, nDecodableBytes);
+			if ((nPacketBytes && nPacketBytes < 3) || (!nPacketBytes && nDecodableBytes >= kBBFrame_ExtendedHeaderSize))
+			{
+				BBCON_ERROR("bbcon_decodePacket found an invalid frame length");
+				bbcon_disconnect_no_flush_no_lock(con);
+			}
+			else if (nPacketBytes && nDecodableBytes >= nPacketBytes)
 			{
 				//BBCON_LOG( "bbcon_decodePacket PRE decodeCursor:%d recvCursor:%d nPacketBytes:%d", con->decodeCursor, con->recvCursor, nPacketBytes );
 
 				u8* buffer = con->recvBuffer + con->decodeCursor;
-				valid = bbpacket_deserialize(buffer + 2, nPacketBytes - 2U, decoded);
+				const u32 nHeaderBytes = bbpacket_frame_header_size(buffer);
+				if (nHeaderBytes == kBBFrame_HeaderSize && bbpacket_is_batch_frame(buffer, nPacketBytes))
+				{
+					if (!con->recvBatch)
+					{
+						con->recvBatch = (u8*)bb_malloc(kBBBatch_MaxExpandedSize);
+					}
+					con->recvBatchCursor = 0;
+					con->recvBatchLen = (con->recvBatch) ? bbpacket_expand_batch(buffer, nPacketBytes, con->recvBatch, kBBBatch_MaxExpandedSize) : 0;
+					if (con->recvBatchLen)
+					{
+						if (con->batchFrameFunc)
+						{
+							(*con->batchFrameFunc)(buffer, nPacketBytes, con->batchFrameContext);
+						}
+						frame = bbcon_next_batched_frame_no_lock(con, frameLen);
+					}
+					else
+					{
+						BBCON_ERROR("bbcon_decodePacket failed to expand compressed batch of %u bytes", (u32)nPacketBytes);
+					}
+				}
+				else
+				{
+					frame = buffer;
+					*frameLen = nPacketBytes;
+				}
 
 				con->decodeCursor += nPacketBytes;
 
 				//BBCON_LOG( "bbcon_decodePacket POST decodeCursor:%d recvCursor:%d valid:%d", con->decodeCursor, con->recvCursor, valid );
-
-				// TODO: rather lame to keep resetting the buffer - this should be a circular buffer
-				if (con->decodeCursor >= kHalfRecvBufferBytes)
-				{
-					u16 nBytesRemaining = (u16)(con->recvCursor - con->decodeCursor);
-					//BBCON_LOG( "bbcon_decodePacketReset PRE decodeCursor:%d recvCursor:%d", con->decodeCursor, con->recvCursor );
-					memmove(con->recvBuffer, con->recvBuffer + con->decodeCursor, nBytesRemaining);
-					con->decodeCursor = 0;
-					con->recvCursor = nBytesRemaining;
-					//BBCON_LOG( "bbcon_decodePacketReset POST decodeCursor:%d recvCursor:%d", con->decodeCursor, con->recvCursor );
-				}
 			}
 		}
 	}
 
+	return frame;
+}
+
+static b32 bbcon_decode_compact_no_lock(bb_connection_t* con, bb_decoded_packet_t* decoded)
+{
+	if (bbcompact_decode(&con->compactRecv, decoded))
+	{
+		return true;
+	}
+	BBCON_ERROR("bbcon_decodePacket failed to expand compact packet type %d", decoded->type);
+	return false;
+}
+
+b32 bbcon_decodePacket(bb_connection_t* con, bb_decoded_packet_t* decoded)
+{
+	b32 valid = false;
+
+	if (!con->cs.initialized)
+		return false;
+
+	// #investigate why original impl didn't lock here
+	bb_critical_section_lock(&con->cs);
+
+	u32 frameLen = 0;
+	u8* frame = bbcon_next_frame_no_lock(con, &frameLen);
+	if (frame)
+	{
+		const u32 nHeaderBytes = bbpacket_frame_header_size(frame);
+		valid = bbpacket_deserialize(frame + nHeaderBytes, (u16)(frameLen - nHeaderBytes), decoded);
+	}
+
+	if (valid)
+	{
+		valid = bbcon_decode_compact_no_lock(con, decoded);
+	}
+
 	bb_critical_section_unlock(&con->cs);
 
 	return valid;
 }
 
+u8* bbcon_next_frame(bb_connection_t* con, u32* frameLen)
+{
+	if (!con->cs.initialized)
+		return NULL;
+
+	bb_critical_section_lock(&con->cs);
+	u8* frame = bbcon_next_frame_no_lock(con, frameLen);
+	bb_critical_section_unlock(&con->cs);
+	return frame;
+}
+
 void bbcon_tick(bb_connection_t* con)
 {
 	if (con->socket != BB_INVALID_SOCKET && con->cs.initialized)
 	{
 		bb_critical_section_lock(&con->cs);
 
+		bbcon_drain_backlog_no_lock(con, false);
+
 		u64 now = bb_current_time_ms();
 		if (now >= con->prevSendTime + con->sendInterval)
 		{
+			bbcon_seal_batch_no_lock(con, false);
 			bbcon_flush_no_lock(con, false);
 		}
 
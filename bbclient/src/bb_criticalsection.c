@@ -31,6 +31,11 @@ _Releases_lock_(cs->platform) void bb_critical_section_unlock_impl(bb_critical_s
 	LeaveCriticalSection(&cs->platform);
 }
 
+_When_(return != 0, _Acquires_lock_(cs->platform)) b32 bb_critical_section_try_lock(bb_critical_section* cs)
+{
+	return TryEnterCriticalSection(&cs->platform) != 0;
+}
+
 #else // #if BB_USING(BB_COMPILER_MSVC)
 
 void bb_critical_section_init(bb_critical_section* cs)
@@ -59,6 +64,11 @@ void bb_critical_section_unlock_impl(bb_critical_section* cs)
 	pthread_mutex_unlock(&cs->platform);
 }
 
+b32 bb_critical_section_try_lock(bb_critical_section* cs)
+{
+	return pthread_mutex_trylock(&cs->platform) == 0;
+}
+
 #endif // #else // #if BB_USING(BB_COMPILER_MSVC)
 
 #endif // #if BB_ENABLED
@@ -7,6 +7,7 @@
 
 #include "bbclient/bb_discovery_server.h"
 
+#include "bbclient/bb_array.h"
 #include "bbclient/bb_assert.h"
 #include "bbclient/bb_connection.h"
 #include "bbclient/bb_log.h"
@@ -90,6 +91,11 @@ void bb_discovery_server_shutdown(bb_discovery_server_t* ds)
 {
 	bbnet_gracefulclose(&ds->socket_in4);
 	bbnet_gracefulclose(&ds->socket_in6);
+	for (u32 i = 0; i < ds->pendingConnections.count; ++i)
+	{
+		bbnet_gracefulclose(&ds->pendingConnections.data[i].socket);
+	}
+	bba_free(ds->pendingConnections);
 }
 
 static void bb_discovery_remove_response(bb_discovery_server_t* ds, const struct sockaddr_storage* sin)
@@ -300,26 +306,22 @@ void bb_discovery_process_request(bb_discovery_server_t* ds, struct sockaddr_sto
 
 	case kBBDiscoveryPacketType_ReservationAccept:
 	{
-		if (ds->numPendingConnections < BB_ARRAYSIZE(ds->pendingConnections))
+		bb_discovery_pending_connection_t pending;
+		memset(&pending, 0, sizeof(pending));
+		pending.socket = bbcon_init_server(&pending.localIp, &pending.localPort);
+		if (pending.socket == BB_INVALID_SOCKET)
 		{
-			bb_discovery_pending_connection_t* pending = ds->pendingConnections + ds->numPendingConnections;
-			pending->localIp = 0;
-			pending->localPort = 0;
-			pending->socket = bbcon_init_server(&pending->localIp, &pending->localPort);
-			if (pending->socket == BB_INVALID_SOCKET)
-			{
-				BB_ERROR_A("Discovery", "ignoring reservation accept request from %s - too many pending connections", ip);
-			}
-			else
-			{
-				BB_LOG_A("Discovery", "pending connection %u using socket %d", ds->numPendingConnections, pending->socket);
-				bb_strncpy(pending->applicationName, decoded->packet.request.applicationName, sizeof(pending->applicationName));
-				response->nMaxTimesSent = kBBDiscoveryRetries;
-				response->packet.type = kBBDiscoveryPacketType_ReservationAccept;
-				response->packet.packet.response.port = pending->localPort;
-				response->packet.packet.response.protocolVersion = BB_PROTOCOL_VERSION;
-				++ds->numPendingConnections;
-			}
+			BB_ERROR_A("Discovery", "refusing reservation from %s - could not open a socket to listen on", ip);
+		}
+		else
+		{
+			BB_LOG_A("Discovery", "pending connection %u using socket %d", ds->pendingConnections.count, pending.socket);
+			bb_strncpy(pending.applicationName, decoded->packet.request.applicationName, sizeof(pending.applicationName));
+			bba_push(ds->pendingConnections, pending);
+			response->nMaxTimesSent = kBBDiscoveryRetries;
+			response->packet.type = kBBDiscoveryPacketType_ReservationAccept;
+			response->packet.packet.response.port = pending.localPort;
+			response->packet.packet.response.protocolVersion = BB_PROTOCOL_VERSION;
 		}
 		break;
 	}
@@ -0,0 +1,561 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#if !defined(BB_ENABLED) || BB_ENABLED
+
+#include "bb.h"
+
+#include "bbclient/bb_format.h"
+#include "bbclient/bb_packet.h"
+#include "bbclient/bb_string.h"
+#include "bbclient/bb_wrap_stdio.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef enum bbformat_length_e
+{
+	kBBFormatLength_None,
+	kBBFormatLength_hh,
+	kBBFormatLength_h,
+	kBBFormatLength_l,
+	kBBFormatLength_ll,
+	kBBFormatLength_z,
+	kBBFormatLength_t,
+	kBBFormatLength_j,
+	kBBFormatLength_L,
+} bbformat_length_e;
+
+typedef struct bbformat_spec_s
+{
+	const char* flags;
+	const char* width;
+	const char* precision;
+	u32 flagsLen;
+	u32 widthLen;
+	u32 precisionLen;
+	b32 hasPrecision;
+	bbformat_length_e length;
+	char conversion;
+	u8 pad[3];
+} bbformat_spec_t;
+
+enum
+{
+	kBBFormat_MaxSpecText = 48, // flags, width, and precision of a single conversion
+};
+
+static b32 bbformat_is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+// Parses the conversion following a '%'.  Returns the character after the conversion, or NULL if it
+// can't be deferred.
+static const char* bbformat_parse_spec(const char* s, bbformat_spec_t* spec)
+{
+	memset(spec, 0, sizeof(*spec));
+
+	spec->flags = s;
+	while (*s == '-' || *s == '+' || *s == ' ' || *s == '#' || *s == '0')
+	{
+		++s;
+	}
+	spec->flagsLen = (u32)(s - spec->flags);
+
+	spec->width = s;
+	if (*s == '*')
+	{
+		++s;
+	}
+	else
+	{
+		while (bbformat_is_digit(*s))
+		{
+			++s;
+		}
+		if (*s == '$')
+		{
+			return NULL; // positional arguments
+		}
+	}
+	spec->widthLen = (u32)(s - spec->width);
+
+	if (*s == '.')
+	{
+		++s;
+		spec->hasPrecision = true;
+		spec->precision = s;
+		if (*s == '*')
+		{
+			++s;
+		}
+		else
+		{
+			while (bbformat_is_digit(*s))
+			{
+				++s;
+			}
+		}
+		spec->precisionLen = (u32)(s - spec->precision);
+	}
+
+	if (spec->flagsLen + spec->widthLen + spec->precisionLen > kBBFormat_MaxSpecText)
+	{
+		return NULL;
+	}
+
+	switch (*s)
+	{
+	case 'h':
+		++s;
+		spec->length = (*s == 'h') ? kBBFormatLength_hh : kBBFormatLength_h;
+		s += (*s == 'h') ? 1 : 0;
+		break;
+	case 'l':
+		++s;
+		spec->length = (*s == 'l') ? kBBFormatLength_ll : kBBFormatLength_l;
+		s += (*s == 'l') ? 1 : 0;
+		break;
+	case 'z': ++s; spec->length = kBBFormatLength_z; break;
+	case 't': ++s; spec->length = kBBFormatLength_t; break;
+	case 'j': ++s; spec->length = kBBFormatLength_j; break;
+	case 'L': ++s; spec->length = kBBFormatLength_L; break;
+	default: break;
+	}
+
+	spec->conversion = *s;
+	return (*s) ? s + 1 : NULL;
+}
+
+static b32 bbformat_get_spec_arg(const bbformat_spec_t* spec, bb_format_arg_e* arg)
+{
+	switch (spec->conversion)
+	{
+	case 'd':
+	case 'i':
+		switch (spec->length)
+		{
+		case kBBFormatLength_None: *arg = kBBFormatArg_Int; return true;
+		case kBBFormatLength_hh: *arg = kBBFormatArg_SChar; return true;
+		case kBBFormatLength_h: *arg = kBBFormatArg_Short; return true;
+		case kBBFormatLength_l: *arg = kBBFormatArg_Long; return true;
+		case kBBFormatLength_ll: *arg = kBBFormatArg_LongLong; return true;
+		case kBBFormatLength_z: *arg = kBBFormatArg_PtrDiff; return true;
+		case kBBFormatLength_t: *arg = kBBFormatArg_PtrDiff; return true;
+		case kBBFormatLength_j: *arg = kBBFormatArg_IntMax; return true;
+		case kBBFormatLength_L: return false;
+		}
+		return false;
+
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+		switch (spec->length)
+		{
+		case kBBFormatLength_None: *arg = kBBFormatArg_UInt; return true;
+		case kBBFormatLength_hh: *arg = kBBFormatArg_UChar; return true;
+		case kBBFormatLength_h: *arg = kBBFormatArg_UShort; return true;
+		case kBBFormatLength_l: *arg = kBBFormatArg_ULong; return true;
+		case kBBFormatLength_ll: *arg = kBBFormatArg_ULongLong; return true;
+		case kBBFormatLength_z: *arg = kBBFormatArg_Size; return true;
+		case kBBFormatLength_t: *arg = kBBFormatArg_Size; return true;
+		case kBBFormatLength_j: *arg = kBBFormatArg_UIntMax; return true;
+		case kBBFormatLength_L: return false;
+		}
+		return false;
+
+	case 'c':
+		*arg = kBBFormatArg_Int;
+		return spec->length == kBBFormatLength_None;
+
+	case 's':
+		*arg = kBBFormatArg_String;
+		return spec->length == kBBFormatLength_None;
+
+	case 'p':
+		*arg = kBBFormatArg_Pointer;
+		return spec->length == kBBFormatLength_None;
+
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		*arg = kBBFormatArg_Double;
+		return spec->length == kBBFormatLength_None || spec->length == kBBFormatLength_l;
+
+	default:
+		return false; // %n, %S, %C, and anything platform-specific
+	}
+}
+
+static b32 bbformat_add_arg(bb_format_t* format, bb_format_arg_e arg)
+{
+	if (format->numArgs >= BB_ARRAYSIZE(format->args))
+	{
+		return false;
+	}
+	format->args[format->numArgs++] = (u8)arg;
+	return true;
+}
+
+b32 bbformat_parse(const char* fmt, bb_format_t* format)
+{
+	memset(format, 0, sizeof(*format));
+	format->fmt = fmt;
+
+	const char* s = fmt;
+	while ((s = strchr(s, '%')) != NULL)
+	{
+		if (s[1] == '%')
+		{
+			s += 2;
+			continue;
+		}
+
+		bbformat_spec_t spec;
+		bb_format_arg_e arg;
+		s = bbformat_parse_spec(s + 1, &spec);
+		if (!s || !bbformat_get_spec_arg(&spec, &arg))
+		{
+			return false;
+		}
+		if (spec.widthLen && *spec.width == '*' && !bbformat_add_arg(format, kBBFormatArg_Int))
+		{
+			return false;
+		}
+		if (spec.precisionLen && *spec.precision == '*' && !bbformat_add_arg(format, kBBFormatArg_Int))
+		{
+			return false;
+		}
+		if (!bbformat_add_arg(format, arg))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+b32 bbformat_pack(const bb_format_t* format, u8* buffer, u32 bufferSize, u16* argsLen, va_list args)
+{
+	u32 len = 0;
+	for (u32 i = 0; i < format->numArgs; ++i)
+	{
+		u64 value = 0;
+		switch ((bb_format_arg_e)format->args[i])
+		{
+		case kBBFormatArg_Int: value = (u64)(s64)va_arg(args, int); break;
+		case kBBFormatArg_UInt: value = (u64)va_arg(args, unsigned int); break;
+		case kBBFormatArg_SChar: value = (u64)(s64)(signed char)va_arg(args, int); break;
+		case kBBFormatArg_UChar: value = (u64)(unsigned char)va_arg(args, int); break;
+		case kBBFormatArg_Short: value = (u64)(s64)(short)va_arg(args, int); break;
+		case kBBFormatArg_UShort: value = (u64)(unsigned short)va_arg(args, int); break;
+		case kBBFormatArg_Long: value = (u64)(s64)va_arg(args, long); break;
+		case kBBFormatArg_ULong: value = (u64)va_arg(args, unsigned long); break;
+		case kBBFormatArg_LongLong: value = (u64)va_arg(args, long long); break;
+		case kBBFormatArg_ULongLong: value = (u64)va_arg(args, unsigned long long); break;
+		case kBBFormatArg_Size: value = (u64)va_arg(args, size_t); break;
+		case kBBFormatArg_PtrDiff: value = (u64)(s64)va_arg(args, ptrdiff_t); break;
+		case kBBFormatArg_IntMax: value = (u64)(s64)va_arg(args, intmax_t); break;
+		case kBBFormatArg_UIntMax: value = (u64)va_arg(args, uintmax_t); break;
+		case kBBFormatArg_Pointer: value = (u64)(uintptr_t)va_arg(args, void*); break;
+
+		case kBBFormatArg_Double:
+		{
+			double d = va_arg(args, double);
+			memcpy(&value, &d, sizeof(value));
+			break;
+		}
+
+		case kBBFormatArg_String:
+		{
+			const char* str = va_arg(args, const char*);
+			size_t strLen = (str) ? strlen(str) : 0;
+			if (strLen >= kBBFormat_NullString || len + sizeof(u16) + strLen > bufferSize)
+			{
+				return false;
+			}
+			u16 header = (str) ? (u16)strLen : (u16)kBBFormat_NullString;
+			memcpy(buffer + len, &header, sizeof(header));
+			memcpy(buffer + len + sizeof(header), str, strLen);
+			len += (u32)(sizeof(header) + strLen);
+			continue;
+		}
+		}
+
+		if (len + sizeof(value) > bufferSize)
+		{
+			return false;
+		}
+		memcpy(buffer + len, &value, sizeof(value));
+		len += sizeof(value);
+	}
+
+	*argsLen = (u16)len;
+	return true;
+}
+
+typedef struct bbformat_reader_s
+{
+	const u8* cursor;
+	const u8* end;
+	b32 ok;
+	u8 pad[4];
+} bbformat_reader_t;
+
+static u64 bbformat_read_u64(bbformat_reader_t* reader)
+{
+	u64 value = 0;
+	if ((size_t)(reader->end - reader->cursor) < sizeof(value))
+	{
+		reader->ok = false;
+		return 0;
+	}
+	memcpy(&value, reader->cursor, sizeof(value));
+	reader->cursor += sizeof(value);
+	return value;
+}
+
+static const char* bbformat_read_string(bbformat_reader_t* reader, char* buffer, size_t bufferSize)
+{
+	u16 len = 0;
+	if ((size_t)(reader->end - reader->cursor) < sizeof(len))
+	{
+		reader->ok = false;
+		return "";
+	}
+	memcpy(&len, reader->cursor, sizeof(len));
+	reader->cursor += sizeof(len);
+	if (len == kBBFormat_NullString)
+	{
+		return "(null)";
+	}
+	if ((size_t)(reader->end - reader->cursor) < len || len >= bufferSize)
+	{
+		reader->ok = false;
+		return "";
+	}
+	memcpy(buffer, reader->cursor, len);
+	buffer[len] = '\0';
+	reader->cursor += len;
+	return buffer;
+}
+
+typedef struct bbformat_output_s
+{
+	char* buffer;
+	size_t size;
+	size_t len;
+} bbformat_output_t;
+
+static void bbformat_output_range(bbformat_output_t* out, const char* start, size_t len)
+{
+	size_t remaining = out->size - 1 - out->len;
+	len = BB_MIN(len, remaining);
+	memcpy(out->buffer + out->len, start, len);
+	out->len += len;
+	out->buffer[out->len] = '\0';
+}
+
+static void bbformat_output_result(bbformat_output_t* out, int len)
+{
+	size_t remaining = out->size - 1 - out->len;
+	out->len += (len < 0) ? remaining : BB_MIN((size_t)len, remaining);
+	out->buffer[out->len] = '\0';
+}
+
+static char* bbformat_append_spec_range(char* cursor, const char* start, u32 len)
+{
+	memcpy(cursor, start, len);
+	return cursor + len;
+}
+
+int bbformat_expand(char* buffer, size_t bufferSize, const char* fmt, const u8* args, u32 argsLen)
+{
+	if (!bufferSize)
+	{
+		return -1;
+	}
+
+	bbformat_output_t out = { buffer, bufferSize, 0 };
+	bbformat_reader_t reader = { BB_EMPTY_INITIALIZER };
+	reader.cursor = args;
+	reader.end = args + argsLen;
+	reader.ok = true;
+	buffer[0] = '\0';
+
+	const char* s = fmt;
+	while (*s)
+	{
+		const char* percent = strchr(s, '%');
+		if (!percent)
+		{
+			bbformat_output_range(&out, s, strlen(s));
+			break;
+		}
+		bbformat_output_range(&out, s, (size_t)(percent - s));
+		if (percent[1] == '%')
+		{
+			bbformat_output_range(&out, percent, 1);
+			s = percent + 2;
+			continue;
+		}
+
+		bbformat_spec_t spec;
+		bb_format_arg_e arg;
+		s = bbformat_parse_spec(percent + 1, &spec);
+		if (!s || !bbformat_get_spec_arg(&spec, &arg))
+		{
+			return -1;
+		}
+
+		// rebuild the spec with '*' replaced by the packed values and integers widened to 64 bits
+		char specText[kBBFormat_MaxSpecText + 32];
+		char* cursor = specText;
+		*cursor++ = '%';
+		cursor = bbformat_append_spec_range(cursor, spec.flags, spec.flagsLen);
+		if (spec.widthLen && *spec.width == '*')
+		{
+			cursor += bb_snprintf(cursor, 16, "%d", (int)(s64)bbformat_read_u64(&reader));
+		}
+		else
+		{
+			cursor = bbformat_append_spec_range(cursor, spec.width, spec.widthLen);
+		}
+		if (spec.hasPrecision)
+		{
+			if (spec.precisionLen && *spec.precision == '*')
+			{
+				int precision = (int)(s64)bbformat_read_u64(&reader);
+				if (precision >= 0)
+				{
+					cursor += bb_snprintf(cursor, 16, ".%d", precision);
+				}
+			}
+			else
+			{
+				*cursor++ = '.';
+				cursor = bbformat_append_spec_range(cursor, spec.precision, spec.precisionLen);
+			}
+		}
+
+		char* target = out.buffer + out.len;
+		size_t targetSize = out.size - out.len;
+		int len = 0;
+		switch (arg)
+		{
+		case kBBFormatArg_String:
+		{
+			char str[kBBSize_DeferredArgs + 1];
+			const char* value = bbformat_read_string(&reader, str, sizeof(str));
+			*cursor++ = 's';
+			*cursor = '\0';
+			len = bb_snprintf(target, targetSize, specText, value);
+			break;
+		}
+
+		case kBBFormatArg_Double:
+		{
+			double value;
+			u64 bits = bbformat_read_u64(&reader);
+			memcpy(&value, &bits, sizeof(value));
+			*cursor++ = spec.conversion;
+			*cursor = '\0';
+			len = bb_snprintf(target, targetSize, specText, value);
+			break;
+		}
+
+		case kBBFormatArg_Pointer:
+		{
+			u64 value = bbformat_read_u64(&reader);
+			*cursor++ = 'p';
+			*cursor = '\0';
+			len = bb_snprintf(target, targetSize, specText, (void*)(uintptr_t)value);
+			break;
+		}
+
+		default:
+		{
+			u64 value = bbformat_read_u64(&reader);
+			if (spec.conversion == 'c')
+			{
+				*cursor++ = 'c';
+				*cursor = '\0';
+				len = bb_snprintf(target, targetSize, specText, (int)(s64)value);
+			}
+			else
+			{
+				*cursor++ = 'l';
+				*cursor++ = 'l';
+				*cursor++ = spec.conversion;
+				*cursor = '\0';
+				if (spec.conversion == 'd' || spec.conversion == 'i')
+				{
+					len = bb_snprintf(target, targetSize, specText, (long long)(s64)value);
+				}
+				else
+				{
+					len = bb_snprintf(target, targetSize, specText, (unsigned long long)value);
+				}
+			}
+			break;
+		}
+		}
+
+		if (!reader.ok)
+		{
+			return -1;
+		}
+		bbformat_output_result(&out, len);
+	}
+
+	return (int)out.len;
+}
+
+void bbformat_expand_log_packet(const bb_decoded_packet_t* deferred, const char* fmt, bbformat_log_text_func func, void* context)
+{
+	const bb_packet_log_text_deferred_t* packet = &deferred->packet.logTextDeferred;
+	char text[kBBFormat_MaxExpandedText];
+	int len = (fmt) ? bbformat_expand(text, sizeof(text) - 1, fmt, packet->args, packet->argsLen) : -1;
+	if (len < 0)
+	{
+		len = bb_snprintf(text, sizeof(text) - 1, "Unable to format deferred log (format id %u): %s", packet->formatId, (fmt) ? fmt : "(unregistered)");
+		len = (len < 0 || len > (int)sizeof(text) - 2) ? (int)sizeof(text) - 2 : len;
+	}
+
+	// match the newline termination bb_trace does before sending
+	if (len == 0 || text[len - 1] != '\n')
+	{
+		text[len++] = '\n';
+	}
+	text[len] = '\0';
+
+	bb_decoded_packet_t decoded = { BB_EMPTY_INITIALIZER };
+	decoded.header = deferred->header;
+	decoded.packet.logText.categoryId = packet->categoryId;
+	decoded.packet.logText.level = packet->level;
+	decoded.packet.logText.pieInstance = packet->pieInstance;
+	decoded.packet.logText.colors = packet->colors;
+
+	const char* cursor = text;
+	size_t remaining = (size_t)len;
+	while (remaining >= kBBSize_LogText)
+	{
+		decoded.type = kBBPacketType_LogTextPartial;
+		bb_strncpy(decoded.packet.logText.text, cursor, kBBSize_LogText);
+		(*func)(&decoded, context);
+		cursor += kBBSize_LogText - 1;
+		remaining -= kBBSize_LogText - 1;
+	}
+
+	decoded.type = kBBPacketType_LogText;
+	bb_strncpy(decoded.packet.logText.text, cursor, remaining + 1);
+	(*func)(&decoded, context);
+}
+
+#endif // #if BB_ENABLED
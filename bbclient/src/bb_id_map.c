@@ -0,0 +1,168 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#if !defined(BB_ENABLED) || BB_ENABLED
+
+#include "bb.h"
+
+#include "bbclient/bb_atomic.h"
+#include "bbclient/bb_id_map.h"
+#include "bbclient/bb_malloc.h"
+#include "bbclient/bb_string.h"
+#include <string.h>
+
+enum
+{
+	kBBIdMap_InitialSize = 256,
+};
+
+u32 bb_id_map_hash(const char* name)
+{
+	// FNV-1a over lowercased ASCII, to match bb_stricmp - NULL hashes the same as ""
+	u32 hash = 2166136261u;
+	for (const char* c = name; c && *c; ++c)
+	{
+		hash = (hash ^ (u8)bb_tolower(*c)) * 16777619u;
+	}
+	return hash;
+}
+
+static size_t bb_id_map_table_bytes(u32 size)
+{
+	return sizeof(bb_id_map_table_t) + (size - 1) * sizeof(bb_id_map_slot_t);
+}
+
+static bb_id_map_table_t* bb_id_map_create_table(u32 size)
+{
+	size_t bytes = bb_id_map_table_bytes(size);
+	bb_id_map_table_t* table = (bb_id_map_table_t*)bb_malloc(bytes);
+	if (table)
+	{
+		memset(table, 0, bytes);
+		table->mask = size - 1;
+	}
+	return table;
+}
+
+// the smallest table that holds maxIds without bb_id_map_insert wanting to grow it
+static u32 bb_id_map_fixed_slots(u32 maxIds)
+{
+	u32 size = kBBIdMap_InitialSize;
+	while (size < maxIds * 2 && size < 0x80000000u)
+	{
+		size <<= 1;
+	}
+	return size;
+}
+
+static void bb_id_map_table_insert(bb_id_map_table_t* table, const char* name, u32 hash, u32 id)
+{
+	u32 index = hash & table->mask;
+	while (table->slots[index].id)
+	{
+		index = (index + 1) & table->mask;
+	}
+	bb_id_map_slot_t* slot = table->slots + index;
+	slot->name = name;
+	slot->hash = hash;
+	bb_atomic_store_u32(&slot->id, id);
+	++table->count;
+}
+
+u32 bb_id_map_find(const bb_id_map_t* map, const char* name, u32 hash)
+{
+	const bb_id_map_table_t* table = (const bb_id_map_table_t*)bb_atomic_load_ptr((void* const volatile*)&map->table);
+	if (!table)
+	{
+		return 0;
+	}
+
+	u32 index = hash & table->mask;
+	for (;;)
+	{
+		const bb_id_map_slot_t* slot = table->slots + index;
+		u32 id = bb_atomic_load_u32(&slot->id);
+		if (!id)
+		{
+			return 0;
+		}
+		if (slot->hash == hash && !bb_stricmp(slot->name, name))
+		{
+			return id;
+		}
+		index = (index + 1) & table->mask;
+	}
+}
+
+b32 bb_id_map_insert(bb_id_map_t* map, const char* name, u32 hash, u32 id)
+{
+	bb_id_map_table_t* table = map->table;
+	if (!table || (table->count + 1) * 2 > table->mask + 1)
+	{
+		if (table && table->fixed)
+		{
+			return false;
+		}
+
+		// grow into a new table and publish it once it is complete, so readers always see a full table
+		u32 size = (table) ? (table->mask + 1) * 2 : (u32)kBBIdMap_InitialSize;
+		bb_id_map_table_t* grown = bb_id_map_create_table(size);
+		if (!grown)
+		{
+			return false;
+		}
+		if (table)
+		{
+			for (u32 i = 0; i <= table->mask; ++i)
+			{
+				const bb_id_map_slot_t* slot = table->slots + i;
+				if (slot->id)
+				{
+					bb_id_map_table_insert(grown, slot->name, slot->hash, slot->id);
+				}
+			}
+		}
+		grown->retired = table;
+		bb_atomic_store_ptr((void* volatile*)&map->table, grown);
+		table = grown;
+	}
+
+	bb_id_map_table_insert(table, name, hash, id);
+	return true;
+}
+
+void bb_id_map_reset(bb_id_map_t* map)
+{
+	bb_id_map_table_t* table = map->table;
+	if (table && table->fixed)
+	{
+		memset(table->slots, 0, (table->mask + 1) * sizeof(bb_id_map_slot_t));
+		table->count = 0;
+		return;
+	}
+
+	map->table = NULL;
+	while (table)
+	{
+		bb_id_map_table_t* retired = table->retired;
+		bb_free(table);
+		table = retired;
+	}
+}
+
+u32 bb_id_map_fixed_size(u32 maxIds)
+{
+	return (u32)bb_id_map_table_bytes(bb_id_map_fixed_slots(maxIds));
+}
+
+void bb_id_map_init_fixed(bb_id_map_t* map, void* memory, u32 maxIds)
+{
+	u32 size = bb_id_map_fixed_slots(maxIds);
+	bb_id_map_table_t* table = (bb_id_map_table_t*)memory;
+	memset(table, 0, bb_id_map_table_bytes(size));
+	table->mask = size - 1;
+	table->fixed = true;
+	map->table = table;
+}
+
+#endif // #if BB_ENABLED
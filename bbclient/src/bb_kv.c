@@ -0,0 +1,518 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#if !defined(BB_ENABLED) || BB_ENABLED
+
+#include "bb.h"
+
+#include "bbclient/bb_kv.h"
+#include "bbclient/bb_wrap_stdio.h"
+#include <stdlib.h>
+#include <string.h>
+
+bb_kv_t bb_kv_int(const char* key, int64_t value)
+{
+	bb_kv_t kv = { BB_EMPTY_INITIALIZER };
+	kv.key = key;
+	kv.type = kBBKV_Int;
+	kv.value.i = value;
+	return kv;
+}
+
+bb_kv_t bb_kv_float(const char* key, double value)
+{
+	bb_kv_t kv = { BB_EMPTY_INITIALIZER };
+	kv.key = key;
+	kv.type = kBBKV_Float;
+	kv.value.f = value;
+	return kv;
+}
+
+bb_kv_t bb_kv_string(const char* key, const char* value)
+{
+	bb_kv_t kv = { BB_EMPTY_INITIALIZER };
+	kv.key = key;
+	kv.type = kBBKV_String;
+	kv.value.s = value;
+	return kv;
+}
+
+bb_kv_t bb_kv_bool(const char* key, int value)
+{
+	bb_kv_t kv = { BB_EMPTY_INITIALIZER };
+	kv.key = key;
+	kv.type = kBBKV_Bool;
+	kv.value.i = value != 0;
+	return kv;
+}
+
+bb_kv_t bb_kv_object(const char* key)
+{
+	bb_kv_t kv = { BB_EMPTY_INITIALIZER };
+	kv.key = key;
+	kv.type = kBBKV_Object;
+	return kv;
+}
+
+bb_kv_t bb_kv_object_end(void)
+{
+	bb_kv_t kv = { BB_EMPTY_INITIALIZER };
+	kv.type = kBBKV_ObjectEnd;
+	return kv;
+}
+
+typedef struct bbkv_writer_s
+{
+	u8* dest;
+	u32 destSize;
+	u32 len;
+	b32 overflow;
+	u8 pad[4];
+} bbkv_writer_t;
+
+static void bbkv_write(bbkv_writer_t* writer, const void* data, u32 len)
+{
+	if (writer->overflow || writer->destSize - writer->len < len)
+	{
+		writer->overflow = true;
+		return;
+	}
+	memcpy(writer->dest + writer->len, data, len);
+	writer->len += len;
+}
+
+static void bbkv_write_u8(bbkv_writer_t* writer, u8 value)
+{
+	bbkv_write(writer, &value, 1);
+}
+
+static void bbkv_write_varint(bbkv_writer_t* writer, u64 value)
+{
+	u8 bytes[10];
+	u32 len = 0;
+	while (value >= 0x80)
+	{
+		bytes[len++] = (u8)(value | 0x80);
+		value >>= 7;
+	}
+	bytes[len++] = (u8)value;
+	bbkv_write(writer, bytes, len);
+}
+
+static void bbkv_write_key(bbkv_writer_t* writer, const char* key)
+{
+	size_t keyLen = (key) ? strlen(key) : 0;
+	keyLen = (keyLen > (size_t)kBBKV_MaxKeyLen) ? (size_t)kBBKV_MaxKeyLen : keyLen;
+	bbkv_write_u8(writer, (u8)keyLen);
+	bbkv_write(writer, key, (u32)keyLen);
+}
+
+u32 bbkv_encode(const bb_kv_t* fields, u32 count, u8* dest, u32 destSize)
+{
+	bbkv_writer_t writer = { BB_EMPTY_INITIALIZER };
+	writer.dest = dest;
+	writer.destSize = destSize;
+
+	u32 depth = 0;
+	for (u32 i = 0; i < count; ++i)
+	{
+		const bb_kv_t* field = fields + i;
+		if (field->type >= kBBKV_Count)
+			return 0;
+
+		bbkv_write_u8(&writer, (u8)field->type);
+		if (field->type == kBBKV_ObjectEnd)
+		{
+			if (!depth)
+				return 0;
+			--depth;
+			continue;
+		}
+
+		bbkv_write_key(&writer, field->key);
+		switch (field->type)
+		{
+		case kBBKV_Int:
+		{
+			const u64 value = (u64)field->value.i;
+			bbkv_write_varint(&writer, (value << 1) ^ (u64)(field->value.i >> 63));
+			break;
+		}
+		case kBBKV_Float:
+		{
+			u64 bits;
+			u8 bytes[8];
+			memcpy(&bits, &field->value.f, sizeof(bits));
+			for (u32 byte = 0; byte < 8; ++byte)
+			{
+				bytes[byte] = (u8)(bits >> (byte * 8));
+			}
+			bbkv_write(&writer, bytes, sizeof(bytes));
+			break;
+		}
+		case kBBKV_String:
+		{
+			const char* value = (field->value.s) ? field->value.s : "";
+			const size_t len = strlen(value);
+			if (len > destSize)
+				return 0;
+			bbkv_write_varint(&writer, len);
+			bbkv_write(&writer, value, (u32)len);
+			break;
+		}
+		case kBBKV_Bool:
+			bbkv_write_u8(&writer, field->value.i != 0);
+			break;
+		case kBBKV_Object:
+			if (++depth > kBBKV_MaxDepth)
+				return 0;
+			break;
+		case kBBKV_ObjectEnd:
+		case kBBKV_Count:
+		default:
+			break;
+		}
+	}
+
+	while (depth--)
+	{
+		bbkv_write_u8(&writer, kBBKV_ObjectEnd);
+	}
+	return (writer.overflow) ? 0u : writer.len;
+}
+
+void bbkv_reader_init(bbkv_reader_t* reader, const u8* data, u32 len)
+{
+	memset(reader, 0, sizeof(*reader));
+	reader->data = data;
+	reader->len = len;
+}
+
+static b32 bbkv_read_varint(bbkv_reader_t* reader, u64* value)
+{
+	*value = 0;
+	for (u32 shift = 0; shift < 64 && reader->cursor < reader->len; shift += 7)
+	{
+		const u8 byte = reader->data[reader->cursor++];
+		*value |= (u64)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+b32 bbkv_read(bbkv_reader_t* reader, bbkv_field_t* field)
+{
+	memset(field, 0, sizeof(*field));
+	if (reader->cursor >= reader->len)
+		return false;
+
+	const u8 type = reader->data[reader->cursor++];
+	if (type >= kBBKV_Count)
+	{
+		reader->cursor = reader->len;
+		return false;
+	}
+	field->type = (bb_kv_type_e)type;
+	if (field->type == kBBKV_ObjectEnd)
+	{
+		if (!reader->depth)
+		{
+			reader->cursor = reader->len;
+			return false;
+		}
+		field->depth = --reader->depth;
+		return true;
+	}
+
+	field->depth = reader->depth;
+	if (reader->cursor >= reader->len || reader->len - reader->cursor - 1 < reader->data[reader->cursor])
+	{
+		reader->cursor = reader->len;
+		return false;
+	}
+	field->keyLen = reader->data[reader->cursor++];
+	field->key = (const char*)reader->data + reader->cursor;
+	reader->cursor += field->keyLen;
+
+	b32 ok = true;
+	switch (field->type)
+	{
+	case kBBKV_Int:
+	{
+		u64 value;
+		ok = bbkv_read_varint(reader, &value);
+		field->i = (s64)(value >> 1) ^ -(s64)(value & 1);
+		break;
+	}
+	case kBBKV_Float:
+		if (reader->len - reader->cursor >= 8)
+		{
+			u64 bits = 0;
+			for (u32 byte = 0; byte < 8; ++byte)
+			{
+				bits |= (u64)reader->data[reader->cursor++] << (byte * 8);
+			}
+			memcpy(&field->f, &bits, sizeof(field->f));
+		}
+		else
+		{
+			ok = false;
+		}
+		break;
+	case kBBKV_String:
+	{
+		u64 len;
+		ok = bbkv_read_varint(reader, &len) && len <= reader->len - reader->cursor;
+		if (ok)
+		{
+			field->stringLen = (u32)len;
+			field->string = (const char*)reader->data + reader->cursor;
+			reader->cursor += field->stringLen;
+		}
+		break;
+	}
+	case kBBKV_Bool:
+		ok = reader->cursor < reader->len;
+		if (ok)
+		{
+			field->i = reader->data[reader->cursor++] != 0;
+		}
+		break;
+	case kBBKV_Object:
+		ok = reader->depth < kBBKV_MaxDepth;
+		++reader->depth;
+		break;
+	case kBBKV_ObjectEnd:
+	case kBBKV_Count:
+	default:
+		break;
+	}
+
+	if (!ok)
+	{
+		reader->cursor = reader->len;
+	}
+	return ok;
+}
+
+b32 bbkv_find(const u8* data, u32 len, const char* path, bbkv_field_t* field)
+{
+	// matched is how many of the leading keys in path the objects the reader is in match
+	u32 matched = 0;
+	const char* key = path;
+	bbkv_reader_t reader;
+	bbkv_reader_init(&reader, data, len);
+	while (bbkv_read(&reader, field))
+	{
+		if (field->type == kBBKV_ObjectEnd)
+		{
+			if (field->depth < matched)
+			{
+				// left an object whose key matched - rewind the path to its key
+				matched = field->depth;
+				key = path;
+				for (u32 i = 0; i < matched; ++i)
+				{
+					key = strchr(key, '.') + 1;
+				}
+			}
+			continue;
+		}
+		if (field->depth != matched)
+			continue;
+
+		const char* keyEnd = strchr(key, '.');
+		const size_t keyLen = (keyEnd) ? (size_t)(keyEnd - key) : strlen(key);
+		if (keyLen != field->keyLen || strncmp(key, field->key, keyLen) != 0)
+			continue;
+
+		if (!keyEnd)
+			return true;
+		if (field->type == kBBKV_Object)
+		{
+			++matched;
+			key = keyEnd + 1;
+		}
+	}
+	return false;
+}
+
+typedef struct bbkv_text_s
+{
+	char* dest;
+	u32 destSize;
+	u32 len;
+} bbkv_text_t;
+
+static void bbkv_text_append(bbkv_text_t* text, const char* data, u32 len)
+{
+	if (text->dest && text->len + 1 < text->destSize)
+	{
+		const u32 space = text->destSize - 1 - text->len;
+		memcpy(text->dest + text->len, data, (len < space) ? len : space);
+	}
+	text->len += len;
+}
+
+static u32 bbkv_text_finish(bbkv_text_t* text)
+{
+	if (text->dest && text->destSize)
+	{
+		text->dest[(text->len < text->destSize) ? text->len : text->destSize - 1] = '\0';
+	}
+	return text->len;
+}
+
+// Shortest of %.15g and %.17g that reads back as the same double
+static void bbkv_text_append_double(bbkv_text_t* text, double value)
+{
+	char buffer[32];
+	int len = bb_snprintf(buffer, sizeof(buffer), "%.15g", value);
+	if (len > 0 && (size_t)len < sizeof(buffer) && strtod(buffer, NULL) != value)
+	{
+		len = bb_snprintf(buffer, sizeof(buffer), "%.17g", value);
+	}
+	if (len > 0 && (size_t)len < sizeof(buffer))
+	{
+		bbkv_text_append(text, buffer, (u32)len);
+	}
+}
+
+static void bbkv_text_append_value(bbkv_text_t* text, const bbkv_field_t* field)
+{
+	switch (field->type)
+	{
+	case kBBKV_Int:
+	{
+		char buffer[32];
+		int len = bb_snprintf(buffer, sizeof(buffer), "%lld", (long long)field->i);
+		if (len > 0 && (size_t)len < sizeof(buffer))
+		{
+			bbkv_text_append(text, buffer, (u32)len);
+		}
+		break;
+	}
+	case kBBKV_Float:
+		bbkv_text_append_double(text, field->f);
+		break;
+	case kBBKV_String:
+		bbkv_text_append(text, field->string, field->stringLen);
+		break;
+	case kBBKV_Bool:
+		if (field->i)
+		{
+			bbkv_text_append(text, "true", 4);
+		}
+		else
+		{
+			bbkv_text_append(text, "false", 5);
+		}
+		break;
+	case kBBKV_Object:
+	case kBBKV_ObjectEnd:
+	case kBBKV_Count:
+	default:
+		break;
+	}
+}
+
+static void bbkv_text_append_json_string(bbkv_text_t* text, const char* str, u32 len)
+{
+	static const char s_hex[] = "0123456789abcdef";
+	bbkv_text_append(text, "\"", 1);
+	for (u32 i = 0; i < len; ++i)
+	{
+		const u8 c = (u8)str[i];
+		if (c == '"' || c == '\\')
+		{
+			const char escaped[2] = { '\\', (char)c };
+			bbkv_text_append(text, escaped, 2);
+		}
+		else if (c == '\n')
+		{
+			bbkv_text_append(text, "\\n", 2);
+		}
+		else if (c == '\r')
+		{
+			bbkv_text_append(text, "\\r", 2);
+		}
+		else if (c == '\t')
+		{
+			bbkv_text_append(text, "\\t", 2);
+		}
+		else if (c < 0x20)
+		{
+			const char escaped[6] = { '\\', 'u', '0', '0', s_hex[c >> 4], s_hex[c & 0xF] };
+			bbkv_text_append(text, escaped, 6);
+		}
+		else
+		{
+			bbkv_text_append(text, str + i, 1);
+		}
+	}
+	bbkv_text_append(text, "\"", 1);
+}
+
+u32 bbkv_format_value(const bbkv_field_t* field, char* dest, u32 destSize)
+{
+	bbkv_text_t text = { dest, destSize, 0 };
+	bbkv_text_append_value(&text, field);
+	return bbkv_text_finish(&text);
+}
+
+u32 bbkv_format_json(const u8* data, u32 len, char* dest, u32 destSize)
+{
+	bbkv_text_t text = { dest, destSize, 0 };
+	b32 first = true;
+	bbkv_field_t field;
+	bbkv_reader_t reader;
+	bbkv_reader_init(&reader, data, len);
+	bbkv_text_append(&text, "{", 1);
+	while (bbkv_read(&reader, &field))
+	{
+		if (field.type == kBBKV_ObjectEnd)
+		{
+			bbkv_text_append(&text, "}", 1);
+			first = false;
+			continue;
+		}
+
+		if (!first)
+		{
+			bbkv_text_append(&text, ",", 1);
+		}
+		bbkv_text_append_json_string(&text, field.key, field.keyLen);
+		bbkv_text_append(&text, ":", 1);
+		if (field.type == kBBKV_Object)
+		{
+			bbkv_text_append(&text, "{", 1);
+			first = true;
+			continue;
+		}
+
+		if (field.type == kBBKV_String)
+		{
+			bbkv_text_append_json_string(&text, field.string, field.stringLen);
+		}
+		else if (field.type == kBBKV_Float && field.f - field.f != 0.0)
+		{
+			// JSON has no infinity or NaN
+			bbkv_text_append(&text, "null", 4);
+		}
+		else
+		{
+			bbkv_text_append_value(&text, &field);
+		}
+		first = false;
+	}
+
+	// corrupt fields can leave objects open
+	for (u32 i = 0; i <= reader.depth; ++i)
+	{
+		bbkv_text_append(&text, "}", 1);
+	}
+	return bbkv_text_finish(&text);
+}
+
+#endif // #if BB_ENABLED
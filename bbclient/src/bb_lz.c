@@ -0,0 +1,189 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#if !defined(BB_ENABLED) || BB_ENABLED
+
+#include "bb.h"
+
+#include "bbclient/bb_lz.h"
+#include <string.h>
+
+enum
+{
+	kBBLZ_LastLiterals = 5, // matches stop short of the end, so the block always ends in literals
+};
+
+static BB_INLINE u32 bblz_read_u32(const u8* p)
+{
+	u32 value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static BB_INLINE u32 bblz_hash(const u8* p)
+{
+	return (bblz_read_u32(p) * 2654435761u) >> (32 - kBBLZ_HashBits);
+}
+
+static u8* bblz_write_length(u8* op, const u8* opEnd, u32 len)
+{
+	while (len >= 255)
+	{
+		if (op >= opEnd)
+			return NULL;
+		*op++ = 255;
+		len -= 255;
+	}
+	if (op >= opEnd)
+		return NULL;
+	*op++ = (u8)len;
+	return op;
+}
+
+static u8* bblz_write_sequence(u8* op, const u8* opEnd, const u8* literals, u32 literalLen, u32 offset, u32 matchLen)
+{
+	if (op >= opEnd)
+		return NULL;
+
+	u8* token = op++;
+	*token = (u8)(((literalLen < 15) ? literalLen : 15) << 4);
+	if (literalLen >= 15)
+	{
+		op = bblz_write_length(op, opEnd, literalLen - 15);
+		if (!op)
+			return NULL;
+	}
+	if ((u32)(opEnd - op) < literalLen)
+		return NULL;
+	memcpy(op, literals, literalLen);
+	op += literalLen;
+
+	if (matchLen)
+	{
+		u32 matchCode = matchLen - kBBLZ_MinMatch;
+		*token |= (u8)((matchCode < 15) ? matchCode : 15);
+		if (opEnd - op < 2)
+			return NULL;
+		*op++ = (u8)(offset & 0xFF);
+		*op++ = (u8)(offset >> 8);
+		if (matchCode >= 15)
+		{
+			op = bblz_write_length(op, opEnd, matchCode - 15);
+		}
+	}
+	return op;
+}
+
+u32 bblz_compress_bound(u32 srcLen)
+{
+	return srcLen + srcLen / 255 + 16;
+}
+
+u32 bblz_compress(const u8* src, u32 srcLen, u8* dst, u32 dstSize, u16* hashTable)
+{
+	if (srcLen > kBBLZ_MaxInput)
+		return 0;
+
+	u8* op = dst;
+	const u8* opEnd = dst + dstSize;
+	u32 anchor = 0;
+	u32 pos = 0;
+
+	if (srcLen > kBBLZ_MinMatch + kBBLZ_LastLiterals)
+	{
+		const u32 matchLimit = srcLen - kBBLZ_LastLiterals;
+		memset(hashTable, 0, kBBLZ_HashEntries * sizeof(u16));
+		while (pos + kBBLZ_MinMatch <= matchLimit)
+		{
+			const u32 h = bblz_hash(src + pos);
+			const u32 candidate = hashTable[h];
+			hashTable[h] = (u16)pos;
+			if (candidate >= pos || bblz_read_u32(src + candidate) != bblz_read_u32(src + pos))
+			{
+				++pos;
+				continue;
+			}
+
+			u32 matchLen = kBBLZ_MinMatch;
+			while (pos + matchLen < matchLimit && src[candidate + matchLen] == src[pos + matchLen])
+			{
+				++matchLen;
+			}
+
+			op = bblz_write_sequence(op, opEnd, src + anchor, pos - anchor, pos - candidate, matchLen);
+			if (!op)
+				return 0;
+
+			pos += matchLen;
+			anchor = pos;
+			if (pos + kBBLZ_MinMatch <= matchLimit)
+			{
+				// keep the table warm across the match, so runs of similar lines keep matching
+				hashTable[bblz_hash(src + pos - 2)] = (u16)(pos - 2);
+			}
+		}
+	}
+
+	op = bblz_write_sequence(op, opEnd, src + anchor, srcLen - anchor, 0, 0);
+	return (op) ? (u32)(op - dst) : 0;
+}
+
+static b32 bblz_read_length(const u8** ip, const u8* ipEnd, u32* len)
+{
+	u8 b;
+	do
+	{
+		if (*ip >= ipEnd)
+			return false;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+b32 bblz_decompress(const u8* src, u32 srcLen, u8* dst, u32 dstLen)
+{
+	const u8* ip = src;
+	const u8* ipEnd = src + srcLen;
+	u8* op = dst;
+	u8* opEnd = dst + dstLen;
+
+	while (ip < ipEnd)
+	{
+		const u8 token = *ip++;
+		u32 literalLen = token >> 4;
+		if (literalLen == 15 && !bblz_read_length(&ip, ipEnd, &literalLen))
+			return false;
+		if ((u32)(ipEnd - ip) < literalLen || (u32)(opEnd - op) < literalLen)
+			return false;
+		memcpy(op, ip, literalLen);
+		ip += literalLen;
+		op += literalLen;
+
+		if (ip == ipEnd)
+			break; // final sequence is literals only
+
+		if (ipEnd - ip < 2)
+			return false;
+		const u32 offset = (u32)ip[0] | ((u32)ip[1] << 8);
+		ip += 2;
+		u32 matchLen = token & 15;
+		if (matchLen == 15 && !bblz_read_length(&ip, ipEnd, &matchLen))
+			return false;
+		matchLen += kBBLZ_MinMatch;
+		if (!offset || offset > (u32)(op - dst) || (u32)(opEnd - op) < matchLen)
+			return false;
+
+		// byte by byte, since the match can overlap the bytes it is producing
+		const u8* match = op - offset;
+		for (u32 i = 0; i < matchLen; ++i)
+		{
+			op[i] = match[i];
+		}
+		op += matchLen;
+	}
+
+	return op == opEnd;
+}
+
+#endif // #if BB_ENABLED
@@ -4,6 +4,7 @@
 #if !defined(BB_ENABLED) || BB_ENABLED
 
 #include "bb.h"
+#include "bbclient/bb_assert.h"
 #include "bbclient/bb_malloc.h"
 #include "bbclient/bb_common.h"
 #include "bbclient/bb_wrap_malloc.h"
@@ -18,14 +19,21 @@ BB_WARNING_DISABLE(4710) // warning C4710: 'snprintf': function not inlined
 #endif
 
 static b32 s_bbTrackMalloc;
+static b32 s_bbMallocForbidden;
 
 void bb_tracked_malloc_enable(b32 enabled)
 {
 	s_bbTrackMalloc = enabled;
 }
 
+void bb_malloc_forbid(b32 forbidden)
+{
+	s_bbMallocForbidden = forbidden;
+}
+
 void* bb_malloc_loc(const char* file, int line, size_t size)
 {
+	BB_ASSERT_MSG(!s_bbMallocForbidden, "%s(%d) : bb_malloc(%zu) after bb_init with bb_set_pools", file, line, size);
 	void* ptr = malloc(size);
 	if (s_bbTrackMalloc)
 	{
@@ -45,6 +53,7 @@ void* bb_malloc_loc(const char* file, int line, size_t size)
 
 void* bb_realloc_loc(const char* file, int line, void* ptr, size_t size)
 {
+	BB_ASSERT_MSG(!s_bbMallocForbidden, "%s(%d) : bb_realloc(%zu) after bb_init with bb_set_pools", file, line, size);
 	u64 oldPtr = (u64)ptr;
 	void* newPtr = realloc(ptr, size);
 	if (s_bbTrackMalloc)
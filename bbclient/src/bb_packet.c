@@ -6,8 +6,10 @@
 #include "bb.h"
 
 #include "bbclient/bb_assert.h"
+#include "bbclient/bb_lz.h"
 #include "bbclient/bb_packet.h"
 #include "bbclient/bb_serialize.h"
+#include <stdio.h>
 #include <string.h>
 
 static b32 bbpacket_serialize_header(bb_serialize_t* ser, bb_decoded_packet_t* decoded)
@@ -148,6 +150,106 @@ static b32 bbpacket_serialize_log_text(bb_serialize_t* ser, bb_decoded_packet_t*
 	return bbserialize_remaining_text(ser, decoded->packet.logText.text);
 }
 
+static b32 bbpacket_serialize_log_text_deferred(bb_serialize_t* ser, bb_decoded_packet_t* decoded)
+{
+	bb_packet_log_text_deferred_t* packet = &decoded->packet.logTextDeferred;
+	bbserialize_u32(ser, &packet->categoryId);
+	bbserialize_u32(ser, &packet->level);
+	bbserialize_s32(ser, &packet->pieInstance);
+	bbserialize_s32(ser, (s32*)&packet->colors.fg);
+	bbserialize_s32(ser, (s32*)&packet->colors.bg);
+	bbserialize_u32(ser, &packet->formatId);
+	return bbserialize_remaining_buffer(ser, packet->args, BB_ARRAYSIZE(packet->args), &packet->argsLen);
+}
+
+static b32 bbpacket_serialize_log_text_kv(bb_serialize_t* ser, bb_decoded_packet_t* decoded)
+{
+	bb_packet_log_text_kv_t* packet = &decoded->packet.logTextKV;
+	bbserialize_u32(ser, &packet->categoryId);
+	bbserialize_u32(ser, &packet->level);
+	bbserialize_s32(ser, &packet->pieInstance);
+	bbserialize_s32(ser, (s32*)&packet->colors.fg);
+	bbserialize_s32(ser, (s32*)&packet->colors.bg);
+	bbserialize_u16(ser, &packet->fieldsLen);
+	if (packet->fieldsLen > sizeof(packet->fields))
+	{
+		ser->state = kBBSerialize_OutOfSpace;
+		return false;
+	}
+	bbserialize_buffer(ser, packet->fields, packet->fieldsLen);
+	return bbserialize_remaining_text(ser, packet->text);
+}
+
+// The header fields hold the callsite id, thread index and zigzag timestamp delta until bbcompact_decode expands them
+static b32 bbpacket_serialize_log_text_compact(bb_serialize_t* ser, bb_decoded_packet_t* decoded)
+{
+	u64 callsiteId = decoded->header.fileId;
+	u64 threadIndex = decoded->header.threadId;
+	bbserialize_varint(ser, &callsiteId);
+	bbserialize_varint(ser, &threadIndex);
+	bbserialize_varint(ser, &decoded->header.timestamp);
+	if (ser->reading)
+	{
+		decoded->header.fileId = (u32)callsiteId;
+		decoded->header.threadId = threadIndex;
+		decoded->header.line = 0;
+	}
+	return bbserialize_remaining_text(ser, decoded->packet.logText.text);
+}
+
+static b32 bbpacket_serialize_callsite(bb_serialize_t* ser, bb_decoded_packet_t* decoded)
+{
+	bb_packet_callsite_t* packet = &decoded->packet.callsite;
+	bbserialize_u32(ser, &packet->id);
+	bbserialize_u32(ser, &packet->categoryId);
+	bbserialize_u32(ser, &packet->level);
+	bbserialize_s32(ser, &packet->pieInstance);
+	bbserialize_s32(ser, (s32*)&packet->colors.fg);
+	return bbserialize_s32(ser, (s32*)&packet->colors.bg);
+}
+
+static b32 bbpacket_serialize_thread_index(bb_serialize_t* ser, bb_decoded_packet_t* decoded)
+{
+	return bbserialize_u32(ser, &decoded->packet.threadIndex.index);
+}
+
+static b32 bbpacket_serialize_category_levels(bb_serialize_t* ser, bb_decoded_packet_t* decoded)
+{
+	bb_packet_category_levels_t* categoryLevels = &decoded->packet.categoryLevels;
+	bbserialize_u32(ser, &categoryLevels->firstCategoryId);
+	return bbserialize_remaining_buffer(ser, categoryLevels->minLevels, BB_ARRAYSIZE(categoryLevels->minLevels), &categoryLevels->count);
+}
+
+static b32 bbpacket_serialize_log_suppressed(bb_serialize_t* ser, bb_decoded_packet_t* decoded)
+{
+	bb_packet_log_suppressed_t* logSuppressed = &decoded->packet.logSuppressed;
+	bbserialize_u32(ser, &logSuppressed->categoryId);
+	bbserialize_u32(ser, &logSuppressed->level);
+	bbserialize_u32(ser, &logSuppressed->rateLimited);
+	return bbserialize_u32(ser, &logSuppressed->repeated);
+}
+
+// Reading leaves the text where it is, in the buffer being deserialized
+static b32 bbpacket_serialize_log_text_large(bb_serialize_t* ser, bb_decoded_packet_t* decoded)
+{
+	bb_packet_log_text_large_t* packet = &decoded->packet.logTextLarge;
+	bbserialize_u32(ser, &packet->categoryId);
+	bbserialize_u32(ser, &packet->level);
+	bbserialize_s32(ser, &packet->pieInstance);
+	bbserialize_s32(ser, (s32*)&packet->colors.fg);
+	bbserialize_s32(ser, (s32*)&packet->colors.bg);
+	if (ser->reading)
+	{
+		if (ser->state != kBBSerialize_Ok)
+			return false;
+		packet->textLen = bbserialize_get_remaining(ser);
+		packet->text = (const char*)ser->pBuffer + ser->nCursorBytes;
+		ser->nCursorBytes += packet->textLen;
+		return true;
+	}
+	return bbserialize_buffer(ser, (void*)packet->text, packet->textLen);
+}
+
 static b32 bbpacket_serialize_frameend(bb_serialize_t* ser, bb_decoded_packet_t* decoded)
 {
 	return bbserialize_double(ser, &decoded->packet.frameEnd.milliseconds);
@@ -191,6 +293,55 @@ static b32 bbpacket_serialize_framenumber(bb_serialize_t* ser, bb_decoded_packet
 	return bbserialize_u64(ser, &decoded->packet.frameNumber.frameNumber);
 }
 
+static b32 bbpacket_serialize_server_features(bb_serialize_t* ser, bb_decoded_packet_t* decoded)
+{
+	return bbserialize_u32(ser, &decoded->packet.serverFeatures.features);
+}
+
+static b32 bbpacket_serialize_time_calibration(bb_serialize_t* ser, bb_decoded_packet_t* decoded)
+{
+	bb_packet_time_calibration_t* packet = &decoded->packet.timeCalibration;
+	bbserialize_double(ser, &packet->millisPerTick);
+	return bbserialize_u64(ser, &packet->microsecondsFromEpoch);
+}
+
+static b32 bbpacket_serialize_logs_dropped(bb_serialize_t* ser, bb_decoded_packet_t* decoded)
+{
+	bb_packet_logs_dropped_t* packet = &decoded->packet.logsDropped;
+	bbserialize_u32(ser, &packet->categoryId);
+	bbserialize_u32(ser, &packet->policy);
+	for (u32 i = 0; i < BB_ARRAYSIZE(packet->dropped); ++i)
+	{
+		bbserialize_u32(ser, packet->dropped + i);
+	}
+	return ser->state == kBBSerialize_Ok;
+}
+
+static b32 bbpacket_serialize_client_telemetry(bb_serialize_t* ser, bb_decoded_packet_t* decoded)
+{
+	bb_packet_client_telemetry_t* packet = &decoded->packet.clientTelemetry;
+	bbserialize_double(ser, &packet->intervalMillis);
+	bbserialize_double(ser, &packet->flushMillis);
+	bbserialize_double(ser, &packet->lockWaitMillis);
+	bbserialize_u64(ser, &packet->packetsSent);
+	bbserialize_u64(ser, &packet->bytesSent);
+	bbserialize_u32(ser, &packet->flushes);
+	bbserialize_u32(ser, &packet->maxSendBytes);
+	bbserialize_u32(ser, &packet->queuedBytes);
+	bbserialize_u32(ser, &packet->droppedLogs);
+	return bbserialize_u32(ser, &packet->suppressedLogs);
+}
+
+static b32 bbpacket_serialize_flight_recorder(bb_serialize_t* ser, bb_decoded_packet_t* decoded)
+{
+	bb_packet_flight_recorder_t* packet = &decoded->packet.flightRecorder;
+	bbserialize_u32(ser, &packet->categoryId);
+	bbserialize_u32(ser, &packet->trigger);
+	bbserialize_u32(ser, &packet->logCount);
+	bbserialize_u32(ser, &packet->overwrittenLogs);
+	return bbserialize_u32(ser, &packet->end);
+}
+
 b32 bbpacket_deserialize(u8* buffer, u16 len, bb_decoded_packet_t* decoded)
 {
 	u8 type;
@@ -198,8 +349,12 @@ b32 bbpacket_deserialize(u8* buffer, u16 len, bb_decoded_packet_t* decoded)
 	bbserialize_init_read(&ser, buffer, len);
 	type = kBBPacketType_Invalid;
 	bbserialize_u8(&ser, &type);
-	bbpacket_serialize_header(&ser, decoded);
 	decoded->type = (bb_packet_type_e)type;
+	if (decoded->type == kBBPacketType_LogTextCompact)
+	{
+		return bbpacket_serialize_log_text_compact(&ser, decoded);
+	}
+	bbpacket_serialize_header(&ser, decoded);
 	switch (decoded->type)
 	{
 	case kBBPacketType_AppInfo_v1:
@@ -235,8 +390,15 @@ b32 bbpacket_deserialize(u8* buffer, u16 len, bb_decoded_packet_t* decoded)
 
 	case kBBPacketType_FileId:
 	case kBBPacketType_CategoryId:
+	case kBBPacketType_FormatId:
 		return bbpacket_serialize_register_id(&ser, decoded);
 
+	case kBBPacketType_LogTextDeferred:
+		return bbpacket_serialize_log_text_deferred(&ser, decoded);
+
+	case kBBPacketType_LogTextKV:
+		return bbpacket_serialize_log_text_kv(&ser, decoded);
+
 	case kBBPacketType_ThreadEnd:
 		return ser.state == kBBSerialize_Ok;
 
@@ -262,9 +424,41 @@ b32 bbpacket_deserialize(u8* buffer, u16 len, bb_decoded_packet_t* decoded)
 	case kBBPacketType_FrameNumber:
 		return bbpacket_serialize_framenumber(&ser, decoded);
 
+	case kBBPacketType_ServerFeatures:
+		return bbpacket_serialize_server_features(&ser, decoded);
+
+	case kBBPacketType_Callsite:
+		return bbpacket_serialize_callsite(&ser, decoded);
+
+	case kBBPacketType_ThreadIndex:
+		return bbpacket_serialize_thread_index(&ser, decoded);
+
+	case kBBPacketType_CategoryLevels:
+		return bbpacket_serialize_category_levels(&ser, decoded);
+
+	case kBBPacketType_LogSuppressed:
+		return bbpacket_serialize_log_suppressed(&ser, decoded);
+
+	case kBBPacketType_LogTextLarge:
+		return bbpacket_serialize_log_text_large(&ser, decoded);
+
+	case kBBPacketType_TimeCalibration:
+		return bbpacket_serialize_time_calibration(&ser, decoded);
+
+	case kBBPacketType_LogsDropped:
+		return bbpacket_serialize_logs_dropped(&ser, decoded);
+
+	case kBBPacketType_ClientTelemetry:
+		return bbpacket_serialize_client_telemetry(&ser, decoded);
+
+	case kBBPacketType_FlightRecorder:
+		return bbpacket_serialize_flight_recorder(&ser, decoded);
+
 	case kBBPacketType_Invalid:
 	case kBBPacketType_Restart:
 	case kBBPacketType_StopRecording:
+	case kBBPacketType_CompressedBatch:
+	case kBBPacketType_LogTextCompact:
 		break;
 	}
 
@@ -278,7 +472,10 @@ u16 bbpacket_serialize(bb_decoded_packet_t* source, u8* buffer, u16 len)
 	bbserialize_init_write(&ser, buffer, len);
 	type = (u8)source->type;
 	bbserialize_u8(&ser, &type);
-	bbpacket_serialize_header(&ser, source);
+	if (source->type != kBBPacketType_LogTextCompact)
+	{
+		bbpacket_serialize_header(&ser, source);
+	}
 	switch (source->type)
 	{
 	case kBBPacketType_AppInfo_v1:
@@ -323,9 +520,18 @@ u16 bbpacket_serialize(bb_decoded_packet_t* source, u8* buffer, u16 len)
 
 	case kBBPacketType_FileId:
 	case kBBPacketType_CategoryId:
+	case kBBPacketType_FormatId:
 		bbpacket_serialize_register_id(&ser, source);
 		break;
 
+	case kBBPacketType_LogTextDeferred:
+		bbpacket_serialize_log_text_deferred(&ser, source);
+		break;
+
+	case kBBPacketType_LogTextKV:
+		bbpacket_serialize_log_text_kv(&ser, source);
+		break;
+
 	case kBBPacketType_ThreadEnd:
 		break;
 
@@ -358,9 +564,54 @@ u16 bbpacket_serialize(bb_decoded_packet_t* source, u8* buffer, u16 len)
 		bbpacket_serialize_framenumber(&ser, source);
 		break;
 
+	case kBBPacketType_ServerFeatures:
+		bbpacket_serialize_server_features(&ser, source);
+		break;
+
+	case kBBPacketType_Callsite:
+		bbpacket_serialize_callsite(&ser, source);
+		break;
+
+	case kBBPacketType_ThreadIndex:
+		bbpacket_serialize_thread_index(&ser, source);
+		break;
+
+	case kBBPacketType_CategoryLevels:
+		bbpacket_serialize_category_levels(&ser, source);
+		break;
+
+	case kBBPacketType_LogSuppressed:
+		bbpacket_serialize_log_suppressed(&ser, source);
+		break;
+
+	case kBBPacketType_LogTextLarge:
+		bbpacket_serialize_log_text_large(&ser, source);
+		break;
+
+	case kBBPacketType_TimeCalibration:
+		bbpacket_serialize_time_calibration(&ser, source);
+		break;
+
+	case kBBPacketType_LogsDropped:
+		bbpacket_serialize_logs_dropped(&ser, source);
+		break;
+
+	case kBBPacketType_ClientTelemetry:
+		bbpacket_serialize_client_telemetry(&ser, source);
+		break;
+
+	case kBBPacketType_FlightRecorder:
+		bbpacket_serialize_flight_recorder(&ser, source);
+		break;
+
+	case kBBPacketType_LogTextCompact:
+		bbpacket_serialize_log_text_compact(&ser, source);
+		break;
+
 	case kBBPacketType_Invalid:
 	case kBBPacketType_Restart:
 	case kBBPacketType_StopRecording:
+	case kBBPacketType_CompressedBatch:
 		BB_ASSERT(false);
 		return 0;
 	}
@@ -385,6 +636,114 @@ b32 bbpacket_is_app_info_type(bb_packet_type_e type)
 	       type == kBBPacketType_AppInfo_v6;
 }
 
+u32 bbpacket_frame_length(const u8* frame, u32 available)
+{
+	if (available < kBBFrame_HeaderSize)
+		return 0;
+	const u32 frameLen = ((u32)frame[0] << 8) + frame[1];
+	if (frameLen)
+		return frameLen;
+	if (available < kBBFrame_ExtendedHeaderSize)
+		return 0;
+	const u32 extendedLen = ((u32)frame[2] << 24) + ((u32)frame[3] << 16) + ((u32)frame[4] << 8) + frame[5];
+	return (extendedLen > kBBFrame_ExtendedHeaderSize && extendedLen <= kBBFrame_MaxExtendedSize) ? extendedLen : 0;
+}
+
+u32 bbpacket_frame_header_size(const u8* frame)
+{
+	return (frame[0] || frame[1]) ? kBBFrame_HeaderSize : kBBFrame_ExtendedHeaderSize;
+}
+
+void bbpacket_write_frame_header(u8* frame, u32 frameLen, b32 extended)
+{
+	if (extended)
+	{
+		frame[0] = 0;
+		frame[1] = 0;
+		frame[2] = (u8)(frameLen >> 24);
+		frame[3] = (u8)((frameLen >> 16) & 0xFF);
+		frame[4] = (u8)((frameLen >> 8) & 0xFF);
+		frame[5] = (u8)(frameLen & 0xFF);
+	}
+	else
+	{
+		frame[0] = (u8)(frameLen >> 8);
+		frame[1] = (u8)(frameLen & 0xFF);
+	}
+}
+
+u32 bbpacket_serialize_frame(bb_decoded_packet_t* source, u8* frame, u32 frameSize)
+{
+	const b32 extended = source->type == kBBPacketType_LogTextLarge;
+	const u32 headerSize = (extended) ? kBBFrame_ExtendedHeaderSize : kBBFrame_HeaderSize;
+	const u32 maxFrameSize = (extended) ? kBBFrame_MaxExtendedSize : 0xFFFF;
+	if (frameSize <= headerSize)
+		return 0;
+	const u16 serializedLen = bbpacket_serialize(source, frame + headerSize, (u16)BB_MIN(frameSize, maxFrameSize) - (u16)headerSize);
+	if (!serializedLen)
+		return 0;
+	const u32 frameLen = serializedLen + headerSize;
+	bbpacket_write_frame_header(frame, frameLen, extended);
+	return frameLen;
+}
+
+void bbpacket_write_log_text_prefix(u8* frame, bb_packet_type_e type, const bb_packet_header_t* header, u32 categoryId, u32 level, s32 pieInstance, bb_colors_t colors)
+{
+	// same layout as bbpacket_serialize_header and bbpacket_serialize_log_text
+	const u32 headerSize = (type == kBBPacketType_LogTextLarge) ? kBBFrame_ExtendedHeaderSize : kBBFrame_HeaderSize;
+	u8 packetType = (u8)type;
+	bb_packet_header_t packetHeader = *header;
+	bb_serialize_t ser;
+	bbserialize_init_write(&ser, frame + headerSize, kBBPacket_LogTextPrefixSize - kBBFrame_HeaderSize);
+	bbserialize_u8(&ser, &packetType);
+	bbserialize_u64(&ser, &packetHeader.timestamp);
+	bbserialize_u64(&ser, &packetHeader.threadId);
+	bbserialize_u32(&ser, &packetHeader.fileId);
+	bbserialize_u32(&ser, &packetHeader.line);
+	bbserialize_u32(&ser, &categoryId);
+	bbserialize_u32(&ser, &level);
+	bbserialize_s32(&ser, &pieInstance);
+	bbserialize_s32(&ser, (s32*)&colors.fg);
+	bbserialize_s32(&ser, (s32*)&colors.bg);
+}
+
+void bbpacket_write_log_text_kv_fields_len(u8* frame, u16 fieldsLen)
+{
+	// same layout as bbpacket_serialize_log_text_kv
+	bb_serialize_t ser;
+	bbserialize_init_write(&ser, frame + kBBPacket_LogTextPrefixSize, kBBPacket_LogTextKVPrefixSize - kBBPacket_LogTextPrefixSize);
+	bbserialize_u16(&ser, &fieldsLen);
+}
+
+void bbpacket_write_log_text_deferred_format_id(u8* frame, u32 formatId)
+{
+	// same layout as bbpacket_serialize_log_text_deferred
+	bb_serialize_t ser;
+	bbserialize_init_write(&ser, frame + kBBPacket_LogTextPrefixSize, kBBPacket_LogTextDeferredPrefixSize - kBBPacket_LogTextPrefixSize);
+	bbserialize_u32(&ser, &formatId);
+}
+
+void bbpacket_write_flight_recorder(u8* frame, const bb_packet_header_t* header, const bb_packet_flight_recorder_t* packet)
+{
+	// same layout as bbpacket_serialize_header and bbpacket_serialize_flight_recorder
+	u8 packetType = (u8)kBBPacketType_FlightRecorder;
+	bb_packet_header_t packetHeader = *header;
+	bb_packet_flight_recorder_t flightRecorder = *packet;
+	bb_serialize_t ser;
+	bbserialize_init_write(&ser, frame + kBBFrame_HeaderSize, kBBPacket_FlightRecorderFrameSize - kBBFrame_HeaderSize);
+	bbserialize_u8(&ser, &packetType);
+	bbserialize_u64(&ser, &packetHeader.timestamp);
+	bbserialize_u64(&ser, &packetHeader.threadId);
+	bbserialize_u32(&ser, &packetHeader.fileId);
+	bbserialize_u32(&ser, &packetHeader.line);
+	bbserialize_u32(&ser, &flightRecorder.categoryId);
+	bbserialize_u32(&ser, &flightRecorder.trigger);
+	bbserialize_u32(&ser, &flightRecorder.logCount);
+	bbserialize_u32(&ser, &flightRecorder.overwrittenLogs);
+	bbserialize_u32(&ser, &flightRecorder.end);
+	bbpacket_write_frame_header(frame, kBBPacket_FlightRecorderFrameSize, false);
+}
+
 b32 bbpacket_is_log_text_type(bb_packet_type_e type)
 {
 	return type == kBBPacketType_LogText_v1 ||
@@ -393,4 +752,151 @@ b32 bbpacket_is_log_text_type(bb_packet_type_e type)
 	       type == kBBPacketType_LogTextPartial;
 }
 
+void bbpacket_expand_log_suppressed(const bb_decoded_packet_t* suppressed, bb_decoded_packet_t* logText)
+{
+	const bb_packet_log_suppressed_t* packet = &suppressed->packet.logSuppressed;
+	memset(logText, 0, sizeof(*logText));
+	logText->type = kBBPacketType_LogText;
+	logText->header = suppressed->header;
+	logText->packet.logText.categoryId = packet->categoryId;
+	logText->packet.logText.level = packet->level;
+	logText->packet.logText.colors.fg = kBBColor_Default;
+	logText->packet.logText.colors.bg = kBBColor_Default;
+	if (bb_snprintf(logText->packet.logText.text, sizeof(logText->packet.logText.text),
+	                "(suppressed %u logs from this line - %u over the rate limit, %u repeats)\n",
+	                packet->rateLimited + packet->repeated, packet->rateLimited, packet->repeated) < 0)
+	{
+		logText->packet.logText.text[0] = '\0';
+	}
+}
+
+static const char* s_bb_backpressure_names[] = { "blocking", "dropping the oldest logs", "dropping new logs", "spilling to disk" };
+BB_CTASSERT(BB_ARRAYSIZE(s_bb_backpressure_names) == kBBBackpressure_Count);
+
+void bbpacket_expand_logs_dropped(const bb_decoded_packet_t* logsDropped, bb_decoded_packet_t* logText)
+{
+	const bb_packet_logs_dropped_t* packet = &logsDropped->packet.logsDropped;
+	memset(logText, 0, sizeof(*logText));
+	logText->type = kBBPacketType_LogText;
+	logText->header = logsDropped->header;
+	logText->packet.logText.categoryId = packet->categoryId;
+	logText->packet.logText.level = kBBLogLevel_Warning;
+	logText->packet.logText.colors.fg = kBBColor_Default;
+	logText->packet.logText.colors.bg = kBBColor_Default;
+
+	u32 total = 0;
+	for (u32 i = 0; i < BB_ARRAYSIZE(packet->dropped); ++i)
+	{
+		total += packet->dropped[i];
+	}
+
+	char* text = logText->packet.logText.text;
+	const size_t textSize = sizeof(logText->packet.logText.text);
+	int len = bb_snprintf(text, textSize, "(dropped %u logs while the connection was backed up, %s -", total,
+	                      (packet->policy < kBBBackpressure_Count) ? s_bb_backpressure_names[packet->policy] : "unknown policy");
+	for (u32 i = 0; i < BB_ARRAYSIZE(packet->dropped); ++i)
+	{
+		if (packet->dropped[i] && len >= 0 && (size_t)len < textSize)
+		{
+			int ret = bb_snprintf(text + len, textSize - (size_t)len, " %u %s", packet->dropped[i], bb_get_log_level_name((bb_log_level_e)i, "Unknown"));
+			len = (ret < 0) ? ret : len + ret;
+		}
+	}
+	if (len < 0 || (size_t)len >= textSize || bb_snprintf(text + len, textSize - (size_t)len, ")\n") < 0)
+	{
+		text[textSize - 1] = '\0';
+	}
+}
+
+static const char* s_bb_flight_recorder_trigger_names[] = { "an error was logged", "the server asked for it", "the application asked for it" };
+BB_CTASSERT(BB_ARRAYSIZE(s_bb_flight_recorder_trigger_names) == kBBFlightRecorder_Count);
+
+void bbpacket_expand_flight_recorder(const bb_decoded_packet_t* flightRecorder, bb_decoded_packet_t* logText)
+{
+	const bb_packet_flight_recorder_t* packet = &flightRecorder->packet.flightRecorder;
+	memset(logText, 0, sizeof(*logText));
+	logText->type = kBBPacketType_LogText;
+	logText->header = flightRecorder->header;
+	logText->packet.logText.categoryId = packet->categoryId;
+	logText->packet.logText.level = kBBLogLevel_Display;
+	logText->packet.logText.colors.fg = kBBColor_Default;
+	logText->packet.logText.colors.bg = kBBColor_Default;
+	if (bb_snprintf(logText->packet.logText.text, sizeof(logText->packet.logText.text),
+	                "(flight recorder sent %u earlier logs because %s - %u older logs had been overwritten)\n", packet->logCount,
+	                (packet->trigger < kBBFlightRecorder_Count) ? s_bb_flight_recorder_trigger_names[packet->trigger] : "of an unknown trigger",
+	                packet->overwrittenLogs) < 0)
+	{
+		logText->packet.logText.text[0] = '\0';
+	}
+}
+
+b32 bbpacket_get_frame_log_level(const u8* frame, u32 frameLen, bb_log_level_e* level)
+{
+	// [frame header][u8 type][u64 timestamp][u64 threadId][u32 fileId][u32 line][u32 categoryId][u32 level] - see
+	// bbpacket_write_log_text_prefix, bbpacket_serialize_log_suppressed and bbpacket_serialize_log_text_kv
+	const u32 headerSize = bbpacket_frame_header_size(frame);
+	const u32 levelOffset = headerSize + 1 + 8 + 8 + 4 + 4 + 4;
+	if (frameLen < levelOffset + 4)
+		return false;
+
+	const bb_packet_type_e type = (bb_packet_type_e)frame[headerSize];
+	if (type != kBBPacketType_LogText && type != kBBPacketType_LogTextPartial && type != kBBPacketType_LogTextDeferred &&
+	    type != kBBPacketType_LogTextLarge && type != kBBPacketType_LogSuppressed && type != kBBPacketType_LogTextKV)
+		return false;
+
+	u32 value;
+	memcpy(&value, frame + levelOffset, sizeof(value));
+	*level = (value < kBBLogLevel_Count) ? (bb_log_level_e)value : kBBLogLevel_Log;
+	return true;
+}
+
+void bbpacket_split_log_text_large(const bb_decoded_packet_t* large, bbpacket_log_text_func func, void* context)
+{
+	const bb_packet_log_text_large_t* packet = &large->packet.logTextLarge;
+	u32 textOffset = 0;
+	do
+	{
+		bb_decoded_packet_t decoded;
+		const u32 remaining = packet->textLen - textOffset;
+		const b32 partial = remaining >= kBBSize_LogText;
+		const u32 chunkLen = (partial) ? kBBSize_LogText - 1 : remaining;
+		decoded.type = (partial) ? kBBPacketType_LogTextPartial : kBBPacketType_LogText;
+		decoded.header = large->header;
+		decoded.packet.logText.categoryId = packet->categoryId;
+		decoded.packet.logText.level = packet->level;
+		decoded.packet.logText.pieInstance = packet->pieInstance;
+		decoded.packet.logText.colors = packet->colors;
+		memcpy(decoded.packet.logText.text, packet->text + textOffset, chunkLen);
+		decoded.packet.logText.text[chunkLen] = '\0';
+		(*func)(&decoded, context);
+		textOffset += chunkLen;
+	} while (textOffset < packet->textLen);
+}
+
+b32 bbpacket_is_batch_frame(const u8* frame, u32 frameLen)
+{
+	return frameLen >= kBBBatch_HeaderSize && frame[2] == kBBPacketType_CompressedBatch;
+}
+
+u32 bbpacket_expand_batch(const u8* frame, u32 frameLen, u8* dest, u32 destSize)
+{
+	if (!bbpacket_is_batch_frame(frame, frameLen))
+		return 0;
+
+	const u32 expandedLen = ((u32)frame[3] << 8) + frame[4];
+	if (expandedLen > destSize || !bblz_decompress(frame + kBBBatch_HeaderSize, frameLen - kBBBatch_HeaderSize, dest, expandedLen))
+		return 0;
+
+	// only hand back whole frames
+	u32 cursor = 0;
+	while (cursor + 2 < expandedLen)
+	{
+		const u32 nPacketBytes = ((u32)dest[cursor] << 8) + dest[cursor + 1];
+		if (nPacketBytes < 3)
+			break;
+		cursor += nPacketBytes;
+	}
+	return (cursor == expandedLen) ? expandedLen : 0;
+}
+
 #endif // #if BB_ENABLED
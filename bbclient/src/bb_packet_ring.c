@@ -0,0 +1,138 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#if !defined(BB_ENABLED) || BB_ENABLED
+
+#include "bb.h"
+
+#include "bbclient/bb_atomic.h"
+#include "bbclient/bb_malloc.h"
+#include "bbclient/bb_packet.h"
+#include "bbclient/bb_packet_ring.h"
+#include <string.h>
+
+static u32 bb_packet_ring_data_size(u32 size)
+{
+	u32 powerOfTwo = 1024;
+	while (powerOfTwo < size && powerOfTwo < 0x80000000u)
+	{
+		powerOfTwo <<= 1;
+	}
+	return powerOfTwo;
+}
+
+u32 bb_packet_ring_memory_size(u32 size)
+{
+	return (u32)sizeof(bb_packet_ring_t) + bb_packet_ring_data_size(size);
+}
+
+bb_packet_ring_t* bb_packet_ring_init(void* memory, u32 size)
+{
+	bb_packet_ring_t* ring = (bb_packet_ring_t*)memory;
+	memset(ring, 0, sizeof(*ring));
+	ring->data = (u8*)(ring + 1);
+	ring->size = bb_packet_ring_data_size(size);
+	return ring;
+}
+
+bb_packet_ring_t* bb_packet_ring_create(u32 size)
+{
+	void* memory = bb_malloc(bb_packet_ring_memory_size(size));
+	return (memory) ? bb_packet_ring_init(memory, size) : NULL;
+}
+
+void bb_packet_ring_destroy(bb_packet_ring_t* ring)
+{
+	if (ring)
+	{
+		bb_free(ring);
+	}
+}
+
+b32 bb_packet_ring_write(bb_packet_ring_t* ring, const void* frame, u32 frameLen)
+{
+	const u32 writeCursor = ring->writeCursor;
+	const u32 readCursor = bb_atomic_load_u32(&ring->readCursor);
+	if (frameLen > ring->size - (writeCursor - readCursor))
+	{
+		++ring->stalls;
+		return false;
+	}
+
+	const u32 mask = ring->size - 1;
+	const u32 start = writeCursor & mask;
+	const u32 firstLen = BB_MIN(frameLen, ring->size - start);
+	memcpy(ring->data + start, frame, firstLen);
+	if (firstLen < frameLen)
+	{
+		memcpy(ring->data, (const u8*)frame + firstLen, frameLen - firstLen);
+	}
+
+	bb_atomic_store_u32(&ring->writeCursor, writeCursor + frameLen);
+	return true;
+}
+
+// length of the frame offset bytes past the read cursor, or 0 if there isn't a whole one
+static u32 bb_packet_ring_frame_length(const bb_packet_ring_t* ring, u32 readCursor, u32 available, u32 offset)
+{
+	if (available - offset < kBBFrame_HeaderSize)
+		return 0;
+
+	const u32 mask = ring->size - 1;
+	u8 frameHeader[kBBFrame_ExtendedHeaderSize];
+	const u32 headerLen = BB_MIN(available - offset, (u32)kBBFrame_ExtendedHeaderSize);
+	for (u32 i = 0; i < headerLen; ++i)
+	{
+		frameHeader[i] = ring->data[(readCursor + offset + i) & mask];
+	}
+	const u32 frameLen = bbpacket_frame_length(frameHeader, headerLen);
+	return (frameLen < 3 || frameLen > available - offset) ? 0 : frameLen;
+}
+
+static u32 bb_packet_ring_read(bb_packet_ring_t* ring, u8* dest, u32 destSize, u32 maxFrames)
+{
+	const u32 mask = ring->size - 1;
+	const u32 readCursor = ring->readCursor;
+	const u32 available = bb_atomic_load_u32(&ring->writeCursor) - readCursor;
+
+	u32 bytes = 0;
+	for (u32 frames = 0; frames < maxFrames; ++frames)
+	{
+		const u32 frameLen = bb_packet_ring_frame_length(ring, readCursor, available, bytes);
+		if (!frameLen || bytes + frameLen > destSize)
+		{
+			break;
+		}
+		bytes += frameLen;
+	}
+
+	if (bytes)
+	{
+		const u32 start = readCursor & mask;
+		const u32 firstLen = BB_MIN(bytes, ring->size - start);
+		memcpy(dest, ring->data + start, firstLen);
+		if (firstLen < bytes)
+		{
+			memcpy(dest + firstLen, ring->data, bytes - firstLen);
+		}
+		bb_atomic_store_u32(&ring->readCursor, readCursor + bytes);
+	}
+	return bytes;
+}
+
+u32 bb_packet_ring_read_frames(bb_packet_ring_t* ring, u8* dest, u32 destSize)
+{
+	return bb_packet_ring_read(ring, dest, destSize, ~0u);
+}
+
+u32 bb_packet_ring_read_frame(bb_packet_ring_t* ring, u8* dest, u32 destSize)
+{
+	return bb_packet_ring_read(ring, dest, destSize, 1);
+}
+
+b32 bb_packet_ring_is_empty(const bb_packet_ring_t* ring)
+{
+	return bb_atomic_load_u32(&ring->readCursor) == bb_atomic_load_u32(&ring->writeCursor);
+}
+
+#endif // #if BB_ENABLED
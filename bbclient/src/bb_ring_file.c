@@ -0,0 +1,363 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#if !defined(BB_ENABLED) || BB_ENABLED
+
+#include "bb.h"
+
+#include "bbclient/bb_atomic.h"
+#include "bbclient/bb_malloc.h"
+#include "bbclient/bb_packet.h"
+#include "bbclient/bb_ring_file.h"
+#include <string.h>
+
+#if BB_USING(BB_PLATFORM_WINDOWS)
+#include "bbclient/bb_wrap_windows.h"
+#elif BB_USING(BB_PLATFORM_LINUX) || BB_USING(BB_PLATFORM_ANDROID)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static const char s_bb_ring_file_magic[8] = { 'B', 'B', 'R', 'I', 'N', 'G', '0', '1' };
+
+enum
+{
+	kBBRingFile_Version = 1,
+	kBBRingFile_HeaderSize = 64,
+	kBBRingFile_RecordHeaderSize = 8,
+	kBBRingFile_MaxRecordLen = 0x10000, // one frame can be bigger than kBBRingFile_MaxRecordSize
+};
+
+static BB_INLINE u32 bb_ring_file_stamp(u64 cursor)
+{
+	return 0xB10CF11Eu ^ (u32)(cursor >> 3);
+}
+
+static BB_INLINE u32 bb_ring_file_record_size(u32 len)
+{
+	return (kBBRingFile_RecordHeaderSize + len + 7u) & ~7u;
+}
+
+// Registrations are needed to make sense of everything after them, so they are kept out of the ring
+static b32 bb_ring_file_is_preamble_type(u8 type)
+{
+	switch (type)
+	{
+	case kBBPacketType_AppInfo_v1:
+	case kBBPacketType_AppInfo_v2:
+	case kBBPacketType_AppInfo_v3:
+	case kBBPacketType_AppInfo_v4:
+	case kBBPacketType_AppInfo_v5:
+	case kBBPacketType_AppInfo_v6:
+	case kBBPacketType_ThreadStart:
+	case kBBPacketType_ThreadName:
+	case kBBPacketType_FileId:
+	case kBBPacketType_CategoryId:
+	case kBBPacketType_FormatId:
+		return true;
+	default:
+		return false;
+	}
+}
+
+#if BB_USING(BB_PLATFORM_WINDOWS)
+
+static void* bb_ring_file_map(const char* path, u32 size)
+{
+	HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	void* view = NULL;
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, size, NULL);
+	if (mapping)
+	{
+		view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+		CloseHandle(mapping); // the view keeps the mapping and the file alive
+	}
+	CloseHandle(file);
+	return view;
+}
+
+static void bb_ring_file_unmap(void* view, u64 size)
+{
+	BB_UNUSED(size);
+	UnmapViewOfFile(view);
+}
+
+static void bb_ring_file_sync(void* view, u64 size)
+{
+	BB_UNUSED(size);
+	FlushViewOfFile(view, 0);
+}
+
+#elif BB_USING(BB_PLATFORM_LINUX) || BB_USING(BB_PLATFORM_ANDROID)
+
+static void* bb_ring_file_map(const char* path, u32 size)
+{
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return NULL;
+
+	void* view = NULL;
+	if (ftruncate(fd, (off_t)size) == 0)
+	{
+		view = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (view == MAP_FAILED)
+		{
+			view = NULL;
+		}
+	}
+	close(fd); // the mapping keeps the file alive
+	return view;
+}
+
+static void bb_ring_file_unmap(void* view, u64 size)
+{
+	munmap(view, (size_t)size);
+}
+
+static void bb_ring_file_sync(void* view, u64 size)
+{
+	msync(view, (size_t)size, MS_ASYNC);
+}
+
+#else
+
+static void* bb_ring_file_map(const char* path, u32 size)
+{
+	BB_UNUSED(path);
+	BB_UNUSED(size);
+	return NULL;
+}
+
+static void bb_ring_file_unmap(void* view, u64 size)
+{
+	BB_UNUSED(view);
+	BB_UNUSED(size);
+}
+
+static void bb_ring_file_sync(void* view, u64 size)
+{
+	BB_UNUSED(view);
+	BB_UNUSED(size);
+}
+
+#endif
+
+b32 bb_ring_file_open(bb_ring_file_t* ringFile, const char* path, u32 size)
+{
+	memset(ringFile, 0, sizeof(*ringFile));
+	size = BB_MAX(size, (u32)kBBRingFile_MinSize) & ~7u;
+
+	u8* view = (u8*)bb_ring_file_map(path, size);
+	if (!view)
+		return false;
+
+	bb_ring_file_header_t* header = (bb_ring_file_header_t*)view;
+	header->version = kBBRingFile_Version;
+	header->headerSize = kBBRingFile_HeaderSize;
+	header->preambleSize = (size / 8) & ~7u;
+	header->ringSize = size - kBBRingFile_HeaderSize - header->preambleSize;
+	header->preambleCursor = 0;
+	header->ringCursor = 0;
+	memcpy(header->magic, s_bb_ring_file_magic, sizeof(header->magic));
+
+	ringFile->header = header;
+	ringFile->preamble = view + kBBRingFile_HeaderSize;
+	ringFile->ring = ringFile->preamble + header->preambleSize;
+	ringFile->mappedSize = size;
+	return true;
+}
+
+void bb_ring_file_close(bb_ring_file_t* ringFile)
+{
+	if (ringFile->header)
+	{
+		bb_ring_file_sync(ringFile->header, ringFile->mappedSize);
+		bb_ring_file_unmap(ringFile->header, ringFile->mappedSize);
+		memset(ringFile, 0, sizeof(*ringFile));
+	}
+}
+
+b32 bb_ring_file_is_open(const bb_ring_file_t* ringFile)
+{
+	return ringFile->header != NULL;
+}
+
+void bb_ring_file_flush(bb_ring_file_t* ringFile)
+{
+	if (ringFile->header)
+	{
+		bb_ring_file_sync(ringFile->header, ringFile->mappedSize);
+	}
+}
+
+static void bb_ring_file_fill_record(u8* region, u32 regionSize, u64 start, const u8* frames, u32 len)
+{
+	// regionSize and start are multiples of 8, so the record header never wraps - only the frames can
+	const u32 offset = (u32)(start % regionSize);
+	const u32 framesOffset = (offset + kBBRingFile_RecordHeaderSize) % regionSize;
+	const u32 firstLen = BB_MIN(len, regionSize - framesOffset);
+	memcpy(region + framesOffset, frames, firstLen);
+	if (firstLen < len)
+	{
+		memcpy(region, frames + firstLen, len - firstLen);
+	}
+
+	volatile u32* recordHeader = (volatile u32*)(region + offset);
+	recordHeader[0] = len;
+	bb_atomic_store_u32(recordHeader + 1, bb_ring_file_stamp(start)); // the stamp commits the record
+}
+
+static void bb_ring_file_write_record(bb_ring_file_t* ringFile, const u8* frames, u32 len, b32 preamble)
+{
+	bb_ring_file_header_t* header = ringFile->header;
+	const u32 recordSize = bb_ring_file_record_size(len);
+	if (preamble && bb_atomic_load_u64(&header->preambleCursor) + recordSize <= header->preambleSize)
+	{
+		const u64 start = bb_atomic_fetch_add_u64(&header->preambleCursor, recordSize);
+		if (start + recordSize <= header->preambleSize)
+		{
+			bb_ring_file_fill_record(ringFile->preamble, header->preambleSize, start, frames, len);
+			return;
+		}
+	}
+
+	if (recordSize <= header->ringSize)
+	{
+		const u64 start = bb_atomic_fetch_add_u64(&header->ringCursor, recordSize);
+		bb_ring_file_fill_record(ringFile->ring, header->ringSize, start, frames, len);
+	}
+}
+
+void bb_ring_file_write(bb_ring_file_t* ringFile, const u8* frames, u32 framesLen)
+{
+	if (!ringFile->header)
+		return;
+
+	// split the frames into runs that go to the same region
+	u32 runStart = 0;
+	u32 runLen = 0;
+	b32 runPreamble = false;
+	u32 cursor = 0;
+	while (cursor + 3 <= framesLen)
+	{
+		const u32 frameLen = bbpacket_frame_length(frames + cursor, framesLen - cursor);
+		if (frameLen < 3 || cursor + frameLen > framesLen)
+			break;
+
+		const b32 preamble = bb_ring_file_is_preamble_type(frames[cursor + bbpacket_frame_header_size(frames + cursor)]);
+		if (runLen && (preamble != runPreamble || runLen + frameLen > kBBRingFile_MaxRecordSize))
+		{
+			bb_ring_file_write_record(ringFile, frames + runStart, runLen, runPreamble);
+			runLen = 0;
+		}
+		if (!runLen)
+		{
+			runStart = cursor;
+			runPreamble = preamble;
+		}
+		runLen += frameLen;
+		cursor += frameLen;
+	}
+	if (runLen)
+	{
+		bb_ring_file_write_record(ringFile, frames + runStart, runLen, runPreamble);
+	}
+}
+
+b32 bb_ring_file_is_ring_file(const void* data, u64 dataLen)
+{
+	const bb_ring_file_header_t* header = (const bb_ring_file_header_t*)data;
+	return dataLen >= kBBRingFile_HeaderSize &&
+	       !memcmp(header->magic, s_bb_ring_file_magic, sizeof(header->magic)) &&
+	       header->version == kBBRingFile_Version &&
+	       header->headerSize >= sizeof(bb_ring_file_header_t) &&
+	       header->preambleSize % 8 == 0 &&
+	       header->ringSize % 8 == 0 && header->ringSize > 0 &&
+	       (u64)header->headerSize + header->preambleSize + header->ringSize <= dataLen;
+}
+
+static b32 bb_ring_file_frames_are_whole(const u8* frames, u32 len)
+{
+	u32 cursor = 0;
+	while (cursor < len)
+	{
+		if (cursor + 3 > len)
+			return false;
+		const u32 frameLen = bbpacket_frame_length(frames + cursor, len - cursor);
+		if (frameLen < 3)
+			return false;
+		cursor += frameLen;
+	}
+	return cursor == len;
+}
+
+// Walks the records in [begin, end).  Anything that doesn't look like a whole record written at that
+// position - a torn write, or data from an earlier lap of the ring - is skipped 8 bytes at a time.
+static void bb_ring_file_unwrap_region(const u8* region, u32 regionSize, u64 begin, u64 end, u8* scratch, bb_ring_file_frames_func func, void* context)
+{
+	u64 cursor = begin;
+	while (cursor + kBBRingFile_RecordHeaderSize <= end)
+	{
+		const u32 offset = (u32)(cursor % regionSize);
+		u32 recordHeader[2];
+		memcpy(recordHeader, region + offset, sizeof(recordHeader));
+		const u32 len = recordHeader[0];
+		if (recordHeader[1] != bb_ring_file_stamp(cursor) || len == 0 || len > kBBRingFile_MaxRecordLen ||
+		    cursor + bb_ring_file_record_size(len) > end)
+		{
+			cursor += 8;
+			continue;
+		}
+
+		const u32 framesOffset = (offset + kBBRingFile_RecordHeaderSize) % regionSize;
+		const u32 firstLen = BB_MIN(len, regionSize - framesOffset);
+		const u8* frames = region + framesOffset;
+		if (firstLen < len)
+		{
+			memcpy(scratch, region + framesOffset, firstLen);
+			memcpy(scratch + firstLen, region, len - firstLen);
+			frames = scratch;
+		}
+		if (!bb_ring_file_frames_are_whole(frames, len))
+		{
+			cursor += 8;
+			continue;
+		}
+
+		(*func)(frames, len, context);
+		cursor += bb_ring_file_record_size(len);
+	}
+}
+
+b32 bb_ring_file_unwrap(const void* data, u64 dataLen, bb_ring_file_frames_func func, void* context)
+{
+	if (!bb_ring_file_is_ring_file(data, dataLen))
+		return false;
+
+	u8* scratch = (u8*)bb_malloc(kBBRingFile_MaxRecordLen);
+	if (!scratch)
+		return false;
+
+	const bb_ring_file_header_t* header = (const bb_ring_file_header_t*)data;
+	const u8* preamble = (const u8*)data + header->headerSize;
+	const u8* ring = preamble + header->preambleSize;
+
+	if (header->preambleSize)
+	{
+		const u64 preambleEnd = BB_MIN(header->preambleCursor, (u64)header->preambleSize);
+		bb_ring_file_unwrap_region(preamble, header->preambleSize, 0, preambleEnd, scratch, func, context);
+	}
+
+	const u64 ringEnd = header->ringCursor;
+	const u64 ringBegin = (ringEnd > header->ringSize) ? ringEnd - header->ringSize : 0;
+	bb_ring_file_unwrap_region(ring, header->ringSize, ringBegin, ringEnd, scratch, func, context);
+
+	bb_free(scratch);
+	return true;
+}
+
+#endif // #if BB_ENABLED
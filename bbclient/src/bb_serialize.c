@@ -144,6 +144,40 @@ b32 bbserialize_s8(bb_serialize_t* ser, s8* data)
 {
 	return bbserialize_buffer(ser, data, sizeof(*data));
 }
+b32 bbserialize_varint(bb_serialize_t* ser, u64* data)
+{
+	// 7 bits per byte, low bits first, high bit set on all but the last byte
+	if (ser->reading)
+	{
+		u64 value = 0;
+		for (u32 shift = 0; shift < 64; shift += 7)
+		{
+			u8 b = 0;
+			if (!bbserialize_u8(ser, &b))
+				return false;
+			value |= (u64)(b & 0x7F) << shift;
+			if ((b & 0x80) == 0)
+			{
+				*data = value;
+				return true;
+			}
+		}
+		ser->state = kBBSerialize_OutOfSpace;
+		return false;
+	}
+	else
+	{
+		u64 value = *data;
+		while (value >= 0x80)
+		{
+			u8 b = (u8)(value | 0x80);
+			bbserialize_u8(ser, &b);
+			value >>= 7;
+		}
+		u8 b = (u8)value;
+		return bbserialize_u8(ser, &b);
+	}
+}
 b32 bbserialize_text_(bb_serialize_t* ser, char* data, size_t maxLen, u16* len)
 {
 	if (!ser->reading)
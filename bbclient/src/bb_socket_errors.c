@@ -35,6 +35,7 @@ const char* bbnet_error_to_string(int err)
 		BBNET_SOCKET_ERROR_CASE(BBNET_ECONNABORTED);
 		BBNET_SOCKET_ERROR_CASE(BBNET_ECONNRESET);
 		BBNET_SOCKET_ERROR_CASE(BBNET_ENOBUFS);
+		BBNET_SOCKET_ERROR_CASE(BBNET_EMFILE);
 		BBNET_SOCKET_ERROR_CASE(BBNET_EISCONN);
 		BBNET_SOCKET_ERROR_CASE(BBNET_ENOTCONN);
 		BBNET_SOCKET_ERROR_CASE(BBNET_ESHUTDOWN);
@@ -16,6 +16,10 @@
 #include <fcntl.h>
 #endif // #if BB_USING(BB_COMPILER_CLANG)
 
+#if !BB_USING(BB_COMPILER_MSVC) && !BB_USING(BB_PLATFORM_ORBIS) && !BB_USING(BB_PLATFORM_PROSPERO)
+#include <poll.h>
+#endif
+
 b32 bbnet_init(void)
 {
 #if BB_USING(BB_COMPILER_MSVC)
@@ -37,8 +41,6 @@ void bbnet_shutdown(void)
 void bbnet_gracefulclose(bb_socket* socket)
 {
 	bb_socket sock;
-	fd_set set;
-	BB_TIMEVAL tv;
 	char buf[256];
 	if (!socket || *socket == BB_INVALID_SOCKET)
 		return;
@@ -51,13 +53,7 @@ void bbnet_gracefulclose(bb_socket* socket)
 	// Read any remaining data from the socket and discard.
 	for (;;)
 	{
-		FD_ZERO(&set);
-		BB_FD_SET(sock, &set);
-
-		tv.tv_sec = 0;
-		tv.tv_usec = 5 * 1000;
-
-		if (1 != select((int)sock + 1, &set, 0, 0, &tv))
+		if (1 != bbnet_socket_wait(sock, false, 5))
 		{
 			break;
 		}
@@ -115,6 +111,42 @@ int bbnet_socket_nonblocking(bb_socket socket, b32 nonblocking)
 #endif // #else // #elif BB_USING(BB_COMPILER_CLANG) // #if BB_USING(BB_COMPILER_MSVC)
 }
 
+int bbnet_socket_wait(bb_socket socket, b32 writable, u32 timeoutMillis)
+{
+#if BB_USING(BB_PLATFORM_ORBIS) || BB_USING(BB_PLATFORM_PROSPERO)
+
+	// no poll here - these only ever have a handful of sockets open
+	BB_TIMEVAL tv = { BB_EMPTY_INITIALIZER };
+	tv.tv_sec = timeoutMillis / 1000;
+	tv.tv_usec = (timeoutMillis % 1000) * 1000;
+
+	fd_set set;
+	FD_ZERO(&set);
+	BB_FD_SET(socket, &set);
+	return select((int)socket + 1, (writable) ? 0 : &set, (writable) ? &set : 0, 0, &tv);
+
+#else // #if BB_USING(BB_PLATFORM_ORBIS) || BB_USING(BB_PLATFORM_PROSPERO)
+
+#if BB_USING(BB_COMPILER_MSVC)
+	WSAPOLLFD fd;
+#else  // #if BB_USING(BB_COMPILER_MSVC)
+	struct pollfd fd;
+#endif // #else // #if BB_USING(BB_COMPILER_MSVC)
+	fd.fd = socket;
+	fd.events = (writable) ? POLLOUT : POLLIN;
+	fd.revents = 0;
+
+	// errors and hangups count as ready, as they do for select, so the recv, send or SO_ERROR that follows reports them
+#if BB_USING(BB_COMPILER_MSVC)
+	int ret = WSAPoll(&fd, 1, (INT)timeoutMillis);
+#else  // #if BB_USING(BB_COMPILER_MSVC)
+	int ret = poll(&fd, 1, (int)timeoutMillis);
+#endif // #else // #if BB_USING(BB_COMPILER_MSVC)
+	return (ret > 0) ? 1 : ret;
+
+#endif // #else // #if BB_USING(BB_PLATFORM_ORBIS) || BB_USING(BB_PLATFORM_PROSPERO)
+}
+
 int bbnet_socket_ipv6only(bb_socket socket, b32 ipv6only)
 {
 #if !BB_USING(BB_FEATURE_IPV6)
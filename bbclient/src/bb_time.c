@@ -10,6 +10,7 @@
 #if BB_USING(BB_COMPILER_MSVC)
 
 #include "bbclient/bb_wrap_windows.h"
+#include <intrin.h>
 
 u64 bb_current_ticks(void)
 {
@@ -52,6 +53,34 @@ void bb_sleep_ms(u32 millis)
 	Sleep(millis);
 }
 
+u64 bb_monotonic_nanoseconds(void)
+{
+	return (u64)((double)bb_current_ticks() * bb_millis_per_tick() * 1000000.0);
+}
+
+b32 bb_tsc_available(void)
+{
+#if defined(_M_X64) || defined(_M_IX86)
+	int info[4];
+	__cpuid(info, 0x80000000);
+	if ((u32)info[0] < 0x80000007u)
+		return false;
+	__cpuid(info, 0x80000007);
+	return (info[3] & (1 << 8)) != 0; // invariant TSC
+#else
+	return false;
+#endif
+}
+
+u64 bb_tsc_ticks(void)
+{
+#if defined(_M_X64) || defined(_M_IX86)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
 #endif // #if BB_USING(BB_COMPILER_MSVC)
 
 #if BB_USING(BB_COMPILER_CLANG)
@@ -59,6 +88,16 @@ void bb_sleep_ms(u32 millis)
 #include <time.h>
 #include <unistd.h>
 
+#if BB_USING(BB_PLATFORM_LINUX) || BB_USING(BB_PLATFORM_ANDROID)
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define BB_TSC_X86 1
+#elif defined(__aarch64__)
+#define BB_TSC_ARM64 1
+#endif
+#endif
+
 u64 bb_current_ticks(void)
 {
 	return bb_current_time_ms();
@@ -94,6 +133,75 @@ void bb_sleep_ms(u32 millis)
 	usleep(millis * 1000);
 }
 
+u64 bb_monotonic_nanoseconds(void)
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+	{
+		return (ts.tv_sec) * 1000000000ULL + (ts.tv_nsec);
+	}
+	return 0;
+}
+
+b32 bb_tsc_available(void)
+{
+#if defined(BB_TSC_X86)
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (edx & (1u << 8)) != 0; // invariant TSC
+#elif defined(BB_TSC_ARM64)
+	return true; // the generic timer's virtual count runs at a constant rate
+#else
+	return false;
+#endif
+}
+
+u64 bb_tsc_ticks(void)
+{
+#if defined(BB_TSC_X86)
+	return __rdtsc();
+#elif defined(BB_TSC_ARM64)
+	u64 ticks;
+	__asm__ volatile("mrs %0, cntvct_el0"
+	                 : "=r"(ticks));
+	return ticks;
+#else
+	return 0;
+#endif
+}
+
 #endif // #if BB_USING(BB_COMPILER_CLANG)
 
+// reads the counter either side of the clock, to halve the error
+static void bb_tsc_sample(u64* ticks, u64* nanoseconds)
+{
+	const u64 before = bb_tsc_ticks();
+	*nanoseconds = bb_monotonic_nanoseconds();
+	const u64 after = bb_tsc_ticks();
+	*ticks = before + (after - before) / 2;
+}
+
+void bb_tsc_calibration_start(bb_tsc_calibration_t* calibration)
+{
+	bb_tsc_sample(&calibration->startTicks, &calibration->startNanoseconds);
+}
+
+double bb_tsc_millis_per_tick(const bb_tsc_calibration_t* calibration)
+{
+	if (!calibration->startNanoseconds)
+		return 0.0; // no monotonic clock
+
+	u64 ticks;
+	u64 nanoseconds;
+	do
+	{
+		bb_tsc_sample(&ticks, &nanoseconds);
+	} while (nanoseconds < calibration->startNanoseconds + 1000000);
+
+	if (ticks <= calibration->startTicks)
+		return 0.0;
+	return (double)(nanoseconds - calibration->startNanoseconds) / 1000000.0 / (double)(ticks - calibration->startTicks);
+}
+
 #endif // #if BB_ENABLED
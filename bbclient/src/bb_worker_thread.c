@@ -0,0 +1,58 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#if !defined(BB_ENABLED) || BB_ENABLED
+
+#include "bb.h"
+
+#include "bbclient/bb_worker_thread.h"
+
+#if BB_USING(BB_COMPILER_MSVC)
+
+#include "bbclient/bb_wrap_process.h"
+#include "bbclient/bb_wrap_windows.h"
+
+b32 bb_worker_thread_create(bb_worker_thread_handle_t* handle, bb_worker_thread_func func, void* arg)
+{
+	*handle = _beginthreadex(
+	    NULL, // security,
+	    0,    // stack_size,
+	    func, // start_address
+	    arg,  // arglist
+	    0,    // initflag - CREATE_SUSPENDED waits for ResumeThread
+	    NULL  // thrdaddr
+	);
+	return *handle != 0;
+}
+
+void bb_worker_thread_join(bb_worker_thread_handle_t handle)
+{
+	WaitForSingleObject((HANDLE)handle, INFINITE);
+	CloseHandle((HANDLE)handle);
+}
+
+#else // #if BB_USING(BB_COMPILER_MSVC)
+
+b32 bb_worker_thread_create(bb_worker_thread_handle_t* handle, bb_worker_thread_func func, void* arg)
+{
+	b32 result;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	result = pthread_create(
+	             handle, // thread
+	             &attr,  // attr
+	             func,   // start_routine
+	             arg     // arg
+	             ) == 0;
+	pthread_attr_destroy(&attr);
+	return result;
+}
+
+void bb_worker_thread_join(bb_worker_thread_handle_t handle)
+{
+	pthread_join(handle, NULL);
+}
+
+#endif // #else // #if BB_USING(BB_COMPILER_MSVC)
+
+#endif // #if BB_ENABLED
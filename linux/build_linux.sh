@@ -10,6 +10,8 @@ clang -c -g -Werror -Wall -Wextra -I../../bbclient/include ../../bbclient/src/*.
 cd ../../linux
 echo Compiling bbclient_example_wchar...
 clang++ -g -Werror -Wall -Wextra -I../bbclient/include ../obj/linux/*.o ../bbclient/examples/bbclient_example_wchar.cpp -o ../bin/linux/bbclient_example_wchar -lpthread
+echo Compiling bbclient_bench...
+clang -g -O2 -Werror -Wall -Wextra -I../bbclient/include ../obj/linux/*.o ../bbclient/examples/bbclient_bench.c -o ../bin/linux/bbclient_bench -lpthread
 
 cd ../obj/linux
 echo Compiling mc_common...
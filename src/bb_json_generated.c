@@ -315,6 +315,9 @@ config_t json_deserialize_config_t(JSON_Value *src)
 			dst.dirStatsOverall = json_object_get_boolean_safe(obj, "dirStatsOverall");
 			dst.dateTimeUTC = json_object_get_boolean_safe(obj, "dateTimeUTC");
 			dst.tileViews = json_object_get_boolean_safe(obj, "tileViews");
+			dst.recordCompressedBatches = json_object_get_boolean_safe(obj, "recordCompressedBatches");
+			dst.recordingCommitMillis = (u32)json_object_get_number(obj, "recordingCommitMillis");
+			dst.maxConnections = (u32)json_object_get_number(obj, "maxConnections");
 		}
 	}
 	return dst;
@@ -1135,6 +1138,9 @@ JSON_Value *json_serialize_config_t(const config_t *src)
 		json_object_set_boolean(obj, "dirStatsOverall", src->dirStatsOverall);
 		json_object_set_boolean(obj, "dateTimeUTC", src->dateTimeUTC);
 		json_object_set_boolean(obj, "tileViews", src->tileViews);
+		json_object_set_boolean(obj, "recordCompressedBatches", src->recordCompressedBatches);
+		json_object_set_number(obj, "recordingCommitMillis", src->recordingCommitMillis);
+		json_object_set_number(obj, "maxConnections", src->maxConnections);
 	}
 	return val;
 }
@@ -1805,6 +1811,7 @@ vfilter_token_type_e json_deserialize_vfilter_token_type_e(JSON_Value *src)
 			if(!bb_stricmp(str, "kVFT_Text")) { dst = kVFT_Text; }
 			if(!bb_stricmp(str, "kVFT_Number")) { dst = kVFT_Number; }
 			if(!bb_stricmp(str, "kVFT_NamedFilter")) { dst = kVFT_NamedFilter; }
+			if(!bb_stricmp(str, "kVFT_Field")) { dst = kVFT_Field; }
 			if(!bb_stricmp(str, "kVFT_Count")) { dst = kVFT_Count; }
 		}
 	}
@@ -1964,6 +1971,7 @@ JSON_Value *json_serialize_vfilter_token_type_e(const vfilter_token_type_e src)
 		case kVFT_Text: str = "kVFT_Text"; break;
 		case kVFT_Number: str = "kVFT_Number"; break;
 		case kVFT_NamedFilter: str = "kVFT_NamedFilter"; break;
+		case kVFT_Field: str = "kVFT_Field"; break;
 		case kVFT_Count: str = "kVFT_Count"; break;
 	}
 	JSON_Value *val = json_value_init_string(str);
@@ -2114,6 +2122,7 @@ vfilter_token_type_e vfilter_token_type_e_from_string(const char *src)
 		if(!bb_stricmp(src, "kVFT_Text")) { dst = kVFT_Text; }
 		if(!bb_stricmp(src, "kVFT_Number")) { dst = kVFT_Number; }
 		if(!bb_stricmp(src, "kVFT_NamedFilter")) { dst = kVFT_NamedFilter; }
+		if(!bb_stricmp(src, "kVFT_Field")) { dst = kVFT_Field; }
 		if(!bb_stricmp(src, "kVFT_Count")) { dst = kVFT_Count; }
 	}
 	return dst;
@@ -2253,6 +2262,7 @@ const char *string_from_vfilter_token_type_e(const vfilter_token_type_e src)
 		case kVFT_Text: return "kVFT_Text"; break;
 		case kVFT_Number: return "kVFT_Number"; break;
 		case kVFT_NamedFilter: return "kVFT_NamedFilter"; break;
+		case kVFT_Field: return "kVFT_Field"; break;
 		case kVFT_Count: return "kVFT_Count"; break;
 	}
 	return "";
@@ -380,6 +380,9 @@ config_t config_clone(const config_t *src)
 		dst.dirStatsOverall = src->dirStatsOverall;
 		dst.dateTimeUTC = src->dateTimeUTC;
 		dst.tileViews = src->tileViews;
+		dst.recordCompressedBatches = src->recordCompressedBatches;
+		dst.recordingCommitMillis = src->recordingCommitMillis;
+		dst.maxConnections = src->maxConnections;
 	}
 	return dst;
 }
@@ -7,9 +7,13 @@ __pragma(warning(disable : 4710)); // warning C4710 : 'int printf(const char *co
 
 #include "bb.h"
 #include "bbclient/bb_array.h"
+#include "bbclient/bb_compact.h"
 #include "bbclient/bb_file.h"
+#include "bbclient/bb_format.h"
+#include "bbclient/bb_kv.h"
 #include "bbclient/bb_malloc.h"
 #include "bbclient/bb_packet.h"
+#include "bbclient/bb_ring_file.h"
 #include "bbclient/bb_string.h"
 #include "bbclient/bb_time.h"
 #include "bboxtolog_utils.h"
@@ -92,13 +96,17 @@ typedef struct logPackets_s
 static char* g_exe;
 static program g_program;
 static u8 g_recvBuffer[1 * 1024 * 1024];
+static u8 g_batchBuffer[kBBBatch_MaxExpandedSize];
+static bb_compact_state_t g_compact; // callsites and threads for kBBPacketType_LogTextCompact
 
 static partial_logs_t g_partialLogs;
+static sbs_t g_formats; // kBBPacketType_LogTextDeferred format strings, indexed by format id
 static b32 g_inTailCatchup;
 static b32 g_follow;
 static u32 g_numLines;
 static bb_log_level_e g_verbosity;
 static b32 g_printFilename;
+static b32 g_unwrap;
 
 typedef enum plaintext_prefix_e
 {
@@ -130,6 +138,10 @@ u64 g_initialTimestamp = 0;
 b32 g_fixupOldLogLevel = 0;
 static logPackets_t g_queuedPackets;
 static const char* g_pathToPrint;
+static const u8* g_kvFields; // kBBPacketType_LogTextKV fields of the log being passed to log_packet_func
+static u32 g_kvFieldsLen;
+static const char* g_largeLogText; // kBBPacketType_LogTextLarge text of the log being passed to log_packet_func, which
+static u32 g_largeLogTextLen;      // replaces the truncated copy in its logText.text
 
 #if !defined(BB_NO_SQLITE)
 static sqlite3* db;
@@ -166,6 +178,8 @@ static int usage(void)
 	{
 		print_stderr(va("Usage: %s filename.bbox <filename.log>\n", g_exe));
 		print_stderr(va("If no output filename is specified, the target will be the source with .bbox\nextension replaced with .log\n"));
+		print_stderr(va("Usage: %s -unwrap filename.bbox <filename.unwrapped.bbox>\n", g_exe));
+		print_stderr(va("Converts a ring file written after bb_set_ring_file_size into a normal .bbox\n"));
 	}
 	else if (g_program == kProgram_bboxtojson)
 	{
@@ -480,7 +494,14 @@ process_packet_data_t build_packet_data(const bb_decoded_packet_t* decoded)
 			++data.numPartialLogsUsed;
 		}
 	}
-	sb_append(&data.lines, decoded->packet.logText.text);
+	if (g_largeLogText)
+	{
+		sb_append_range(&data.lines, g_largeLogText, g_largeLogText + g_largeLogTextLen);
+	}
+	else
+	{
+		sb_append(&data.lines, decoded->packet.logText.text);
+	}
 
 	return data;
 }
@@ -528,6 +549,265 @@ static void print_queued(FILE* ofp)
 	}
 }
 
+static void add_format(const bb_decoded_packet_t* decoded)
+{
+	u32 id = decoded->packet.formatId.id;
+	if (id > 1024 * 1024)
+	{
+		return;
+	}
+	if (id >= g_formats.count && !bba_add(g_formats, id + 1 - g_formats.count))
+	{
+		return;
+	}
+	sb_t* format = g_formats.data + id;
+	sb_reset(format);
+	*format = sb_from_c_string(decoded->packet.formatId.name);
+}
+
+// Fills logText with the text of a kBBPacketType_LogTextKV followed by its fields as JSON, truncated to fit
+static void expand_log_text_kv(const bb_decoded_packet_t* decoded, bb_decoded_packet_t* logText)
+{
+	const bb_packet_log_text_kv_t* kv = &decoded->packet.logTextKV;
+	bb_packet_log_text_t* packet = &logText->packet.logText;
+	logText->type = kBBPacketType_LogText;
+	logText->header = decoded->header;
+	packet->categoryId = kv->categoryId;
+	packet->level = kv->level;
+	packet->pieInstance = kv->pieInstance;
+	packet->colors = kv->colors;
+
+	size_t len = bb_strncpy(packet->text, kv->text, sizeof(packet->text) - 2);
+	if (len && packet->text[len - 1] == '\n')
+	{
+		--len;
+	}
+	if (len)
+	{
+		packet->text[len++] = ' ';
+	}
+	const u32 jsonLen = bbkv_format_json(kv->fields, kv->fieldsLen, packet->text + len, (u32)(sizeof(packet->text) - 1 - len));
+	len += (jsonLen < sizeof(packet->text) - 2 - len) ? jsonLen : sizeof(packet->text) - 2 - len;
+	packet->text[len++] = '\n';
+	packet->text[len] = '\0';
+}
+
+static void process_expanded_log_packet(bb_decoded_packet_t* decoded, void* context)
+{
+	process_file_data_t* process_file_data = context;
+	if (decoded->type == kBBPacketType_LogTextPartial)
+	{
+		bba_push(g_partialLogs, *decoded);
+	}
+	else if (process_file_data->log_packet_func)
+	{
+		(*process_file_data->log_packet_func)(decoded, process_file_data);
+	}
+}
+
+static b32 process_packet_frame(process_file_data_t* process_file_data, u8* frame, u32 nPacketBytes)
+{
+	bb_decoded_packet_t decoded;
+	const u32 nHeaderBytes = bbpacket_frame_header_size(frame);
+	if (!bbpacket_deserialize(frame + nHeaderBytes, (u16)(nPacketBytes - nHeaderBytes), &decoded) || !bbcompact_decode(&g_compact, &decoded))
+		return false;
+
+	if (g_program == kProgram_bboxtojson)
+	{
+		if (process_file_data->log_packet_func)
+		{
+			(*process_file_data->log_packet_func)(&decoded, process_file_data);
+		}
+	}
+	else if (bbpacket_is_app_info_type(decoded.type))
+	{
+		g_initialTimestamp = decoded.packet.appInfo.initialTimestamp;
+		g_millisPerTick = decoded.packet.appInfo.millisPerTick;
+		g_fixupOldLogLevel = decoded.type == kBBPacketType_AppInfo_v1 ||
+		                     decoded.type == kBBPacketType_AppInfo_v2 ||
+		                     decoded.type == kBBPacketType_AppInfo_v3 ||
+		                     decoded.type == kBBPacketType_AppInfo_v4 ||
+		                     decoded.type == kBBPacketType_AppInfo_v5;
+		if (process_file_data->non_log_packet_func)
+		{
+			(*process_file_data->non_log_packet_func)(&decoded, process_file_data);
+		}
+	}
+	else
+	{
+		BB_WARNING_PUSH(4061); // warning C4061: enumerator 'kBBPacketType_Invalid' in switch of enum 'bb_packet_type_e' is not explicitly handled by a case label
+		switch (decoded.type)
+		{
+		case kBBPacketType_CategoryId:
+		{
+			category_t* c = bba_add(g_categories, 1);
+			if (c)
+			{
+				c->id = decoded.packet.categoryId.id;
+				bb_strncpy(c->name, decoded.packet.categoryId.name, sizeof(c->name));
+			}
+			if (process_file_data->non_log_packet_func)
+			{
+				(*process_file_data->non_log_packet_func)(&decoded, process_file_data);
+			}
+			break;
+		}
+		case kBBPacketType_FormatId:
+		{
+			add_format(&decoded);
+			if (process_file_data->non_log_packet_func)
+			{
+				(*process_file_data->non_log_packet_func)(&decoded, process_file_data);
+			}
+			break;
+		}
+		case kBBPacketType_LogTextPartial:
+		{
+			bba_push(g_partialLogs, decoded);
+			break;
+		}
+		case kBBPacketType_LogTextDeferred:
+		{
+			u32 formatId = decoded.packet.logTextDeferred.formatId;
+			const char* format = (formatId < g_formats.count && sb_len(g_formats.data + formatId)) ? sb_get(g_formats.data + formatId) : NULL;
+			bbformat_expand_log_packet(&decoded, format, &process_expanded_log_packet, process_file_data);
+			break;
+		}
+		case kBBPacketType_LogTextLarge:
+		{
+			if (process_file_data->log_packet_func)
+			{
+				const bb_packet_log_text_large_t* large = &decoded.packet.logTextLarge;
+				bb_decoded_packet_t logText;
+				logText.type = kBBPacketType_LogText;
+				logText.header = decoded.header;
+				logText.packet.logText.categoryId = large->categoryId;
+				logText.packet.logText.level = large->level;
+				logText.packet.logText.pieInstance = large->pieInstance;
+				logText.packet.logText.colors = large->colors;
+				const u32 truncatedLen = BB_MIN(large->textLen, (u32)sizeof(logText.packet.logText.text) - 1);
+				memcpy(logText.packet.logText.text, large->text, truncatedLen);
+				logText.packet.logText.text[truncatedLen] = '\0';
+				g_largeLogText = large->text;
+				g_largeLogTextLen = large->textLen;
+				(*process_file_data->log_packet_func)(&logText, process_file_data);
+				g_largeLogText = NULL;
+				g_largeLogTextLen = 0;
+			}
+			break;
+		}
+		case kBBPacketType_TimeCalibration:
+		{
+			if (decoded.packet.timeCalibration.millisPerTick > 0.0)
+			{
+				g_millisPerTick = decoded.packet.timeCalibration.millisPerTick;
+			}
+			if (process_file_data->non_log_packet_func)
+			{
+				(*process_file_data->non_log_packet_func)(&decoded, process_file_data);
+			}
+			break;
+		}
+		case kBBPacketType_LogSuppressed:
+		{
+			if (process_file_data->log_packet_func)
+			{
+				bb_decoded_packet_t logText;
+				bbpacket_expand_log_suppressed(&decoded, &logText);
+				(*process_file_data->log_packet_func)(&logText, process_file_data);
+			}
+			break;
+		}
+		case kBBPacketType_LogsDropped:
+		{
+			if (process_file_data->log_packet_func)
+			{
+				bb_decoded_packet_t logText;
+				bbpacket_expand_logs_dropped(&decoded, &logText);
+				(*process_file_data->log_packet_func)(&logText, process_file_data);
+			}
+			break;
+		}
+		case kBBPacketType_FlightRecorder:
+		{
+			// the dumped logs that follow are printed where they are in the file, not spliced in by timestamp
+			if (process_file_data->log_packet_func && !decoded.packet.flightRecorder.end)
+			{
+				bb_decoded_packet_t logText;
+				bbpacket_expand_flight_recorder(&decoded, &logText);
+				(*process_file_data->log_packet_func)(&logText, process_file_data);
+			}
+			break;
+		}
+		case kBBPacketType_LogTextKV:
+		{
+			if (process_file_data->log_packet_func)
+			{
+				bb_decoded_packet_t logText;
+				expand_log_text_kv(&decoded, &logText);
+				g_kvFields = decoded.packet.logTextKV.fields;
+				g_kvFieldsLen = decoded.packet.logTextKV.fieldsLen;
+				(*process_file_data->log_packet_func)(&logText, process_file_data);
+				g_kvFields = NULL;
+				g_kvFieldsLen = 0;
+			}
+			break;
+		}
+		case kBBPacketType_LogText_v1:
+		case kBBPacketType_LogText_v2:
+		case kBBPacketType_LogText:
+		{
+			if (process_file_data->log_packet_func)
+			{
+				if (g_fixupOldLogLevel)
+				{
+					switch (decoded.packet.logText.level)
+					{
+					case kOldLogLevel_Log: decoded.packet.logText.level = kBBLogLevel_Log;
+					case kOldLogLevel_Warning: decoded.packet.logText.level = kBBLogLevel_Warning;
+					case kOldLogLevel_Error: decoded.packet.logText.level = kBBLogLevel_Error;
+					case kOldLogLevel_Display: decoded.packet.logText.level = kBBLogLevel_Display;
+					case kOldLogLevel_SetColor: decoded.packet.logText.level = kBBLogLevel_SetColor;
+					case kOldLogLevel_VeryVerbose: decoded.packet.logText.level = kBBLogLevel_VeryVerbose;
+					case kOldLogLevel_Verbose: decoded.packet.logText.level = kBBLogLevel_Verbose;
+					case kOldLogLevel_Fatal: decoded.packet.logText.level = kBBLogLevel_Fatal;
+					case kOldLogLevel_Count: decoded.packet.logText.level = kBBLogLevel_Count;
+					}
+				}
+				(*process_file_data->log_packet_func)(&decoded, process_file_data);
+			}
+			break;
+		}
+		default:
+			if (process_file_data->non_log_packet_func)
+			{
+				(*process_file_data->non_log_packet_func)(&decoded, process_file_data);
+			}
+			break;
+		}
+		BB_WARNING_POP;
+	}
+	return true;
+}
+
+// Processes the packets in a compressed batch frame, as if they had been recorded individually
+static b32 process_batch_frame(process_file_data_t* process_file_data, const u8* frame, u16 nPacketBytes)
+{
+	u32 expandedBytes = bbpacket_expand_batch(frame, nPacketBytes, g_batchBuffer, sizeof(g_batchBuffer));
+	if (!expandedBytes)
+		return false;
+
+	u32 cursor = 0;
+	while (cursor < expandedBytes)
+	{
+		u16 nExpandedPacketBytes = (u16)((g_batchBuffer[cursor] << 8) + g_batchBuffer[cursor + 1]);
+		if (!process_packet_frame(process_file_data, g_batchBuffer + cursor, nExpandedPacketBytes))
+			return false;
+		cursor += nExpandedPacketBytes;
+	}
+	return true;
+}
+
 static int process_bbox_file(process_file_data_t* process_file_data)
 {
 	int ret = kExitCode_Success;
@@ -550,11 +830,9 @@ static int process_bbox_file(process_file_data_t* process_file_data)
 			}
 			const u32 krecvBufferSize = sizeof(g_recvBuffer);
 			const u32 kHalfrecvBufferBytes = krecvBufferSize / 2;
-			bb_decoded_packet_t decoded;
-			u32 nDecodableBytes32 = recvCursor - decodeCursor;
-			u16 nDecodableBytes = nDecodableBytes32 > 0xFFFF ? 0xFFFF : (u16)(nDecodableBytes32);
+			u32 nDecodableBytes = recvCursor - decodeCursor;
 			u8* cursor = g_recvBuffer + decodeCursor;
-			u16 nPacketBytes = (nDecodableBytes >= 3) ? (*cursor << 8) + (*(cursor + 1)) : 0;
+			u32 nPacketBytes = (nDecodableBytes >= 3) ? bbpacket_frame_length(cursor, nDecodableBytes) : 0;
 			if (nPacketBytes == 0 || nPacketBytes > nDecodableBytes)
 			{
 				if (g_program == kProgram_bbtail)
@@ -581,89 +859,16 @@ static int process_bbox_file(process_file_data_t* process_file_data)
 				}
 			}
 
-			if (bbpacket_deserialize(cursor + 2, nPacketBytes - 2, &decoded))
+			if (bbpacket_frame_header_size(cursor) == kBBFrame_HeaderSize && bbpacket_is_batch_frame(cursor, nPacketBytes))
 			{
-				if (g_program == kProgram_bboxtojson)
-				{
-					if (process_file_data->log_packet_func)
-					{
-						(*process_file_data->log_packet_func)(&decoded, process_file_data);
-					}
-				}
-				else if (bbpacket_is_app_info_type(decoded.type))
+				if (!process_batch_frame(process_file_data, cursor, (u16)nPacketBytes))
 				{
-					g_initialTimestamp = decoded.packet.appInfo.initialTimestamp;
-					g_millisPerTick = decoded.packet.appInfo.millisPerTick;
-					g_fixupOldLogLevel = decoded.type == kBBPacketType_AppInfo_v1 ||
-					                     decoded.type == kBBPacketType_AppInfo_v2 ||
-					                     decoded.type == kBBPacketType_AppInfo_v3 ||
-					                     decoded.type == kBBPacketType_AppInfo_v4 ||
-					                     decoded.type == kBBPacketType_AppInfo_v5;
-					if (process_file_data->non_log_packet_func)
-					{
-						(*process_file_data->non_log_packet_func)(&decoded, process_file_data);
-					}
-				}
-				else
-				{
-					BB_WARNING_PUSH(4061); // warning C4061: enumerator 'kBBPacketType_Invalid' in switch of enum 'bb_packet_type_e' is not explicitly handled by a case label
-					switch (decoded.type)
-					{
-					case kBBPacketType_CategoryId:
-					{
-						category_t* c = bba_add(g_categories, 1);
-						if (c)
-						{
-							c->id = decoded.packet.categoryId.id;
-							bb_strncpy(c->name, decoded.packet.categoryId.name, sizeof(c->name));
-						}
-						if (process_file_data->non_log_packet_func)
-						{
-							(*process_file_data->non_log_packet_func)(&decoded, process_file_data);
-						}
-						break;
-					}
-					case kBBPacketType_LogTextPartial:
-					{
-						bba_push(g_partialLogs, decoded);
-						break;
-					}
-					case kBBPacketType_LogText_v1:
-					case kBBPacketType_LogText_v2:
-					case kBBPacketType_LogText:
-					{
-						if (process_file_data->log_packet_func)
-						{
-							if (g_fixupOldLogLevel)
-							{
-								switch (decoded.packet.logText.level)
-								{
-								case kOldLogLevel_Log: decoded.packet.logText.level = kBBLogLevel_Log;
-								case kOldLogLevel_Warning: decoded.packet.logText.level = kBBLogLevel_Warning;
-								case kOldLogLevel_Error: decoded.packet.logText.level = kBBLogLevel_Error;
-								case kOldLogLevel_Display: decoded.packet.logText.level = kBBLogLevel_Display;
-								case kOldLogLevel_SetColor: decoded.packet.logText.level = kBBLogLevel_SetColor;
-								case kOldLogLevel_VeryVerbose: decoded.packet.logText.level = kBBLogLevel_VeryVerbose;
-								case kOldLogLevel_Verbose: decoded.packet.logText.level = kBBLogLevel_Verbose;
-								case kOldLogLevel_Fatal: decoded.packet.logText.level = kBBLogLevel_Fatal;
-								case kOldLogLevel_Count: decoded.packet.logText.level = kBBLogLevel_Count;
-								}
-							}
-							(*process_file_data->log_packet_func)(&decoded, process_file_data);
-						}
-						break;
-					}
-					default:
-						if (process_file_data->non_log_packet_func)
-						{
-							(*process_file_data->non_log_packet_func)(&decoded, process_file_data);
-						}
-						break;
-					}
-					BB_WARNING_POP;
+					fprintf(stderr, "Failed to expand compressed batch from %s\n", process_file_data->source);
+					ret = kExitCode_Error_Decode;
+					done = true;
 				}
 			}
-			else
+			else if (!process_packet_frame(process_file_data, cursor, nPacketBytes))
 			{
 				fprintf(stderr, "Failed to decode packet from %s\n", process_file_data->source);
 				ret = kExitCode_Error_Decode;
@@ -684,6 +889,8 @@ static int process_bbox_file(process_file_data_t* process_file_data)
 
 		fclose(fp);
 		bba_free(g_categories);
+		sbs_reset(&g_formats);
+		bbcompact_reset(&g_compact);
 	}
 	else
 	{
@@ -1103,6 +1310,8 @@ static void bbgrep_log_packet(bb_decoded_packet_t* decoded, process_file_data_t*
 {
 	vfilter_data_t* vfilter_data = process_file_data->userdata;
 	vfilter_data->recordedLog.packet = *decoded;
+	vfilter_data->recordedLog.fields = g_kvFields;
+	vfilter_data->recordedLog.fieldsLen = g_kvFieldsLen;
 	queue_packet(decoded, stdout, vfilter_data);
 	vfilter_data->recordedLog.sessionLogIndex++;
 }
@@ -1261,6 +1470,21 @@ static const char* get_packet_type_string(bb_packet_type_e type)
 	case kBBPacketType_AppInfo_v5: return "kBBPacketType_AppInfo_v5";
 	case kBBPacketType_AppInfo_v6: return "kBBPacketType_AppInfo_v6";
 	case kBBPacketType_FrameNumber: return "kBBPacketType_FrameNumber";
+	case kBBPacketType_FormatId: return "kBBPacketType_FormatId";
+	case kBBPacketType_LogTextDeferred: return "kBBPacketType_LogTextDeferred";
+	case kBBPacketType_ServerFeatures: return "kBBPacketType_ServerFeatures";
+	case kBBPacketType_CompressedBatch: return "kBBPacketType_CompressedBatch";
+	case kBBPacketType_Callsite: return "kBBPacketType_Callsite";
+	case kBBPacketType_ThreadIndex: return "kBBPacketType_ThreadIndex";
+	case kBBPacketType_LogTextCompact: return "kBBPacketType_LogTextCompact";
+	case kBBPacketType_CategoryLevels: return "kBBPacketType_CategoryLevels";
+	case kBBPacketType_LogSuppressed: return "kBBPacketType_LogSuppressed";
+	case kBBPacketType_LogTextLarge: return "kBBPacketType_LogTextLarge";
+	case kBBPacketType_TimeCalibration: return "kBBPacketType_TimeCalibration";
+	case kBBPacketType_LogsDropped: return "kBBPacketType_LogsDropped";
+	case kBBPacketType_ClientTelemetry: return "kBBPacketType_ClientTelemetry";
+	case kBBPacketType_LogTextKV: return "kBBPacketType_LogTextKV";
+	case kBBPacketType_FlightRecorder: return "kBBPacketType_FlightRecorder";
 	default: return "unknown";
 	}
 }
@@ -1344,6 +1568,95 @@ static void json_object_set_log_text(JSON_Object* obj, bb_packet_log_text_t* pac
 	json_object_set_string(obj, "text", packet->text);
 }
 
+static void json_object_set_log_text_large(JSON_Object* obj, bb_packet_log_text_large_t* packet)
+{
+	json_object_set_number(obj, "categoryId", packet->categoryId);
+	json_object_set_number(obj, "level", packet->level);
+	json_object_set_number(obj, "pieInstance", packet->pieInstance);
+	if (packet->colors.bg != kBBColor_Default)
+	{
+		json_object_set_string(obj, "bg", get_bb_color_string(packet->colors.bg));
+	}
+	if (packet->colors.fg != kBBColor_Default)
+	{
+		json_object_set_string(obj, "fg", get_bb_color_string(packet->colors.fg));
+	}
+	sb_t text = { BB_EMPTY_INITIALIZER };
+	sb_append_range(&text, packet->text, packet->text + packet->textLen);
+	json_object_set_string(obj, "text", sb_get(&text));
+	sb_reset(&text);
+}
+
+static void json_object_set_time_calibration(JSON_Object* obj, bb_packet_time_calibration_t* packet)
+{
+	json_object_set_number(obj, "millisPerTick", packet->millisPerTick);
+	json_object_set_string(obj, "microsecondsFromEpoch", va("%llu", packet->microsecondsFromEpoch));
+}
+
+static void json_object_set_client_telemetry(JSON_Object* obj, bb_packet_client_telemetry_t* packet)
+{
+	json_object_set_number(obj, "intervalMillis", packet->intervalMillis);
+	json_object_set_number(obj, "flushMillis", packet->flushMillis);
+	json_object_set_number(obj, "lockWaitMillis", packet->lockWaitMillis);
+	json_object_set_string(obj, "packetsSent", va("%llu", packet->packetsSent));
+	json_object_set_string(obj, "bytesSent", va("%llu", packet->bytesSent));
+	json_object_set_number(obj, "flushes", packet->flushes);
+	json_object_set_number(obj, "maxSendBytes", packet->maxSendBytes);
+	json_object_set_number(obj, "queuedBytes", packet->queuedBytes);
+	json_object_set_number(obj, "droppedLogs", packet->droppedLogs);
+	json_object_set_number(obj, "suppressedLogs", packet->suppressedLogs);
+}
+
+static void json_object_set_flight_recorder(JSON_Object* obj, bb_packet_flight_recorder_t* packet)
+{
+	json_object_set_number(obj, "categoryId", packet->categoryId);
+	json_object_set_number(obj, "trigger", packet->trigger);
+	json_object_set_number(obj, "logCount", packet->logCount);
+	json_object_set_number(obj, "overwrittenLogs", packet->overwrittenLogs);
+	json_object_set_boolean(obj, "end", packet->end != 0);
+}
+
+static void json_object_set_log_text_deferred(JSON_Object* obj, bb_packet_log_text_deferred_t* packet)
+{
+	json_object_set_number(obj, "categoryId", packet->categoryId);
+	json_object_set_number(obj, "level", packet->level);
+	json_object_set_number(obj, "pieInstance", packet->pieInstance);
+	if (packet->colors.bg != kBBColor_Default)
+	{
+		json_object_set_string(obj, "bg", get_bb_color_string(packet->colors.bg));
+	}
+	if (packet->colors.fg != kBBColor_Default)
+	{
+		json_object_set_string(obj, "fg", get_bb_color_string(packet->colors.fg));
+	}
+	json_object_set_number(obj, "formatId", packet->formatId);
+	json_object_set_number(obj, "argsLen", packet->argsLen);
+}
+
+static void json_object_set_log_text_kv(JSON_Object* obj, bb_packet_log_text_kv_t* packet)
+{
+	json_object_set_number(obj, "categoryId", packet->categoryId);
+	json_object_set_number(obj, "level", packet->level);
+	json_object_set_number(obj, "pieInstance", packet->pieInstance);
+	if (packet->colors.bg != kBBColor_Default)
+	{
+		json_object_set_string(obj, "bg", get_bb_color_string(packet->colors.bg));
+	}
+	if (packet->colors.fg != kBBColor_Default)
+	{
+		json_object_set_string(obj, "fg", get_bb_color_string(packet->colors.fg));
+	}
+	json_object_set_string(obj, "text", packet->text);
+	sb_t fields = { BB_EMPTY_INITIALIZER };
+	const u32 fieldsLen = bbkv_format_json(packet->fields, packet->fieldsLen, NULL, 0);
+	if (sb_grow(&fields, fieldsLen))
+	{
+		bbkv_format_json(packet->fields, packet->fieldsLen, fields.data, fieldsLen + 1);
+		json_object_set_value(obj, "fields", json_parse_string(sb_get(&fields)));
+	}
+	sb_reset(&fields);
+}
+
 static void json_object_set_user(JSON_Object* obj, bb_packet_user_t* packet)
 {
 	json_object_set_number(obj, "len", packet->len);
@@ -1356,6 +1669,22 @@ static void json_object_set_register_id(JSON_Object* obj, bb_packet_register_id_
 	json_object_set_string(obj, "name", packet->name);
 }
 
+static void json_object_set_callsite(JSON_Object* obj, bb_packet_callsite_t* packet)
+{
+	json_object_set_number(obj, "id", packet->id);
+	json_object_set_number(obj, "categoryId", packet->categoryId);
+	json_object_set_number(obj, "level", packet->level);
+	json_object_set_number(obj, "pieInstance", packet->pieInstance);
+	if (packet->colors.bg != kBBColor_Default)
+	{
+		json_object_set_string(obj, "bg", get_bb_color_string(packet->colors.bg));
+	}
+	if (packet->colors.fg != kBBColor_Default)
+	{
+		json_object_set_string(obj, "fg", get_bb_color_string(packet->colors.fg));
+	}
+}
+
 static void json_object_set_frame_end(JSON_Object* obj, bb_packet_frame_end_t* packet)
 {
 	json_object_set_number(obj, "milliseconds", packet->milliseconds);
@@ -1394,6 +1723,23 @@ static void json_object_set_frame_number(JSON_Object* obj, bb_packet_frame_numbe
 	json_object_set_string(obj, "frameNumber", va("%llu", header->frameNumber));
 }
 
+static void json_object_set_server_features(JSON_Object* obj, bb_packet_server_features_t* packet)
+{
+	json_object_set_number(obj, "features", packet->features);
+}
+
+static void json_object_set_category_levels(JSON_Object* obj, bb_packet_category_levels_t* packet)
+{
+	json_object_set_number(obj, "firstCategoryId", packet->firstCategoryId);
+	JSON_Value* levelsValue = json_value_init_array();
+	JSON_Array* levels = json_value_get_array(levelsValue);
+	for (u32 i = 0; i < packet->count; ++i)
+	{
+		json_array_append_number(levels, packet->minLevels[i]);
+	}
+	json_object_set_value(obj, "minLevels", levelsValue);
+}
+
 static void bboxtojson_packet(bb_decoded_packet_t* decoded, process_file_data_t* process_file_data)
 {
 	bboxtojson_userdata_t* bboxtojson_userdata = process_file_data->userdata;
@@ -1438,12 +1784,84 @@ static void bboxtojson_packet(bb_decoded_packet_t* decoded, process_file_data_t*
 	case kBBPacketType_AppInfo_v5: json_object_set_app_info(obj, &decoded->packet.appInfo); break;
 	case kBBPacketType_AppInfo_v6: json_object_set_app_info(obj, &decoded->packet.appInfo); break;
 	case kBBPacketType_FrameNumber: json_object_set_frame_number(obj, &decoded->packet.frameNumber); break;
+	case kBBPacketType_FormatId: json_object_set_register_id(obj, &decoded->packet.registerId); break;
+	case kBBPacketType_LogTextDeferred: json_object_set_log_text_deferred(obj, &decoded->packet.logTextDeferred); break;
+	case kBBPacketType_ServerFeatures: json_object_set_server_features(obj, &decoded->packet.serverFeatures); break;
+	case kBBPacketType_CompressedBatch: break;
+	case kBBPacketType_Callsite: json_object_set_callsite(obj, &decoded->packet.callsite); break;
+	case kBBPacketType_ThreadIndex: json_object_set_number(obj, "index", decoded->packet.threadIndex.index); break;
+	case kBBPacketType_LogTextCompact: break;
+	case kBBPacketType_CategoryLevels: json_object_set_category_levels(obj, &decoded->packet.categoryLevels); break;
+	case kBBPacketType_LogTextLarge: json_object_set_log_text_large(obj, &decoded->packet.logTextLarge); break;
+	case kBBPacketType_TimeCalibration: json_object_set_time_calibration(obj, &decoded->packet.timeCalibration); break;
+	case kBBPacketType_ClientTelemetry: json_object_set_client_telemetry(obj, &decoded->packet.clientTelemetry); break;
+	case kBBPacketType_LogTextKV: json_object_set_log_text_kv(obj, &decoded->packet.logTextKV); break;
+	case kBBPacketType_FlightRecorder: json_object_set_flight_recorder(obj, &decoded->packet.flightRecorder); break;
 	default: break;
 	}
 
 	json_array_append_value(arr, value);
 }
 
+static void bboxtolog_unwrap_frames(const u8* frames, u32 framesLen, void* context)
+{
+	fwrite(frames, 1, framesLen, (FILE*)context);
+}
+
+// Writes the frames in a ring file (see bb_ring_file.h) out as a normal .bbox
+static int bboxtolog_unwrap(const char* source, const char* target)
+{
+	bb_file_handle_t ifp = bb_file_open_for_read(source);
+	if (ifp == BB_INVALID_FILE_HANDLE)
+	{
+		fprintf(stderr, "Could not read %s\n", source);
+		return kExitCode_Error_ReadSource;
+	}
+	u32 dataLen = bb_file_size(ifp);
+	u8* data = (u8*)bb_malloc(dataLen ? dataLen : 1);
+	if (data)
+	{
+		dataLen = bb_file_read(ifp, data, dataLen);
+	}
+	bb_file_close(ifp);
+	if (!data)
+		return kExitCode_Error_ReadSource;
+
+	int ret = kExitCode_Success;
+	if (bb_ring_file_is_ring_file(data, dataLen))
+	{
+		sb_t defaultTarget = { BB_EMPTY_INITIALIZER };
+		if (!target)
+		{
+			const char* ext = strrchr(source, '.');
+			sb_append_range(&defaultTarget, source, ext ? ext : source + strlen(source));
+			sb_append(&defaultTarget, ".unwrapped.bbox");
+			target = sb_get(&defaultTarget);
+		}
+
+		FILE* ofp = fopen(target, "wb");
+		if (ofp)
+		{
+			bb_ring_file_unwrap(data, dataLen, &bboxtolog_unwrap_frames, ofp);
+			fclose(ofp);
+		}
+		else
+		{
+			fprintf(stderr, "Could not write to %s\n", target);
+			ret = kExitCode_Error_WriteTarget;
+		}
+		sb_reset(&defaultTarget);
+	}
+	else
+	{
+		fprintf(stderr, "%s is not a ring file\n", source);
+		ret = kExitCode_Error_Decode;
+	}
+
+	bb_free(data);
+	return ret;
+}
+
 int main_loop(int argc, char** argv)
 {
 	g_exe = argv[0];
@@ -1592,6 +2010,10 @@ int main_loop(int argc, char** argv)
 			{
 				bRecursive = true;
 			}
+			else if (!strcmp(arg, "-unwrap") || !strcmp(arg, "--unwrap"))
+			{
+				g_unwrap = true;
+			}
 			else if (!strcmp(arg, "-H") || !strcmp(arg, "--with-filename"))
 			{
 				g_printFilename = true;
@@ -1637,6 +2059,24 @@ int main_loop(int argc, char** argv)
 	if (!source)
 		return usage(); // TODO: read stdin
 
+	if (g_unwrap)
+	{
+		if (g_program != kProgram_bboxtolog || g_follow)
+		{
+			if (target)
+			{
+				bb_free(target);
+			}
+			return usage();
+		}
+		int ret = bboxtolog_unwrap(source, target);
+		if (target)
+		{
+			bb_free(target);
+		}
+		return ret;
+	}
+
 	if (target && g_program != kProgram_bboxtolog && g_program != kProgram_bbgrep && g_program != kProgram_bboxtojson)
 	{
 		bb_free(target);
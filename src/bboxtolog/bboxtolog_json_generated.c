@@ -229,6 +229,7 @@ vfilter_token_type_e json_deserialize_vfilter_token_type_e(JSON_Value *src)
 			if(!bb_stricmp(str, "kVFT_Text")) { dst = kVFT_Text; }
 			if(!bb_stricmp(str, "kVFT_Number")) { dst = kVFT_Number; }
 			if(!bb_stricmp(str, "kVFT_NamedFilter")) { dst = kVFT_NamedFilter; }
+			if(!bb_stricmp(str, "kVFT_Field")) { dst = kVFT_Field; }
 			if(!bb_stricmp(str, "kVFT_Count")) { dst = kVFT_Count; }
 		}
 	}
@@ -343,6 +344,7 @@ JSON_Value *json_serialize_vfilter_token_type_e(const vfilter_token_type_e src)
 		case kVFT_Text: str = "kVFT_Text"; break;
 		case kVFT_Number: str = "kVFT_Number"; break;
 		case kVFT_NamedFilter: str = "kVFT_NamedFilter"; break;
+		case kVFT_Field: str = "kVFT_Field"; break;
 		case kVFT_Count: str = "kVFT_Count"; break;
 	}
 	JSON_Value *val = json_value_init_string(str);
@@ -455,6 +457,7 @@ vfilter_token_type_e vfilter_token_type_e_from_string(const char *src)
 		if(!bb_stricmp(src, "kVFT_Text")) { dst = kVFT_Text; }
 		if(!bb_stricmp(src, "kVFT_Number")) { dst = kVFT_Number; }
 		if(!bb_stricmp(src, "kVFT_NamedFilter")) { dst = kVFT_NamedFilter; }
+		if(!bb_stricmp(src, "kVFT_Field")) { dst = kVFT_Field; }
 		if(!bb_stricmp(src, "kVFT_Count")) { dst = kVFT_Count; }
 	}
 	return dst;
@@ -563,6 +566,7 @@ const char *string_from_vfilter_token_type_e(const vfilter_token_type_e src)
 		case kVFT_Text: return "kVFT_Text"; break;
 		case kVFT_Number: return "kVFT_Number"; break;
 		case kVFT_NamedFilter: return "kVFT_NamedFilter"; break;
+		case kVFT_Field: return "kVFT_Field"; break;
 		case kVFT_Count: return "kVFT_Count"; break;
 	}
 	return "";
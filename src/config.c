@@ -150,7 +150,20 @@ b32 config_read(config_t* config)
 	{
 		config->tileViews = true;
 	}
+	if (config->version <= 12)
+	{
+		config->recordingCommitMillis = 100;
+	}
+	if (config->version <= 13)
+	{
+		config->maxConnections = 512;
+	}
 	config->version = kConfigVersion;
+	if (!config->maxConnections || config->maxConnections > kConfig_MaxConnections)
+	{
+		// 0 used to be labelled unlimited, but ingest never took more than kConfig_MaxConnections
+		config->maxConnections = kConfig_MaxConnections;
+	}
 
 	if (config->listenProtocol == kConfigListenProtocol_Unknown)
 	{
@@ -190,11 +190,15 @@ AUTOJSON typedef struct config_s
 	b32 dirStatsOverall;
 	b32 dateTimeUTC;
 	b32 tileViews;
+	b32 recordCompressedBatches;
+	u32 recordingCommitMillis;
+	u32 maxConnections; // concurrent recordings, 1 to kConfig_MaxConnections
 } config_t;
 
 enum
 {
-	kConfigVersion = 12
+	kConfigVersion = 14,
+	kConfig_MaxConnections = 1024, // the most recordings ingest can take: kDiscovery_IngestThreads * kIngest_MaxConnections
 };
 
 extern config_t g_config;
@@ -3,15 +3,20 @@
 
 #include "config.h"
 #include "config_whitelist_push.h"
+#include "ingest.h"
 #include "message_queue.h"
 #include "recorder_thread.h"
+#include "recorder_writer.h"
+#include "whitelist_matcher.h"
 
 #include "appdata.h"
 #include "bb.h"
 #include "bb_array.h"
+#include "bb_atomic.h"
 #include "bb_discovery_client.h"
 #include "bb_discovery_server.h"
 #include "bb_log.h"
+#include "bb_malloc.h"
 #include "bb_packet.h"
 #include "bb_sockets.h"
 #include "bb_string.h"
@@ -28,15 +33,30 @@ BB_WARNING_DISABLE(4710) // snprintf not inlined - can't push/pop because it hap
 
 const char* bb_discovery_packet_name(bb_discovery_packet_type_e type);
 
+enum
+{
+	kDiscovery_IngestThreads = 2, // recorded connections are spread across these
+};
+BB_CTASSERT(kDiscovery_IngestThreads * kIngest_MaxConnections == kConfig_MaxConnections);
+
+typedef struct server_connections_s
+{
+	u32 count;
+	u32 allocated;
+	bb_server_connection_data_t** data;
+} server_connections_t;
+
 typedef struct
 {
 	bb_discovery_server_t ds;
-	resolved_whitelist_t whitelist;
-	bb_server_connection_data_t con[64];
+	whitelist_matcher_t whitelist;
+	server_connections_t cons; // allocated as clients are accepted, and freed once their recorder is done with them
 	bb_critical_section whitelist_cs;
 	bb_thread_handle_t thread_id;
 	b32 shutdownRequest;
 	s32 addrFamily;
+	u32 refusedConnections;
+	u8 pad[4];
 } discovery_data_t;
 
 static discovery_data_t s_discovery_data; // too large for stack
@@ -49,7 +69,13 @@ static void discovery_init(discovery_data_t* host)
 
 static void discovery_shutdown(discovery_data_t* host)
 {
-	bba_free(host->whitelist);
+	whitelist_matcher_reset(&host->whitelist);
+	for (u32 i = 0; i < host->cons.count; ++i)
+	{
+		bbcon_shutdown(&host->cons.data[i]->con);
+		bb_free(host->cons.data[i]);
+	}
+	bba_free(host->cons);
 	bb_critical_section_shutdown(&host->whitelist_cs);
 }
 
@@ -67,27 +93,7 @@ static resolved_whitelist_entry_t* find_whitelist_match(discovery_data_t* host,
 			struct sockaddr_in* incomingAddr4 = (struct sockaddr_in*)sin;
 			u32 sourceIp = decoded->packet.request.sourceIp;
 			u32 incomingIp = (sourceIp) ? sourceIp : ntohl(BB_S_ADDR_UNION(*incomingAddr4));
-			for (u32 i = 0; i < host->whitelist.count; ++i)
-			{
-				resolved_whitelist_entry_t* entry = host->whitelist.data + i;
-				if (entry->addr.ss_family == AF_INET)
-				{
-					const struct sockaddr_in* entryAddr = (const struct sockaddr_in*)&entry->addr;
-					const struct sockaddr_in* subnetMask = (const struct sockaddr_in*)&entry->subnetMask;
-
-					const u32 entryIp = ntohl(BB_S_ADDR_UNION(*entryAddr));
-					const u32 subnetMaskIp = ntohl(BB_S_ADDR_UNION(*subnetMask));
-
-					if ((incomingIp & subnetMaskIp) == (entryIp & subnetMaskIp))
-					{
-						if (!entry->applicationName[0] ||
-						    !strcmp(entry->applicationName, applicationName))
-						{
-							return entry;
-						}
-					}
-				}
-			}
+			return whitelist_matcher_find_ipv4(&host->whitelist, incomingIp, applicationName);
 		}
 #if BB_USING(BB_FEATURE_IPV6)
 		else if (sin->ss_family == AF_INET6)
@@ -98,37 +104,51 @@ static resolved_whitelist_entry_t* find_whitelist_match(discovery_data_t* host,
 			{
 				bbnet_socket_build6to4(&addr, sourceIp);
 			}
-			for (u32 i = 0; i < host->whitelist.count; ++i)
-			{
-				resolved_whitelist_entry_t* entry = host->whitelist.data + i;
-				if (entry->addr.ss_family == AF_INET6)
-				{
-					struct sockaddr_in6 a = addr;
-					struct sockaddr_in6 b = *(const struct sockaddr_in6*)&entry->addr;
-					const struct sockaddr_in6* subnetMask = (const struct sockaddr_in6*)&entry->subnetMask;
-
-					for (size_t byteIndex = 0; byteIndex < sizeof(addr.sin6_addr); ++byteIndex)
-					{
-						a.sin6_addr.s6_addr[byteIndex] &= subnetMask->sin6_addr.s6_addr[byteIndex];
-						b.sin6_addr.s6_addr[byteIndex] &= subnetMask->sin6_addr.s6_addr[byteIndex];
-					}
-
-					if (!memcmp(&a.sin6_addr, &b.sin6_addr, sizeof(addr.sin6_addr)))
-					{
-						if (!entry->applicationName[0] ||
-						    !strcmp(entry->applicationName, applicationName))
-						{
-							return entry;
-						}
-					}
-				}
-			}
+			return whitelist_matcher_find_ipv6(&host->whitelist, &addr.sin6_addr, applicationName);
 		}
 #endif // #if BB_USING (BB_FEATURE_IPV6)
 	}
 	return NULL;
 }
 
+static void discovery_refuse_connection(discovery_data_t* host, const char* applicationName, const char* reason)
+{
+	++host->refusedConnections;
+	BB_WARNING("bb::discovery", "refused connection from %s - %s (%u refused so far)", applicationName, reason, host->refusedConnections);
+	to_ui(kToUI_DiscoveryStatus, "Running (%u connections refused)", host->refusedConnections);
+}
+
+// config_read and the preferences UI keep g_config.maxConnections from 1 to kConfig_MaxConnections
+static u32 discovery_max_connections(void)
+{
+	const u32 maxConnections = g_config.maxConnections;
+	return (maxConnections && maxConnections < kConfig_MaxConnections) ? maxConnections : kConfig_MaxConnections;
+}
+
+// Connections still being recorded, plus reservations accepted but not yet handed to a recorder
+static b32 discovery_has_free_connection(discovery_data_t* host)
+{
+	return host->cons.count + host->ds.pendingConnections.count < discovery_max_connections();
+}
+
+static void discovery_reclaim_connections(discovery_data_t* host)
+{
+	for (u32 i = 0; i < host->cons.count;)
+	{
+		bb_server_connection_data_t* data = host->cons.data[i];
+		if (bb_atomic_load_u32((volatile u32*)&data->bInUse))
+		{
+			++i;
+		}
+		else
+		{
+			bbcon_shutdown(&data->con);
+			bb_free(data);
+			bba_erase(host->cons, i);
+		}
+	}
+}
+
 static bb_discovery_packet_type_e get_discovery_response(discovery_data_t* host, struct sockaddr_storage* sin,
                                                          bb_decoded_discovery_packet_t* decoded, u64* delay)
 {
@@ -190,6 +210,17 @@ static bb_discovery_packet_type_e get_discovery_response(discovery_data_t* host,
 			deviceCodes_unlock();
 		}
 
+		if (result == kBBDiscoveryPacketType_ReservationAccept && !discovery_has_free_connection(host))
+		{
+			result = kBBDiscoveryPacketType_ReservationRefuse;
+			char reason[128];
+			if (bb_snprintf(reason, sizeof(reason), "already at maxConnections (%u)", discovery_max_connections()) < 0)
+			{
+				reason[sizeof(reason) - 1] = '\0';
+			}
+			discovery_refuse_connection(host, applicationName, reason);
+		}
+
 		BB_CLOG(g_config.minLogLevel.discoveryResponse <= kBBLogLevel_Log, "Discovery::Response",
 		        "Request %s from %s @ %s: response %s\n",
 		        bb_discovery_packet_name(decoded->type), applicationName, ip,
@@ -203,13 +234,8 @@ static bb_discovery_packet_type_e get_discovery_response(discovery_data_t* host,
 void discovery_push_whitelist(resolved_whitelist_t* resolvedWhitelist)
 {
 	u32 i;
-	resolved_whitelist_t oldWhitelist;
-
-	bb_critical_section_lock(&s_discovery_data.whitelist_cs);
-	oldWhitelist = s_discovery_data.whitelist;
-	s_discovery_data.whitelist = *resolvedWhitelist;
-	bb_critical_section_unlock(&s_discovery_data.whitelist_cs);
-	bba_free(oldWhitelist);
+	whitelist_matcher_t matcher;
+	whitelist_matcher_t oldMatcher;
 
 	BB_LOG("bb::discovery", "whitelist has %u entries (%u allocated):", resolvedWhitelist->count, resolvedWhitelist->allocated);
 	for (i = 0; i < resolvedWhitelist->count; ++i)
@@ -222,11 +248,20 @@ void discovery_push_whitelist(resolved_whitelist_t* resolvedWhitelist)
 		       entry->allow ? "(allow)" : "(deny)",
 		       ip, mask, entry->applicationName);
 	}
+
+	// Compiled outside the lock, so discovery only waits for the swap
+	whitelist_matcher_build(&matcher, resolvedWhitelist);
+
+	bb_critical_section_lock(&s_discovery_data.whitelist_cs);
+	oldMatcher = s_discovery_data.whitelist;
+	s_discovery_data.whitelist = matcher;
+	bb_critical_section_unlock(&s_discovery_data.whitelist_cs);
+	whitelist_matcher_reset(&oldMatcher);
 }
 
 static bb_thread_return_t discovery_thread_func(void* args)
 {
-	u32 i, c;
+	u32 i;
 	discovery_data_t* host = (discovery_data_t*)args;
 	bb_discovery_server_t* ds = &host->ds;
 
@@ -247,12 +282,6 @@ static bb_thread_return_t discovery_thread_func(void* args)
 	if (!host->shutdownRequest)
 	{
 		to_ui(kToUI_DiscoveryStatus, "Running");
-
-		for (i = 0; i < BB_ARRAYSIZE(host->con); ++i)
-		{
-			bbcon_init(&host->con[i].con);
-			host->con[i].shutdownRequest = &host->shutdownRequest;
-		}
 	}
 
 	while (!host->shutdownRequest)
@@ -276,40 +305,38 @@ static bb_thread_return_t discovery_thread_func(void* args)
 			}
 		}
 
-		if (ds->numPendingConnections)
+		discovery_reclaim_connections(host);
+
+		for (i = 0; i < ds->pendingConnections.count; ++i)
 		{
-			for (i = 0; i < ds->numPendingConnections; ++i)
+			bb_discovery_pending_connection_t* pending = ds->pendingConnections.data + i;
+			bb_server_connection_data_t* data = (bb_server_connection_data_t*)bb_malloc(sizeof(bb_server_connection_data_t));
+			if (!data)
 			{
-				const bb_discovery_pending_connection_t* pending = ds->pendingConnections + i;
+				bbnet_gracefulclose(&pending->socket);
+				discovery_refuse_connection(host, pending->applicationName, "out of memory");
+				continue;
+			}
 
-				b32 found = false;
-				for (c = 0; c < BB_ARRAYSIZE(host->con); ++c)
-				{
-					bb_server_connection_data_t* data = host->con + c;
-					bb_connection_t* con = &data->con;
-					if (!bbcon_is_connected(con) && !bbcon_is_listening(con) && con->socket == BB_INVALID_SOCKET && !data->bInUse)
-					{
-						data->bInUse = true;
-						found = true;
-						BB_LOG("bb:discovery", "pending con %u using con %u / %p with socket %d state %d", i, c, con, con->socket, con->state);
-						bbcon_init(con);
-						bb_strncpy(data->applicationName, pending->applicationName, sizeof(data->applicationName));
-						if (!bbcon_connect_server(con, pending->socket, pending->localIp, pending->localPort))
-						{
-							BB_ERROR("bb::discovery", "failed to start listening for client connection");
-						}
-						// BB_LOG("bb:discovery", "used con %p with socket %d state %d", con, con->socket, con->state);
-						bbthread_create(recorder_thread, data);
-						break;
-					}
-				}
-				if (!found)
-				{
-					bb_error("no free connections to start listening for client connection");
-				}
+			memset(data, 0, sizeof(*data));
+			data->bInUse = true;
+			bb_connection_t* con = &data->con;
+			bbcon_init(con);
+			BB_LOG("bb:discovery", "pending con %u using con %u / %p with socket %d", i, host->cons.count, con, pending->socket);
+			bb_strncpy(data->applicationName, pending->applicationName, sizeof(data->applicationName));
+			if (!bbcon_connect_server(con, pending->socket, pending->localIp, pending->localPort))
+			{
+				BB_ERROR("bb::discovery", "failed to start listening for client connection");
+			}
+			bba_push(host->cons, data);
+			if (!ingest_add(data))
+			{
+				discovery_refuse_connection(host, pending->applicationName, "every ingest thread is full");
+				bbcon_reset(con);
+				data->bInUse = false; // reclaimed next time around
 			}
-			ds->numPendingConnections = 0;
 		}
+		bba_clear(ds->pendingConnections);
 	}
 
 	to_ui(kToUI_DiscoveryStatus, "Shutting down");
@@ -324,6 +351,8 @@ int discovery_thread_init(const int addrFamily)
 	s_discovery_data.addrFamily = addrFamily;
 	discovery_init(&s_discovery_data);
 	deviceCodes_init();
+	recorder_writer_init();
+	ingest_init(kDiscovery_IngestThreads);
 	s_discovery_data.thread_id = bbthread_create(discovery_thread_func, &s_discovery_data);
 	return s_discovery_data.thread_id != 0;
 }
@@ -336,6 +365,8 @@ void discovery_thread_shutdown(void)
 		bbthread_join(s_discovery_data.thread_id);
 		s_discovery_data.thread_id = 0;
 	}
+	ingest_shutdown();
+	recorder_writer_shutdown();
 	discovery_shutdown(&s_discovery_data);
 	deviceCodes_shutdown();
 }
@@ -0,0 +1,314 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#include "ingest.h"
+
+#include "bb_criticalsection.h"
+#include "bb_log.h"
+#include "bb_sockets.h"
+#include "bb_string.h"
+#include "bb_thread.h"
+#include "bb_time.h"
+
+#include "bb_wrap_stdio.h"
+#include <string.h>
+
+#if BB_USING(BB_PLATFORM_LINUX)
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#define BB_INGEST_EPOLL BB_ON
+#else
+#define BB_INGEST_EPOLL BB_OFF
+#if BB_USING(BB_PLATFORM_WINDOWS)
+#define bb_ingest_poll WSAPoll
+#else
+#include <poll.h>
+#define bb_ingest_poll poll
+#endif
+#endif
+
+#if BB_USING(BB_PLATFORM_WINDOWS)
+BB_WARNING_DISABLE(4710) // snprintf not inlined - can't push/pop because it happens later
+#endif                   // #if BB_USING( BB_PLATFORM_WINDOWS )
+
+enum
+{
+	kIngest_MaxThreads = 8,
+
+	// How long a thread waits for data before checking idle connections for outgoing messages and unflushed
+	// files, and listening connections for timeouts.
+	kIngest_IdleMillis = 10,
+};
+
+typedef struct ingest_thread_s
+{
+	bb_critical_section cs; // guards pending and numAssigned
+	bb_server_connection_data_t* pending[kIngest_MaxConnections];
+	u32 numPending;
+	u32 numAssigned; // connections pending or being recorded
+	u32 index;
+	u8 pad[4];
+
+	// Slots never move while a connection is recorded, so the index can be registered with epoll
+	bb_server_connection_data_t* connections[kIngest_MaxConnections];
+	bb_socket sockets[kIngest_MaxConnections]; // the socket each slot is waiting on - changes when the client connects
+	b8 readable[kIngest_MaxConnections];
+#if BB_USING(BB_INGEST_EPOLL)
+	int epollFd;
+	u8 pad2[4];
+#else
+	struct pollfd fds[kIngest_MaxConnections];
+	u32 fdSlots[kIngest_MaxConnections];
+#endif
+	bb_thread_handle_t handle;
+} ingest_thread_t;
+
+typedef struct ingest_s
+{
+	ingest_thread_t threads[kIngest_MaxThreads];
+	u32 numThreads;
+	volatile b32 shutdownRequest;
+} ingest_t;
+
+static ingest_t s_ingest;
+
+static void ingest_watch(ingest_thread_t* thread, u32 slot)
+{
+	bb_socket socket = thread->connections[slot]->con.socket;
+	if (socket == thread->sockets[slot])
+		return;
+
+	// The old socket has been closed by now, which removes it from the epoll set
+	thread->sockets[slot] = socket;
+#if BB_USING(BB_INGEST_EPOLL)
+	if (socket != BB_INVALID_SOCKET)
+	{
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.u32 = slot;
+		if (epoll_ctl(thread->epollFd, EPOLL_CTL_ADD, socket, &event) != 0)
+		{
+			BB_ERROR("bb::ingest", "ingest thread %u failed to watch socket %d (errno %d)", thread->index, socket, errno);
+		}
+	}
+#endif
+}
+
+static void ingest_remove(ingest_thread_t* thread, u32 slot)
+{
+	bb_server_connection_data_t* data = thread->connections[slot];
+#if BB_USING(BB_INGEST_EPOLL)
+	if (thread->sockets[slot] != BB_INVALID_SOCKET && thread->sockets[slot] == data->con.socket)
+	{
+		epoll_ctl(thread->epollFd, EPOLL_CTL_DEL, thread->sockets[slot], NULL);
+	}
+#endif
+	thread->connections[slot] = NULL;
+	thread->sockets[slot] = BB_INVALID_SOCKET;
+	thread->readable[slot] = false;
+	recorder_stop(data);
+
+	bb_critical_section_lock(&thread->cs);
+	--thread->numAssigned;
+	bb_critical_section_unlock(&thread->cs);
+}
+
+static void ingest_take_pending(ingest_thread_t* thread)
+{
+	bb_server_connection_data_t* pending[kIngest_MaxConnections];
+	bb_critical_section_lock(&thread->cs);
+	u32 numPending = thread->numPending;
+	memcpy(pending, thread->pending, numPending * sizeof(pending[0]));
+	thread->numPending = 0;
+	bb_critical_section_unlock(&thread->cs);
+
+	// numAssigned keeps a slot free for every pending connection
+	u32 slot = 0;
+	for (u32 i = 0; i < numPending; ++i)
+	{
+		while (thread->connections[slot])
+		{
+			++slot;
+		}
+		thread->connections[slot] = pending[i];
+		thread->sockets[slot] = BB_INVALID_SOCKET;
+		thread->readable[slot] = false;
+		if (recorder_start(pending[i]))
+		{
+			ingest_watch(thread, slot);
+		}
+		else
+		{
+			ingest_remove(thread, slot);
+		}
+	}
+}
+
+static void ingest_wait(ingest_thread_t* thread)
+{
+#if BB_USING(BB_INGEST_EPOLL)
+	struct epoll_event events[kIngest_MaxConnections];
+	int count = epoll_wait(thread->epollFd, events, kIngest_MaxConnections, kIngest_IdleMillis);
+	for (int i = 0; i < count; ++i)
+	{
+		thread->readable[events[i].data.u32] = true;
+	}
+#else
+	u32 numFds = 0;
+	for (u32 slot = 0; slot < kIngest_MaxConnections; ++slot)
+	{
+		if (thread->connections[slot] && thread->sockets[slot] != BB_INVALID_SOCKET)
+		{
+			struct pollfd* fd = thread->fds + numFds;
+			fd->fd = thread->sockets[slot];
+			fd->events = POLLIN;
+			fd->revents = 0;
+			thread->fdSlots[numFds++] = slot;
+		}
+	}
+
+	// WSAPoll fails without any sockets to wait on
+	if (!numFds)
+	{
+		bb_sleep_ms(kIngest_IdleMillis);
+		return;
+	}
+
+	int count = bb_ingest_poll(thread->fds, numFds, kIngest_IdleMillis);
+	for (u32 i = 0; i < numFds && count > 0; ++i)
+	{
+		if (thread->fds[i].revents)
+		{
+			thread->readable[thread->fdSlots[i]] = true;
+		}
+	}
+#endif
+}
+
+static bb_thread_return_t ingest_thread_func(void* args)
+{
+	ingest_thread_t* thread = (ingest_thread_t*)args;
+	char name[32];
+	if (bb_snprintf(name, sizeof(name), "ingest %u", thread->index) < 0)
+	{
+		name[sizeof(name) - 1] = '\0';
+	}
+
+	BB_THREAD_START(name);
+	bbthread_set_name(name);
+
+	while (!s_ingest.shutdownRequest)
+	{
+		ingest_take_pending(thread);
+		ingest_wait(thread);
+
+		for (u32 slot = 0; slot < kIngest_MaxConnections; ++slot)
+		{
+			bb_server_connection_data_t* data = thread->connections[slot];
+			if (!data)
+				continue;
+
+			const b32 readable = thread->readable[slot];
+			thread->readable[slot] = false;
+			if (recorder_tick(data, readable))
+			{
+				ingest_watch(thread, slot);
+			}
+			else
+			{
+				ingest_remove(thread, slot);
+			}
+		}
+	}
+
+	ingest_take_pending(thread);
+	for (u32 slot = 0; slot < kIngest_MaxConnections; ++slot)
+	{
+		if (thread->connections[slot])
+		{
+			ingest_remove(thread, slot);
+		}
+	}
+
+	BB_THREAD_END();
+	bb_thread_exit(0);
+}
+
+void ingest_init(u32 threadCount)
+{
+	memset(&s_ingest, 0, sizeof(s_ingest));
+	s_ingest.numThreads = (threadCount < kIngest_MaxThreads) ? threadCount : kIngest_MaxThreads;
+	if (!s_ingest.numThreads)
+	{
+		s_ingest.numThreads = 1;
+	}
+	for (u32 i = 0; i < s_ingest.numThreads; ++i)
+	{
+		ingest_thread_t* thread = s_ingest.threads + i;
+		thread->index = i;
+		for (u32 slot = 0; slot < kIngest_MaxConnections; ++slot)
+		{
+			thread->sockets[slot] = BB_INVALID_SOCKET;
+		}
+		bb_critical_section_init(&thread->cs);
+#if BB_USING(BB_INGEST_EPOLL)
+		thread->epollFd = epoll_create1(0);
+		if (thread->epollFd < 0)
+		{
+			BB_ERROR("bb::ingest", "epoll_create1 failed (errno %d)", errno);
+		}
+#endif
+		thread->handle = bbthread_create(ingest_thread_func, thread);
+	}
+}
+
+void ingest_shutdown(void)
+{
+	s_ingest.shutdownRequest = true;
+	for (u32 i = 0; i < s_ingest.numThreads; ++i)
+	{
+		ingest_thread_t* thread = s_ingest.threads + i;
+		if (thread->handle)
+		{
+			bbthread_join(thread->handle);
+			thread->handle = 0;
+		}
+#if BB_USING(BB_INGEST_EPOLL)
+		if (thread->epollFd >= 0)
+		{
+			close(thread->epollFd);
+		}
+#endif
+		bb_critical_section_shutdown(&thread->cs);
+	}
+	s_ingest.numThreads = 0;
+}
+
+b32 ingest_add(bb_server_connection_data_t* data)
+{
+	ingest_thread_t* best = NULL;
+	u32 bestAssigned = kIngest_MaxConnections;
+	for (u32 i = 0; i < s_ingest.numThreads; ++i)
+	{
+		ingest_thread_t* thread = s_ingest.threads + i;
+		bb_critical_section_lock(&thread->cs);
+		u32 numAssigned = thread->numAssigned;
+		bb_critical_section_unlock(&thread->cs);
+		if (numAssigned < bestAssigned)
+		{
+			best = thread;
+			bestAssigned = numAssigned;
+		}
+	}
+	if (!best)
+		return false;
+
+	// discovery is the only caller, so the count can only have gone down since
+	bb_critical_section_lock(&best->cs);
+	best->pending[best->numPending++] = data;
+	++best->numAssigned;
+	bb_critical_section_unlock(&best->cs);
+	return true;
+}
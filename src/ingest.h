@@ -0,0 +1,28 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#pragma once
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "recorder_thread.h"
+
+enum
+{
+	kIngest_MaxConnections = 512, // per thread - g_config.maxConnections limits the total
+};
+
+// Recorded connections are serviced by a small pool of I/O threads, each waiting on the sockets of its
+// connections with epoll (or poll/WSAPoll where there is no epoll) instead of a thread per connection.
+void ingest_init(u32 threadCount);
+void ingest_shutdown(void);
+
+// Hands a connection that bbcon_connect_server has started listening on to the least busy thread, which starts
+// recording it.  Returns false if every thread is full - the connection is left as it was.
+b32 ingest_add(bb_server_connection_data_t* data);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -19,6 +19,8 @@
 #include "bb.h"
 #include "bb_array.h"
 #include "bb_assert.h"
+#include "bb_format.h"
+#include "bb_kv.h"
 #include "bb_malloc.h"
 #include "bb_packet.h"
 #include "bb_string.h"
@@ -33,7 +35,11 @@ static const u32 g_jsonExpansionMaxLen = 2u * 1024u * 1024u;
 static void recorded_session_add_category(recorded_session_t* session, bb_decoded_packet_t* decoded);
 static void recorded_session_add_partial_log(recorded_session_t* session, bb_decoded_packet_t* decoded, recorded_thread_t* t);
 static void recorded_session_add_log(recorded_session_t* session, bb_decoded_packet_t* decoded, recorded_thread_t* t);
+static void recorded_session_add_log_text(recorded_session_t* session, bb_decoded_packet_t* decoded, recorded_thread_t* t, const char* text, u32 textLen, const u8* fields, u32 fieldsLen);
 static void recorded_session_add_fileid(recorded_session_t* session, bb_decoded_packet_t* decoded);
+static void recorded_session_add_format(recorded_session_t* session, bb_decoded_packet_t* decoded);
+static void recorded_session_add_deferred_log(recorded_session_t* session, bb_decoded_packet_t* decoded, recorded_thread_t* t);
+static void recorded_session_splice_flight_recorder_logs(recorded_session_t* session);
 static recorded_thread_t* recorded_session_find_or_add_thread(recorded_session_t* session, bb_decoded_packet_t* decoded);
 static recorded_pieInstance_t* recorded_session_find_or_add_pieInstance(recorded_session_t* session, s32 pieInstance);
 
@@ -115,6 +121,7 @@ void recorded_session_open(const char* path, const char* applicationFilename, co
 		bb_critical_section_init(&session->incoming->cs);
 		session->appInfo.packet.appInfo.millisPerTick = 1.0;
 		session->recordingActive = (b8)recordingActive;
+		session->categoryLevelsDirty = true;
 		if (outgoingMqId == mq_invalid_id())
 		{
 			session->outgoingMqId = mq_invalid_id();
@@ -134,6 +141,7 @@ void recorded_session_open(const char* path, const char* applicationFilename, co
 		}
 		return;
 	}
+	session->categoryLevelsDirty = true;
 
 	if (!session->threadActive)
 	{
@@ -156,13 +164,30 @@ void recorded_session_restart(recorded_session_t* session)
 		view_restart(session->views.data + j);
 	}
 	recorded_logs_reset(&session->logs);
+	recorded_logs_reset(&session->flightRecorderLogs);
+	session->flightRecorderDump = false;
 	bba_free(session->partialLogs);
 	bba_free(session->categories);
 	bba_free(session->filenames);
+	sbs_reset(&session->formats);
 	bba_free(session->threads);
 	bba_free(session->pieInstances);
 	bba_free(session->consoleAutocomplete);
 	sb_reset(&session->consoleAutocomplete.request);
+	bba_free(session->telemetry);
+}
+
+// kBBPacketType_LogTextLarge packets own a copy of their text until recorded_session_update adds them
+static void recorded_session_free_queued_text(recorded_session_t* session)
+{
+	bb_decoded_packet_t decoded;
+	while (recorded_session_consume(session, &decoded))
+	{
+		if (decoded.type == kBBPacketType_LogTextLarge)
+		{
+			bb_free((void*)decoded.packet.logTextLarge.text);
+		}
+	}
 }
 
 void recorded_session_close(recorded_session_t* session)
@@ -186,13 +211,18 @@ void recorded_session_close(recorded_session_t* session)
 				}
 				bba_free(session->views);
 				recorded_logs_reset(&session->logs);
+				recorded_logs_reset(&session->flightRecorderLogs);
 				bba_free(session->partialLogs);
 				bba_free(session->categories);
 				bba_free(session->filenames);
+				sbs_reset(&session->formats);
 				bba_free(session->threads);
 				bba_free(session->pieInstances);
 				bba_free(session->consoleAutocomplete);
 				sb_reset(&session->consoleAutocomplete.request);
+				bba_free(session->sentCategoryLevels);
+				bba_free(session->telemetry);
+				recorded_session_free_queued_text(session);
 				_aligned_free(session->incoming);
 				if (session->outgoingMqId != mq_invalid_id())
 				{
@@ -363,6 +393,97 @@ static void recorded_session_echo_user_packet(recorded_session_t* session, bb_de
 	}
 }
 
+// The lowest level a view shows, or kBBLogLevel_SetColor if it hides them all
+static u8 recorded_session_view_min_level(const view_t* view)
+{
+	const b32 shown[] = {
+		view->config.showVeryVerbose,
+		view->config.showVerbose,
+		view->config.showLogs,
+		view->config.showDisplay,
+		view->config.showWarnings,
+		view->config.showErrors,
+		view->config.showFatal,
+	};
+	for (u8 level = 0; level < BB_ARRAYSIZE(shown); ++level)
+	{
+		if (shown[level])
+			return level;
+	}
+	return kBBLogLevel_SetColor;
+}
+
+// Tells clients that asked for kBBInitFlag_CategoryLevels which logs no view would show, so they don't format
+// or send them.  A category's level is the lowest any view shows it at.  Categories that no view knows about
+// yet are left enabled.  Levels are only worked out again once views or categories change (categoryLevelsDirty),
+// and only runs of category ids that changed since they were last queued are sent.
+static void recorded_session_update_category_levels(recorded_session_t* session)
+{
+	if (!session->categoryLevelsDirty || !session->recordingActive || session->outgoingMqId == mq_invalid_id() ||
+	    (session->appInfo.packet.appInfo.initFlags & kBBInitFlag_CategoryLevels) == 0)
+		return;
+
+	session->categoryLevelsDirty = false;
+
+	u8 levels[kBBCategoryLevels_Count];
+	memset(levels, kBBLogLevel_Count, sizeof(levels));
+	u32 count = 0;
+	for (u32 viewIndex = 0; viewIndex < session->views.count; ++viewIndex)
+	{
+		const view_t* view = session->views.data + viewIndex;
+		const u8 viewLevel = recorded_session_view_min_level(view);
+		for (u32 categoryIndex = 0; categoryIndex < view->categories.count; ++categoryIndex)
+		{
+			const view_category_t* category = view->categories.data + categoryIndex;
+			if (!category->id || category->id >= kBBCategoryLevels_Count)
+				continue;
+
+			const u8 level = (category->visible && !category->disabled) ? viewLevel : (u8)kBBLogLevel_SetColor;
+			levels[category->id] = BB_MIN(levels[category->id], level);
+			count = BB_MAX(count, category->id + 1);
+		}
+	}
+
+	for (u32 firstCategoryId = 0; firstCategoryId < count; firstCategoryId += kBBSize_CategoryLevels)
+	{
+		const u32 runCount = BB_MIN(count - firstCategoryId, (u32)kBBSize_CategoryLevels);
+		b32 changed = false;
+		for (u32 i = 0; i < runCount; ++i)
+		{
+			const u32 categoryId = firstCategoryId + i;
+			u8* level = levels + categoryId;
+			if (*level == kBBLogLevel_Count)
+			{
+				*level = kBBLogLevel_VeryVerbose;
+			}
+			const u8 sentLevel = (categoryId < session->sentCategoryLevels.count) ? session->sentCategoryLevels.data[categoryId] : (u8)kBBLogLevel_VeryVerbose;
+			changed = changed || *level != sentLevel;
+		}
+		if (!changed)
+			continue;
+
+		// the message is [u16 count][levels], starting at the category id in userData - see recorder_thread
+		u8 message[sizeof(u16) + kBBSize_CategoryLevels];
+		const u16 messageCount = (u16)runCount;
+		memcpy(message, &messageCount, sizeof(messageCount));
+		memcpy(message + sizeof(messageCount), levels + firstCategoryId, runCount);
+		if (!mq_queue_userData(session->outgoingMqId, kBBPacketType_CategoryLevels, firstCategoryId, (const char*)message, (u32)sizeof(messageCount) + runCount))
+		{
+			session->categoryLevelsDirty = true;
+			break;
+		}
+
+		if (session->sentCategoryLevels.count < firstCategoryId + runCount)
+		{
+			bba_add(session->sentCategoryLevels, firstCategoryId + runCount - session->sentCategoryLevels.count);
+		}
+		if (session->sentCategoryLevels.count >= firstCategoryId + runCount)
+		{
+			memcpy(session->sentCategoryLevels.data + firstCategoryId, levels + firstCategoryId, runCount);
+		}
+	}
+}
+
 void recorded_session_update(recorded_session_t* session)
 {
 	u64 start = bb_current_time_ms();
@@ -398,6 +519,68 @@ void recorded_session_update(recorded_session_t* session)
 		case kBBPacketType_FileId:
 			recorded_session_add_fileid(session, &decoded);
 			break;
+		case kBBPacketType_FormatId:
+			recorded_session_add_format(session, &decoded);
+			break;
+		case kBBPacketType_LogTextDeferred:
+			recorded_session_add_deferred_log(session, &decoded, t);
+			break;
+		case kBBPacketType_LogSuppressed:
+		{
+			bb_decoded_packet_t logText;
+			bbpacket_expand_log_suppressed(&decoded, &logText);
+			recorded_session_add_log(session, &logText, t);
+			break;
+		}
+		case kBBPacketType_LogsDropped:
+		{
+			bb_decoded_packet_t logText;
+			bbpacket_expand_logs_dropped(&decoded, &logText);
+			recorded_session_add_log(session, &logText, t);
+			break;
+		}
+		case kBBPacketType_FlightRecorder:
+			if (decoded.packet.flightRecorder.end)
+			{
+				recorded_session_splice_flight_recorder_logs(session);
+			}
+			else
+			{
+				bb_decoded_packet_t logText;
+				bbpacket_expand_flight_recorder(&decoded, &logText);
+				recorded_session_add_log(session, &logText, t);
+				session->flightRecorderDump = true;
+			}
+			break;
+		case kBBPacketType_LogTextKV:
+		{
+			const bb_packet_log_text_kv_t* kv = &decoded.packet.logTextKV;
+			bb_decoded_packet_t logText;
+			logText.type = kBBPacketType_LogText;
+			logText.header = decoded.header;
+			logText.packet.logText.categoryId = kv->categoryId;
+			logText.packet.logText.level = kv->level;
+			logText.packet.logText.pieInstance = kv->pieInstance;
+			logText.packet.logText.colors = kv->colors;
+			bb_strncpy(logText.packet.logText.text, kv->text, sizeof(logText.packet.logText.text));
+			recorded_session_add_log_text(session, &logText, t, logText.packet.logText.text, (u32)strlen(logText.packet.logText.text), kv->fields, kv->fieldsLen);
+			break;
+		}
+		case kBBPacketType_LogTextLarge:
+		{
+			// the text was copied for the queue by recorded_session_thread
+			const bb_packet_log_text_large_t* large = &decoded.packet.logTextLarge;
+			bb_decoded_packet_t logText;
+			logText.type = kBBPacketType_LogText;
+			logText.header = decoded.header;
+			logText.packet.logText.categoryId = large->categoryId;
+			logText.packet.logText.level = large->level;
+			logText.packet.logText.pieInstance = large->pieInstance;
+			logText.packet.logText.colors = large->colors;
+			recorded_session_add_log_text(session, &logText, t, large->text, large->textLen, NULL, 0);
+			bb_free((void*)large->text);
+			break;
+		}
 		case kBBPacketType_ThreadName:
 		case kBBPacketType_ThreadStart:
 			break;
@@ -416,6 +599,22 @@ void recorded_session_update(recorded_session_t* session)
 		case kBBPacketType_FrameNumber:
 			session->currentFrameNumber = decoded.packet.frameNumber.frameNumber;
 			break;
+		case kBBPacketType_TimeCalibration:
+			if (decoded.packet.timeCalibration.millisPerTick > 0.0)
+			{
+				session->appInfo.packet.appInfo.millisPerTick = decoded.packet.timeCalibration.millisPerTick;
+			}
+			break;
+		case kBBPacketType_ClientTelemetry:
+		{
+			recorded_telemetry_sample_t* sample = bba_add(session->telemetry, 1);
+			if (sample)
+			{
+				sample->timestamp = decoded.header.timestamp;
+				sample->telemetry = decoded.packet.clientTelemetry;
+			}
+			break;
+		}
 		case kBBPacketType_Invalid:
 		case kBBPacketType_FrameEnd:
 		case kBBPacketType_ConsoleCommand:
@@ -423,6 +622,12 @@ void recorded_session_update(recorded_session_t* session)
 		case kBBPacketType_StopRecording:
 		case kBBPacketType_RecordingInfo:
 		case kBBPacketType_ConsoleAutocompleteRequest:
+		case kBBPacketType_ServerFeatures:
+		case kBBPacketType_CompressedBatch:
+		case kBBPacketType_Callsite:
+		case kBBPacketType_ThreadIndex:
+		case kBBPacketType_LogTextCompact:
+		case kBBPacketType_CategoryLevels:
 			break;
 		case kBBPacketType_UserToServer:
 			recorded_session_echo_user_packet(session, &decoded);
@@ -462,6 +667,8 @@ void recorded_session_update(recorded_session_t* session)
 			mb_queue(mb, NULL);
 		}
 	}
+
+	recorded_session_update_category_levels(session);
 }
 
 recorded_session_t* recorded_session_find(const char* path)
@@ -507,6 +714,7 @@ static void recorded_session_add_category_from_config(recorded_session_t* sessio
 	c = bba_add(session->categories, 1);
 	if (c)
 	{
+		session->categoryLevelsDirty = true;
 		bb_strncpy(c->categoryName, categoryName, sizeof(c->categoryName));
 		Fonts_CacheGlyphs(c->categoryName);
 		for (u32 viewIndex = 0; viewIndex < session->views.count; ++viewIndex)
@@ -520,6 +728,7 @@ static void recorded_session_add_category_from_config(recorded_session_t* sessio
 static void recorded_session_add_category(recorded_session_t* session, bb_decoded_packet_t* decoded)
 {
 	recorded_category_t* c = recorded_session_find_category_by_name(session, decoded->packet.categoryId.name);
+	session->categoryLevelsDirty = true;
 	if (c)
 	{
 		c->id = decoded->packet.categoryId.id;
@@ -653,6 +862,14 @@ static u32 recorded_session_fixup_old_log_level(u32 oldLogLevel)
 }
 
 static void recorded_session_add_log(recorded_session_t* session, bb_decoded_packet_t* decoded, recorded_thread_t* t)
+{
+	recorded_session_add_log_text(session, decoded, t, decoded->packet.logText.text, (u32)strlen(decoded->packet.logText.text), NULL, 0);
+}
+
+// text replaces decoded's own, so kBBPacketType_LogTextLarge text longer than it is kept whole.  fields are rendered
+// as one line of JSON after the text, so text filters and copies see them, and kept so field filters and the tooltip
+// don't have to parse it back
+static void recorded_session_add_log_text(recorded_session_t* session, bb_decoded_packet_t* decoded, recorded_thread_t* t, const char* text, u32 textLen, const u8* fields, u32 fieldsLen)
 {
 	if (session->appInfo.type == kBBPacketType_AppInfo_v1 ||
 	    session->appInfo.type == kBBPacketType_AppInfo_v2 ||
@@ -672,7 +889,27 @@ static void recorded_session_add_log(recorded_session_t* session, bb_decoded_pac
 			sb_append(&s_reconstructedLogText, partial->packet.logText.text);
 		}
 	}
-	sb_append(&s_reconstructedLogText, decoded->packet.logText.text);
+	sb_append_range(&s_reconstructedLogText, text, text + textLen);
+	if (fieldsLen)
+	{
+		u32 textLen = sb_len(&s_reconstructedLogText);
+		if (textLen && s_reconstructedLogText.data[textLen - 1] == '\n')
+		{
+			s_reconstructedLogText.data[--textLen] = '\0';
+			--s_reconstructedLogText.count;
+		}
+		if (textLen)
+		{
+			sb_append_char(&s_reconstructedLogText, ' ');
+		}
+		const u32 jsonLen = bbkv_format_json(fields, fieldsLen, NULL, 0);
+		const u32 jsonStart = sb_len(&s_reconstructedLogText);
+		if (sb_grow(&s_reconstructedLogText, jsonLen))
+		{
+			bbkv_format_json(fields, fieldsLen, s_reconstructedLogText.data + jsonStart, jsonLen + 1);
+		}
+		sb_append_char(&s_reconstructedLogText, '\n');
+	}
 
 	// Find offsets for embedded lines
 	b32 bAnyLineCanBeJson = false;
@@ -772,25 +1009,32 @@ static void recorded_session_add_log(recorded_session_t* session, bb_decoded_pac
 		}
 		++t->logCount[decoded->packet.logText.level];
 	}
-	plog = bba_add(session->logs, 1);
+	recorded_logs_t* logs = (session->flightRecorderDump) ? &session->flightRecorderLogs : &session->logs;
+	plog = bba_add(*logs, 1);
 	if (plog)
 	{
 		size_t textLen = sb_len(&s_reconstructedLogText);
 		size_t preTextSize = (u8*)decoded->packet.logText.text - (u8*)decoded;
 		size_t decodedSize = preTextSize + textLen + 1;
 		size_t logSize = decodedSize + offsetof(recorded_log_t, packet);
-		*plog = bb_malloc(logSize);
+		*plog = bb_malloc(logSize + fieldsLen);
 		log = *plog;
 		if (log)
 		{
+			log->fields = (fieldsLen) ? (u8*)log + logSize : NULL;
+			log->fieldsLen = fieldsLen;
+			if (fieldsLen)
+			{
+				memcpy((u8*)log + logSize, fields, fieldsLen);
+			}
 			log->expandedJson = expandedJson;
 			log->jsonLines = recordedJsonLogLines;
 			log->lines = recordedLogLines;
-			log->sessionLogIndex = session->logs.count - 1;
+			log->sessionLogIndex = logs->count - 1;
 			log->frameNumber = session->currentFrameNumber;
 			memcpy(&log->packet, decoded, preTextSize);
 			memcpy(log->packet.packet.logText.text, sb_get(&s_reconstructedLogText), textLen + 1);
-			for (u32 i = 0; i < session->views.count; ++i)
+			for (u32 i = 0; i < session->views.count && logs == &session->logs; ++i)
 			{
 				view_add_log(session->views.data + i, log);
 			}
@@ -804,7 +1048,7 @@ static void recorded_session_add_log(recorded_session_t* session, bb_decoded_pac
 		}
 		else
 		{
-			--session->logs.count;
+			--logs->count;
 			bba_free(recordedLogLines);
 		}
 		for (u32 i = 0; i < session->partialLogs.count;)
@@ -839,6 +1083,107 @@ static void recorded_session_add_log(recorded_session_t* session, bb_decoded_pac
 	}
 }
 
+static int FlightRecorderLogCompare(const void* _a, const void* _b)
+{
+	const recorded_log_t* a = *(const recorded_log_t**)_a;
+	const recorded_log_t* b = *(const recorded_log_t**)_b;
+	if (a->packet.header.timestamp != b->packet.header.timestamp)
+	{
+		return (a->packet.header.timestamp < b->packet.header.timestamp) ? -1 : 1;
+	}
+	return (a->sessionLogIndex < b->sessionLogIndex) ? -1 : (a->sessionLogIndex > b->sessionLogIndex) ? 1 : 0;
+}
+
+// Logs from a flight recorder dump sat in the client's ring while later logs were sent, so once the dump ends they
+// are merged into the end of the session by timestamp, and the logs after the first one are renumbered
+static void recorded_session_splice_flight_recorder_logs(recorded_session_t* session)
+{
+	recorded_logs_t* dumped = &session->flightRecorderLogs;
+	session->flightRecorderDump = false;
+	if (!dumped->count)
+		return;
+
+	qsort(dumped->data, dumped->count, sizeof(dumped->data[0]), FlightRecorderLogCompare);
+	const u64 firstTimestamp = dumped->data[0]->packet.header.timestamp;
+	u32 start = session->logs.count;
+	while (start > 0 && session->logs.data[start - 1]->packet.header.timestamp > firstTimestamp)
+	{
+		--start;
+	}
+
+	recorded_logs_t tail = { BB_EMPTY_INITIALIZER };
+	const u32 tailCount = session->logs.count - start;
+	if (tailCount)
+	{
+		recorded_log_t** tailLogs = session->logs.data + start;
+		bba_add_array(tail, tailLogs, tailCount);
+		if (!tail.data)
+		{
+			recorded_logs_reset(dumped);
+			return;
+		}
+	}
+	if (!bba_add(session->logs, dumped->count))
+	{
+		bba_free(tail);
+		recorded_logs_reset(dumped);
+		return;
+	}
+
+	u32 tailIndex = 0;
+	u32 dumpedIndex = 0;
+	for (u32 i = start; i < session->logs.count; ++i)
+	{
+		if (dumpedIndex >= dumped->count ||
+		    (tailIndex < tail.count && tail.data[tailIndex]->packet.header.timestamp <= dumped->data[dumpedIndex]->packet.header.timestamp))
+		{
+			session->logs.data[i] = tail.data[tailIndex++];
+		}
+		else
+		{
+			session->logs.data[i] = dumped->data[dumpedIndex++];
+			session->logs.data[i]->sessionLogIndex = ~0U;
+		}
+	}
+	for (u32 i = 0; i < session->views.count; ++i)
+	{
+		view_splice_logs(session->views.data + i, start);
+	}
+	for (u32 i = start; i < session->logs.count; ++i)
+	{
+		session->logs.data[i]->sessionLogIndex = i;
+	}
+	bba_free(tail);
+	bba_free(*dumped);
+}
+
+typedef struct recorded_session_deferred_log_s
+{
+	recorded_session_t* session;
+	recorded_thread_t* t;
+} recorded_session_deferred_log_t;
+
+static void recorded_session_add_expanded_log(bb_decoded_packet_t* decoded, void* context)
+{
+	recorded_session_deferred_log_t* deferred = context;
+	if (decoded->type == kBBPacketType_LogTextPartial)
+	{
+		recorded_session_add_partial_log(deferred->session, decoded, deferred->t);
+	}
+	else
+	{
+		recorded_session_add_log(deferred->session, decoded, deferred->t);
+	}
+}
+
+static void recorded_session_add_deferred_log(recorded_session_t* session, bb_decoded_packet_t* decoded, recorded_thread_t* t)
+{
+	u32 formatId = decoded->packet.logTextDeferred.formatId;
+	const char* format = (formatId < session->formats.count && sb_len(session->formats.data + formatId)) ? sb_get(session->formats.data + formatId) : NULL;
+	recorded_session_deferred_log_t deferred = { session, t };
+	bbformat_expand_log_packet(decoded, format, &recorded_session_add_expanded_log, &deferred);
+}
+
 recorded_filename_t* recorded_session_find_filename(recorded_session_t* session, u32 fileId)
 {
 	u32 i;
@@ -869,6 +1214,23 @@ static void recorded_session_add_fileid(recorded_session_t* session, bb_decoded_
 	}
 }
 
+static void recorded_session_add_format(recorded_session_t* session, bb_decoded_packet_t* decoded)
+{
+	// format ids are allocated sequentially by the client, so they index directly into formats
+	u32 id = decoded->packet.formatId.id;
+	if (id > 1024 * 1024)
+	{
+		return;
+	}
+	if (id >= session->formats.count && !bba_add(session->formats, id + 1 - session->formats.count))
+	{
+		return;
+	}
+	sb_t* format = session->formats.data + id;
+	sb_reset(format);
+	*format = sb_from_c_string(decoded->packet.formatId.name);
+}
+
 recorded_thread_t* recorded_session_find_thread(recorded_session_t* session, u64 threadId)
 {
 	u32 i;
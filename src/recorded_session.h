@@ -46,8 +46,9 @@ typedef struct recorded_log_lines_s
 typedef struct recorded_log_s
 {
 	u32 sessionLogIndex;
-	u32 pad;
+	u32 fieldsLen;
 	u64 frameNumber;
+	const u8* fields; // kBBPacketType_LogTextKV fields (see bb_kv.h), stored after the text
 	sb_t expandedJson;
 	recorded_log_lines_t lines;
 	recorded_log_lines_t jsonLines;
@@ -125,6 +126,26 @@ typedef struct recorded_pieInstances_s
 	recorded_pieInstance_t* data;
 } recorded_pieInstances_t;
 
+typedef struct recorded_category_levels_s
+{
+	u32 count;
+	u32 allocated;
+	u8* data;
+} recorded_category_levels_t;
+
+typedef struct recorded_telemetry_sample_s
+{
+	u64 timestamp;
+	bb_packet_client_telemetry_t telemetry;
+} recorded_telemetry_sample_t;
+
+typedef struct recorded_telemetry_s
+{
+	u32 count;
+	u32 allocated;
+	recorded_telemetry_sample_t* data;
+} recorded_telemetry_t;
+
 typedef struct recorded_console_autocomplete_s
 {
 	u32 id;
@@ -148,16 +169,21 @@ typedef struct recorded_session_s
 	b8 recordingActive;
 	b8 failedToDeserialize;
 	b8 shownDeserializationMessageBox;
-	u8 pad;
+	b8 flightRecorderDump; // between the kBBPacketType_FlightRecorder packets around a dump
+	b8 categoryLevelsDirty; // views or categories changed since kBBPacketType_CategoryLevels were last worked out
 	bb_decoded_packet_t appInfo;
 	views_t views;
 	recorded_logs_t logs;
+	recorded_logs_t flightRecorderLogs; // held back until the dump ends, then spliced into logs by timestamp
 	partial_logs_t partialLogs;
 	recorded_categories_t categories;
 	recorded_filenames_t filenames;
+	sbs_t formats; // kBBPacketType_LogTextDeferred format strings, indexed by format id
 	recorded_threads_t threads;
 	recorded_pieInstances_t pieInstances;
 	recorded_console_autocomplete_t consoleAutocomplete;
+	recorded_category_levels_t sentCategoryLevels; // kBBPacketType_CategoryLevels queued for the client, indexed by category id
+	recorded_telemetry_t telemetry;                // kBBPacketType_ClientTelemetry, oldest first
 	bb_thread_handle_t threadHandle;
 	u64 currentFrameNumber;
 	u32 outgoingMqId;
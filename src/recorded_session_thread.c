@@ -4,7 +4,9 @@
 #include "recorded_session_thread.h"
 #include "bb.h"
 #include "bb_array.h"
+#include "bb_compact.h"
 #include "bb_file.h"
+#include "bb_malloc.h"
 #include "bb_packet.h"
 #include "bb_string.h"
 #include "bb_thread.h"
@@ -12,6 +14,7 @@
 #include "file_utils.h"
 #include "message_queue.h"
 #include "recorded_session.h"
+#include "recorder_writer.h"
 #include "span.h"
 #include "tokenize.h"
 #include "view.h"
@@ -21,20 +24,75 @@
 #include <locale.h>
 #include <stdlib.h>
 
-static void recorded_session_queue(recorded_session_t* session, bb_decoded_packet_t* decoded)
+enum
+{
+	kRecordedSession_FileSleepMillis = 100,
+	kRecordedSession_FeedSleepMillis = 5, // how long a live session waits for the recorder when it has caught up
+};
+
+static b32 recorded_session_queue(recorded_session_t* session, bb_decoded_packet_t* decoded)
 {
 	session_message_queue_t* mq = session->incoming;
 	bb_decoded_packet_t* message;
 	while (mq->writeCursor - mq->readCursor == BB_ARRAYSIZE(mq->entries))
 	{
 		if (!session->threadDesiredActive)
-			return;
+			return false;
 		bb_sleep_ms(0);
 	}
 
 	message = mq->entries + (mq->writeCursor % BB_ARRAYSIZE(mq->entries));
 	memcpy(message, decoded, sizeof(*message));
 	InterlockedIncrement64(&mq->writeCursor);
+	return true;
+}
+
+// Queues the packets in a compressed batch frame, as if they had been recorded individually
+static b32 recorded_session_queue_batch(recorded_session_t* session, bb_compact_state_t* compact, const u8* frame, u16 frameBytes)
+{
+	u8 expanded[kBBBatch_MaxExpandedSize];
+	u32 expandedBytes = bbpacket_expand_batch(frame, frameBytes, expanded, sizeof(expanded));
+	if (!expandedBytes)
+		return false;
+
+	u32 cursor = 0;
+	while (cursor < expandedBytes)
+	{
+		bb_decoded_packet_t decoded;
+		u16 nPacketBytes = (u16)((expanded[cursor] << 8) + expanded[cursor + 1]);
+		if (!bbpacket_deserialize(expanded + cursor + 2, nPacketBytes - 2, &decoded) || !bbcompact_decode(compact, &decoded))
+			return false;
+		recorded_session_queue(session, &decoded);
+		cursor += nPacketBytes;
+	}
+	return true;
+}
+
+static void recorded_session_queue_split_packet(bb_decoded_packet_t* decoded, void* context)
+{
+	recorded_session_queue((recorded_session_t*)context, decoded);
+}
+
+// The text of a kBBPacketType_LogTextLarge points into recvBuffer, so the queued packet gets its own copy, which
+// recorded_session_update frees.  If there is no memory for one, it is queued as the kBBPacketType_LogTextPartial
+// and kBBPacketType_LogText packets an older client would have sent.
+static void recorded_session_queue_large_log(recorded_session_t* session, bb_decoded_packet_t* decoded)
+{
+	bb_packet_log_text_large_t* large = &decoded->packet.logTextLarge;
+	char* text = bb_malloc(large->textLen + 1);
+	if (!text)
+	{
+		bbpacket_split_log_text_large(decoded, &recorded_session_queue_split_packet, session);
+		return;
+	}
+
+	memcpy(text, large->text, large->textLen);
+	text[large->textLen] = '\0';
+	large->text = text;
+	if (!recorded_session_queue(session, decoded))
+	{
+		bb_free(text);
+	}
 }
 
 b32 recorded_session_consume(recorded_session_t* session, bb_decoded_packet_t* decoded)
@@ -345,35 +403,82 @@ bb_thread_return_t recorded_session_read_thread(void* args)
 			u32 recvCursor = 0;
 			u32 decodeCursor = 0;
 			u32 fileSize = 0;
+			u64 filePosition = 0;   // bytes read from fp
+			u64 streamPosition = 0; // bytes of the recording read, from the file or the feed
+			bb_compact_state_t compact;
+			memset(&compact, 0, sizeof(compact));
+
+			// A recording that is still being made is read from the file up to feedOffset, and from the recorder
+			// after that, without waiting for it to be committed to the file.
+			u64 feedOffset = 0;
+			recorder_feed_t* feed = (session->recordingActive) ? recorder_feed_attach(session->path, &feedOffset) : NULL;
 			while (fp != BB_INVALID_FILE_HANDLE && session->threadDesiredActive && !session->failedToDeserialize)
 			{
 				b32 done = false;
-				u32 bytesRead = bb_file_read(fp, session->recvBuffer + recvCursor, sizeof(session->recvBuffer) - recvCursor);
-				if (bytesRead)
+				u8* dest = session->recvBuffer + recvCursor;
+				const u32 destSize = sizeof(session->recvBuffer) - recvCursor;
+				u32 bytesRead = 0;
+				if (feed && streamPosition >= feedOffset)
 				{
-					recvCursor += bytesRead;
+					b32 overrun = false;
+					b32 finished = false;
+					bytesRead = recorder_feed_read(feed, streamPosition, dest, destSize, &overrun, &finished);
+					if (overrun || finished)
+					{
+						// the reader fell too far behind, or the recording has stopped - the file has the rest
+						BB_LOG("Recorder::Read", "%s live read from %s\n", (overrun) ? "abandoning" : "finished", session->path);
+						recorder_feed_detach(feed);
+						feed = NULL;
+					}
+					else if (!bytesRead)
+					{
+						bb_sleep_ms(kRecordedSession_FeedSleepMillis);
+					}
 				}
-				else
+				else if (filePosition < streamPosition)
 				{
-					u32 oldFileSize = fileSize;
-					fileSize = bb_file_size(fp);
-					if (fileSize < oldFileSize)
+					// skip the part of the file that already came from the feed
+					u8 skipped[4096];
+					const u64 remaining = streamPosition - filePosition;
+					const u32 skippedBytes = bb_file_read(fp, skipped, (remaining < sizeof(skipped)) ? (u32)remaining : (u32)sizeof(skipped));
+					filePosition += skippedBytes;
+					if (!skippedBytes)
 					{
-						BB_LOG("Recorder::Read::Start", "restarting read from %s\n", session->path);
-						bb_file_close(fp);
-						fp = bb_file_open_for_read(session->path);
-						recvCursor = 0;
-						decodeCursor = 0;
-						bb_decoded_packet_t decoded = { BB_EMPTY_INITIALIZER };
-						decoded.type = kBBPacketType_Restart;
-						recorded_session_queue(session, &decoded);
-						continue;
+						bb_sleep_ms(kRecordedSession_FileSleepMillis);
 					}
-					else
+					continue;
+				}
+				else
+				{
+					bytesRead = bb_file_read(fp, dest, destSize);
+					filePosition += bytesRead;
+					if (!bytesRead)
 					{
-						bb_sleep_ms(100);
+						u32 oldFileSize = fileSize;
+						fileSize = bb_file_size(fp);
+						if (fileSize < oldFileSize)
+						{
+							BB_LOG("Recorder::Read::Start", "restarting read from %s\n", session->path);
+							bb_file_close(fp);
+							fp = bb_file_open_for_read(session->path);
+							recvCursor = 0;
+							decodeCursor = 0;
+							filePosition = 0;
+							streamPosition = 0;
+							bbcompact_reset(&compact);
+							bb_decoded_packet_t decoded = { BB_EMPTY_INITIALIZER };
+							decoded.type = kBBPacketType_Restart;
+							recorded_session_queue(session, &decoded);
+							continue;
+						}
+						else
+						{
+							bb_sleep_ms(kRecordedSession_FileSleepMillis);
+						}
 					}
 				}
+				recvCursor += bytesRead;
+				streamPosition += bytesRead;
 
 				while (!done)
 				{
@@ -388,7 +493,13 @@ bb_thread_return_t recorded_session_read_thread(void* args)
 					}
 
 					u8* cursor = session->recvBuffer + decodeCursor;
-					u16 nPacketBytes = (*cursor << 8) + (*(cursor + 1));
+					u32 nPacketBytes = bbpacket_frame_length(cursor, nDecodableBytes);
+					if (!nPacketBytes && nDecodableBytes < kBBFrame_ExtendedHeaderSize)
+					{
+						done = true;
+						break;
+					}
+
 					if (!nPacketBytes)
 					{
 						BB_ERROR("Recorder::Read", "recieved 0-byte packet from %s\n", session->path);
@@ -403,9 +514,31 @@ bb_thread_return_t recorded_session_read_thread(void* args)
 						break;
 					}
 
-					if (bbpacket_deserialize(cursor + 2, nPacketBytes - 2, &decoded))
+					const u32 nHeaderBytes = bbpacket_frame_header_size(cursor);
+					if (nHeaderBytes == kBBFrame_HeaderSize && bbpacket_is_batch_frame(cursor, nPacketBytes))
 					{
-						recorded_session_queue(session, &decoded);
+						if (!recorded_session_queue_batch(session, &compact, cursor, (u16)nPacketBytes))
+						{
+							BB_ERROR("Recorder::Read", "failed to expand compressed batch from %s\n", session->path);
+							done = true;
+							session->failedToDeserialize = true;
+							break;
+						}
+						if (session->logReads)
+						{
+							BB_LOG("Recorder::Read", "decoded compressed batch from %s\n", session->path);
+						}
+					}
+					else if (bbpacket_deserialize(cursor + nHeaderBytes, (u16)(nPacketBytes - nHeaderBytes), &decoded) && bbcompact_decode(&compact, &decoded))
+					{
+						if (decoded.type == kBBPacketType_LogTextLarge)
+						{
+							recorded_session_queue_large_log(session, &decoded);
+						}
+						else
+						{
+							recorded_session_queue(session, &decoded);
+						}
 						if (session->logReads)
 						{
 							BB_LOG("Recorder::Read", "decoded packet type %d from %s\n", decoded.type, session->path);
@@ -432,10 +565,15 @@ bb_thread_return_t recorded_session_read_thread(void* args)
 				}
 			}
 
+			if (feed)
+			{
+				recorder_feed_detach(feed);
+			}
 			if (fp != BB_INVALID_FILE_HANDLE)
 			{
 				bb_file_close(fp);
 			}
+			bbcompact_reset(&compact);
 		}
 	}
 
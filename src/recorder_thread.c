@@ -3,9 +3,11 @@
 
 #include "recorder_thread.h"
 #include "bb_structs_generated.h"
+#include "config.h"
 #include "message_queue.h"
 #include "recordings.h"
 
+#include "bb_atomic.h"
 #include "bb_log.h"
 #include "bb_malloc.h"
 #include "bb_packet.h"
@@ -146,209 +148,243 @@ void sanitize_app_filename(const char* applicationName, char* applicationFilenam
 	*dest = 0;
 }
 
-bb_thread_return_t recorder_thread(void* args)
+static void recorder_write_batch_frame(const u8* frame, u32 frameLen, void* context)
+{
+	recorder_writer_append((recorder_file_t*)context, frame, frameLen);
+}
+
+b32 recorder_start(bb_server_connection_data_t* data)
 {
-	FILE* fp;
-	bb_server_connection_data_t* data = (bb_server_connection_data_t*)args;
 	bb_connection_t* con = &data->con;
-	char path[1024];
 	char dir[1024];
 	rfc_uuid uuid;
-	char uuidBuffer[64];
-	char applicationName[kBBSize_ApplicationName];
-	sanitize_app_filename(data->applicationName, applicationName, sizeof(applicationName));
-	if (bb_snprintf(dir, sizeof(dir), "%s recorder %p", data->applicationName, con) < 0)
-	{
-		dir[sizeof(dir) - 1] = '\0';
-	}
-
-	BB_THREAD_START(dir);
-	bbthread_set_name(dir);
+	sanitize_app_filename(data->applicationName, data->applicationFilename, sizeof(data->applicationFilename));
 
 	get_appdata_folder(dir, sizeof(dir));
-	if (bb_snprintf(path, sizeof(path), "%s/%s", dir, applicationName) < 0)
+	if (bb_snprintf(data->path, sizeof(data->path), "%s/%s", dir, data->applicationFilename) < 0)
 	{
-		path[sizeof(path) - 1] = '\0';
+		data->path[sizeof(data->path) - 1] = '\0';
 	}
-	mkdir_recursive(path);
+	mkdir_recursive(data->path);
 	uuid_create(&uuid);
-	format_uuid(&uuid, uuidBuffer, sizeof(uuidBuffer));
-	if (bb_snprintf(path, sizeof(path), "%s\\%s\\{%s}%s.bbox", dir, applicationName, uuidBuffer, applicationName) < 0)
+	format_uuid(&uuid, data->uuidBuffer, sizeof(data->uuidBuffer));
+	if (bb_snprintf(data->path, sizeof(data->path), "%s\\%s\\{%s}%s.bbox", dir, data->applicationFilename, data->uuidBuffer, data->applicationFilename) < 0)
 	{
-		path[sizeof(path) - 1] = '\0';
+		data->path[sizeof(data->path) - 1] = '\0';
 	}
-	path[sizeof(path) - 1] = '\0';
-	BB_LOG("bb::recorder", "recorder con %p using path %s", con, path);
-	fp = fopen(path, "wb");
-	if (fp)
+	data->path[sizeof(data->path) - 1] = '\0';
+	BB_LOG("bb::recorder", "recorder con %p using path %s", con, data->path);
+	if (!recorder_writer_open(&data->file, data->path))
+	{
+		return false;
+	}
+
+	// compressed batches are either written as they arrive, or expanded back into individual packets
+	data->storeBatches = g_config.recordCompressedBatches;
+	if (data->storeBatches)
+	{
+		con->batchFrameFunc = &recorder_write_batch_frame;
+		con->batchFrameContext = &data->file;
+	}
+
+	data->sentRecordingStart = false;
+	data->lastKeepalive = bb_current_time_ms();
+	data->recording.applicationName = sb_from_c_string(data->applicationName);
+	data->recording.applicationFilename = sb_from_c_string(data->applicationFilename);
+	data->recording.path = sb_from_c_string(data->path);
+	data->recording.openView = false;
+	data->recording.recordingType = kRecordingType_Normal;
+	data->recording.mqId = mq_acquire();
+	data->recording.platform = kBBPlatform_Unknown;
+	GetSystemTimeAsFileTime(&data->recording.filetime);
+	return true;
+}
+
+b32 recorder_tick(bb_server_connection_data_t* data, b32 readable)
+{
+	bb_connection_t* con = &data->con;
+	u64 now = bb_current_time_ms();
+	if (bbcon_is_connected(con))
 	{
-		b32 sentRecordingStart = false;
-		b32 dirty = false;
-		u64 lastFlush = bb_current_time_ms();
-		u64 lastKeepalive = bb_current_time_ms();
-		new_recording_t recording;
-		recording.applicationName = sb_from_c_string(data->applicationName);
-		recording.applicationFilename = sb_from_c_string(applicationName);
-		recording.path = sb_from_c_string(path);
-		recording.openView = false;
-		recording.recordingType = kRecordingType_Normal;
-		recording.mqId = mq_acquire();
-		recording.platform = kBBPlatform_Unknown;
-		GetSystemTimeAsFileTime(&recording.filetime);
-		while (!*data->shutdownRequest)
+		bb_decoded_packet_t decoded;
+
+		if (data->recording.mqId != mq_invalid_id())
 		{
-			if (bbcon_is_connected(con))
+			const message_queue_message_t* outgoingMessage = mq_peek(data->recording.mqId);
+			if (outgoingMessage)
 			{
-				bb_decoded_packet_t decoded;
-
-				if (recording.mqId != mq_invalid_id())
+				b32 valid = false;
+				bb_decoded_packet_t outgoing;
+				memset(&outgoing, 0, sizeof(outgoing));
+				if (outgoingMessage->command == kBBPacketType_ConsoleCommand)
+				{
+					valid = true;
+					bb_strncpy(outgoing.packet.consoleCommand.text, outgoingMessage->text, sizeof(outgoing.packet.consoleCommand.text));
+				}
+				else if (outgoingMessage->command == kBBPacketType_ConsoleAutocompleteRequest)
+				{
+					valid = true;
+					outgoing.packet.consoleAutocompleteRequest.id = outgoingMessage->userData;
+					bb_strncpy(outgoing.packet.consoleAutocompleteRequest.text, outgoingMessage->text, sizeof(outgoing.packet.consoleAutocompleteRequest.text));
+				}
+				else if (outgoingMessage->command == kBBPacketType_UserToClient)
+				{
+					valid = true;
+					memcpy(outgoing.packet.userToClient.data, outgoingMessage->text, outgoingMessage->userData);
+					outgoing.packet.userToClient.len = (u16)outgoingMessage->userData;
+				}
+				else if (outgoingMessage->command == kBBPacketType_CategoryLevels)
 				{
-					const message_queue_message_t* outgoingMessage = mq_peek(recording.mqId);
-					if (outgoingMessage)
+					// levels are queued as [u16 count][levels], starting at the category id in userData
+					valid = true;
+					bb_packet_category_levels_t* categoryLevels = &outgoing.packet.categoryLevels;
+					categoryLevels->firstCategoryId = outgoingMessage->userData;
+					memcpy(&categoryLevels->count, outgoingMessage->text, sizeof(categoryLevels->count));
+					categoryLevels->count = (u16)BB_MIN(categoryLevels->count, (u16)BB_ARRAYSIZE(categoryLevels->minLevels));
+					memcpy(categoryLevels->minLevels, outgoingMessage->text + sizeof(categoryLevels->count), categoryLevels->count);
+				}
+				else if (outgoingMessage->command == kBBPacketType_StopRecording)
+				{
+					bbcon_disconnect(con);
+				}
+				if (valid)
+				{
+					outgoing.type = outgoingMessage->command;
+					if (bbcon_try_send(con, &outgoing))
 					{
-						b32 valid = false;
-						bb_decoded_packet_t outgoing;
-						memset(&outgoing, 0, sizeof(outgoing));
-						if (outgoingMessage->command == kBBPacketType_ConsoleCommand)
-						{
-							valid = true;
-							bb_strncpy(outgoing.packet.consoleCommand.text, outgoingMessage->text, sizeof(outgoing.packet.consoleCommand.text));
-						}
-						else if (outgoingMessage->command == kBBPacketType_ConsoleAutocompleteRequest)
-						{
-							valid = true;
-							outgoing.packet.consoleAutocompleteRequest.id = outgoingMessage->userData;
-							bb_strncpy(outgoing.packet.consoleAutocompleteRequest.text, outgoingMessage->text, sizeof(outgoing.packet.consoleAutocompleteRequest.text));
-						}
-						else if (outgoingMessage->command == kBBPacketType_UserToClient)
-						{
-							valid = true;
-							memcpy(outgoing.packet.userToClient.data, outgoingMessage->text, outgoingMessage->userData);
-							outgoing.packet.userToClient.len = (u16)outgoingMessage->userData;
-						}
-						else if (outgoingMessage->command == kBBPacketType_StopRecording)
-						{
-							bbcon_disconnect(con);
-						}
-						if (valid)
-						{
-							outgoing.type = outgoingMessage->command;
-							if (bbcon_try_send(con, &outgoing))
-							{
-								mq_consume_peek_result(recording.mqId);
-							}
-						}
-						else
-						{
-							mq_consume_peek_result(recording.mqId);
-						}
+						mq_consume_peek_result(data->recording.mqId);
 					}
 				}
+				else
+				{
+					mq_consume_peek_result(data->recording.mqId);
+				}
+			}
+		}
 
 #define KEEPALIVE_INTERVAL_MS 3 * 24 * 60 * 60 * 1000
-				u64 now = bb_current_time_ms();
-				if (now > lastKeepalive + KEEPALIVE_INTERVAL_MS)
+		if (now > data->lastKeepalive + KEEPALIVE_INTERVAL_MS)
+		{
+			data->lastKeepalive = now;
+			if (data->recording.platform == kBBPlatform_Durango)
+			{
+				bb_decoded_packet_t outgoing;
+				memset(&outgoing, 0, sizeof(outgoing));
+				outgoing.type = kBBPacketType_UserToClient;
+				bbcon_try_send(con, &outgoing);
+			}
+		}
+
+		// bbcon_tick is skipped while the socket is idle and nothing is waiting to be sent
+		if (readable || con->sendCursor || con->sendBatchCursor)
+		{
+			bbcon_tick(con);
+			// Frames are recorded as they arrived, compact logs and all, and are only decoded by whatever reads the
+			// recording.  Stored batches have already been appended whole by recorder_write_batch_frame.
+			u32 frameLen = 0;
+			u8* frame;
+			while ((frame = bbcon_next_frame(con, &frameLen)) != NULL)
+			{
+				if (!data->storeBatches || !con->decodedFromBatch)
 				{
-					lastKeepalive = now;
-					if (recording.platform == kBBPlatform_Durango)
-					{
-						bb_decoded_packet_t outgoing;
-						memset(&outgoing, 0, sizeof(outgoing));
-						outgoing.type = kBBPacketType_UserToClient;
-						bbcon_try_send(con, &outgoing);
-					}
+					recorder_writer_append(&data->file, frame, frameLen);
 				}
-
-				bbcon_tick(con);
-				while (bbcon_decodePacket(con, &decoded))
+				data->lastKeepalive = now;
+				const u32 nHeaderBytes = bbpacket_frame_header_size(frame);
+				if (bbpacket_is_app_info_type((bb_packet_type_e)frame[nHeaderBytes]))
 				{
-					// #TODO: return buffer, not decoded packets...
-					u8 buf[BB_MAX_PACKET_BUFFER_SIZE];
-					u16 serializedLen = bbpacket_serialize(&decoded, buf + 2, sizeof(buf) - 2);
-					if (serializedLen)
-					{
-						serializedLen += 2;
-						buf[0] = (u8)(serializedLen >> 8);
-						buf[1] = (u8)(serializedLen & 0xFF);
-						fwrite(buf, serializedLen, 1, fp);
-					}
-					lastKeepalive = now;
-					if (bbpacket_is_app_info_type(decoded.type))
+					// the UI opens the recording as soon as it hears about it, so it has to be on disk first
+					recorder_writer_commit(&data->file);
+					if (!data->sentRecordingStart && bbpacket_deserialize(frame + nHeaderBytes, (u16)(frameLen - nHeaderBytes), &decoded))
 					{
-						fflush(fp);
-						lastFlush = bb_current_time_ms();
-						if (!sentRecordingStart)
+						data->sentRecordingStart = true;
+						if (decoded.type == kBBPacketType_AppInfo_v1 ||
+						    ((decoded.packet.appInfo.initFlags & kBBInitFlag_NoOpenView) == 0))
 						{
-							sentRecordingStart = true;
-							if (decoded.type == kBBPacketType_AppInfo_v1 ||
-							    ((decoded.packet.appInfo.initFlags & kBBInitFlag_NoOpenView) == 0))
-							{
-								recording.openView = true;
-							}
-							recording.platform = decoded.packet.appInfo.platform;
-							to_ui(kToUI_RecordingStart, "%s", recording_build_start_identifier(recording));
+							data->recording.openView = true;
+						}
+						data->recording.platform = decoded.packet.appInfo.platform;
+						to_ui(kToUI_RecordingStart, "%s", recording_build_start_identifier(data->recording));
 
-							if ((decoded.packet.appInfo.initFlags & kBBInitFlag_RecordingInfo) != 0)
-							{
-								bb_decoded_packet_t outgoing;
-								memset(&outgoing, 0, sizeof(outgoing));
-								outgoing.type = kBBPacketType_RecordingInfo;
+						if ((decoded.packet.appInfo.initFlags & kBBInitFlag_RecordingInfo) != 0)
+						{
+							bb_decoded_packet_t outgoing;
+							memset(&outgoing, 0, sizeof(outgoing));
+							outgoing.type = kBBPacketType_RecordingInfo;
 #if BB_USING(BB_PLATFORM_WINDOWS)
-								DWORD machineNameSize = sizeof(outgoing.packet.recordingInfo.machineName);
-								if (!GetComputerNameA(outgoing.packet.recordingInfo.machineName, &machineNameSize))
-								{
-									bb_strncpy(outgoing.packet.recordingInfo.machineName, "Unknown", sizeof(outgoing.packet.recordingInfo.machineName));
-								}
-#else
+							DWORD machineNameSize = sizeof(outgoing.packet.recordingInfo.machineName);
+							if (!GetComputerNameA(outgoing.packet.recordingInfo.machineName, &machineNameSize))
+							{
 								bb_strncpy(outgoing.packet.recordingInfo.machineName, "Unknown", sizeof(outgoing.packet.recordingInfo.machineName));
+							}
+#else
+							bb_strncpy(outgoing.packet.recordingInfo.machineName, "Unknown", sizeof(outgoing.packet.recordingInfo.machineName));
 #endif
-								if (bb_snprintf(outgoing.packet.recordingInfo.recordingName, sizeof(outgoing.packet.recordingInfo.recordingName), "{%s}%s.bbox", uuidBuffer, applicationName) < 0)
-								{
-									outgoing.packet.recordingInfo.recordingName[sizeof(outgoing.packet.recordingInfo.recordingName) - 1] = '\0';
-								}
+							if (bb_snprintf(outgoing.packet.recordingInfo.recordingName, sizeof(outgoing.packet.recordingInfo.recordingName), "{%s}%s.bbox", data->uuidBuffer, data->applicationFilename) < 0)
+							{
 								outgoing.packet.recordingInfo.recordingName[sizeof(outgoing.packet.recordingInfo.recordingName) - 1] = '\0';
-								bbcon_try_send(con, &outgoing);
 							}
+							outgoing.packet.recordingInfo.recordingName[sizeof(outgoing.packet.recordingInfo.recordingName) - 1] = '\0';
+							bbcon_try_send(con, &outgoing);
+						}
+
+						u32 features = 0;
+						if ((decoded.packet.appInfo.initFlags & kBBInitFlag_CompressedBatches) != 0)
+						{
+							features |= kBBServerFeature_CompressedBatches;
+						}
+						if ((decoded.packet.appInfo.initFlags & kBBInitFlag_CompactLogs) != 0)
+						{
+							features |= kBBServerFeature_CompactLogs;
+						}
+						if ((decoded.packet.appInfo.initFlags & kBBInitFlag_LargeLogs) != 0)
+						{
+							features |= kBBServerFeature_LargeLogs;
+						}
+						if (features)
+						{
+							bb_decoded_packet_t outgoing;
+							memset(&outgoing, 0, sizeof(outgoing));
+							outgoing.type = kBBPacketType_ServerFeatures;
+							outgoing.packet.serverFeatures.features = features;
+							bbcon_try_send(con, &outgoing);
 						}
-					}
-					else
-					{
-						dirty = true;
-					}
-				}
-				if (dirty)
-				{
-					if (now - lastFlush > 100)
-					{
-						fflush(fp);
-						lastFlush = now;
 					}
 				}
 			}
-			else if (bbcon_is_listening(con))
-			{
-				bbcon_tick_listening(con);
-			}
-			else
-			{
-				break;
-			}
 		}
+		return true;
+	}
+	else if (bbcon_is_listening(con))
+	{
+		if (readable || now >= con->connectTimeoutTime)
+		{
+			bbcon_tick_listening(con);
+		}
+		return true;
+	}
+	return false;
+}
 
-		fclose(fp);
-		if (!sentRecordingStart)
+void recorder_stop(bb_server_connection_data_t* data)
+{
+	bb_connection_t* con = &data->con;
+	if (data->file.fp)
+	{
+		con->batchFrameFunc = NULL;
+		con->batchFrameContext = NULL;
+		recorder_writer_close(&data->file);
+		if (!data->sentRecordingStart)
 		{
-			sentRecordingStart = true;
-			to_ui(kToUI_RecordingStart, "%s", recording_build_start_identifier(recording));
+			data->sentRecordingStart = true;
+			to_ui(kToUI_RecordingStart, "%s", recording_build_start_identifier(data->recording));
 		}
-		to_ui(kToUI_RecordingStop, "%s\n%s", data->applicationName, path);
-		mq_releaseref(recording.mqId);
-		new_recording_reset(&recording);
+		to_ui(kToUI_RecordingStop, "%s\n%s", data->applicationName, data->path);
+		mq_releaseref(data->recording.mqId);
+		new_recording_reset(&data->recording);
 	}
 
-	BB_LOG("bb::recorder", "recorder con %p finished using path %s", con, path);
+	BB_LOG("bb::recorder", "recorder con %p finished using path %s", con, data->path);
 	bbcon_reset(con);
-	data->bInUse = false;
-	BB_THREAD_END();
-	bb_thread_exit(0);
+	bb_atomic_store_u32((volatile u32*)&data->bInUse, false); // discovery frees the connection once it sees this
 }
@@ -10,18 +10,36 @@ extern "C" {
 #include "bb.h"
 #include "bb_common.h"
 #include "bb_connection.h"
-#include "bb_thread.h"
+#include "recorder_writer.h"
+#include "recordings.h"
 
 typedef struct bb_server_connection_data_s
 {
 	bb_connection_t con;
-	b32* shutdownRequest;
+	recorder_file_t file;
+	new_recording_t recording;
+	u64 lastKeepalive;
+	b32 storeBatches;
+	b32 sentRecordingStart;
+	char path[1024];
+	char uuidBuffer[64];
 	char applicationName[kBBSize_ApplicationName];
+	char applicationFilename[kBBSize_ApplicationName];
 	b32 bInUse;
 	u8 pad[4];
 } bb_server_connection_data_t;
 
-bb_thread_return_t recorder_thread(void* args);
+// Opens the recording for a connection that bbcon_connect_server has started listening on.  Returns false if the
+// file can't be created, and the connection should be passed to recorder_stop.
+b32 recorder_start(bb_server_connection_data_t* data);
+
+// Services the connection - outgoing messages, then anything received if the socket is readable.  Frames are
+// appended to the recording as they arrived, and only AppInfo is decoded.
+// Returns false once the connection has closed or timed out waiting for the client, and should be stopped.
+b32 recorder_tick(bb_server_connection_data_t* data, b32 readable);
+
+// Finishes the recording, and releases the connection back to discovery
+void recorder_stop(bb_server_connection_data_t* data);
 
 #if defined(__cplusplus)
 }
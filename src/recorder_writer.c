@@ -0,0 +1,422 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#include "recorder_writer.h"
+#include "bb_structs_generated.h"
+#include "config.h"
+
+#include "bb_array.h"
+#include "bb_log.h"
+#include "bb_malloc.h"
+#include "bb_packet.h"
+#include "bb_string.h"
+#include "bb_thread.h"
+#include "bb_time.h"
+
+#include <errno.h>
+#include <string.h>
+
+enum
+{
+	kRecorderWriter_DefaultCommitMillis = 100,
+	kRecorderWriter_SleepMillis = 10, // how often the thread checks for files due to be committed, or shutdown
+};
+
+typedef struct recorder_files_s
+{
+	u32 count;
+	u32 allocated;
+	recorder_file_t** data;
+} recorder_files_t;
+
+typedef struct recorder_writer_s
+{
+	bb_critical_section cs; // guards files, and each file's writerRefs - never held for file I/O
+	recorder_files_t files;
+	recorder_files_t due; // the writer thread's copy of files, each with a writerRef, committed outside cs
+	bb_thread_handle_t thread;
+	volatile b32 shutdownRequest;
+	u8 pad[4];
+} recorder_writer_t;
+
+static recorder_writer_t s_writer;
+
+// Bytes are pushed under the file's cs, so a feed's end always matches the file's appended count
+struct recorder_feed_s
+{
+	bb_critical_section cs; // guards everything but refcount
+	u8* ring;
+	u64 begin; // offsets in the recording of the oldest byte in the ring, and of the next one to be pushed
+	u64 end;
+	recorder_file_t* file; // guarded by s_writer.cs - the file pushing to the feed, until it closes
+	u32 refcount;          // guarded by s_writer.cs - one per attached session
+	b32 finished;
+};
+
+// Expects s_writer.cs to be held.  The last session to detach frees the feed, and the file stops pushing to it.
+static void recorder_feed_release_no_lock(recorder_feed_t* feed)
+{
+	if (--feed->refcount == 0)
+	{
+		if (feed->file)
+		{
+			bb_critical_section_lock(&feed->file->cs);
+			feed->file->feed = NULL;
+			bb_critical_section_unlock(&feed->file->cs);
+		}
+		bb_critical_section_shutdown(&feed->cs);
+		bb_free(feed->ring);
+		bb_free(feed);
+	}
+}
+
+static void recorder_feed_push(recorder_feed_t* feed, const u8* bytes, u32 len)
+{
+	bb_critical_section_lock(&feed->cs);
+	if (len > kRecorderFeed_Size)
+	{
+		feed->end += len - kRecorderFeed_Size;
+		bytes += len - kRecorderFeed_Size;
+		len = kRecorderFeed_Size;
+	}
+	const u32 ringOffset = (u32)(feed->end % kRecorderFeed_Size);
+	const u32 firstLen = (len < kRecorderFeed_Size - ringOffset) ? len : kRecorderFeed_Size - ringOffset;
+	memcpy(feed->ring + ringOffset, bytes, firstLen);
+	memcpy(feed->ring, bytes + firstLen, len - firstLen);
+	feed->end += len;
+	if (feed->end - feed->begin > kRecorderFeed_Size)
+	{
+		feed->begin = feed->end - kRecorderFeed_Size;
+	}
+	bb_critical_section_unlock(&feed->cs);
+}
+
+// Expects file->writeCs to be held
+static void recorder_writer_commit_no_lock(recorder_file_t* file, u64 now)
+{
+	bb_critical_section_lock(&file->cs);
+	recorder_bytes_t writing = file->writing;
+	file->writing = file->pending;
+	file->pending = writing;
+	const u64 droppedBytes = file->droppedBytes;
+	const u32 droppedAppends = file->droppedAppends;
+	file->droppedBytes = 0;
+	file->droppedAppends = 0;
+	bb_critical_section_unlock(&file->cs);
+
+	if (droppedAppends)
+	{
+		BB_WARNING("bb::recorder", "recorder dropped %u logs (%" PRIu64 " bytes) to %s while more than %u bytes were waiting to be written",
+		           droppedAppends, droppedBytes, file->path, kRecorderWriter_MaxPendingBytes);
+	}
+
+	if (file->writing.count)
+	{
+		fwrite(file->writing.data, file->writing.count, 1, file->fp);
+		fflush(file->fp);
+		file->writing.count = 0;
+	}
+	file->lastCommit = now;
+}
+
+static void recorder_writer_release_refs(recorder_files_t* files)
+{
+	bb_critical_section_lock(&s_writer.cs);
+	for (u32 i = 0; i < files->count; ++i)
+	{
+		--files->data[i]->writerRefs;
+	}
+	bb_critical_section_unlock(&s_writer.cs);
+	files->count = 0;
+}
+
+static bb_thread_return_t recorder_writer_thread(void* args)
+{
+	BB_UNUSED(args);
+	BB_THREAD_START("recorder writer");
+	bbthread_set_name("recorder_writer_thread");
+
+	while (!s_writer.shutdownRequest)
+	{
+		bb_sleep_ms(kRecorderWriter_SleepMillis);
+
+		const u64 commitMillis = (g_config.recordingCommitMillis) ? g_config.recordingCommitMillis : kRecorderWriter_DefaultCommitMillis;
+		const u64 now = bb_current_time_ms();
+		bb_critical_section_lock(&s_writer.cs);
+		for (u32 i = 0; i < s_writer.files.count; ++i)
+		{
+			recorder_file_t* file = s_writer.files.data[i];
+			if (bba_add_noclear(s_writer.due, 1))
+			{
+				bba_last(s_writer.due) = file;
+				++file->writerRefs;
+			}
+		}
+		bb_critical_section_unlock(&s_writer.cs);
+
+		for (u32 i = 0; i < s_writer.due.count; ++i)
+		{
+			recorder_file_t* file = s_writer.due.data[i];
+			bb_critical_section_lock(&file->writeCs);
+			if (now >= file->lastCommit + commitMillis)
+			{
+				recorder_writer_commit_no_lock(file, now);
+			}
+			bb_critical_section_unlock(&file->writeCs);
+		}
+		recorder_writer_release_refs(&s_writer.due);
+	}
+
+	BB_THREAD_END();
+	bb_thread_exit(0);
+}
+
+void recorder_writer_init(void)
+{
+	memset(&s_writer, 0, sizeof(s_writer));
+	bb_critical_section_init(&s_writer.cs);
+	s_writer.thread = bbthread_create(recorder_writer_thread, NULL);
+}
+
+void recorder_writer_shutdown(void)
+{
+	s_writer.shutdownRequest = true;
+	if (s_writer.thread)
+	{
+		bbthread_join(s_writer.thread);
+		s_writer.thread = 0;
+	}
+	if (s_writer.files.count)
+	{
+		BB_WARNING("bb::recorder", "recorder writer shut down with %u files still open", s_writer.files.count);
+	}
+	bba_free(s_writer.files);
+	bba_free(s_writer.due);
+	bb_critical_section_shutdown(&s_writer.cs);
+}
+
+b32 recorder_writer_open(recorder_file_t* file, const char* path)
+{
+	memset(file, 0, sizeof(*file));
+	file->fp = fopen(path, "wb");
+	if (!file->fp)
+	{
+		const int err = errno;
+		if (err == EMFILE)
+		{
+			BB_ERROR("bb::recorder", "refusing recording to %s - out of file descriptors", path);
+		}
+		else
+		{
+			BB_ERROR("bb::recorder", "refusing recording to %s - could not open it with errno %d", path, err);
+		}
+		return false;
+	}
+
+	file->path = path;
+	bb_critical_section_init(&file->cs);
+	bb_critical_section_init(&file->writeCs);
+	file->lastCommit = bb_current_time_ms();
+	bb_critical_section_lock(&s_writer.cs);
+	bba_push(s_writer.files, file);
+	bb_critical_section_unlock(&s_writer.cs);
+	return true;
+}
+
+// Logs nothing else refers to can be dropped without making the rest of the recording unreadable.  Compact logs
+// can't, since each one's timestamp is a delta from the last one on its thread.
+static b32 recorder_writer_is_droppable(const u8* frame, u32 len)
+{
+	const u32 nHeaderBytes = bbpacket_frame_header_size(frame);
+	if (len <= nHeaderBytes)
+		return false;
+
+	const bb_packet_type_e type = (bb_packet_type_e)frame[nHeaderBytes];
+	return bbpacket_is_log_text_type(type) || type == kBBPacketType_LogTextDeferred || type == kBBPacketType_LogSuppressed ||
+	       type == kBBPacketType_LogTextLarge || type == kBBPacketType_LogTextKV;
+}
+
+void recorder_writer_append(recorder_file_t* file, const void* bytes, u32 len)
+{
+	// appends are whole frames
+	b32 stopped = false;
+	u32 pendingBytes = 0;
+	bb_critical_section_lock(&file->cs);
+	if (file->stopped)
+	{
+		// the recording ends at the last frame kept
+	}
+	else if (file->pending.count + (u64)len > kRecorderWriter_MaxPendingBytes && recorder_writer_is_droppable((const u8*)bytes, len))
+	{
+		file->droppedBytes += len;
+		++file->droppedAppends;
+	}
+	else if (file->pending.count + (u64)len <= kRecorderWriter_StopPendingBytes && bba_add_noclear(file->pending, len))
+	{
+		memcpy(file->pending.data + file->pending.count - len, bytes, len);
+		file->appended += len;
+		if (file->feed)
+		{
+			recorder_feed_push(file->feed, (const u8*)bytes, len);
+		}
+	}
+	else
+	{
+		file->stopped = true;
+		stopped = true;
+		pendingBytes = file->pending.count;
+	}
+	bb_critical_section_unlock(&file->cs);
+
+	if (stopped)
+	{
+		BB_ERROR("bb::recorder", "recording to %s stopped - %u bytes were waiting to be written", file->path, pendingBytes);
+	}
+}
+
+void recorder_writer_commit(recorder_file_t* file)
+{
+	bb_critical_section_lock(&file->writeCs);
+	recorder_writer_commit_no_lock(file, bb_current_time_ms());
+	bb_critical_section_unlock(&file->writeCs);
+}
+
+void recorder_writer_close(recorder_file_t* file)
+{
+	if (!file->fp)
+		return;
+
+	// once the file is out of the list, only commits already holding a writerRef can still reach it
+	bb_critical_section_lock(&s_writer.cs);
+	for (u32 i = 0; i < s_writer.files.count; ++i)
+	{
+		if (s_writer.files.data[i] == file)
+		{
+			bba_erase(s_writer.files, i);
+			break;
+		}
+	}
+	while (file->writerRefs)
+	{
+		bb_critical_section_unlock(&s_writer.cs);
+		bb_sleep_ms(1);
+		bb_critical_section_lock(&s_writer.cs);
+	}
+	bb_critical_section_unlock(&s_writer.cs);
+
+	recorder_writer_commit(file);
+
+	bb_critical_section_lock(&s_writer.cs);
+	if (file->feed)
+	{
+		bb_critical_section_lock(&file->feed->cs);
+		file->feed->finished = true;
+		bb_critical_section_unlock(&file->feed->cs);
+		file->feed->file = NULL;
+		file->feed = NULL;
+	}
+	bb_critical_section_unlock(&s_writer.cs);
+
+	fclose(file->fp);
+	file->fp = NULL;
+	bba_free(file->pending);
+	bba_free(file->writing);
+	bb_critical_section_shutdown(&file->writeCs);
+	bb_critical_section_shutdown(&file->cs);
+}
+
+recorder_feed_t* recorder_feed_attach(const char* path, u64* feedOffset)
+{
+	recorder_feed_t* feed = NULL;
+	recorder_file_t* committing = NULL;
+	bb_critical_section_lock(&s_writer.cs);
+	for (u32 i = 0; i < s_writer.files.count; ++i)
+	{
+		recorder_file_t* file = s_writer.files.data[i];
+		if (bb_stricmp(file->path, path))
+			continue;
+
+		bb_critical_section_lock(&file->cs);
+		if (!file->feed)
+		{
+			recorder_feed_t* newFeed = (recorder_feed_t*)bb_malloc(sizeof(recorder_feed_t));
+			u8* ring = (u8*)bb_malloc(kRecorderFeed_Size);
+			if (newFeed && ring)
+			{
+				memset(newFeed, 0, sizeof(*newFeed));
+				bb_critical_section_init(&newFeed->cs);
+				newFeed->ring = ring;
+				newFeed->begin = newFeed->end = file->appended;
+				newFeed->file = file;
+				file->feed = newFeed;
+			}
+			else
+			{
+				if (newFeed)
+				{
+					bb_free(newFeed);
+				}
+				if (ring)
+				{
+					bb_free(ring);
+				}
+			}
+		}
+		feed = file->feed;
+		if (feed)
+		{
+			++feed->refcount;
+			*feedOffset = file->appended;
+		}
+		bb_critical_section_unlock(&file->cs);
+
+		++file->writerRefs;
+		committing = file;
+		break;
+	}
+	bb_critical_section_unlock(&s_writer.cs);
+
+	if (committing)
+	{
+		// everything before feedOffset has been appended, so this puts it in the file
+		recorder_writer_commit(committing);
+		bb_critical_section_lock(&s_writer.cs);
+		--committing->writerRefs;
+		bb_critical_section_unlock(&s_writer.cs);
+	}
+	return feed;
+}
+
+void recorder_feed_detach(recorder_feed_t* feed)
+{
+	bb_critical_section_lock(&s_writer.cs);
+	recorder_feed_release_no_lock(feed);
+	bb_critical_section_unlock(&s_writer.cs);
+}
+
+u32 recorder_feed_read(recorder_feed_t* feed, u64 offset, void* dest, u32 destSize, b32* overrun, b32* finished)
+{
+	u32 len = 0;
+	*overrun = false;
+	*finished = false;
+	bb_critical_section_lock(&feed->cs);
+	if (offset < feed->begin)
+	{
+		*overrun = true;
+	}
+	else if (offset < feed->end)
+	{
+		const u64 available = feed->end - offset;
+		len = (available < destSize) ? (u32)available : destSize;
+		const u32 ringOffset = (u32)(offset % kRecorderFeed_Size);
+		const u32 firstLen = (len < kRecorderFeed_Size - ringOffset) ? len : kRecorderFeed_Size - ringOffset;
+		memcpy(dest, feed->ring + ringOffset, firstLen);
+		memcpy((u8*)dest + firstLen, feed->ring, len - firstLen);
+	}
+	else
+	{
+		*finished = feed->finished;
+	}
+	bb_critical_section_unlock(&feed->cs);
+	return len;
+}
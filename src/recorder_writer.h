@@ -0,0 +1,75 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#pragma once
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "bb.h"
+#include "bb_common.h"
+#include "bb_criticalsection.h"
+
+#include "bb_wrap_stdio.h"
+
+typedef struct recorder_bytes_s
+{
+	u32 count;
+	u32 allocated;
+	u8* data;
+} recorder_bytes_t;
+
+enum
+{
+	kRecorderFeed_Size = 4 * 1024 * 1024,
+	kRecorderWriter_MaxPendingBytes = 64 * 1024 * 1024,
+	kRecorderWriter_StopPendingBytes = 2 * kRecorderWriter_MaxPendingBytes,
+};
+
+typedef struct recorder_feed_s recorder_feed_t;
+
+// Recordings are appended to in memory, and a writer thread commits what has been appended to each file with one
+// write and flush every g_config.recordingCommitMillis, instead of the recorder writing every packet.  Once
+// kRecorderWriter_MaxPendingBytes are waiting to be written, further logs are dropped and counted, and the next
+// commit logs them.  Everything else (ids, app info, compact logs, stored batches) is still kept, since what comes
+// after depends on it, until kRecorderWriter_StopPendingBytes, when the recording stops where it is.
+typedef struct recorder_file_s
+{
+	FILE* fp;
+	const char* path;            // owned by the caller, and must outlive the file
+	bb_critical_section cs;      // guards pending, appended, dropped and feed
+	bb_critical_section writeCs; // held by whoever commits, for the write and flush - guards writing and lastCommit
+	recorder_bytes_t pending;    // appended by the recorder
+	recorder_bytes_t writing;    // swapped with pending, and written, by whoever commits
+	recorder_feed_t* feed;       // set while any session is reading the recording live
+	u64 appended;                // total bytes appended - the offset in the file the next append will land at
+	u64 lastCommit;
+	u64 droppedBytes; // logs dropped since the last commit
+	u32 droppedAppends;
+	b32 stopped; // nothing more is appended - see kRecorderWriter_StopPendingBytes
+	u32 writerRefs; // guarded by the writer's list lock - taken to commit the file without it, and waited out by close
+} recorder_file_t;
+
+void recorder_writer_init(void);
+void recorder_writer_shutdown(void);
+
+b32 recorder_writer_open(recorder_file_t* file, const char* path);
+void recorder_writer_append(recorder_file_t* file, const void* bytes, u32 len);
+void recorder_writer_commit(recorder_file_t* file); // writes and flushes now - for anything readers need immediately
+void recorder_writer_close(recorder_file_t* file);  // commits whatever is left
+
+// Sessions viewing a recording as it is made read the appended bytes straight from the recorder through a feed,
+// instead of reading them back from the file once they are committed.  Attaching commits the file, and returns
+// NULL if path isn't being recorded.  Everything before *feedOffset is in the file, and the feed has the rest.
+recorder_feed_t* recorder_feed_attach(const char* path, u64* feedOffset);
+void recorder_feed_detach(recorder_feed_t* feed); // the last session to detach frees the feed, even mid-recording
+
+// Copies bytes from offset on into dest.  Feeds only keep the most recent kRecorderFeed_Size bytes, so a reader
+// that falls too far behind gets *overrun, and has to carry on from the file.  *finished is set once offset
+// reaches the end of a recording that has been closed.
+u32 recorder_feed_read(recorder_feed_t* feed, u64 offset, void* dest, u32 destSize, b32* overrun, b32* finished);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -742,6 +742,14 @@ void UIConfig_Update(config_t* config)
 			if (s_preferencesAdvanced)
 			{
 				Checkbox("Disable log deletion", &s_preferencesConfig.disableLogDeletion);
+				Checkbox("Record compressed batches as received (older tools can't read them)", &s_preferencesConfig.recordCompressedBatches);
+				u32 commitStep = 10;
+				u32 commitStepFast = 100;
+				InputScalar("Recording commit interval in ms (0 == 100)", ImGuiDataType_U32, &s_preferencesConfig.recordingCommitMillis, &commitStep, &commitStepFast, "%u", ImGuiInputTextFlags_None);
+				u32 connectionsStep = 1;
+				u32 connectionsStepFast = 64;
+				InputScalar("Max concurrent recordings (1 to 1024)", ImGuiDataType_U32, &s_preferencesConfig.maxConnections, &connectionsStep, &connectionsStepFast, "%u", ImGuiInputTextFlags_None);
+				s_preferencesConfig.maxConnections = BB_CLAMP(s_preferencesConfig.maxConnections, 1u, (u32)kConfig_MaxConnections);
 			}
 			Checkbox("Show advanced config", &s_preferencesAdvanced);
 		}
@@ -5,6 +5,7 @@
 #include "bb_array.h"
 #include "bb_assert.h"
 #include "bb_colors.h"
+#include "bb_kv.h"
 #include "bb_string.h"
 #include "bb_structs_generated.h"
 #include "bb_time.h"
@@ -36,6 +37,7 @@
 #include "ui_view_filter.h"
 #include "ui_view_log_table.h"
 #include "ui_view_pie_instances.h"
+#include "ui_view_telemetry.h"
 #include "ui_view_threads.h"
 #include "va.h"
 #include "view.h"
@@ -781,6 +783,27 @@ void UIRecordedView_SetLogTooltip(bb_decoded_packet_t* decoded, recorded_categor
 			TextWrappedMaxLines(sb_get(&s_strippedLine), 40, Imgui_Core_GetTextShadows() != 0, bTrimmed);
 		}
 
+		if (sessionLog->fieldsLen)
+		{
+			Separator();
+			bbkv_field_t field;
+			bbkv_reader_t reader;
+			bbkv_reader_init(&reader, sessionLog->fields, sessionLog->fieldsLen);
+			while (bbkv_read(&reader, &field))
+			{
+				if (field.type == kBBKV_Object)
+				{
+					TextShadowed(va("%*s%.*s:", (int)field.depth * 2, "", (int)field.keyLen, field.key));
+				}
+				else if (field.type != kBBKV_ObjectEnd)
+				{
+					char value[1024];
+					bbkv_format_value(&field, value, sizeof(value));
+					TextShadowed(va("%*s%.*s: %s", (int)field.depth * 2, "", (int)field.keyLen, field.key, value));
+				}
+			}
+		}
+
 		PopTextWrapPos();
 
 		EndTooltip();
@@ -2055,6 +2078,7 @@ static void UIRecordedView_Update(view_t* view, bool autoTileViews)
 			UIViewThreads_Update(view);
 			UIViewFiles_Update(view);
 			UIViewPieInstances_Update(view);
+			UIViewTelemetry_Update(view);
 			ImGui::PopStyleVar();
 
 			ImGui::EndChild();
@@ -2600,6 +2624,7 @@ void UIRecordedView_RemoveClosedViews()
 			{
 				view_reset(view);
 				bba_erase(session->views, viewIndex);
+				session->categoryLevelsDirty = true;
 			}
 			else
 			{
@@ -0,0 +1,92 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#include "ui_view_telemetry.h"
+#include "imgui_tooltips.h"
+#include "recorded_session.h"
+#include "va.h"
+#include "view.h"
+#include "wrap_imgui.h"
+
+using namespace ImGui;
+
+enum
+{
+	kUIViewTelemetry_PlotSamples = 120, // two minutes at the client's one sample per second
+};
+
+typedef enum
+{
+	kTelemetryPlot_CostMillisPerSecond,
+	kTelemetryPlot_KilobytesPerSecond,
+} telemetryPlot_e;
+
+typedef struct telemetryPlotData_s
+{
+	const recorded_telemetry_sample_t* samples;
+	telemetryPlot_e plot;
+	u8 pad[4];
+} telemetryPlotData_t;
+
+static double UIViewTelemetry_PerSecond(const bb_packet_client_telemetry_t* telemetry, double value)
+{
+	return (telemetry->intervalMillis > 0.0) ? value * 1000.0 / telemetry->intervalMillis : 0.0;
+}
+
+static float UIViewTelemetry_PlotValue(void* data, int index)
+{
+	const telemetryPlotData_t* plotData = (const telemetryPlotData_t*)data;
+	const bb_packet_client_telemetry_t* telemetry = &plotData->samples[index].telemetry;
+	switch (plotData->plot)
+	{
+	case kTelemetryPlot_CostMillisPerSecond: return (float)UIViewTelemetry_PerSecond(telemetry, telemetry->flushMillis + telemetry->lockWaitMillis);
+	case kTelemetryPlot_KilobytesPerSecond: return (float)UIViewTelemetry_PerSecond(telemetry, (double)telemetry->bytesSent / 1024.0);
+	}
+	return 0.0f;
+}
+
+void UIViewTelemetry_Update(view_t* view)
+{
+	const recorded_telemetry_t* samples = &view->session->telemetry;
+	if (!samples->count)
+		return;
+
+	if (ImGui::CollapsingHeader("Client Telemetry", ImGuiTreeNodeFlags_None))
+	{
+		ImGui::PushID("ClientTelemetryHeader");
+
+		const bb_packet_client_telemetry_t* latest = &samples->data[samples->count - 1].telemetry;
+		const u32 plotCount = BB_MIN(samples->count, (u32)kUIViewTelemetry_PlotSamples);
+		telemetryPlotData_t plotData = {};
+		plotData.samples = samples->data + samples->count - plotCount;
+
+		// what logging cost the client's sending thread(s) - the cost of formatting logs isn't included
+		const double costMillis = UIViewTelemetry_PerSecond(latest, latest->flushMillis + latest->lockWaitMillis);
+		plotData.plot = kTelemetryPlot_CostMillisPerSecond;
+		ImGui::PlotLines("##Cost", &UIViewTelemetry_PlotValue, &plotData, (int)plotCount, 0, va("%.2f ms/s sending", costMillis), 0.0f, FLT_MAX, ImVec2(0.0f, ImGui::GetTextLineHeight() * 3.0f));
+		if (IsTooltipActive())
+		{
+			BeginTooltip();
+			Text("Flushing: %.2f ms/s over %u flushes", UIViewTelemetry_PerSecond(latest, latest->flushMillis), latest->flushes);
+			Text("Waiting for the connection lock: %.2f ms/s", UIViewTelemetry_PerSecond(latest, latest->lockWaitMillis));
+			EndTooltip();
+		}
+
+		const double kilobytes = UIViewTelemetry_PerSecond(latest, (double)latest->bytesSent / 1024.0);
+		plotData.plot = kTelemetryPlot_KilobytesPerSecond;
+		ImGui::PlotLines("##Throughput", &UIViewTelemetry_PlotValue, &plotData, (int)plotCount, 0, va("%.1f KB/s", kilobytes), 0.0f, FLT_MAX, ImVec2(0.0f, ImGui::GetTextLineHeight() * 3.0f));
+
+		ImGui::Text("%.0f packets/s", UIViewTelemetry_PerSecond(latest, (double)latest->packetsSent));
+		ImGui::Text("Send buffer: %u bytes max", latest->maxSendBytes);
+		if (latest->queuedBytes)
+		{
+			ImGui::Text("Queued: %u bytes", latest->queuedBytes);
+		}
+		if (latest->droppedLogs || latest->suppressedLogs)
+		{
+			ImGui::Text("Dropped: %u, suppressed: %u", latest->droppedLogs, latest->suppressedLogs);
+		}
+
+		ImGui::PopID();
+	}
+}
@@ -0,0 +1,8 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#pragma once
+
+typedef struct view_s view_t;
+
+void UIViewTelemetry_Update(view_t* view);
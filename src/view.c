@@ -1013,6 +1013,7 @@ void view_update_visible_logs(view_t* view)
 	view_logs_t oldLogs = view->visibleLogs;
 	u32 lastClickIndex = view->visibleLogs.lastClickIndex;
 	memset(&view->visibleLogs, 0, sizeof(view->visibleLogs));
+	session->categoryLevelsDirty = true; // what the client can skip changes with what the view shows
 	view->visibleLogs.lastClickIndex = lastClickIndex;
 	view->lastSessionLogIndex = ~0U;
 	view->lastVisibleSessionLogIndex = ~0U;
@@ -1245,6 +1246,57 @@ void view_add_log(view_t* view, recorded_log_t* log)
 	}
 }
 
+// Called when recorded_session has merged flight recorder logs into the session from sessionLogIndex on, before it
+// renumbers them.  Logs that were already there still have their old sessionLogIndex (so their bookmarks carry
+// over), and the merged ones have ~0U.
+void view_splice_logs(view_t* view, u32 sessionLogIndex)
+{
+	u32 i, j;
+	recorded_session_t* session = view->session;
+	u32 first = 0;
+	while (first < view->persistentLogs.count && view->persistentLogs.data[first].sessionLogIndex < sessionLogIndex)
+	{
+		++first;
+	}
+
+	view_persistent_logs_t oldLogs = { BB_EMPTY_INITIALIZER };
+	const u32 oldCount = view->persistentLogs.count - first;
+	if (oldCount)
+	{
+		const view_persistent_log_t* oldData = view->persistentLogs.data + first;
+		bba_add_array(oldLogs, oldData, oldCount);
+	}
+	view->persistentLogs.count = first;
+
+	u32 oldIndex = 0;
+	for (i = sessionLogIndex; i < session->logs.count; ++i)
+	{
+		recorded_log_t* log = session->logs.data[i];
+		for (j = 0; j < log->lines.count; ++j)
+		{
+			view_persistent_log_t* persistent = bba_add(view->persistentLogs, 1);
+			if (!persistent)
+				break;
+			persistent->sessionLogIndex = i;
+			persistent->subLine = j;
+			persistent->bookmarked = false;
+			if (log->sessionLogIndex == ~0U)
+				continue;
+			while (oldIndex < oldLogs.count && (oldLogs.data[oldIndex].sessionLogIndex < log->sessionLogIndex ||
+			                                    (oldLogs.data[oldIndex].sessionLogIndex == log->sessionLogIndex && oldLogs.data[oldIndex].subLine < j)))
+			{
+				++oldIndex;
+			}
+			if (oldIndex < oldLogs.count && oldLogs.data[oldIndex].sessionLogIndex == log->sessionLogIndex && oldLogs.data[oldIndex].subLine == j)
+			{
+				persistent->bookmarked = oldLogs.data[oldIndex].bookmarked;
+			}
+		}
+	}
+	bba_free(oldLogs);
+	view->visibleLogsDirty = true;
+}
+
 static void view_add_log_internal(view_t* view, recorded_log_t* log, u32 persistentLogIndex)
 {
 	view_persistent_log_t* persistent = view->persistentLogs.data + persistentLogIndex;
@@ -420,6 +420,7 @@ void view_add_file(view_t* view, recorded_filename_t* rf);
 void view_add_pieInstance(view_t* view, s32 pieInstance);
 view_pieInstance_t* view_find_pieInstance(view_t* view, s32 pieInstance);
 void view_add_log(view_t* view, recorded_log_t* log);
+void view_splice_logs(view_t* view, u32 sessionLogIndex);
 void view_update_visible_logs(view_t* view);
 void view_update_category_id(view_t* view, recorded_category_t* category);
 void view_set_thread_name(view_t* view, u64 id, const char* name);
@@ -5,6 +5,7 @@
 #include "bb_array.h"
 #include "bb_assert.h"
 #include "bb_json_generated.h"
+#include "bb_kv.h"
 #include "bb_string.h"
 #include "bb_structs_generated.h"
 #include "recorded_session.h"
@@ -13,6 +14,7 @@
 #include "va.h"
 #include "view.h"
 #include "view_filter_legacy.h"
+#include <stdlib.h>
 
 #if defined(BB_STANDALONE)
 #define FILTER_COND false
@@ -263,6 +265,7 @@ u32 view_filter_validate_tokens(vfilter_t* filter, u32 index, int* parenDepth, c
 
 	b32 bLeftTokenIsNumeric = false;
 	b32 bLeftTokenIsVerbosity = false;
+	b32 bLeftTokenIsField = false;
 	b32 bHasNot = false;
 
 	while (index < filter->tokens.count)
@@ -307,9 +310,9 @@ u32 view_filter_validate_tokens(vfilter_t* filter, u32 index, int* parenDepth, c
 		case kVFT_NotEquals:
 		case kVFT_GreaterThan:
 		case kVFT_GreaterThanEquals:
-			if (state == kVFVS_HasLeft && (bLeftTokenIsNumeric || bLeftTokenIsVerbosity))
+			if (state == kVFVS_HasLeft && (bLeftTokenIsNumeric || bLeftTokenIsVerbosity || bLeftTokenIsField))
 			{
-				// can only follow kVFT_DeltaMillisecondsAbsolute, kVFT_DeltaMillisecondsViewRelative, kVFT_PIEInstance, or kVFT_Verbosity
+				// can only follow kVFT_DeltaMillisecondsAbsolute, kVFT_DeltaMillisecondsViewRelative, kVFT_PIEInstance, kVFT_Verbosity, or kVFT_Field
 				state = kVFVS_HasOperator;
 				++index;
 			}
@@ -335,6 +338,7 @@ u32 view_filter_validate_tokens(vfilter_t* filter, u32 index, int* parenDepth, c
 					state = kVFVS_HasLeft;
 					bLeftTokenIsNumeric = false;
 					bLeftTokenIsVerbosity = false;
+					bLeftTokenIsField = false;
 					if (!span_stricmp(token->span, span_from_string("absms")))
 					{
 						token->type = kVFT_DeltaMillisecondsAbsolute;
@@ -370,6 +374,12 @@ u32 view_filter_validate_tokens(vfilter_t* filter, u32 index, int* parenDepth, c
 					{
 						token->type = kVFT_Text;
 					}
+					else if (span_starts_with(token->span, "field.", kSpanCaseInsentitive) && span_length(token->span) > 6)
+					{
+						// field.pos.x - a kBBPacketType_LogTextKV field, compared as a number or as text
+						token->type = kVFT_Field;
+						bLeftTokenIsField = true;
+					}
 					else
 					{
 						return view_filter_validate_error(filter, index, input, "Unknown left hand side");
@@ -529,6 +539,7 @@ static vfilter_token_classification_e view_filter_token_classify(vfilter_token_t
 	case kVFT_Number:
 	case kVFT_String:
 	case kVFT_NamedFilter:
+	case kVFT_Field:
 		return kVFC_Operand;
 	case kVFT_Invalid:
 	case kVFT_Count:
@@ -647,7 +658,8 @@ static vfilter_t view_filter_parse_single(const char* name, const char* input)
 		if (filter.tokens.count >= 3)
 		{
 			if (!span_stricmp(filter.tokens.data[0].span, span_from_string("text")) ||
-			    !span_stricmp(filter.tokens.data[0].span, span_from_string("category")))
+			    !span_stricmp(filter.tokens.data[0].span, span_from_string("category")) ||
+			    span_starts_with(filter.tokens.data[0].span, "field.", kSpanCaseInsentitive))
 			{
 				if (!span_stricmp(filter.tokens.data[1].span, span_from_string("is")) ||
 				    !span_stricmp(filter.tokens.data[1].span, span_from_string("matches")) ||
@@ -858,6 +870,7 @@ static const char* get_vfilter_token_text(vfilter_token_t* token)
 	case kVFT_Text: return "Text"; break;
 	case kVFT_Number: return va("%u", token->number); break;
 	case kVFT_NamedFilter: return va(" \"@%.*s\"", span_length(token->span), token->span.start); break;
+	case kVFT_Field: return va(" \"%.*s\"", span_length(token->span), token->span.start); break;
 	case kVFT_Count: return "Count"; break;
 	}
 	return "";
@@ -970,6 +983,55 @@ static u32 view_filter_get_millis(const view_t* view, const recorded_log_t* log,
 	return (u32)deltaMillis;
 }
 
+// true, false, or the whole text as a number
+static b32 view_filter_parse_field_number(const char* text, u32 len, double* value)
+{
+	char buffer[64];
+	if (!len || len >= sizeof(buffer))
+		return false;
+	memcpy(buffer, text, len);
+	buffer[len] = '\0';
+
+	if (!bb_stricmp(buffer, "true") || !bb_stricmp(buffer, "false"))
+	{
+		*value = (buffer[0] == 't' || buffer[0] == 'T') ? 1.0 : 0.0;
+		return true;
+	}
+	char* end = NULL;
+	*value = strtod(buffer, &end);
+	return end == buffer + len;
+}
+
+// Logs without the field, or where either side isn't a number, fail every comparison
+static b32 view_filter_get_field_numbers(const recorded_log_t* log, const vfilter_token_t* left, const vfilter_token_t* right, double* lhs, double* rhs)
+{
+	// token spans are terminated once parsed, so the path is the rest of the token after "field."
+	bbkv_field_t field;
+	if (!bbkv_find(log->fields, log->fieldsLen, left->span.start + 6, &field))
+		return false;
+
+	switch (field.type)
+	{
+	case kBBKV_Int:
+	case kBBKV_Bool:
+		*lhs = (double)field.i;
+		break;
+	case kBBKV_Float:
+		*lhs = field.f;
+		break;
+	case kBBKV_String:
+		if (!view_filter_parse_field_number(field.string, field.stringLen, lhs))
+			return false;
+		break;
+	case kBBKV_Object:
+	case kBBKV_ObjectEnd:
+	case kBBKV_Count:
+	default:
+		return false;
+	}
+	return view_filter_parse_field_number(right->span.start, (u32)span_length(right->span), rhs);
+}
+
 static void view_filter_evaluate_number(vfilter_t* vfilter, const view_t* view, const recorded_log_t* log, u32 operatorIndex)
 {
 	if (operatorIndex < 2)
@@ -982,7 +1044,9 @@ static void view_filter_evaluate_number(vfilter_t* vfilter, const view_t* view,
 	vfilter_token_t* right = vfilter->rpn_tokens.data + operatorIndex - 1;
 	vfilter_token_t* comparison = vfilter->rpn_tokens.data + operatorIndex;
 
-	u32 lhs = 0;
+	double lhs = 0.0;
+	double rhs = right->number;
+	b32 bComparable = true;
 	BB_WARNING_PUSH(4062);
 	switch (left->type)
 	{
@@ -998,6 +1062,9 @@ static void view_filter_evaluate_number(vfilter_t* vfilter, const view_t* view,
 	case kVFT_Verbosity:
 		lhs = 0; // TODO
 		break;
+	case kVFT_Field:
+		bComparable = view_filter_get_field_numbers(log, left, right, &lhs, &rhs);
+		break;
 	case kVFT_Invalid:
 	case kVFT_OpenParen:
 	case kVFT_CloseParen:
@@ -1026,11 +1093,10 @@ static void view_filter_evaluate_number(vfilter_t* vfilter, const view_t* view,
 		break;
 	}
 	BB_WARNING_POP;
-	u32 rhs = right->number;
 
 	vfilter_result_t result = { false };
 	BB_WARNING_PUSH(4062);
-	switch (comparison->type)
+	switch ((bComparable) ? comparison->type : kVFT_Invalid)
 	{
 	case kVFT_LessThan:
 		result.value = lhs < rhs;
@@ -1071,6 +1137,7 @@ static void view_filter_evaluate_number(vfilter_t* vfilter, const view_t* view,
 	case kVFT_Text:
 	case kVFT_Number:
 	case kVFT_NamedFilter:
+	case kVFT_Field:
 	case kVFT_Count:
 	default:
 		break;
@@ -1088,6 +1155,8 @@ static void view_filter_evaluate_string(vfilter_t* vfilter, const view_t* view,
 	vfilter_result_t result = { false };
 
 	const char* lhs = "";
+	char fieldValue[1024];
+	bbkv_field_t field;
 	BB_WARNING_PUSH(4062);
 	switch (left->type)
 	{
@@ -1103,6 +1172,13 @@ static void view_filter_evaluate_string(vfilter_t* vfilter, const view_t* view,
 	case kVFT_Text:
 		lhs = log->packet.packet.logText.text;
 		break;
+	case kVFT_Field:
+		if (bbkv_find(log->fields, log->fieldsLen, left->span.start + 6, &field))
+		{
+			bbkv_format_value(&field, fieldValue, sizeof(fieldValue));
+			lhs = fieldValue;
+		}
+		break;
 	case kVFT_Invalid:
 	case kVFT_OpenParen:
 	case kVFT_CloseParen:
@@ -1187,6 +1263,7 @@ static void view_filter_evaluate_string(vfilter_t* vfilter, const view_t* view,
 	case kVFT_Text:
 	case kVFT_Number:
 	case kVFT_NamedFilter:
+	case kVFT_Field:
 	case kVFT_Count:
 	default:
 		break;
@@ -1288,6 +1365,7 @@ static b32 view_filter_visible_standard(vfilter_t* vfilter, const view_t* view,
 		case kVFT_Verbosity:
 		case kVFT_Text:
 		case kVFT_Number:
+		case kVFT_Field:
 		case kVFT_Invalid:
 		case kVFT_OpenParen:
 		case kVFT_CloseParen:
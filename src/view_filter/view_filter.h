@@ -49,6 +49,7 @@ AUTOJSON typedef enum vfilter_token_type_e {
 	kVFT_Text,
 	kVFT_Number,
 	kVFT_NamedFilter,
+	kVFT_Field,
 	kVFT_Count
 } vfilter_token_type_e;
 
@@ -0,0 +1,240 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#include "whitelist_matcher.h"
+
+#include "bb_array.h"
+
+#include <string.h>
+
+#define kWhitelistMatcher_None 0xFFFFFFFFu
+
+enum
+{
+	kWhitelistMatcher_IPv4,
+	kWhitelistMatcher_IPv6,
+};
+
+static u32 whitelist_matcher_add_node(whitelist_matcher_t* matcher)
+{
+	whitelist_trie_node_t* node = bba_add(matcher->nodes, 1);
+	if (!node)
+		return kWhitelistMatcher_None;
+
+	node->children[0] = node->children[1] = kWhitelistMatcher_None;
+	node->anyApplication = kWhitelistMatcher_None;
+	node->firstNamedRule = node->lastNamedRule = kWhitelistMatcher_None;
+	return matcher->nodes.count - 1;
+}
+
+static u32 whitelist_matcher_bit(const u8* key, u32 bit)
+{
+	return (key[bit / 8] >> (7 - bit % 8)) & 1u;
+}
+
+// Returns false if the mask isn't a run of leading ones
+static b32 whitelist_mask_prefix_bits(const u8* mask, u32 len, u32* prefixBits)
+{
+	u32 bits = 0;
+	u32 i = 0;
+	for (; i < len && mask[i] == 0xFF; ++i)
+	{
+		bits += 8;
+	}
+	if (i < len)
+	{
+		u8 partial = mask[i];
+		while (partial & 0x80)
+		{
+			++bits;
+			partial = (u8)(partial << 1);
+		}
+		if (partial)
+			return false;
+		++i;
+	}
+	for (; i < len; ++i)
+	{
+		if (mask[i])
+			return false;
+	}
+	*prefixBits = bits;
+	return true;
+}
+
+static b32 whitelist_matcher_insert(whitelist_matcher_t* matcher, u32 family, const u8* addr, u32 prefixBits, u32 entryIndex)
+{
+	u32 nodeIndex = matcher->roots[family];
+	for (u32 bit = 0; bit < prefixBits; ++bit)
+	{
+		const u32 direction = whitelist_matcher_bit(addr, bit);
+		u32 child = matcher->nodes.data[nodeIndex].children[direction];
+		if (child == kWhitelistMatcher_None)
+		{
+			child = whitelist_matcher_add_node(matcher);
+			if (child == kWhitelistMatcher_None)
+				return false;
+			matcher->nodes.data[nodeIndex].children[direction] = child;
+		}
+		nodeIndex = child;
+	}
+
+	// Entries are inserted in order, so anything after an entry for any application can never be the first match
+	whitelist_trie_node_t* node = matcher->nodes.data + nodeIndex;
+	if (node->anyApplication != kWhitelistMatcher_None)
+		return true;
+
+	if (!matcher->entries.data[entryIndex].applicationName[0])
+	{
+		node->anyApplication = entryIndex;
+		return true;
+	}
+
+	whitelist_named_rule_t* rule = bba_add(matcher->namedRules, 1);
+	if (!rule)
+		return false;
+
+	const u32 ruleIndex = matcher->namedRules.count - 1;
+	rule->entryIndex = entryIndex;
+	rule->next = kWhitelistMatcher_None;
+	node = matcher->nodes.data + nodeIndex;
+	if (node->lastNamedRule == kWhitelistMatcher_None)
+	{
+		node->firstNamedRule = ruleIndex;
+	}
+	else
+	{
+		matcher->namedRules.data[node->lastNamedRule].next = ruleIndex;
+	}
+	node->lastNamedRule = ruleIndex;
+	return true;
+}
+
+static void whitelist_matcher_add_entry(whitelist_matcher_t* matcher, u32 family, const u8* addr, const u8* mask, u32 len, u32 entryIndex)
+{
+	u32 prefixBits = 0;
+	if (whitelist_mask_prefix_bits(mask, len, &prefixBits) && whitelist_matcher_insert(matcher, family, addr, prefixBits, entryIndex))
+		return;
+
+	whitelist_masked_entry_t* masked = bba_add(matcher->masked[family], 1);
+	if (masked)
+	{
+		masked->entryIndex = entryIndex;
+		memcpy(masked->addr, addr, len);
+		memcpy(masked->mask, mask, len);
+	}
+}
+
+static void whitelist_ipv4_bytes(u32 ip, u8* bytes)
+{
+	bytes[0] = (u8)(ip >> 24);
+	bytes[1] = (u8)(ip >> 16);
+	bytes[2] = (u8)(ip >> 8);
+	bytes[3] = (u8)ip;
+}
+
+void whitelist_matcher_build(whitelist_matcher_t* matcher, resolved_whitelist_t* whitelist)
+{
+	memset(matcher, 0, sizeof(*matcher));
+	matcher->entries = *whitelist;
+	memset(whitelist, 0, sizeof(*whitelist));
+	matcher->roots[kWhitelistMatcher_IPv4] = whitelist_matcher_add_node(matcher);
+	matcher->roots[kWhitelistMatcher_IPv6] = whitelist_matcher_add_node(matcher);
+
+	for (u32 i = 0; i < matcher->entries.count; ++i)
+	{
+		const resolved_whitelist_entry_t* entry = matcher->entries.data + i;
+		if (entry->addr.ss_family == AF_INET)
+		{
+			u8 addr[4];
+			u8 mask[4];
+			whitelist_ipv4_bytes(ntohl(BB_S_ADDR_UNION(*(const struct sockaddr_in*)&entry->addr)), addr);
+			whitelist_ipv4_bytes(ntohl(BB_S_ADDR_UNION(*(const struct sockaddr_in*)&entry->subnetMask)), mask);
+			whitelist_matcher_add_entry(matcher, kWhitelistMatcher_IPv4, addr, mask, sizeof(addr), i);
+		}
+#if BB_USING(BB_FEATURE_IPV6)
+		else if (entry->addr.ss_family == AF_INET6)
+		{
+			const struct sockaddr_in6* addr = (const struct sockaddr_in6*)&entry->addr;
+			const struct sockaddr_in6* mask = (const struct sockaddr_in6*)&entry->subnetMask;
+			whitelist_matcher_add_entry(matcher, kWhitelistMatcher_IPv6, addr->sin6_addr.s6_addr, mask->sin6_addr.s6_addr, sizeof(addr->sin6_addr), i);
+		}
+#endif // #if BB_USING(BB_FEATURE_IPV6)
+	}
+}
+
+void whitelist_matcher_reset(whitelist_matcher_t* matcher)
+{
+	bba_free(matcher->entries);
+	bba_free(matcher->nodes);
+	bba_free(matcher->namedRules);
+	bba_free(matcher->masked[kWhitelistMatcher_IPv4]);
+	bba_free(matcher->masked[kWhitelistMatcher_IPv6]);
+}
+
+static b32 whitelist_matcher_applies(const resolved_whitelist_entry_t* entry, const char* applicationName)
+{
+	return !entry->applicationName[0] || !strcmp(entry->applicationName, applicationName);
+}
+
+static resolved_whitelist_entry_t* whitelist_matcher_find(const whitelist_matcher_t* matcher, u32 family, const u8* addr, u32 len, const char* applicationName)
+{
+	if (!matcher->nodes.count)
+		return NULL;
+
+	u32 best = kWhitelistMatcher_None;
+	u32 nodeIndex = matcher->roots[family];
+	for (u32 bit = 0; nodeIndex != kWhitelistMatcher_None; ++bit)
+	{
+		const whitelist_trie_node_t* node = matcher->nodes.data + nodeIndex;
+		if (node->anyApplication < best)
+		{
+			best = node->anyApplication;
+		}
+		for (u32 ruleIndex = node->firstNamedRule; ruleIndex != kWhitelistMatcher_None;)
+		{
+			const whitelist_named_rule_t* rule = matcher->namedRules.data + ruleIndex;
+			if (rule->entryIndex >= best)
+				break;
+			if (whitelist_matcher_applies(matcher->entries.data + rule->entryIndex, applicationName))
+			{
+				best = rule->entryIndex;
+				break;
+			}
+			ruleIndex = rule->next;
+		}
+		if (bit == len * 8)
+			break;
+		nodeIndex = node->children[whitelist_matcher_bit(addr, bit)];
+	}
+
+	const whitelist_masked_entries_t* maskedEntries = matcher->masked + family;
+	for (u32 i = 0; i < maskedEntries->count && maskedEntries->data[i].entryIndex < best; ++i)
+	{
+		const whitelist_masked_entry_t* masked = maskedEntries->data + i;
+		u32 byteIndex = 0;
+		while (byteIndex < len && (addr[byteIndex] & masked->mask[byteIndex]) == (masked->addr[byteIndex] & masked->mask[byteIndex]))
+		{
+			++byteIndex;
+		}
+		if (byteIndex == len && whitelist_matcher_applies(matcher->entries.data + masked->entryIndex, applicationName))
+		{
+			best = masked->entryIndex;
+			break;
+		}
+	}
+
+	return (best == kWhitelistMatcher_None) ? NULL : matcher->entries.data + best;
+}
+
+resolved_whitelist_entry_t* whitelist_matcher_find_ipv4(const whitelist_matcher_t* matcher, u32 ip, const char* applicationName)
+{
+	u8 addr[4];
+	whitelist_ipv4_bytes(ip, addr);
+	return whitelist_matcher_find(matcher, kWhitelistMatcher_IPv4, addr, sizeof(addr), applicationName);
+}
+
+resolved_whitelist_entry_t* whitelist_matcher_find_ipv6(const whitelist_matcher_t* matcher, const struct in6_addr* addr, const char* applicationName)
+{
+	return whitelist_matcher_find(matcher, kWhitelistMatcher_IPv6, addr->s6_addr, sizeof(addr->s6_addr), applicationName);
+}
@@ -0,0 +1,77 @@
+// Copyright (c) Matt Campbell
+// MIT license (see License.txt)
+
+#pragma once
+
+#include "config_whitelist_push.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct whitelist_trie_node_s
+{
+	u32 children[2];
+	u32 anyApplication;  // lowest index of an entry for any application ending at this node
+	u32 firstNamedRule;  // entries for one application, in whitelist order - only those before anyApplication
+	u32 lastNamedRule;
+} whitelist_trie_node_t;
+
+typedef struct whitelist_trie_nodes_s
+{
+	u32 count;
+	u32 allocated;
+	whitelist_trie_node_t* data;
+} whitelist_trie_nodes_t;
+
+typedef struct whitelist_named_rule_s
+{
+	u32 entryIndex;
+	u32 next;
+} whitelist_named_rule_t;
+
+typedef struct whitelist_named_rules_s
+{
+	u32 count;
+	u32 allocated;
+	whitelist_named_rule_t* data;
+} whitelist_named_rules_t;
+
+typedef struct whitelist_masked_entry_s
+{
+	u32 entryIndex;
+	u8 addr[16];
+	u8 mask[16];
+} whitelist_masked_entry_t;
+
+typedef struct whitelist_masked_entries_s
+{
+	u32 count;
+	u32 allocated;
+	whitelist_masked_entry_t* data;
+} whitelist_masked_entries_t;
+
+// The resolved whitelist compiled into a binary trie per address family, with each entry stored at the node for
+// its subnet.  A lookup walks the address's bits once, instead of comparing every entry, and finds the same entry a
+// linear search would - the first one in whitelist order covering the address and application.  Entries whose
+// mask isn't a prefix (IPv4 masks that aren't whole bytes are stored that way) are checked one by one.
+typedef struct whitelist_matcher_s
+{
+	resolved_whitelist_t entries;
+	whitelist_trie_nodes_t nodes;
+	whitelist_named_rules_t namedRules;
+	whitelist_masked_entries_t masked[2]; // IPv4, IPv6
+	u32 roots[2];
+	u8 pad[4];
+} whitelist_matcher_t;
+
+// Takes ownership of the whitelist's entries
+void whitelist_matcher_build(whitelist_matcher_t* matcher, resolved_whitelist_t* whitelist);
+void whitelist_matcher_reset(whitelist_matcher_t* matcher);
+
+resolved_whitelist_entry_t* whitelist_matcher_find_ipv4(const whitelist_matcher_t* matcher, u32 ip, const char* applicationName); // ip in host order
+resolved_whitelist_entry_t* whitelist_matcher_find_ipv6(const whitelist_matcher_t* matcher, const struct in6_addr* addr, const char* applicationName);
+
+#if defined(__cplusplus)
+}
+#endif